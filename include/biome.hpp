@@ -3,6 +3,7 @@
 #include <filesystem>
 #include <list>
 #include <optional>
+#include <set>
 
 #include <microlog/microlog.h>
 
@@ -188,6 +189,12 @@ struct Biome {
 		return tuples;
 	}
 
+	// Every texture referenced by a material, for prefetching
+	std::set <std::string> textures() const;
+
+	// Those bound as normal maps, which are not cooked as color
+	std::set <std::string> normal_maps() const;
+
 	// Loading from a file
 	// TODO: standard scene description vs in house format
 	static Biome &blank();
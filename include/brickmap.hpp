@@ -0,0 +1,87 @@
+#pragma once
+
+#include <functional>
+
+#include "core/contexts.hpp"
+#include "distance_grid.hpp"
+#include "sdf.hpp"
+
+namespace ivy::sdf {
+
+// Distance field sampled into bricks of 8^3 quantized distances, which
+// are only allocated near the surface; a grid over the bounds maps each
+// brick cell to its brick. Samples lie on the corners of the cells, so
+// neighboring bricks share their faces and filter seamlessly.
+struct BrickMap {
+	static constexpr uint32_t brick_size = 8;
+	static constexpr uint32_t brick_cells = brick_size - 1;
+	static constexpr uint32_t brick_volume = brick_size * brick_size * brick_size;
+	static constexpr uint32_t empty = UINT32_MAX;
+
+	using Function = std::function <float (const glm::vec3 &)>;
+
+	glm::vec3 origin;
+	float cell;		// Distance between samples
+	float band;		// Distances are clamped to this, and quantized within it
+	glm::uvec3 dims;	// In bricks
+
+	std::vector <uint32_t> indirection;
+	std::vector <uint8_t> samples;
+
+	// Bricks released by re-baking, reused before growing
+	std::vector <uint32_t> free;
+
+	// Bricks written since the last upload
+	std::vector <uint32_t> dirty;
+
+	uint32_t bricks() const {
+		return samples.size()/brick_volume;
+	}
+
+	float extent() const {
+		return brick_cells * cell;
+	}
+
+	// Re-samples the bricks that could be affected by changes within
+	// the region, allocating and releasing bricks as needed
+	void rebake(const Function &, const AABB &);
+
+	static BrickMap bake(const Function &, const AABB &, float);
+
+	// Region covered, and the function, taken from the compound
+	static BrickMap bake(const Compound &, float);
+
+	// Union of the shapes and grids of a compound, for re-baking
+	static Function function(const Compound &);
+};
+
+// Device copy, for sdf.frag; the atlas is a 3D texture of bricks and the
+// grid follows a header in a storage buffer
+struct BrickMapHeader {
+	glm::vec3 origin;
+	float cell;
+	glm::uvec3 dims;
+	float band;
+	glm::uvec3 atlas;	// In bricks
+	uint32_t bricks;	// Zero to march the analytic shapes instead
+};
+
+struct DeviceBrickMap {
+	static constexpr uint32_t atlas_width = 32;	// Bricks along x and y
+
+	AllocatedImage atlas;
+	AllocatedBuffer grid;
+
+	// Bricks the atlas can hold
+	uint32_t capacity = 0;
+
+	// Records copies of the dirty bricks into the command buffer, outside
+	// of any render pass; the grid buffer is always replaced, and so is
+	// the atlas when it grows, retiring the old ones
+	void upload(VulkanResourceBase &, const vk::CommandBuffer &, BrickMap &);
+
+	// Header with no bricks, so that descriptors are always valid
+	static DeviceBrickMap from(VulkanResourceBase &);
+};
+
+}
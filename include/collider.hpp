@@ -1,14 +1,17 @@
 #pragma once
 
 #include <functional>
+#include <memory>
 #include <variant>
 
 #include "core/transform.hpp"
+#include "distance_grid.hpp"
 #include "sdf.hpp"
 
 namespace ivy::physics {
 
-using ColliderShape = std::variant <sdf::Sphere, sdf::Box>;
+// Meshes collide through their distance grids, which may be shared
+using ColliderShape = std::variant <sdf::Sphere, sdf::Box, std::shared_ptr <const sdf::DistanceGrid>>;
 
 struct Collider {
 	std::reference_wrapper <Transform> transform;
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include <littlevk/littlevk.hpp>
+
+namespace ivy {
+
+// Region of device memory handed out by the allocator
+struct MemoryAllocation {
+	vk::DeviceMemory memory;
+	vk::DeviceSize offset = 0;
+	vk::DeviceSize size = 0;
+
+	// Bookkeeping for returning the region
+	uint32_t type = 0;
+	uint32_t order = 0;
+	int32_t block = -1; // Negative for dedicated allocations
+
+	// Persistent mapping, if host visible
+	void *mapped = nullptr;
+};
+
+// Resources backed by the allocator
+struct AllocatedBuffer {
+	vk::Buffer buffer;
+	vk::DeviceSize size = 0;
+	MemoryAllocation allocation;
+
+	const vk::Buffer &operator*() const {
+		return buffer;
+	}
+};
+
+struct AllocatedImage {
+	vk::Image image;
+	vk::ImageView view;
+	vk::Extent3D extent;
+	vk::Format format = vk::Format::eUndefined;
+	vk::ImageAspectFlags aspect;
+	uint32_t mips = 1;
+	uint32_t layers = 1;
+	MemoryAllocation allocation;
+
+	vk::Extent2D extent_2d() const {
+		return { extent.width, extent.height };
+	}
+};
+
+// Snapshot of the allocator state
+struct MemoryStatistics {
+	vk::DeviceSize live = 0;		// Bytes requested by live allocations
+	vk::DeviceSize committed = 0;		// Bytes consumed in blocks, after rounding
+	vk::DeviceSize reserved = 0;		// Bytes reserved by blocks
+	vk::DeviceSize dedicated = 0;		// Bytes in dedicated allocations
+	uint32_t allocations = 0;
+	uint32_t blocks = 0;
+	uint32_t dedicated_allocations = 0;
+
+	// Ratio of free space outside of the largest free ranges
+	float fragmentation = 0.0f;
+};
+
+// Pooled device memory; large blocks per memory type which are
+// sub-allocated with a buddy scheme, and dedicated allocations
+// reserved for large resources
+struct DeviceMemoryAllocator {
+	static constexpr vk::DeviceSize block_size = 64ull << 20;
+	static constexpr vk::DeviceSize min_allocation = 256;
+	static constexpr vk::DeviceSize dedicated_threshold = block_size/4;
+	static constexpr uint32_t max_order = 18; // log2(block_size/min_allocation)
+
+	static constexpr vk::MemoryPropertyFlags host_visible =
+		vk::MemoryPropertyFlagBits::eHostVisible
+		| vk::MemoryPropertyFlagBits::eHostCoherent;
+
+	static constexpr vk::MemoryPropertyFlags device_local =
+		vk::MemoryPropertyFlagBits::eDeviceLocal;
+
+	struct Block {
+		vk::DeviceMemory memory;
+		uint32_t type;
+		bool linear;
+		void *mapped;
+		vk::DeviceSize committed;
+		uint32_t allocations;
+
+		// Free offsets for each order
+		std::vector <std::set <vk::DeviceSize>> free;
+	};
+
+	vk::Device device;
+	vk::PhysicalDeviceMemoryProperties memory_properties;
+
+	// Released blocks are kept as null entries, so that indices remain valid
+	std::vector <Block> blocks;
+
+	// Live dedicated allocations, released along with the blocks
+	std::set <vk::DeviceMemory> dedicated_memory;
+
+	// Tracking for statistics
+	vk::DeviceSize live = 0;
+	vk::DeviceSize dedicated = 0;
+	uint32_t allocations = 0;
+	uint32_t dedicated_allocations = 0;
+
+	// Called with allocations that are worth relocating after defragmentation
+	std::function <void (const MemoryAllocation &)> relocation_hook;
+
+	mutable std::mutex lock;
+
+	// Raw memory
+	MemoryAllocation allocate(const vk::MemoryRequirements &, vk::MemoryPropertyFlags,
+		bool linear, const vk::MemoryDedicatedAllocateInfo * = nullptr);
+	void free(const MemoryAllocation &);
+
+	// Buffers
+	AllocatedBuffer buffer(vk::DeviceSize, vk::BufferUsageFlags, vk::MemoryPropertyFlags = host_visible);
+	void upload(const AllocatedBuffer &, const void *, vk::DeviceSize, vk::DeviceSize = 0) const;
+
+	template <typename T>
+	AllocatedBuffer buffer(const std::vector <T> &data, vk::BufferUsageFlags usage) {
+		AllocatedBuffer result = buffer(data.size() * sizeof(T), usage);
+		upload(result, data.data(), data.size() * sizeof(T));
+		return result;
+	}
+
+	// Images
+	AllocatedImage image(const vk::ImageCreateInfo &, vk::ImageViewType, vk::ImageAspectFlags,
+		const vk::ComponentMapping & = {});
+	AllocatedImage image(const vk::Extent2D &, vk::Format, vk::ImageUsageFlags, vk::ImageAspectFlags, uint32_t = 1);
+
+	// Releasing resources
+	void destroy(AllocatedBuffer &);
+	void destroy(AllocatedImage &);
+	void destroy();
+
+	// Defragmentation hooks; sparse blocks are reported to the relocation
+	// hook, and empty blocks can be returned to the driver
+	void defragment(float = 0.25f);
+	void release_empty_blocks();
+
+	MemoryStatistics statistics() const;
+
+	static DeviceMemoryAllocator *from(const vk::Device &, const vk::PhysicalDeviceMemoryProperties &);
+};
+
+// Image commands for allocator images
+void transition(const vk::CommandBuffer &, const AllocatedImage &, vk::ImageLayout, vk::ImageLayout,
+	uint32_t = 0, uint32_t = VK_REMAINING_MIP_LEVELS);
+void copy_buffer_to_image(const vk::CommandBuffer &, const AllocatedImage &, const AllocatedBuffer &,
+	vk::ImageLayout, uint32_t = 0, vk::DeviceSize = 0);
+void copy_image_to_buffer(const vk::CommandBuffer &, const AllocatedImage &, const AllocatedBuffer &,
+	vk::ImageLayout, uint32_t = 0, vk::DeviceSize = 0);
+
+// Blits every level from the one above it; expects all levels in transfer
+// destination layout and leaves them ready for sampling
+void generate_mips(const vk::CommandBuffer &, const AllocatedImage &);
+
+}
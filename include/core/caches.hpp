@@ -1,40 +1,133 @@
 #pragma once
 
+#include <future>
+#include <limits>
+#include <set>
+
 #include "texture.hpp"
+#include "texture_cooker.hpp"
 #include "contexts.hpp"
 
 namespace ivy {
 
+bool supports_block_compression(const vk::PhysicalDevice &);
+
 struct DeviceTextureCache {
 	vk::Device device;
+	vk::PhysicalDevice phdev;
 	vk::CommandPool command_pool;
 	vk::Queue queue;
 	vk::PhysicalDeviceMemoryProperties memory_properties;
 	
-	littlevk::Deallocator *dal;
+	DeviceMemoryAllocator *allocator;
+
+	// Decoding happens on the workers; the maps below are only
+	// touched by the thread that owns the cache
+	ThreadPool *workers;
+
+	// Releases evicted images and streaming staging buffers once the
+	// frames in flight are done
+	std::function <void (const AllocatedImage &)> release;
+	std::function <void (const AllocatedBuffer &)> release_staging;
 
+	// Mips and block compression, when the device samples BC formats
+	TextureCooker cooker;
+
+	// Paths bound as normal maps; everything else is cooked as color
+	std::set <std::string> normal_maps;
+
+	// Host copies are dropped once uploaded
 	std::unordered_map <std::string, Texture> host_textures;
-	std::unordered_map <std::string, littlevk::Image> device_textures;
+	std::unordered_map <std::string, std::shared_future <Texture>> pending;
+	std::unordered_map <std::string, AllocatedImage> device_textures;
+
+	// Stable slots for bindless texture arrays, kept through eviction;
+	// each slot has two array elements, alternated whenever its image
+	// changes so that frames in flight keep a valid descriptor
+	std::unordered_map <std::string, uint32_t> indices;
+	std::vector <std::string> slots;
+	std::vector <uint32_t> parity;
+	std::vector <uint64_t> changed_at;
+
+	// Mip streaming; textures start with the levels up to tail_size
+	// resident, and finer levels are uploaded as their footprint grows
+	static constexpr uint32_t tail_size = 64;
+
+	struct Stream {
+		CookedTexture cooked;
+		uint32_t resident;	// Finest level on the device
+		uint32_t tail;
+		uint32_t requested;	// Finest level touched this frame
+		uint64_t requested_at;
+	};
+
+	std::unordered_map <uint32_t, Stream> streams;
+
+	// Residency; textures unused for a while are evicted once over
+	// budget, and reloaded when used again
+	static constexpr uint64_t min_eviction_age = 8;
+
+	struct {
+		size_t host = 1ull << 30;
+		vk::DeviceSize device = 0;	// Zero to follow the heap budget
+		vk::DeviceSize upload = 16ull << 20;	// Streamed bytes per frame
+	} budget;
+
+	size_t host_usage = 0;
+	vk::DeviceSize device_usage = 0;
+
+	uint64_t frame = 0;
+	std::vector <uint64_t> last_used;
+	std::unordered_map <std::string, uint64_t> host_last_used;
 
+	// Never evicted
+	std::set <std::string> pinned;
+
+	bool memory_budget = false;
+
+	// Blocks until the texture is decoded, if it is still in flight
 	void load(const std::filesystem::path &path);
+
+	// Starts decoding in the background, once per path
+	void load_async(const std::filesystem::path &);
+	void prefetch(const std::set <std::string> &);
+
+	// Moves finished decodes into the host textures
+	void poll();
+
 	void upload(const std::filesystem::path &path);
 
-	static DeviceTextureCache from(const VulkanResourceBase &drc) {
-		DeviceTextureCache dtc {
-			.device = drc.device,
-			.command_pool = drc.command_pool,
-			.queue = drc.graphics_queue,
-			.memory_properties = drc.memory_properties,
-			.dal = drc.dal
-		};
-
-		// Populate with a default blank texture
-		// TODO: should this be a checkboard instead?
-		dtc.host_textures["blank"] = Texture::blank();
-		dtc.upload("blank");
-
-		return dtc;
-	}
+	// Every mip of every texture in a single submission, with the mips of
+	// uncompressed textures blitted on the device
+	void upload(const std::vector <std::filesystem::path> &);
+
+	// Marks the slot as used by the frame being recorded, along with
+	// its approximate size on screen in pixels
+	void touch(uint32_t, float = std::numeric_limits <float> ::infinity());
+
+	bool resident(const std::string &) const;
+
+	// Array element to bind for the slot this frame
+	uint32_t physical(uint32_t) const;
+
+	bool streamed(const std::string &, const CookedTexture &) const;
+
+	static uint32_t tail_level(const CookedTexture &);
+
+	// Once per frame, before the render pass; finishes reloads, streams
+	// mips and enforces the budgets, returning the slots which need to
+	// be rewritten
+	struct Residency {
+		std::vector <std::string> uploaded;
+		std::vector <std::string> evicted;
+	};
+
+	Residency update(const vk::CommandBuffer &);
+	void stream(const vk::CommandBuffer &, Residency &);
+
+	vk::DeviceSize device_budget() const;
+
+	static DeviceTextureCache from(VulkanResourceBase &);
 };
 
-}
\ No newline at end of file
+}
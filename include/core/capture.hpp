@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <future>
+#include <memory>
+
+#include "contexts.hpp"
+
+namespace ivy {
+
+// Container picked from the extension of the output path
+enum class ImageEncoding {
+	ePNG,
+	eQOI,
+	eEXR,	// Half float, linearized if the image is sRGB
+};
+
+std::optional <ImageEncoding> encoding_from(const std::filesystem::path &);
+
+// Encoders for eight bit RGBA pixels, with rows from the top
+std::vector <uint8_t> encode_qoi(const uint8_t *, uint32_t, uint32_t);
+std::vector <uint8_t> encode_exr(const uint16_t *, uint32_t, uint32_t);
+
+// Frame captures without stalls; copies are recorded into the frame
+// being recorded, into a ring of host visible buffers, and encoded on
+// the workers once the timeline passes the frame
+struct CaptureService {
+	static constexpr uint32_t ring_size = 4;
+
+	struct Slot {
+		AllocatedBuffer buffer;
+
+		// Released by the worker once encoded
+		std::atomic <bool> busy = false;
+
+		// Copy completes once the timeline reaches this value
+		uint64_t timeline = 0;
+		bool recorded = false;
+
+		vk::Extent2D extent;
+		vk::Format format;
+		std::filesystem::path path;
+		ImageEncoding encoding;
+
+		std::shared_ptr <std::promise <bool>> done;
+		std::future <void> job;
+	};
+
+	VulkanResourceBase *vrb = nullptr;
+	std::vector <std::unique_ptr <Slot>> slots;
+
+	// Captures handed out, for logging
+	uint64_t captured = 0;
+
+	// Records the copy of an image in the given layout, which is restored
+	// afterwards, outside of any render pass; the future resolves once
+	// the file is written. Waits on the oldest capture if every buffer
+	// is in use.
+	std::shared_future <bool> capture(const vk::CommandBuffer &, const AllocatedImage &,
+		vk::ImageLayout, const std::filesystem::path &);
+
+	// Hands finished copies to the workers; once per frame
+	void poll();
+
+	// Blocks until every capture is written
+	void flush();
+
+	void destroy();
+
+	static CaptureService *from(VulkanResourceBase &);
+};
+
+}
@@ -2,31 +2,131 @@
 
 #include <littlevk/littlevk.hpp>
 
-// For one device/window
+#include "allocator.hpp"
+#include "deletion_queue.hpp"
+#include "frame_context.hpp"
+#include "gpu_profiler.hpp"
+#include "pipeline_service.hpp"
+#include "pipelines.hpp"
+#include "texture.hpp"
+#include "thread_pool.hpp"
+
+// For one device/window, or a device rendering offscreen
 struct VulkanResourceBase : littlevk::Skeleton {
 	vk::PhysicalDevice phdev;
 	vk::PhysicalDeviceMemoryProperties memory_properties;
 
 	littlevk::Deallocator *dal = nullptr;
+	ivy::DeviceMemoryAllocator *allocator = nullptr;
 
 	vk::CommandPool command_pool;
 	vk::DescriptorPool descriptor_pool;
 
-	std::vector <vk::CommandBuffer> command_buffers;
+	// Persisted across runs, see save_pipeline_cache
+	vk::PipelineCache pipeline_cache;
+
+	// Background work, shared by the services
+	ivy::ThreadPool *workers = nullptr;
+	ivy::PipelineService *pipeline_service = nullptr;
+
+	// Frames in flight, paced by a single timeline semaphore
+	uint32_t frames_in_flight = 0;
+	std::vector <ivy::FrameContext> frames;
+	size_t frame = 0;
+
+	vk::Semaphore timeline;
+	uint64_t timeline_value = 0;
+
+	// Waited on by presentation, one for each swapchain image since
+	// it stays pending until that image is acquired again
+	std::vector <vk::Semaphore> render_finished;
+	uint32_t image_index = 0;
+
+	// Released once the timeline passes the frame that retired them
+	ivy::DeletionQueue *deletion_queue = nullptr;
+
+	ivy::PresentMode present_mode = ivy::PresentMode::eFifo;
+
+	// Timestamps for each frame in flight
+	ivy::GpuProfiler *gpu_profiler = nullptr;
+
+	// Headless mode has no window, surface or swapchain; the offscreen
+	// images are listed in the swapchain in their place
+	bool headless = false;
+	vk::Instance instance;
+	std::vector <ivy::AllocatedImage> offscreen;
+	vk::Extent2D offscreen_extent;
+	uint32_t offscreen_index = 0;
+
+	// Changes requested at runtime, applied before the next frame
+	struct {
+		std::optional <uint32_t> frames_in_flight;
+		std::optional <ivy::PresentMode> present_mode;
+	} requested;
+
+	// Returns nothing if the swapchain was recreated
+	std::optional <std::pair <vk::CommandBuffer, littlevk::SurfaceOperation>> new_frame();
+	void end_frame(const vk::CommandBuffer &);
+	littlevk::SurfaceOperation present_frame(const littlevk::SurfaceOperation &);
 
-	littlevk::PresentSyncronization sync;
+	ivy::FrameContext &current_frame();
+
+	// Releases resources once the GPU is done with the frame being
+	// recorded, or the next one if called between frames
+	template <typename ... Args>
+	void retire(const Args &... args) {
+		deletion_queue->push(timeline_value + 1, args...);
+	}
+
+	void defer(std::function <void ()> &&);
+
+	void configure_frames(uint32_t);
+	void release_frames();
+	bool configure_present_mode(ivy::PresentMode);
+	void wait_idle();
 
-	std::optional <std::pair <vk::CommandBuffer, littlevk::SurfaceOperation>> new_frame(size_t);
-	void end_frame(const vk::CommandBuffer &, size_t) const;
-	littlevk::SurfaceOperation present_frame(const littlevk::SurfaceOperation &, size_t);
 	bool valid_window() const;
+	void save_pipeline_cache() const;
+
+	// Only four channel, eight bit formats
+	ivy::Texture readback(const ivy::AllocatedImage &, vk::ImageLayout);
 
 	bool destroy() override {
+		// Finish any outstanding jobs first
+		delete workers;
+		delete pipeline_service;
+
+		wait_idle();
+		release_frames();
+		gpu_profiler->destroy();
+		delete gpu_profiler;
+		device.destroySemaphore(timeline);
+		delete deletion_queue;
+
+		for (ivy::AllocatedImage &image : offscreen)
+			allocator->destroy(image);
+
+		save_pipeline_cache();
+		device.destroyPipelineCache(pipeline_cache);
+		allocator->destroy();
+		delete allocator;
 		delete dal;
+
+		if (headless) {
+			device.destroy();
+			instance.destroy();
+			return true;
+		}
+
 		return littlevk::Skeleton::destroy();
 	}
 
-	static VulkanResourceBase from(const vk::PhysicalDevice &, const std::vector <const char *> &, const vk::PhysicalDeviceFeatures2KHR &);
+	static VulkanResourceBase from(const vk::PhysicalDevice &, const std::vector <const char *> &,
+			const vk::PhysicalDeviceFeatures2KHR &, uint32_t = 2);
+
+	static VulkanResourceBase headless_from(const vk::Instance &, const vk::PhysicalDevice &,
+			const std::vector <const char *> &, const vk::PhysicalDeviceFeatures2KHR &,
+			const vk::Extent2D &, uint32_t = 2);
 };
 
 // For an ImGui context
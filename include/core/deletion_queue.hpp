@@ -0,0 +1,60 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include <littlevk/littlevk.hpp>
+
+#include "allocator.hpp"
+
+namespace ivy {
+
+// Resources that are released in bulk once the GPU has passed a value on
+// the frame timeline; one bucket per frame in flight, reused in a ring
+struct DeletionQueue {
+	struct Bucket {
+		// Timeline value that must be reached before release
+		uint64_t value = 0;
+
+		std::vector <AllocatedBuffer> buffers;
+		std::vector <AllocatedImage> images;
+		std::vector <vk::Pipeline> pipelines;
+		std::vector <vk::Framebuffer> framebuffers;
+		std::vector <std::pair <vk::DescriptorPool, vk::DescriptorSet>> descriptor_sets;
+
+		// Anything else, e.g. resources owned by other libraries
+		std::vector <std::function <void ()>> callbacks;
+
+		size_t size() const;
+	};
+
+	vk::Device device;
+	DeviceMemoryAllocator *allocator = nullptr;
+
+	std::vector <Bucket> buckets;
+
+	void push(uint64_t, const AllocatedBuffer &);
+	void push(uint64_t, const AllocatedImage &);
+	void push(uint64_t, const vk::Pipeline &);
+	void push(uint64_t, const vk::Framebuffer &);
+	void push(uint64_t, const vk::DescriptorPool &, const vk::DescriptorSet &);
+	void push(uint64_t, std::function <void ()> &&);
+
+	// Releases every bucket whose value has been reached
+	void collect(uint64_t);
+
+	// Releases everything, the device must be idle
+	void flush();
+
+	// Resizes the ring, flushing first
+	void resize(size_t);
+
+	size_t pending() const;
+
+	Bucket &bucket(uint64_t);
+	void release(Bucket &);
+
+	static DeletionQueue *from(const vk::Device &, DeviceMemoryAllocator *, size_t);
+};
+
+}
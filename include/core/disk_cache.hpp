@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace ivy {
+
+// Files under the cache directory, grouped by category and keyed by name
+std::filesystem::path cache_path(const std::string &, const std::string &);
+
+std::optional <std::vector <uint8_t>> read_cache(const std::string &, const std::string &);
+
+// Writes are atomic, so concurrent writers of the same key are safe
+bool write_cache(const std::string &, const std::string &, const void *, size_t);
+
+template <typename T>
+bool write_cache(const std::string &category, const std::string &key, const std::vector <T> &data)
+{
+	return write_cache(category, key, data.data(), data.size() * sizeof(T));
+}
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <filesystem>
+
+#include "contexts.hpp"
+
+namespace ivy {
+
+// Cubemap converted from an equirectangular HDR image on the GPU; each
+// mip is prefiltered with the GGX lobe for a roughness that increases
+// linearly down the chain, and the result is cached on disk
+struct EnvironmentMap {
+	static constexpr uint32_t face_size = 512;
+	static constexpr uint32_t levels = 6;
+	static constexpr uint32_t samples = 512;
+
+	AllocatedImage cubemap;
+
+	// Hash of the source file contents
+	uint64_t hash = 0;
+
+	float roughness(uint32_t level) const {
+		return level/float(levels - 1);
+	}
+
+	void destroy(VulkanResourceBase &);
+
+	static EnvironmentMap from(VulkanResourceBase &, const std::filesystem::path &);
+};
+
+// For keying caches derived from a file
+uint64_t hash_file(const std::filesystem::path &);
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include <littlevk/littlevk.hpp>
+
+#include "allocator.hpp"
+
+namespace ivy {
+
+// Presentation modes exposed to users
+enum class PresentMode {
+	eFifo,		// Vertical sync, no tearing
+	eMailbox,	// Lowest latency without tearing, if supported
+	eImmediate,	// Uncapped, may tear
+};
+
+inline vk::PresentModeKHR translate(PresentMode mode)
+{
+	switch (mode) {
+	case PresentMode::eMailbox:
+		return vk::PresentModeKHR::eMailbox;
+	case PresentMode::eImmediate:
+		return vk::PresentModeKHR::eImmediate;
+	default:
+		break;
+	}
+
+	return vk::PresentModeKHR::eFifo;
+}
+
+// Linear host visible memory for one frame, reset once the frame retires
+struct TransientBuffer {
+	AllocatedBuffer buffer;
+	vk::DeviceSize offset = 0;
+
+	struct Slice {
+		void *data;
+		vk::DeviceSize offset;
+	};
+
+	std::optional <Slice> allocate(vk::DeviceSize size, vk::DeviceSize alignment = 256) {
+		vk::DeviceSize start = (offset + alignment - 1) & ~(alignment - 1);
+		if (start + size > buffer.size)
+			return std::nullopt;
+
+		offset = start + size;
+		return Slice { (uint8_t *) buffer.allocation.mapped + start, start };
+	}
+
+	void reset() {
+		offset = 0;
+	}
+};
+
+// Resources owned by one frame in flight; the frame may only be
+// recorded again once the timeline reaches the value of its last submission
+struct FrameContext {
+	vk::CommandBuffer cmd;
+
+	// Binary semaphore still required for acquiring from the swapchain
+	vk::Semaphore image_available;
+
+	// Value signaled on the timeline when the frame completes
+	uint64_t timeline = 0;
+
+	TransientBuffer transient;
+};
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <littlevk/littlevk.hpp>
+
+namespace ivy {
+
+// Timings of GPU work between timestamps written into the command buffer;
+// one query pool for each frame in flight, read back once the frame is
+// known to have completed
+struct GpuProfiler {
+	static constexpr uint32_t max_scopes = 64;
+	static constexpr uint32_t history = 256;
+
+	struct Scope {
+		std::string name;
+		uint32_t depth;
+		uint32_t begin;
+		uint32_t end;
+	};
+
+	struct FrameQueries {
+		vk::QueryPool pool;
+		std::vector <Scope> scopes;
+		uint32_t next = 0;
+	};
+
+	// Rolling window of samples, in milliseconds
+	struct Statistics {
+		uint32_t depth = 0;
+		std::vector <float> samples;
+		uint32_t head = 0;
+
+		void add(float);
+		float last() const;
+		float average() const;
+		float percentile(float) const;
+	};
+
+	vk::Device device;
+
+	bool enabled = false;
+	float period = 1.0f;		// Nanoseconds per tick
+	uint64_t valid_mask = ~0ull;
+
+	std::vector <FrameQueries> frames;
+	size_t current = 0;
+
+	// Open scopes, as indices into the current frame
+	std::vector <uint32_t> stack;
+
+	// Statistics per scope, in the order they first appeared
+	std::vector <std::string> order;
+	std::unordered_map <std::string, Statistics> statistics;
+
+	// Reads back the previous results for the frame and resets its queries,
+	// then opens a scope spanning the whole frame; the frame must have
+	// completed on the GPU
+	void begin_frame(const vk::CommandBuffer &, size_t);
+	void end_frame(const vk::CommandBuffer &);
+
+	uint32_t begin(const vk::CommandBuffer &, const std::string &);
+	void end(const vk::CommandBuffer &, uint32_t);
+
+	// Ends the scope when going out of scope
+	struct ScopeGuard {
+		GpuProfiler *profiler;
+		vk::CommandBuffer cmd;
+		uint32_t index;
+
+		~ScopeGuard() {
+			if (profiler)
+				profiler->end(cmd, index);
+		}
+	};
+
+	ScopeGuard scope(const vk::CommandBuffer &, const std::string &);
+
+	// Nothing may be in flight
+	void resize(uint32_t);
+	void destroy();
+
+	// For automated comparisons
+	std::string export_csv() const;
+	std::string export_json() const;
+	void save(const std::filesystem::path &) const;
+
+	static GpuProfiler *from(const vk::Device &, const vk::PhysicalDevice &);
+};
+
+}
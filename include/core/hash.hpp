@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace ivy {
+
+// FNV-1a hashing, for keying on-disk caches
+constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325ull;
+constexpr uint64_t FNV_PRIME = 0x100000001b3ull;
+
+inline uint64_t hash_bytes(const void *data, size_t size, uint64_t seed = FNV_OFFSET)
+{
+	const uint8_t *bytes = (const uint8_t *) data;
+
+	uint64_t h = seed;
+	for (size_t i = 0; i < size; i++) {
+		h ^= bytes[i];
+		h *= FNV_PRIME;
+	}
+
+	return h;
+}
+
+inline uint64_t hash_string(std::string_view s, uint64_t seed = FNV_OFFSET)
+{
+	return hash_bytes(s.data(), s.size(), seed);
+}
+
+template <typename T>
+inline uint64_t hash_value(const T &value, uint64_t seed = FNV_OFFSET)
+{
+	return hash_bytes(&value, sizeof(T), seed);
+}
+
+inline std::string hash_hex(uint64_t h)
+{
+	static constexpr char digits[] = "0123456789abcdef";
+
+	std::string result(16, '0');
+	for (int i = 15; i >= 0; i--, h >>= 4)
+		result[i] = digits[h & 0xf];
+
+	return result;
+}
+
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+namespace ivy {
+
+// Read-only memory mapping of a whole file
+struct MappedFile {
+	const uint8_t *data = nullptr;
+	size_t size = 0;
+
+	MappedFile() = default;
+	MappedFile(const MappedFile &) = delete;
+	MappedFile(MappedFile &&);
+
+	MappedFile &operator=(const MappedFile &) = delete;
+	MappedFile &operator=(MappedFile &&);
+
+	~MappedFile();
+
+	static std::optional <MappedFile> from(const std::filesystem::path &);
+};
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <optional>
+
+#include "pipelines.hpp"
+#include "thread_pool.hpp"
+
+namespace ivy {
+
+// Pipeline whose layouts are available immediately, while the
+// handle is still being compiled on a worker
+struct PendingPipeline {
+	std::shared_future <vk::Pipeline> handle;
+	vk::PipelineLayout layout;
+	std::optional <vk::DescriptorSetLayout> dsl;
+
+	bool requested() const {
+		return handle.valid();
+	}
+
+	bool ready() const {
+		return handle.valid() && handle.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	}
+
+	// Blocks until the pipeline is available
+	littlevk::Pipeline get() const {
+		return littlevk::Pipeline {
+			.handle = handle.get(),
+			.layout = layout,
+			.dsl = dsl,
+		};
+	}
+};
+
+// Shader compilation and pipeline creation off of the main thread;
+// the pipeline cache is internally synchronized, and is written back
+// to disk each time the queue of requests drains
+struct PipelineService {
+	vk::Device device;
+	vk::PhysicalDevice phdev;
+	vk::PipelineCache cache;
+
+	// Shared with other services, owned by the resource base
+	ThreadPool *workers = nullptr;
+	std::atomic <uint32_t> outstanding = 0;
+
+	PendingPipeline graphics(const GraphicsPipelineInfo &, const std::optional <vk::DescriptorSetLayout> & = std::nullopt);
+	PendingPipeline compute(const ShaderSource &, const vk::PipelineLayout &, const std::optional <vk::DescriptorSetLayout> & = std::nullopt);
+
+	template <typename F>
+	vk::Pipeline finish(const F &);
+
+	static PipelineService *from(const vk::Device &, const vk::PhysicalDevice &, const vk::PipelineCache &, ThreadPool *);
+};
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <littlevk/littlevk.hpp>
+
+namespace ivy {
+
+// Shader source and compilation
+struct ShaderSource {
+	std::string source;
+	vk::ShaderStageFlagBits stage;
+	std::vector <std::string> defines = {};
+};
+
+std::optional <std::vector <uint32_t>> compile_glsl(const ShaderSource &);
+
+// Compiles through the on-disk SPIR-V cache, keyed by the source,
+// definitions, stage and compiler version
+std::optional <std::vector <uint32_t>> load_spirv(const ShaderSource &);
+
+// Pipeline construction outside of littlevk, for custom layouts
+struct GraphicsPipelineInfo {
+	vk::RenderPass render_pass;
+	uint32_t subpass = 0;
+
+	// Interleaved attributes of a single vertex buffer
+	std::vector <vk::Format> vertex_attributes;
+
+	std::vector <ShaderSource> shaders;
+
+	vk::PipelineLayout layout;
+
+	bool alpha_blending = false;
+	bool depth_test = true;
+	bool depth_write = true;
+	vk::CompareOp depth_compare = vk::CompareOp::eLess;
+};
+
+vk::Pipeline create_graphics_pipeline(const vk::Device &, const GraphicsPipelineInfo &, const vk::PipelineCache & = {});
+vk::Pipeline create_compute_pipeline(const vk::Device &, const ShaderSource &, const vk::PipelineLayout &, const vk::PipelineCache & = {});
+
+// Pipeline caches persisted per device
+vk::PipelineCache load_pipeline_cache(const vk::Device &, const vk::PhysicalDevice &);
+void save_pipeline_cache(const vk::Device &, const vk::PhysicalDevice &, const vk::PipelineCache &);
+
+vk::DescriptorSetLayout create_descriptor_set_layout(const vk::Device &,
+	const std::vector <vk::DescriptorSetLayoutBinding> &,
+	const std::vector <vk::DescriptorBindingFlags> & = {},
+	vk::DescriptorSetLayoutCreateFlags = {});
+
+vk::PipelineLayout create_pipeline_layout(const vk::Device &,
+	const std::vector <vk::DescriptorSetLayout> &,
+	const std::vector <vk::PushConstantRange> & = {});
+
+}
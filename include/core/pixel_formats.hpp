@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace ivy {
+
+// Conversions between pixel formats, in memory order; large images are
+// split into chunks of rows for the OpenMP workers, and each chunk runs
+// the widest kernel the processor supports
+enum class SIMDLevel {
+	eScalar,
+	eSSE4,
+	eAVX2,
+};
+
+// Detected once, on first use
+SIMDLevel simd_level();
+
+// Unsigned normalized bytes to floats in [0, 1], per component
+void u8_to_f32(const uint8_t *, float *, size_t);
+void u8_to_f16(const uint8_t *, uint16_t *, size_t);
+
+// Floats to unsigned normalized bytes, clamped and rounded, per component
+void f32_to_u8(const float *, uint8_t *, size_t);
+void f32_to_f16(const float *, uint16_t *, size_t);
+
+// Decodes the color channels of sRGB pixels; the fourth channel of
+// four channel pixels is alpha, which stays linear
+void srgb_to_linear(const uint8_t *, float *, size_t, uint32_t);
+
+// Reorders the channels of four channel pixels, i.e. { 2, 1, 0, 3 }
+// between RGBA and BGRA
+void swizzle_rgba8(const uint8_t *, uint8_t *, size_t, const std::array <uint8_t, 4> &);
+
+// Between one to three channels and four; missing channels read as
+// zero and alpha as opaque, the same as sampling R8 or RG8 images
+void expand_u8(const uint8_t *, uint32_t, uint8_t *, size_t);
+void pack_u8(const uint8_t *, uint8_t *, uint32_t, size_t);
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+// CPU scopes, recorded into a ring buffer for each thread; everything
+// is compiled out unless IVY_PROFILING is defined
+#ifdef IVY_PROFILING
+
+#define IVY_PROFILE_CONCAT_(a, b) a##b
+#define IVY_PROFILE_CONCAT(a, b) IVY_PROFILE_CONCAT_(a, b)
+
+// Names must outlive the trace, i.e. string literals
+#define IVY_PROFILE_SCOPE(name) ::ivy::profiling::Scope IVY_PROFILE_CONCAT(__ivy_scope_, __LINE__)(name)
+#define IVY_PROFILE_FUNCTION() IVY_PROFILE_SCOPE(__func__)
+#define IVY_PROFILE_THREAD(name) ::ivy::profiling::set_thread_name(name)
+
+#else
+
+#define IVY_PROFILE_SCOPE(name) ((void) 0)
+#define IVY_PROFILE_FUNCTION() ((void) 0)
+#define IVY_PROFILE_THREAD(name) ((void) 0)
+
+#endif
+
+namespace ivy::profiling {
+
+// Completed scope, in nanoseconds since startup
+struct Event {
+	const char *name;
+	uint64_t begin;
+	uint64_t end;
+};
+
+// Only written by its own thread; kept alive after the thread exits
+struct ThreadBuffer {
+	static constexpr size_t capacity = 1 << 16;
+
+	// Read while the thread may be overwriting it, so every field is
+	// atomic; the sequence is odd during a write, and otherwise twice
+	// the index of the event it holds plus two
+	struct Slot {
+		std::atomic <uint64_t> sequence = 0;
+		std::atomic <const char *> name = nullptr;
+		std::atomic <uint64_t> begin = 0;
+		std::atomic <uint64_t> end = 0;
+	};
+
+	uint32_t tid;
+	std::string name;
+	std::unique_ptr <Slot []> slots;
+	std::atomic <uint64_t> head = 0;
+};
+
+uint64_t now();
+
+void record(const char *, uint64_t, uint64_t);
+void set_thread_name(const std::string &);
+
+struct Scope {
+	const char *name;
+	uint64_t begin;
+
+	Scope(const char *name_) : name(name_), begin(now()) {}
+
+	~Scope() {
+		record(name, begin, now());
+	}
+};
+
+// Chrome trace event JSON, for chrome://tracing or Perfetto
+bool save_trace(const std::filesystem::path &);
+
+}
@@ -7,35 +7,36 @@
 
 namespace ivy {
 
-// Host texture
+// Host texture; grey images keep one channel and grey with alpha two,
+// while color is always stored with four channels
 struct Texture {
 	int width;
 	int height;
 	int channels;
 	std::vector <uint8_t> pixels;
 
-	std::vector <glm::vec3> as_rgb() const {
-		std::vector <glm::vec3> rgb;
-		rgb.resize(width * height);
+	// Grey replicated into color, for consumers of four channels
+	Texture as_rgba() const;
 
-		for (int i = 0; i < width; i++) {
-			for (int j = 0; j < height; j++) {
-				uint32_t index = (i * height + j);
-				uint32_t pixel = *(uint32_t *) &pixels[index << 2];
-				float r = ((pixel >> 16) & 0xff)/255.0f;
-				float g = ((pixel >> 8) & 0xff)/255.0f;
-				float b = (pixel & 0xff)/255.0f;
-				rgb[index] = { r, g, b };
-			}
-		}
+	// Color channels as floats in [0, 1], in memory order
+	std::vector <glm::vec3> as_rgb() const;
 
-		return rgb;
-	}
-
-	void save(const std::filesystem::path &) const;
+	// PNG, with rows flipped back to the top first
+	bool save(const std::filesystem::path &) const;
 
 	static Texture load(const std::filesystem::path &);
+	static Texture decode(const uint8_t *, size_t);
 	static Texture blank();
 };
 
+// Linear floating point RGBA, for high dynamic range images
+struct HDRTexture {
+	int width;
+	int height;
+	std::vector <float> pixels;
+
+	static HDRTexture load(const std::filesystem::path &);
+	static HDRTexture decode(const uint8_t *, size_t);
+};
+
 }
\ No newline at end of file
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include <littlevk/littlevk.hpp>
+
+#include "texture.hpp"
+
+namespace ivy {
+
+// Encodings for cooked textures, chosen by channel usage
+enum class TextureEncoding : uint32_t {
+	eRGBA8,
+	eBC1,		// Opaque color
+	eBC3,		// Color with alpha
+	eBC5,		// Two channels, i.e. tangent space normals
+	eBC7,		// Color with or without alpha, at a higher quality
+	eR8,		// Grey, i.e. masks and roughness
+	eRG8,		// Grey with alpha, or two channel data
+};
+
+// Color is sampled as sRGB where the format has a variant for it
+vk::Format encoding_format(TextureEncoding, bool = false);
+
+// Block compressed encodings carry their own mips; the rest only store
+// the base level and have mips generated on the device
+bool encoding_compressed(TextureEncoding);
+
+// Bytes per 4x4 block, or per texel when uncompressed
+size_t encoding_block_size(TextureEncoding);
+
+// Mip chain, tightly packed starting from the largest level
+struct CookedTexture {
+	struct Level {
+		uint32_t width;
+		uint32_t height;
+		size_t offset;
+		size_t size;
+	};
+
+	TextureEncoding encoding = TextureEncoding::eRGBA8;
+	bool srgb = false;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector <Level> levels;
+	std::vector <uint8_t> data;
+
+	vk::Format format() const {
+		return encoding_format(encoding, srgb);
+	}
+
+	// Levels past the stored ones are blitted at upload
+	bool device_mips() const {
+		return !encoding_compressed(encoding);
+	}
+
+	// Full chain, including the generated levels
+	uint32_t mip_count() const;
+
+	// KTX2 container, without a data format descriptor
+	std::vector <uint8_t> serialize() const;
+
+	static std::optional <CookedTexture> deserialize(const std::vector <uint8_t> &);
+};
+
+struct TextureFormat {
+	TextureEncoding encoding;
+	bool srgb;
+};
+
+// What a texture is sampled as, from the material slot it is bound to
+enum class TextureRole : uint32_t {
+	eColor,
+	eNormal,
+};
+
+// Generates mips and encodes them, with results cached on disk by content
+struct TextureCooker {
+	bool block_compression = true;
+	bool high_quality = false;	// BC7 for all color textures
+	bool cache = true;
+
+	// One and two channel textures stay as is; four channel normal maps
+	// keep only their first two channels, and the rest are sRGB color
+	TextureFormat choose(const Texture &, TextureRole = TextureRole::eColor) const;
+	CookedTexture cook(const Texture &, TextureRole = TextureRole::eColor) const;
+
+	// Box filtered, down to 1x1
+	static std::vector <Texture> mip_chain(const Texture &);
+};
+
+// Encoders for a 4x4 block of RGBA8 texels
+void encode_bc1(const uint8_t *, uint8_t *);
+void encode_bc3(const uint8_t *, uint8_t *);
+void encode_bc5(const uint8_t *, uint8_t *);
+void encode_bc7(const uint8_t *, uint8_t *);
+
+}
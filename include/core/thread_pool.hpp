@@ -0,0 +1,49 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ivy {
+
+// Fixed set of workers consuming a shared job queue
+struct ThreadPool {
+	std::vector <std::thread> workers;
+	std::deque <std::function <void ()>> jobs;
+
+	std::mutex lock;
+	std::condition_variable signal;
+	bool stopping = false;
+
+	~ThreadPool();
+
+	template <typename F>
+	auto submit(F &&ftn) -> std::future <std::invoke_result_t <F>> {
+		using R = std::invoke_result_t <F>;
+
+		auto task = std::make_shared <std::packaged_task <R ()>> (std::forward <F> (ftn));
+		auto future = task->get_future();
+
+		{
+			std::lock_guard guard(lock);
+			jobs.emplace_back([task]() { (*task)(); });
+		}
+
+		signal.notify_one();
+		return future;
+	}
+
+	size_t size() const {
+		return workers.size();
+	}
+
+	// Defaults to the hardware concurrency
+	static ThreadPool *from(size_t = 0);
+};
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+
+#include "core/mesh.hpp"
+#include "sdf.hpp"
+
+namespace ivy::sdf {
+
+// Signed distances sampled on a dense grid, negative inside; built from
+// triangle meshes so that they can be used next to the analytic shapes.
+// Queries are trilinear within the grid; placed in a Compound through a
+// GridInstance, they reach the Evaluator and the brick maps for sdf.frag.
+struct DistanceGrid {
+	glm::vec3 origin;	// Position of the first sample
+	float cell;		// Distance between samples
+	glm::uvec3 dims;	// In samples
+
+	std::vector <float> values;
+
+	AABB bounds() const {
+		return { origin, origin + glm::vec3(dims - 1u) * cell };
+	}
+
+	float &operator()(uint32_t x, uint32_t y, uint32_t z) {
+		return values[(size_t(z) * dims.y + y) * dims.x + x];
+	}
+
+	float operator()(uint32_t x, uint32_t y, uint32_t z) const {
+		return values[(size_t(z) * dims.y + y) * dims.x + x];
+	}
+
+	// Outside the grid, the distance to the grid is added on
+	float distance(const glm::vec3 &) const;
+	void distance(const glm::vec3 *, float *, size_t) const;
+
+	// Exact distances to the nearest triangle in a narrow band around the
+	// surface, swept out through the rest of the grid; inside is decided
+	// by a vote of ray parities along the three axes, which tolerates
+	// small holes in the mesh
+	static DistanceGrid from(const Mesh &, float);
+};
+
+}
@@ -19,9 +19,12 @@ struct Globals {
 	Biome &active_biome();
 
 	// Construction
-	static Globals from();
+	static Globals from(uint32_t = 2);
 };
 
-VulkanResourceBase prepare_vulkan_resource_base();
+VulkanResourceBase prepare_vulkan_resource_base(uint32_t = 2);
+
+// Without a window or presentation, rendering into offscreen images
+VulkanResourceBase prepare_headless_resource_base(const vk::Extent2D &, uint32_t = 2);
 
 }
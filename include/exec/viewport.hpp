@@ -1,10 +1,14 @@
 #pragma once
 
 #include "biome.hpp"
+#include "brickmap.hpp"
 #include "core/caches.hpp"
 #include "core/camera.hpp"
+#include "core/environment_map.hpp"
+#include "core/pipeline_service.hpp"
 #include "core/transform.hpp"
 #include "cursor_dispatcher.hpp"
+#include "sdf_tree.hpp"
 #include "vkport.hpp"
 
 namespace ivy::exec {
@@ -14,25 +18,40 @@ struct Viewport {
 	// Only active while there is a valid Biome
 	const Biome &biome;
 
-	// Vulkan resource base
-	const VulkanResourceBase &vrb;
+	// Vulkan resource base, for deferring work to the frames in flight
+	VulkanResourceBase &vrb;
 
 	// Render pass and framebuffer data
 	struct {
 		vk::RenderPass render_pass;
 
 		// TODO: one or multiple fbs?
-		littlevk::Image depth;
-		std::vector <littlevk::Image> images;
+		AllocatedImage depth;
+
+		// Distances the SDF rays of each 2x2 tile can start from, marched
+		// as cones before the render pass
+		AllocatedImage cone_seeds;
+		std::vector <AllocatedImage> images;
 		std::vector <vk::Framebuffer> framebuffers;
 		vk::Extent2D extent;
 	} vk;
 
-	// Pipelines
+	// Pipelines, compiled in the background; passes are
+	// skipped until their pipeline is ready
 	struct {
-		littlevk::Pipeline raster;
-		littlevk::Pipeline sdf;
-		littlevk::Pipeline environment;
+		PendingPipeline raster;
+		PendingPipeline sdf;
+		PendingPipeline sdf_cone;
+		PendingPipeline environment;
+
+		// Only requested once the biome has colliders
+		GraphicsPipelineInfo sdf_info;
+		ShaderSource sdf_cone_shader;
+
+		// Both of the above specialized to an SDF tree, by its hash;
+		// those of earlier versions of the tree are retired
+		std::unordered_map <uint64_t, PendingPipeline> sdf_trees;
+		std::unordered_map <uint64_t, PendingPipeline> sdf_tree_cones;
 	} pipelines;
 
 	// Scrap data
@@ -42,6 +61,20 @@ struct Viewport {
 
 		vk::DescriptorSet sdf_descriptor;
 		vk::DescriptorSet environment_descriptor;
+
+		// Colliders as a serialized sdf::Compound, uploaded whenever
+		// their shapes or transforms change
+		AllocatedBuffer sdf_scene;
+		uint64_t sdf_hash = 0;
+
+		// Larger scenes, and those with meshes, are baked into a brick
+		// map instead, re-baked only around the shapes which changed
+		sdf::Compound sdf_compound;
+		std::optional <sdf::BrickMap> brickmap;
+		sdf::DeviceBrickMap device_brickmap;
+		vk::Sampler brick_sampler;
+
+		EnvironmentMap environment;
 	} scrap;
 
 	// ImGui handles
@@ -50,12 +83,40 @@ struct Viewport {
 	// Cache for textures for the biome
 	DeviceTextureCache dtc;
 
+	// Texture slot and object space bounds of a geometry, for
+	// estimating its texel footprint on screen
+	struct TextureUsage {
+		uint32_t slot;
+		glm::vec3 center;
+		float radius;
+		float tiling;	// Largest UV span over the mesh
+	};
+
 	// Caches
 	struct {
 		std::unordered_map <uint32_t, VulkanGeometry> geometry;
-		std::unordered_map <uint32_t, vk::DescriptorSet> descriptors;
+		std::unordered_map <uint32_t, uint32_t> materials;
+		std::unordered_map <uint32_t, TextureUsage> textures;
 	} caches;
 
+	// Global descriptor set for the raster pipeline; all textures are
+	// in a single array and materials in a table, indexed per draw
+	struct {
+		vk::DescriptorSetLayout dsl;
+		vk::DescriptorPool pool;
+		vk::DescriptorSet dset;
+
+		AllocatedBuffer materials;
+		uint32_t material_count = 0;
+		uint32_t material_capacity = 0;
+
+		uint32_t max_textures = 0;
+	} bindless;
+
+	// Static signed distance asset, drawn along with the colliders by
+	// shaders generated for it; not drawn until they are compiled
+	sdf::Tree sdf_tree;
+
 	// Viewport camera configuration
 	Camera camera;
 	Transform camera_transform;
@@ -66,15 +127,6 @@ struct Viewport {
 	// Default sampler
 	vk::Sampler sampler;
 
-	struct AwaitResourceFree {
-		int left;
-		size_t frame;
-		std::variant <littlevk::Image, vk::DescriptorSet> resource;
-	};
-
-	// TODO: display size as internal statistics
-	std::list <AwaitResourceFree> await_free_queue;
-
 	// Cursor handler
 	void cursor_handler(const CursorDispatcher::MouseInfo &);
 
@@ -85,19 +137,36 @@ struct Viewport {
 	// Preparing resources
 	void prepare();
 	void prepare_render_pass();
+	void prepare_bindless();
 	void prepare_raster_pipeline();
 	void prepare_sdf_pipeline();
 	void prepare_environment_pipeline();
+	void request_sdf_pipeline();
+	void request_sdf_tree_pipeline(uint64_t);
+	void retire_sdf_tree_pipelines(const std::optional <uint64_t> &);
+	void wait_for_pipelines();
+
+	// Signed distance field scene
+	void update_sdf_scene(const vk::CommandBuffer &);
+	void update_brickmap(const vk::CommandBuffer &, const sdf::Compound &);
+	void write_sdf_descriptor();
 
 	// Caching functions
 	void cache_geometry_properties(ComponentRef <Geometry> &);
+	uint32_t cache_texture(const std::string &);
+	void write_bindless_texture(const std::string &);
+	uint32_t cache_material(const VulkanMaterial &);
+	void allocate_bindless_set(uint32_t);
 
 	// Rendering functions
 	void render(const vk::CommandBuffer &, const littlevk::SurfaceOperation &);
 
 	// Construction
-	static std::unique_ptr <Viewport> from(Biome &, const VulkanResourceBase &,
+	static std::unique_ptr <Viewport> from(Biome &, VulkanResourceBase &,
 			std::unique_ptr <CursorDispatcher> &, const vk::Extent2D &);
+
+	// Retires whatever the deallocator does not own
+	~Viewport();
 };
 
 }
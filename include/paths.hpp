@@ -4,4 +4,7 @@
 #define IVY_ROOT ".."
 #endif
 
-#define IVY_SHADERS IVY_ROOT "/shaders"
\ No newline at end of file
+#define IVY_SHADERS IVY_ROOT "/shaders"
+
+// On-disk caches for compiled and cooked assets
+#define IVY_CACHE IVY_ROOT "/.cache"
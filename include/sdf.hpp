@@ -1,6 +1,8 @@
 #pragma once
 
+#include <memory>
 #include <variant>
+#include <vector>
 
 #include <glm/glm.hpp>
 
@@ -22,11 +24,73 @@ struct Box {
 // Compound shapes or scenes
 using Shape = std::variant <Sphere, Box>;
 
+struct AABB {
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+AABB bounds(const Shape &);
+
+float distance(const Shape &, const glm::vec3 &);
+
+// Places a shape in the world; boxes stay axis aligned, so rotated
+// boxes are replaced by their bounds
+Shape transformed(const Shape &, const Transform &);
+
+// Hierarchy over shape (or any other) bounds, split at the median of
+// the longest axis; the children of interior nodes are adjacent,
+// starting at first
+struct BVH {
+	static constexpr uint32_t leaf_size = 4;
+
+	struct Node {
+		glm::vec3 min;
+		uint32_t first;		// First child, or first index for leaves
+		glm::vec3 max;
+		uint32_t count;		// Zero for interior nodes
+	};
+
+	std::vector <Node> nodes;
+	std::vector <uint32_t> indices;
+
+	// Union of the shapes it was built from, nearest nodes first
+	float distance(const std::vector <Shape> &, const glm::vec3 &) const;
+
+	static BVH from(const std::vector <AABB> &);
+	static BVH from(const std::vector <Shape> &);
+};
+
+struct DistanceGrid;
+
+// Distance grid placed in the world; distances are scaled by the
+// smallest axis scale, so that they stay a lower bound when stretched
+struct GridInstance {
+	std::shared_ptr <const DistanceGrid> grid;
+	glm::mat4 inverse;
+	float scale;
+	AABB box;	// World space bounds of the grid
+
+	float distance(const glm::vec3 &) const;
+
+	// Central differences over half a cell
+	glm::vec3 gradient(const glm::vec3 &) const;
+
+	static GridInstance from(const std::shared_ptr <const DistanceGrid> &, const Transform &);
+};
+
 // NOTE: serializing transform buffers is a separate task
 struct Compound {
 	std::vector <Shape> shapes;
 
-	// TODO: alias
+	// Meshes, which sdf.frag only reaches through a brick map; they are
+	// not serialized
+	std::vector <GridInstance> grids;
+
+	// Of the shapes and grids together
+	AABB bounds() const;
+
+	// Shape and node counts, then two vec4 per shape in the order of the
+	// leaves, then two per node; see sdf.frag
 	std::vector <glm::vec4> serialize() const;
 };
 
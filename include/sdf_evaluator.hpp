@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "sdf.hpp"
+
+namespace ivy::sdf {
+
+// Batched queries against a compound, for physics and gameplay; shapes
+// are split by type into arrays of their parameters, and each shape is
+// tested against eight points at once where AVX2 is available. Large
+// batches are split across the OpenMP workers.
+struct Evaluator {
+	static constexpr uint32_t none = UINT32_MAX;
+
+	struct {
+		std::vector <float> x;
+		std::vector <float> y;
+		std::vector <float> z;
+		std::vector <float> radius;
+		std::vector <uint32_t> ids;
+	} spheres;
+
+	// By center and half size
+	struct {
+		std::vector <float> x;
+		std::vector <float> y;
+		std::vector <float> z;
+		std::vector <float> hx;
+		std::vector <float> hy;
+		std::vector <float> hz;
+		std::vector <uint32_t> ids;
+	} boxes;
+
+	// Numbered after the shapes, and tested point by point since each
+	// lookup is a trilinear fetch
+	struct {
+		std::vector <GridInstance> instances;
+		std::vector <uint32_t> ids;
+	} grids;
+
+	size_t size() const {
+		return spheres.ids.size() + boxes.ids.size() + grids.ids.size();
+	}
+
+	// Distances to the union of the shapes and grids, along with the unit
+	// gradient, or the index of the closest one in the compound; an empty
+	// compound gives the largest float and no shape
+	void distance(const glm::vec3 *, float *, size_t) const;
+	void gradient(const glm::vec3 *, float *, glm::vec3 *, size_t) const;
+	void closest(const glm::vec3 *, float *, uint32_t *, size_t) const;
+
+	static Evaluator from(const Compound &);
+};
+
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "core/mesh.hpp"
+#include "sdf.hpp"
+
+namespace ivy::sdf {
+
+// Triangle mesh of the surface of a compound, by dual contouring on an
+// octree; only cells the surface may pass through are refined down to
+// the given size. Each cell crossed by the surface has one vertex, placed
+// to keep the edges and corners of boxes sharp, so the mesh is welded by
+// construction. Normals are the gradient of the distance, and UVs are
+// left at zero, so that the result can be used as a Geometry directly.
+Mesh polygonize(const Compound &, float);
+
+}
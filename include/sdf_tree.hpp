@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "sdf.hpp"
+
+namespace ivy::sdf {
+
+// Operations of tree nodes; the smooth variants blend their children
+// over a radius, and transforms place a single child
+enum class Operation : uint32_t {
+	eShape,
+	eUnion,
+	eIntersection,
+	eSubtraction,
+	eSmoothUnion,
+	eSmoothIntersection,
+	eSmoothSubtraction,
+	eTransform,
+};
+
+// Constructive solid geometry over the primitives, for static assets;
+// nodes are stored flat, and each builder returns its node and makes it
+// the root. Distances are exact for unions of shapes and a lower bound
+// otherwise, which is all sphere tracing needs.
+struct Tree {
+	struct Node {
+		Operation op;
+		uint32_t left = 0;	// First child, or the shape
+		uint32_t right = 0;	// Second child, or the transform
+		float radius = 0.0f;	// Of the smooth operations
+	};
+
+	std::vector <Node> nodes;
+	std::vector <Shape> shapes;
+	std::vector <Transform> transforms;
+
+	uint32_t root = 0;
+
+	bool empty() const {
+		return nodes.empty();
+	}
+
+	uint32_t shape(const Shape &);
+	uint32_t unite(uint32_t, uint32_t, float = 0.0f);
+	uint32_t intersect(uint32_t, uint32_t, float = 0.0f);
+	uint32_t subtract(uint32_t, uint32_t, float = 0.0f);
+
+	// Non-uniform scales are bounded by their smallest factor
+	uint32_t transform(uint32_t, const Transform &);
+
+	AABB bounds() const;
+	float distance(const glm::vec3 &) const;
+
+	// Of the nodes reachable from the root, for caching generated shaders
+	uint64_t hash() const;
+
+	// Union of the shapes; grids have no tree form and are left out
+	static Tree from(const Compound &);
+};
+
+// GLSL source of a function float sdf_tree(vec3 p) specialized to the
+// tree, along with its bounds as SDF_TREE_MIN and SDF_TREE_MAX; every
+// parameter is a literal, transforms without rotation are folded into
+// the shapes, and blends without a radius become plain min and max
+std::string glsl(const Tree &);
+
+}
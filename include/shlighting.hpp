@@ -1,5 +1,7 @@
 #pragma once
 
+#include <filesystem>
+
 #include <glm/glm.hpp>
 
 #include "core/texture.hpp"
@@ -11,7 +13,13 @@ struct SHLighting {
 	glm::mat4 green;
 	glm::mat4 blue;
 
+	// Projections of equirectangular images, with the same mapping
+	// as the background; rows are split across threads
 	static SHLighting from(const Texture &);
+	static SHLighting from(const HDRTexture &);
+
+	// Cached on disk by the contents of the file
+	static SHLighting from(const std::filesystem::path &);
 };
 
 }
\ No newline at end of file
@@ -9,8 +9,8 @@
 
 // Vulkan ports of rendering structures
 struct VulkanGeometry {
-	littlevk::Buffer vertices;
-	littlevk::Buffer triangles;
+	ivy::AllocatedBuffer vertices;
+	ivy::AllocatedBuffer triangles;
 	size_t count = 0;
 
 	template <typename G>
@@ -22,12 +22,13 @@ VulkanGeometry VulkanGeometry::from(const VulkanResourceBase &drc, const G &g)
 {
 	VulkanGeometry vm;
 	vm.count = 3 * g.triangles.size();
-	std::tie(vm.vertices, vm.triangles) = bind(drc.device, drc.memory_properties, drc.dal)
-		.buffer(interleave_attributes(g), vk::BufferUsageFlagBits::eVertexBuffer)
-		.buffer(g.triangles, vk::BufferUsageFlagBits::eIndexBuffer);
+	vm.vertices = drc.allocator->buffer(interleave_attributes(g), vk::BufferUsageFlagBits::eVertexBuffer);
+	vm.triangles = drc.allocator->buffer(g.triangles, vk::BufferUsageFlagBits::eIndexBuffer);
 	return vm;
 }
 
+// Layout matches the std430 material table; the texture slot is pushed
+// per draw, since residency may move it between frames
 struct VulkanMaterial {
 	alignas(16) glm::vec3 albedo;
 	alignas(16) glm::vec3 specular;
@@ -1,25 +1,41 @@
 #version 450
 
+#extension GL_EXT_nonuniform_qualifier : require
+
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 uv;
 layout (location = 3) in vec3 camera;
 
-layout (binding = 0) uniform sampler2D diffuse_texture;
+layout (push_constant) uniform PushConstants {
+	mat4 model;
+	mat4 view;
+	mat4 proj;
+	vec3 camera_position;
+	uint material_index;
+	uint texture_index;	// Array element for the albedo texture this frame
+};
 
 // Spherical harmonics lighting
-layout (binding = 1) uniform SHLihgting {
+layout (binding = 0) uniform SHLihgting {
 	mat4 Mred;
 	mat4 Mgreen;
 	mat4 Mblue;
 } shl;
 
-layout (binding = 2) uniform Materials {
+// Global material table and texture array
+struct Material {
 	vec3 albedo;
 	vec3 specular;
 
 	int has_albedo_texture;
-} material;
+};
+
+layout (binding = 1) readonly buffer Materials {
+	Material materials[];
+};
+
+layout (binding = 2) uniform sampler2D textures[];
 
 layout (location = 0) out vec4 fragment;
 
@@ -36,9 +52,11 @@ vec3 aces(vec3 x)
 
 void main()
 {
+	Material material = materials[material_index];
+
 	vec3 albedo = material.albedo;
 	if (material.has_albedo_texture != 0) {
-		vec4 f = texture(diffuse_texture, uv);
+		vec4 f = texture(textures[texture_index], uv);
 		if (f.a < 0.5)
 			discard;
 
@@ -9,6 +9,8 @@ layout (push_constant) uniform PushConstants {
 	mat4 view;
 	mat4 proj;
 	vec3 camera;
+	uint material;
+	uint texture_index;
 };
 
 layout (location = 0) out vec3 out_position;
@@ -15,25 +15,32 @@ layout (push_constant) uniform PushConstants {
 	float far;
 };
 
-layout (binding = 1) uniform sampler2D environment_texture;
+// Prefiltered cubemap, sharpest at the base level
+layout (binding = 1) uniform samplerCube environment_texture;
 
 layout (location = 0) out vec4 fragment;
 
+// Tone mapping, matching the raster pass
+vec3 aces(vec3 x)
+{
+	const float a = 2.51;
+	const float b = 0.03;
+	const float c = 2.43;
+	const float d = 0.59;
+	const float e = 0.14;
+	return clamp((x * (a * x + b)) / (x * (c * x + d) + e), 0.0, 1.0);
+}
+
 void main()
 {
 	if (subpassLoad(depth).x < 1)
 		discard;
 
 	vec3 n = normalize(lower_left + uv.x * horizontal + (1 - uv.y) * vertical - origin);
-	float phi = mod(PI + atan(n.z, n.x), 2 * PI);
-	float theta = PI - acos(n.y);
-	vec2 euv = vec2(phi, theta)/vec2(2 * PI, PI);
-	vec3 env = texture(environment_texture, euv).xyz;
-	fragment = vec4(env, 1);
+	vec3 env = textureLod(environment_texture, n, 0).xyz;
+	fragment = vec4(aces(env), 1);
 
 	/* float d = subpassLoad(depth).x;
 	float nd = near * far / (far + d * (near - far));
 	fragment = vec4(vec3(nd/1000), 1); */
-
-	// TODO: some tone mapping here later...
 }
@@ -1,60 +1,411 @@
 #version 450
 
+// Also compiled as a compute shader with CONE_PASS defined, which marches
+// cones at half resolution to find where the rays of each texel can
+// safely start; with SDF_TREE defined, a generated sdf_tree function and
+// its bounds are inserted above, and drawn along with the colliders
+
+#ifdef CONE_PASS
+
+layout (local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+layout (binding = 4, r32f) uniform writeonly image2D cone_seeds;
+
+#else
+
+layout (input_attachment_index = 0, binding = 0) uniform subpassInput depth;
+
 layout (location = 0) in vec2 uv;
 
+layout (binding = 4, r32f) uniform readonly image2D cone_seeds;
+
+layout (location = 0) out vec4 fragment;
+
+#endif
+
 layout (push_constant) uniform PushConstants {
 	vec3 origin;
 	vec3 lower_left;
 	vec3 horizontal;
 	vec3 vertical;
+	layout (offset = 64) float near;
+	float far;
 };
 
-layout (location = 0) out vec4 fragment;
-
-struct Sphere {
-	vec3 origin;
-	float radius;
+// Serialized sdf::Compound; a header of shape and node counts, then two
+// vec4 per shape in the order of the leaves, then two per node
+layout (std430, binding = 1) readonly buffer Scene {
+	vec4 scene[];
 };
 
-struct Box {
-	vec3 origin;
-	vec3 hsize;
+// Baked sdf::BrickMap; bricks of 8^3 distances in an atlas, and a grid
+// of brick indices over the scene, used instead of the shapes if any
+// bricks are present
+layout (binding = 2) uniform sampler3D brick_atlas;
+
+layout (std430, binding = 3) readonly buffer BrickGrid {
+	vec3 brick_origin;
+	float brick_cell;
+	uvec3 brick_dims;
+	float brick_band;
+	uvec3 brick_atlas_dims;
+	uint brick_count;
+	uint bricks[];
 };
 
-float sdf(Sphere sphere, vec3 p)
+const uint BRICK_SIZE = 8;
+const uint EMPTY_BRICK = 0xffffffffu;
+
+// Seeds of texels whose cone misses the scene
+const float NO_SEED = 1e30f;
+
+const uint MAX_STEPS = 256;
+
+// Over-relaxation of the steps, while consecutive spheres overlap
+const float RELAXATION = 1.6;
+
+float sdf_sphere(vec3 center, float radius, vec3 p)
 {
-	return distance(p, sphere.origin) - sphere.radius;
+	return distance(p, center) - radius;
 }
 
-float sdf(Box box, vec3 p)
+float sdf_box(vec3 lo, vec3 hi, vec3 p)
 {
-	vec3 q = abs(p - box.origin) - box.hsize;
+	vec3 q = abs(p - 0.5 * (lo + hi)) - 0.5 * (hi - lo);
 	return length(max(q, 0.0)) + min(max(q.x, max(q.y, q.z)), 0.0);
 }
 
+// Lower bound on the distance to anything inside the bounds
+float sdf_bounds(vec3 lo, vec3 hi, vec3 p)
+{
+	return length(max(max(lo - p, p - hi), 0.0));
+}
+
+float sdf_shape(uint index, vec3 p)
+{
+	vec4 a = scene[1 + 2 * index];
+	vec4 b = scene[2 + 2 * index];
+
+	if (a.w == 0)
+		return sdf_sphere(a.xyz, b.x, p);
+
+	return sdf_box(a.xyz, b.xyz, p);
+}
+
+// Union of every shape, skipping nodes farther than the closest so far;
+// with no shapes there is no hierarchy to read
+float sdf_scene(vec3 p, uint shapes)
+{
+	if (shapes == 0)
+		return 1e30f;
+
+	uint nodes = 1 + 2 * shapes;
+
+	float closest = 1e10f;
+
+	uint stack[32];
+	uint top = 0;
+	stack[top++] = 0;
+
+	while (top > 0) {
+		uint node = stack[--top];
+
+		vec4 lo = scene[nodes + 2 * node];
+		vec4 hi = scene[nodes + 2 * node + 1];
+		if (sdf_bounds(lo.xyz, hi.xyz, p) >= closest)
+			continue;
+
+		uint first = uint(lo.w);
+		uint count = uint(hi.w);
+		if (count > 0) {
+			for (uint i = first; i < first + count; i++)
+				closest = min(closest, sdf_shape(i, p));
+
+			continue;
+		}
+
+		// Nearer child last, so that it is visited first
+		vec4 left_lo = scene[nodes + 2 * first];
+		vec4 left_hi = scene[nodes + 2 * first + 1];
+		vec4 right_lo = scene[nodes + 2 * (first + 1)];
+		vec4 right_hi = scene[nodes + 2 * (first + 1) + 1];
+
+		float left = sdf_bounds(left_lo.xyz, left_hi.xyz, p);
+		float right = sdf_bounds(right_lo.xyz, right_hi.xyz, p);
+
+		if (left < right) {
+			stack[top++] = first + 1;
+			stack[top++] = first;
+		} else {
+			stack[top++] = first;
+			stack[top++] = first + 1;
+		}
+	}
+
+	return closest;
+}
+
+// Brick cell containing the point, clamped to the grid
+uvec3 brick_coordinate(vec3 p)
+{
+	float extent = brick_cell * (BRICK_SIZE - 1);
+	return uvec3(clamp(floor((p - brick_origin)/extent), vec3(0), vec3(brick_dims - 1)));
+}
+
+uint brick_at(uvec3 c)
+{
+	return bricks[(c.z * brick_dims.y + c.y) * brick_dims.x + c.x];
+}
+
+// Sample centers, since neighboring bricks share their faces
+float sample_brick(uint brick, uvec3 c, vec3 p)
+{
+	float extent = brick_cell * (BRICK_SIZE - 1);
+
+	uvec3 slot = uvec3(brick % brick_atlas_dims.x,
+		(brick/brick_atlas_dims.x) % brick_atlas_dims.y,
+		brick/(brick_atlas_dims.x * brick_atlas_dims.y));
+
+	vec3 g = (p - brick_origin)/extent;
+	vec3 local = clamp((g - vec3(c)) * (BRICK_SIZE - 1), vec3(0), vec3(BRICK_SIZE - 1));
+	vec3 uvw = (vec3(slot * BRICK_SIZE) + local + 0.5)/vec3(brick_atlas_dims * BRICK_SIZE);
+
+	return (2 * textureLod(brick_atlas, uvw, 0).r - 1) * brick_band;
+}
+
+// Distance from the brick map, or the distance to the far side of the
+// brick cell along the ray if it has no brick
+float sdf_bricks(vec3 p, vec3 ray, out bool empty)
+{
+	uvec3 c = brick_coordinate(p);
+	uint brick = brick_at(c);
+
+	empty = (brick == EMPTY_BRICK);
+	if (empty) {
+		float extent = brick_cell * (BRICK_SIZE - 1);
+		vec3 lo = brick_origin + vec3(c) * extent;
+		vec3 hi = lo + extent;
+		vec3 exits = max((lo - p)/ray, (hi - p)/ray);
+		return min(exits.x, min(exits.y, exits.z)) + 1e-3f * extent;
+	}
+
+	return sample_brick(brick, c, p);
+}
+
+// Lower bound on the distance to the colliders in any direction; empty
+// bricks hold nothing within their band, so points in them are at least
+// a cell away from it, and no nearer than the sides of the brick
+float collider_bound(vec3 p)
+{
+	if (brick_count == 0)
+		return sdf_scene(p, uint(scene[0].x));
+
+	uvec3 c = brick_coordinate(p);
+	uint brick = brick_at(c);
+	if (brick != EMPTY_BRICK)
+		return sample_brick(brick, c, p);
+
+	float extent = brick_cell * (BRICK_SIZE - 1);
+	vec3 lo = brick_origin + vec3(c) * extent;
+	vec3 hi = lo + extent;
+	vec3 sides = min(p - lo, hi - p);
+	return max(min(sides.x, min(sides.y, sides.z)), brick_cell);
+}
+
+float sdf_bound(vec3 p)
+{
+#ifdef SDF_TREE
+	return min(collider_bound(p), sdf_tree(p));
+#else
+	return collider_bound(p);
+#endif
+}
+
+// Clips the ray to a box, returning false if it is missed
+bool clip(vec3 lo, vec3 hi, vec3 ray, out float enter, out float exit)
+{
+	vec3 inverse = 1.0 / ray;
+	vec3 t0 = (lo - origin) * inverse;
+	vec3 t1 = (hi - origin) * inverse;
+	vec3 tmin = min(t0, t1);
+	vec3 tmax = max(t0, t1);
+
+	enter = max(max(tmin.x, tmin.y), max(tmin.z, 0.0));
+	exit = min(tmax.x, min(tmax.y, tmax.z));
+	return enter <= exit;
+}
+
+// Within the brick map, or the root of the collider hierarchy
+bool collider_range(vec3 ray, out float enter, out float exit)
+{
+	enter = 0;
+	exit = 0;
+
+	if (brick_count > 0) {
+		vec3 lo = brick_origin;
+		vec3 hi = brick_origin + vec3(brick_dims) * brick_cell * (BRICK_SIZE - 1);
+		return clip(lo, hi, ray, enter, exit);
+	}
+
+	uint shapes = uint(scene[0].x);
+	if (shapes == 0)
+		return false;
+
+	uint nodes = 1 + 2 * shapes;
+	return clip(scene[nodes].xyz, scene[nodes + 1].xyz, ray, enter, exit);
+}
+
+// Only march within the bounds of the whole scene
+bool scene_range(vec3 ray, out float enter, out float exit)
+{
+	bool hit = collider_range(ray, enter, exit);
+
+#ifdef SDF_TREE
+	float tree_enter;
+	float tree_exit;
+	if (clip(SDF_TREE_MIN, SDF_TREE_MAX, ray, tree_enter, tree_exit)) {
+		enter = hit ? min(enter, tree_enter) : tree_enter;
+		exit = hit ? max(exit, tree_exit) : tree_exit;
+		hit = true;
+	}
+#endif
+
+	return hit;
+}
+
+#ifdef CONE_PASS
+
+// Marches a cone through each texel, stepping only as far as no ray
+// within it could have reached the surface
 void main()
 {
-	Sphere sphere = Sphere(vec3(0, 2, 0), 10.0);
-	// Box box = Box(vec3(0, 2, 0), vec3(5, 10, 2));
+	ivec2 size = imageSize(cone_seeds);
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	if (any(greaterThanEqual(texel, size)))
+		return;
 
-	float s = 1e10f;
+	vec2 st = (vec2(texel) + 0.5)/vec2(size);
+	vec3 ray = normalize(lower_left + horizontal * st.x + vertical * (1.0 - st.y) - origin);
 
-	vec3 ray = normalize(lower_left + horizontal * uv.x + vertical * (1.0 - uv.y) - origin);
+	// Radius per unit of distance, across the diagonal of a texel
+	float cone = length(vec2(length(horizontal)/size.x, length(vertical)/size.y));
+
+	float enter;
+	float exit;
+	if (!scene_range(ray, enter, exit)) {
+		imageStore(cone_seeds, texel, vec4(NO_SEED));
+		return;
+	}
 
-	vec3 p = origin;
-	for (uint i = 0; i < 256; i++) {
-		s = sdf(sphere, p);
-		if (abs(s) < 1e-3f)
+	float t = enter;
+	for (uint i = 0; i < MAX_STEPS && t <= exit; i++) {
+		float s = sdf_bound(origin + t * ray);
+		float radius = cone * t;
+		if (s <= radius)
 			break;
 
-		p += abs(s) * ray;
+		t += (s - radius)/(1.0 + cone);
 	}
 
-	if (abs(s) > 1e-3f)
+	imageStore(cone_seeds, texel, vec4(t > exit ? NO_SEED : t));
+}
+
+#else
+
+// Over-relaxed sphere tracing, falling back to plain steps once the
+// spheres stop overlapping; rays end when the distance is within the
+// footprint of the pixel, and empty bricks are skipped along the ray
+float march(vec3 ray, float t, float limit, float pixel)
+{
+	float threshold = (brick_count > 0) ? 5e-2f * brick_cell : 1e-3f;
+	uint shapes = uint(scene[0].x);
+
+	float omega = RELAXATION;
+	float previous = 0;
+	float stride = 0;
+
+	for (uint i = 0; i < MAX_STEPS && t <= limit; i++) {
+		vec3 p = origin + t * ray;
+
+		bool empty = false;
+		float s = (brick_count > 0) ? sdf_bricks(p, ray, empty) : sdf_scene(p, shapes);
+
+#ifdef SDF_TREE
+		// Empty bricks are only skipped up to the tree
+		float tree = sdf_tree(p);
+		if (tree < s) {
+			s = tree;
+			empty = false;
+		}
+#endif
+		if (empty) {
+			t += s;
+			previous = 0;
+			stride = 0;
+			continue;
+		}
+
+		// Steps keep the sign of the distance, so that a relaxed step
+		// which lands inside backs out again
+		float radius = abs(s);
+
+		bool overshot = (omega > 1 && radius + previous < stride);
+		if (overshot) {
+			stride -= omega * stride;
+			omega = 1;
+		} else {
+			stride = omega * s;
+
+			// Nor may one end the march by stepping past the limit
+			if (omega > 1 && t + stride > limit) {
+				stride = s;
+				omega = 1;
+			}
+		}
+
+		previous = radius;
+		if (!overshot && radius < max(pixel * t, threshold))
+			return t;
+
+		t += stride;
+	}
+
+	return -1;
+}
+
+void main()
+{
+	// Angle subtended by a pixel; before any divergence
+	float pixel = length(vertical) * abs(dFdy(uv.y));
+
+	vec3 ray = normalize(lower_left + horizontal * uv.x + vertical * (1.0 - uv.y) - origin);
+	vec3 forward = normalize(lower_left + 0.5 * (horizontal + vertical) - origin);
+
+	float enter;
+	float exit;
+	if (!scene_range(ray, enter, exit))
+		discard;
+
+	// Rays end at the rasterized geometry
+	float d = subpassLoad(depth).x;
+	float raster = near * far / (far + d * (near - far));
+	float limit = min(exit, raster/dot(ray, forward));
+
+	float seed = imageLoad(cone_seeds, ivec2(gl_FragCoord.xy)/2).x;
+	float start = max(enter, seed);
+	if (start > limit)
+		discard;
+
+	float t = march(ray, start, limit, pixel);
+	if (t < 0)
 		discard;
 
 	vec3 albedo = vec3(0.5, 0.8, 0.5);
 	fragment = vec4(albedo, 1);
 
-	// TODO: depth buffer to write to as well
+	// Same depth as the rasterizer, so that later passes composite
+	float z = t * dot(ray, forward);
+	gl_FragDepth = far * (z - near)/(z * (far - near));
 }
+
+#endif
@@ -5,6 +5,7 @@
 #include <microlog/microlog.h>
 
 #include "biome.hpp"
+#include "core/profiler.hpp"
 
 namespace ivy {
 
@@ -171,13 +172,18 @@ Biome &Biome::blank()
 
 Biome &Biome::load(const std::filesystem::path &path)
 {
+	IVY_PROFILE_SCOPE("Biome::load");
+
 	Assimp::Importer importer;
         ulog_assert(std::filesystem::exists(path),
 		__FUNCTION__ , "file \"%s\" does not exist\n", path.c_str());
 
         // Read scene
 	const aiScene *scene;
-	scene = importer.ReadFile(path, aiProcess_Triangulate);
+	{
+		IVY_PROFILE_SCOPE("Biome::load: import");
+		scene = importer.ReadFile(path, aiProcess_Triangulate);
+	}
 
 	// Check if the scene was loaded
 	if (!scene || (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE) || !scene->mRootNode) {
@@ -185,6 +191,7 @@ Biome &Biome::load(const std::filesystem::path &path)
 		throw "error";
 	}
 
+	IVY_PROFILE_SCOPE("Biome::load: process");
 	auto results = assimp_process_node(scene->mRootNode, scene, path.parent_path());
 
 	// Construct the biome from the results, with a top level node
@@ -206,6 +213,31 @@ Biome &Biome::load(const std::filesystem::path &path)
 	return b;
 }
 
+std::set <std::string> Biome::textures() const
+{
+	std::set <std::string> paths;
+	for (const Geometry &g : geometries) {
+		const auto &textures = g.material.textures;
+		for (const std::string &path : { textures.diffuse, textures.specular, textures.normal }) {
+			if (!path.empty())
+				paths.insert(path);
+		}
+	}
+
+	return paths;
+}
+
+std::set <std::string> Biome::normal_maps() const
+{
+	std::set <std::string> paths;
+	for (const Geometry &g : geometries) {
+		if (!g.material.textures.normal.empty())
+			paths.insert(g.material.textures.normal);
+	}
+
+	return paths;
+}
+
 std::list <Biome> Biome::active;
 
 }
@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <cmath>
+
+#include <littlevk/littlevk.hpp>
+
+#include "brickmap.hpp"
+#include "core/profiler.hpp"
+
+namespace ivy::sdf {
+
+static uint8_t quantize(float distance, float band)
+{
+	float normalized = std::clamp(distance/band, -1.0f, 1.0f);
+	return uint8_t(std::lround((0.5f * normalized + 0.5f) * 255.0f));
+}
+
+void BrickMap::rebake(const Function &ftn, const AABB &region)
+{
+	IVY_PROFILE_SCOPE("BrickMap::rebake");
+
+	if (dims.x == 0 || dims.y == 0 || dims.z == 0)
+		return;
+
+	// Anything changing within the region only moves distances within
+	// the band around it, and bricks are only kept within the band
+	glm::ivec3 lo(glm::floor((region.min - band - origin)/extent()));
+	glm::ivec3 hi(glm::floor((region.max + band - origin)/extent()));
+	lo = glm::max(lo, glm::ivec3(0));
+	hi = glm::min(hi, glm::ivec3(dims) - 1);
+
+	if (glm::any(glm::lessThan(hi, lo)))
+		return;
+
+	glm::ivec3 range = hi - lo + 1;
+	int count = range.x * range.y * range.z;
+
+	// Bricks whose center is within the band of the surface; the band
+	// covers half the diagonal of a brick, so none is missed
+	std::vector <uint8_t> needed(count);
+
+	#pragma omp parallel for schedule(dynamic, 64)
+	for (int i = 0; i < count; i++) {
+		glm::ivec3 c = lo + glm::ivec3(i % range.x, (i/range.x) % range.y, i/(range.x * range.y));
+		glm::vec3 center = origin + (glm::vec3(c) + 0.5f) * extent();
+		needed[i] = std::abs(ftn(center)) <= band;
+	}
+
+	struct Fill {
+		glm::ivec3 cell;
+		uint32_t brick;
+	};
+
+	std::vector <Fill> fills;
+	for (int i = 0; i < count; i++) {
+		glm::ivec3 c = lo + glm::ivec3(i % range.x, (i/range.x) % range.y, i/(range.x * range.y));
+		uint32_t &slot = indirection[(c.z * dims.y + c.y) * dims.x + c.x];
+
+		if (!needed[i]) {
+			if (slot != empty)
+				free.push_back(slot);
+
+			slot = empty;
+			continue;
+		}
+
+		if (slot == empty) {
+			if (free.empty()) {
+				slot = bricks();
+				samples.resize(samples.size() + brick_volume);
+			} else {
+				slot = free.back();
+				free.pop_back();
+			}
+		}
+
+		fills.push_back({ c, slot });
+	}
+
+	#pragma omp parallel for schedule(dynamic, 4)
+	for (size_t i = 0; i < fills.size(); i++) {
+		glm::vec3 corner = origin + glm::vec3(fills[i].cell) * extent();
+		uint8_t *dst = &samples[size_t(fills[i].brick) * brick_volume];
+
+		for (uint32_t z = 0; z < brick_size; z++) {
+			for (uint32_t y = 0; y < brick_size; y++) {
+				for (uint32_t x = 0; x < brick_size; x++) {
+					glm::vec3 p = corner + glm::vec3(x, y, z) * cell;
+					dst[(z * brick_size + y) * brick_size + x] = quantize(ftn(p), band);
+				}
+			}
+		}
+	}
+
+	for (const Fill &fill : fills)
+		dirty.push_back(fill.brick);
+}
+
+BrickMap BrickMap::bake(const Function &ftn, const AABB &bounds, float cell)
+{
+	IVY_PROFILE_SCOPE("BrickMap::bake");
+
+	BrickMap map;
+	map.cell = cell;
+	map.band = 0.5f * std::sqrt(3.0f) * map.extent() + cell;
+
+	// Padded so that surfaces on the bounds are still covered
+	glm::vec3 size = bounds.max - bounds.min + 2.0f * map.band;
+
+	map.origin = bounds.min - map.band;
+	map.dims = glm::max(glm::uvec3(glm::ceil(size/map.extent())), glm::uvec3(1));
+	map.indirection.assign(map.dims.x * map.dims.y * map.dims.z, empty);
+
+	map.rebake(ftn, bounds);
+
+	return map;
+}
+
+BrickMap BrickMap::bake(const Compound &compound, float cell)
+{
+	return bake(function(compound), compound.bounds(), cell);
+}
+
+BrickMap::Function BrickMap::function(const Compound &compound)
+{
+	BVH bvh = BVH::from(compound.shapes);
+
+	return [bvh, shapes = compound.shapes, grids = compound.grids](const glm::vec3 &p) {
+		float d = bvh.distance(shapes, p);
+		for (const GridInstance &instance : grids)
+			d = std::min(d, instance.distance(p));
+
+		return d;
+	};
+}
+
+// Uploading to the device
+static constexpr vk::Format ATLAS_FORMAT = vk::Format::eR8Unorm;
+
+static AllocatedImage allocate_atlas(DeviceMemoryAllocator *allocator, uint32_t layers)
+{
+	uint32_t side = DeviceBrickMap::atlas_width * BrickMap::brick_size;
+
+	vk::ImageCreateInfo info {
+		{}, vk::ImageType::e3D, ATLAS_FORMAT,
+		vk::Extent3D { side, side, layers * BrickMap::brick_size },
+		1, 1, vk::SampleCountFlagBits::e1,
+		vk::ImageTiling::eOptimal,
+		vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst,
+		vk::SharingMode::eExclusive, {},
+		vk::ImageLayout::eUndefined
+	};
+
+	return allocator->image(info, vk::ImageViewType::e3D, vk::ImageAspectFlagBits::eColor);
+}
+
+static AllocatedBuffer allocate_grid(DeviceMemoryAllocator *allocator, const BrickMapHeader &header,
+		const std::vector <uint32_t> &indirection)
+{
+	vk::DeviceSize size = sizeof(BrickMapHeader) + std::max(indirection.size(), size_t(1)) * sizeof(uint32_t);
+
+	AllocatedBuffer grid = allocator->buffer(size, vk::BufferUsageFlagBits::eStorageBuffer);
+	allocator->upload(grid, &header, sizeof(header));
+	if (!indirection.empty())
+		allocator->upload(grid, indirection.data(), indirection.size() * sizeof(uint32_t), sizeof(header));
+
+	return grid;
+}
+
+void DeviceBrickMap::upload(VulkanResourceBase &vrb, const vk::CommandBuffer &cmd, BrickMap &map)
+{
+	IVY_PROFILE_SCOPE("DeviceBrickMap::upload");
+
+	constexpr uint32_t layer = atlas_width * atlas_width;
+
+	// Grown geometrically; everything is uploaded again into the new atlas
+	bool fresh = false;
+	if (map.bricks() > capacity) {
+		uint32_t layers = std::max(capacity/layer, 1u);
+		while (layers * layer < map.bricks())
+			layers *= 2;
+
+		vrb.retire(atlas);
+		atlas = allocate_atlas(vrb.allocator, layers);
+		capacity = layers * layer;
+		fresh = true;
+
+		map.dirty.resize(map.bricks());
+		for (uint32_t i = 0; i < map.bricks(); i++)
+			map.dirty[i] = i;
+	}
+
+	std::sort(map.dirty.begin(), map.dirty.end());
+	map.dirty.erase(std::unique(map.dirty.begin(), map.dirty.end()), map.dirty.end());
+
+	if (!map.dirty.empty()) {
+		AllocatedBuffer staging = vrb.allocator->buffer(map.dirty.size() * BrickMap::brick_volume,
+			vk::BufferUsageFlagBits::eTransferSrc);
+
+		std::vector <vk::BufferImageCopy> regions;
+		for (size_t i = 0; i < map.dirty.size(); i++) {
+			uint32_t brick = map.dirty[i];
+			vk::DeviceSize offset = i * BrickMap::brick_volume;
+
+			vrb.allocator->upload(staging, &map.samples[size_t(brick) * BrickMap::brick_volume],
+				BrickMap::brick_volume, offset);
+
+			glm::uvec3 position {
+				brick % atlas_width,
+				(brick/atlas_width) % atlas_width,
+				brick/layer
+			};
+
+			regions.push_back(vk::BufferImageCopy {
+				offset, 0, 0,
+				vk::ImageSubresourceLayers { vk::ImageAspectFlagBits::eColor, 0, 0, 1 },
+				vk::Offset3D {
+					int32_t(position.x * BrickMap::brick_size),
+					int32_t(position.y * BrickMap::brick_size),
+					int32_t(position.z * BrickMap::brick_size)
+				},
+				vk::Extent3D { BrickMap::brick_size, BrickMap::brick_size, BrickMap::brick_size }
+			});
+		}
+
+		// Frames in flight read the atlas before this, in submission order
+		vk::ImageLayout from = fresh ? vk::ImageLayout::eUndefined : vk::ImageLayout::eShaderReadOnlyOptimal;
+		transition(cmd, atlas, from, vk::ImageLayout::eTransferDstOptimal);
+		cmd.copyBufferToImage(staging.buffer, atlas.image, vk::ImageLayout::eTransferDstOptimal, regions);
+		transition(cmd, atlas, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
+
+		vrb.retire(staging);
+		map.dirty.clear();
+	}
+
+	// The grid is small, so it is replaced rather than patched
+	BrickMapHeader header {
+		.origin = map.origin,
+		.cell = map.cell,
+		.dims = map.dims,
+		.band = map.band,
+		.atlas = glm::uvec3(atlas_width, atlas_width, capacity/layer),
+		.bricks = map.bricks()
+	};
+
+	vrb.retire(grid);
+	grid = allocate_grid(vrb.allocator, header, map.indirection);
+}
+
+DeviceBrickMap DeviceBrickMap::from(VulkanResourceBase &vrb)
+{
+	DeviceBrickMap dbm;
+	dbm.atlas = allocate_atlas(vrb.allocator, 1);
+	dbm.capacity = atlas_width * atlas_width;
+	dbm.grid = allocate_grid(vrb.allocator, BrickMapHeader {}, {});
+
+	littlevk::submit_now(vrb.device, vrb.command_pool, vrb.graphics_queue,
+		[&](const vk::CommandBuffer &cmd) {
+			transition(cmd, dbm.atlas, vk::ImageLayout::eUndefined, vk::ImageLayout::eShaderReadOnlyOptimal);
+		}
+	);
+
+	return dbm;
+}
+
+}
@@ -0,0 +1,481 @@
+#include <bit>
+#include <cstring>
+
+#include <microlog/microlog.h>
+
+#include "core/allocator.hpp"
+
+namespace ivy {
+
+static std::optional <uint32_t> find_memory_type(const vk::PhysicalDeviceMemoryProperties &properties,
+		uint32_t type_bits, vk::MemoryPropertyFlags flags)
+{
+	for (uint32_t i = 0; i < properties.memoryTypeCount; i++) {
+		if ((type_bits & (1u << i)) && (properties.memoryTypes[i].propertyFlags & flags) == flags)
+			return i;
+	}
+
+	return std::nullopt;
+}
+
+// Smallest order whose chunk can fit the size and alignment
+static uint32_t buddy_order(vk::DeviceSize size, vk::DeviceSize alignment)
+{
+	vk::DeviceSize chunk = std::max({ size, alignment, DeviceMemoryAllocator::min_allocation });
+	chunk = std::bit_ceil(chunk);
+	return std::countr_zero(chunk/DeviceMemoryAllocator::min_allocation);
+}
+
+MemoryAllocation DeviceMemoryAllocator::allocate(const vk::MemoryRequirements &requirements,
+		vk::MemoryPropertyFlags properties, bool linear,
+		const vk::MemoryDedicatedAllocateInfo *dedicated_info)
+{
+	auto type = find_memory_type(memory_properties, requirements.memoryTypeBits, properties);
+	if (!type) {
+		ulog_error("allocator", "no memory type for requirements (bits: %x)\n", requirements.memoryTypeBits);
+		throw "error";
+	}
+
+	bool host = bool(properties & vk::MemoryPropertyFlagBits::eHostVisible);
+
+	std::lock_guard guard(lock);
+
+	MemoryAllocation allocation;
+	allocation.type = *type;
+	allocation.size = requirements.size;
+
+	// Large resources get their own memory
+	if (dedicated_info || requirements.size > dedicated_threshold) {
+		vk::MemoryAllocateInfo info { requirements.size, *type };
+		info.pNext = dedicated_info;
+
+		allocation.memory = device.allocateMemory(info);
+		if (host)
+			allocation.mapped = device.mapMemory(allocation.memory, 0, VK_WHOLE_SIZE);
+
+		dedicated_memory.insert(allocation.memory);
+
+		live += requirements.size;
+		dedicated += requirements.size;
+		dedicated_allocations++;
+		return allocation;
+	}
+
+	uint32_t order = buddy_order(requirements.size, requirements.alignment);
+
+	// Find a compatible block with a large enough range
+	auto search = [&](Block &block) -> std::optional <vk::DeviceSize> {
+		for (uint32_t k = order; k <= max_order; k++) {
+			if (block.free[k].empty())
+				continue;
+
+			vk::DeviceSize offset = *block.free[k].begin();
+			block.free[k].erase(block.free[k].begin());
+
+			// Split down to the requested order
+			while (k > order) {
+				k--;
+				block.free[k].insert(offset + (min_allocation << k));
+			}
+
+			return offset;
+		}
+
+		return std::nullopt;
+	};
+
+	std::optional <vk::DeviceSize> offset;
+
+	int32_t index = 0;
+	for (; index < (int32_t) blocks.size(); index++) {
+		Block &block = blocks[index];
+		if (!block.memory || block.type != *type || block.linear != linear)
+			continue;
+
+		if ((offset = search(block)))
+			break;
+	}
+
+	if (!offset) {
+		// Reuse a released slot if possible
+		index = 0;
+		while (index < (int32_t) blocks.size() && blocks[index].memory)
+			index++;
+
+		if (index == (int32_t) blocks.size())
+			blocks.emplace_back();
+
+		Block &block = blocks[index];
+		block.memory = device.allocateMemory(vk::MemoryAllocateInfo { block_size, *type });
+		block.type = *type;
+		block.linear = linear;
+		block.mapped = host ? device.mapMemory(block.memory, 0, VK_WHOLE_SIZE) : nullptr;
+		block.committed = 0;
+		block.allocations = 0;
+		block.free.assign(max_order + 1, {});
+		block.free[max_order].insert(0);
+
+		offset = search(block);
+	}
+
+	Block &block = blocks[index];
+	block.committed += min_allocation << order;
+	block.allocations++;
+
+	allocation.memory = block.memory;
+	allocation.offset = *offset;
+	allocation.order = order;
+	allocation.block = index;
+	if (block.mapped)
+		allocation.mapped = (uint8_t *) block.mapped + *offset;
+
+	live += requirements.size;
+	allocations++;
+
+	return allocation;
+}
+
+void DeviceMemoryAllocator::free(const MemoryAllocation &allocation)
+{
+	if (!allocation.memory)
+		return;
+
+	std::lock_guard guard(lock);
+
+	live -= allocation.size;
+
+	if (allocation.block < 0) {
+		dedicated_memory.erase(allocation.memory);
+		device.freeMemory(allocation.memory);
+		dedicated -= allocation.size;
+		dedicated_allocations--;
+		return;
+	}
+
+	Block &block = blocks[allocation.block];
+	block.committed -= min_allocation << allocation.order;
+	block.allocations--;
+	allocations--;
+
+	// Merge with free buddies as far as possible
+	vk::DeviceSize offset = allocation.offset;
+
+	uint32_t k = allocation.order;
+	while (k < max_order) {
+		vk::DeviceSize buddy = offset ^ (min_allocation << k);
+		auto it = block.free[k].find(buddy);
+		if (it == block.free[k].end())
+			break;
+
+		block.free[k].erase(it);
+		offset = std::min(offset, buddy);
+		k++;
+	}
+
+	block.free[k].insert(offset);
+}
+
+AllocatedBuffer DeviceMemoryAllocator::buffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties)
+{
+	AllocatedBuffer result;
+	result.size = size;
+	result.buffer = device.createBuffer(vk::BufferCreateInfo {
+		{}, size, usage, vk::SharingMode::eExclusive
+	});
+
+	vk::MemoryRequirements requirements = device.getBufferMemoryRequirements(result.buffer);
+	result.allocation = allocate(requirements, properties, true);
+	device.bindBufferMemory(result.buffer, result.allocation.memory, result.allocation.offset);
+
+	return result;
+}
+
+void DeviceMemoryAllocator::upload(const AllocatedBuffer &buffer, const void *data, vk::DeviceSize size, vk::DeviceSize offset) const
+{
+	ulog_assert(buffer.allocation.mapped, "allocator", "uploading to a buffer which is not host visible\n");
+	std::memcpy((uint8_t *) buffer.allocation.mapped + offset, data, size);
+}
+
+AllocatedImage DeviceMemoryAllocator::image(const vk::ImageCreateInfo &info, vk::ImageViewType view_type,
+		vk::ImageAspectFlags aspect, const vk::ComponentMapping &components)
+{
+	AllocatedImage result;
+	result.image = device.createImage(info);
+	result.extent = info.extent;
+	result.format = info.format;
+	result.aspect = aspect;
+	result.mips = info.mipLevels;
+	result.layers = info.arrayLayers;
+
+	vk::MemoryRequirements requirements = device.getImageMemoryRequirements(result.image);
+
+	bool linear = (info.tiling == vk::ImageTiling::eLinear);
+	if (requirements.size > dedicated_threshold) {
+		vk::MemoryDedicatedAllocateInfo dedicated_info { result.image };
+		result.allocation = allocate(requirements, device_local, linear, &dedicated_info);
+	} else {
+		result.allocation = allocate(requirements, device_local, linear);
+	}
+
+	device.bindImageMemory(result.image, result.allocation.memory, result.allocation.offset);
+
+	result.view = device.createImageView(vk::ImageViewCreateInfo {
+		{}, result.image, view_type, info.format, components,
+		vk::ImageSubresourceRange { aspect, 0, info.mipLevels, 0, info.arrayLayers }
+	});
+
+	return result;
+}
+
+AllocatedImage DeviceMemoryAllocator::image(const vk::Extent2D &extent, vk::Format format,
+		vk::ImageUsageFlags usage, vk::ImageAspectFlags aspect, uint32_t mips)
+{
+	vk::ImageCreateInfo info {
+		{}, vk::ImageType::e2D, format,
+		vk::Extent3D { extent.width, extent.height, 1 },
+		mips, 1, vk::SampleCountFlagBits::e1,
+		vk::ImageTiling::eOptimal, usage,
+		vk::SharingMode::eExclusive, {},
+		vk::ImageLayout::eUndefined
+	};
+
+	return image(info, vk::ImageViewType::e2D, aspect);
+}
+
+void DeviceMemoryAllocator::destroy(AllocatedBuffer &buffer)
+{
+	if (!buffer.buffer)
+		return;
+
+	device.destroyBuffer(buffer.buffer);
+	free(buffer.allocation);
+	buffer = {};
+}
+
+void DeviceMemoryAllocator::destroy(AllocatedImage &image)
+{
+	if (!image.image)
+		return;
+
+	device.destroyImageView(image.view);
+	device.destroyImage(image.image);
+	free(image.allocation);
+	image = {};
+}
+
+void DeviceMemoryAllocator::destroy()
+{
+	std::lock_guard guard(lock);
+
+	for (Block &block : blocks) {
+		if (block.memory)
+			device.freeMemory(block.memory);
+	}
+
+	for (vk::DeviceMemory memory : dedicated_memory)
+		device.freeMemory(memory);
+
+	blocks.clear();
+	dedicated_memory.clear();
+	live = dedicated = 0;
+	allocations = dedicated_allocations = 0;
+}
+
+void DeviceMemoryAllocator::defragment(float occupancy)
+{
+	if (!relocation_hook)
+		return;
+
+	// Report the contents of sparsely used blocks; owners are expected to
+	// recreate the resources and free the reported allocations
+	std::vector <MemoryAllocation> candidates;
+
+	{
+		std::lock_guard guard(lock);
+
+		for (int32_t i = 0; i < (int32_t) blocks.size(); i++) {
+			const Block &block = blocks[i];
+			if (!block.memory || block.allocations == 0)
+				continue;
+
+			if (float(block.committed)/float(block_size) > occupancy)
+				continue;
+
+			MemoryAllocation allocation;
+			allocation.memory = block.memory;
+			allocation.type = block.type;
+			allocation.block = i;
+			allocation.size = block.committed;
+			candidates.push_back(allocation);
+		}
+	}
+
+	for (const MemoryAllocation &allocation : candidates)
+		relocation_hook(allocation);
+}
+
+void DeviceMemoryAllocator::release_empty_blocks()
+{
+	std::lock_guard guard(lock);
+
+	for (Block &block : blocks) {
+		if (!block.memory || block.allocations > 0)
+			continue;
+
+		device.freeMemory(block.memory);
+		block = {};
+	}
+}
+
+MemoryStatistics DeviceMemoryAllocator::statistics() const
+{
+	std::lock_guard guard(lock);
+
+	MemoryStatistics stats;
+	stats.live = live;
+	stats.dedicated = dedicated;
+	stats.allocations = allocations + dedicated_allocations;
+	stats.dedicated_allocations = dedicated_allocations;
+
+	vk::DeviceSize free = 0;
+	vk::DeviceSize largest = 0;
+	for (const Block &block : blocks) {
+		if (!block.memory)
+			continue;
+
+		stats.blocks++;
+		stats.reserved += block_size;
+		stats.committed += block.committed;
+
+		for (uint32_t k = max_order + 1; k-- > 0; ) {
+			if (block.free[k].empty())
+				continue;
+
+			largest = std::max(largest, min_allocation << k);
+			break;
+		}
+
+		free += block_size - block.committed;
+	}
+
+	if (free > 0)
+		stats.fragmentation = 1.0f - float(largest)/float(free);
+
+	return stats;
+}
+
+DeviceMemoryAllocator *DeviceMemoryAllocator::from(const vk::Device &device, const vk::PhysicalDeviceMemoryProperties &memory_properties)
+{
+	auto allocator = new DeviceMemoryAllocator;
+	allocator->device = device;
+	allocator->memory_properties = memory_properties;
+	return allocator;
+}
+
+// Image commands
+static std::pair <vk::AccessFlags, vk::PipelineStageFlags> layout_access(vk::ImageLayout layout)
+{
+	switch (layout) {
+	case vk::ImageLayout::eUndefined:
+		return { {}, vk::PipelineStageFlagBits::eTopOfPipe };
+	case vk::ImageLayout::eTransferDstOptimal:
+		return { vk::AccessFlagBits::eTransferWrite, vk::PipelineStageFlagBits::eTransfer };
+	case vk::ImageLayout::eTransferSrcOptimal:
+		return { vk::AccessFlagBits::eTransferRead, vk::PipelineStageFlagBits::eTransfer };
+	case vk::ImageLayout::eShaderReadOnlyOptimal:
+		return { vk::AccessFlagBits::eShaderRead,
+			vk::PipelineStageFlagBits::eFragmentShader
+			| vk::PipelineStageFlagBits::eComputeShader };
+	case vk::ImageLayout::eGeneral:
+		return { vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+			vk::PipelineStageFlagBits::eFragmentShader
+			| vk::PipelineStageFlagBits::eComputeShader };
+	case vk::ImageLayout::eColorAttachmentOptimal:
+		return { vk::AccessFlagBits::eColorAttachmentWrite, vk::PipelineStageFlagBits::eColorAttachmentOutput };
+	case vk::ImageLayout::ePresentSrcKHR:
+		return { {}, vk::PipelineStageFlagBits::eBottomOfPipe };
+	default:
+		break;
+	}
+
+	return { vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite, vk::PipelineStageFlagBits::eAllCommands };
+}
+
+void transition(const vk::CommandBuffer &cmd, const AllocatedImage &image,
+		vk::ImageLayout from, vk::ImageLayout to, uint32_t base_mip, uint32_t mips)
+{
+	auto [src_access, src_stage] = layout_access(from);
+	auto [dst_access, dst_stage] = layout_access(to);
+
+	vk::ImageMemoryBarrier barrier {
+		src_access, dst_access,
+		from, to,
+		VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+		image.image,
+		vk::ImageSubresourceRange { image.aspect, base_mip, mips, 0, image.layers }
+	};
+
+	cmd.pipelineBarrier(src_stage, dst_stage, {}, {}, {}, barrier);
+}
+
+void copy_buffer_to_image(const vk::CommandBuffer &cmd, const AllocatedImage &image, const AllocatedBuffer &buffer,
+		vk::ImageLayout layout, uint32_t mip, vk::DeviceSize offset)
+{
+	vk::BufferImageCopy region {
+		offset, 0, 0,
+		vk::ImageSubresourceLayers { image.aspect, mip, 0, image.layers },
+		vk::Offset3D { 0, 0, 0 },
+		vk::Extent3D {
+			std::max(image.extent.width >> mip, 1u),
+			std::max(image.extent.height >> mip, 1u),
+			std::max(image.extent.depth >> mip, 1u)
+		}
+	};
+
+	cmd.copyBufferToImage(buffer.buffer, image.image, layout, region);
+}
+
+void copy_image_to_buffer(const vk::CommandBuffer &cmd, const AllocatedImage &image, const AllocatedBuffer &buffer,
+		vk::ImageLayout layout, uint32_t mip, vk::DeviceSize offset)
+{
+	vk::BufferImageCopy region {
+		offset, 0, 0,
+		vk::ImageSubresourceLayers { image.aspect, mip, 0, image.layers },
+		vk::Offset3D { 0, 0, 0 },
+		vk::Extent3D {
+			std::max(image.extent.width >> mip, 1u),
+			std::max(image.extent.height >> mip, 1u),
+			std::max(image.extent.depth >> mip, 1u)
+		}
+	};
+
+	cmd.copyImageToBuffer(image.image, layout, buffer.buffer, region);
+}
+
+void generate_mips(const vk::CommandBuffer &cmd, const AllocatedImage &image)
+{
+	for (uint32_t mip = 1; mip < image.mips; mip++) {
+		transition(cmd, image, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eTransferSrcOptimal, mip - 1, 1);
+
+		int32_t sw = std::max(image.extent.width >> (mip - 1), 1u);
+		int32_t sh = std::max(image.extent.height >> (mip - 1), 1u);
+		int32_t dw = std::max(image.extent.width >> mip, 1u);
+		int32_t dh = std::max(image.extent.height >> mip, 1u);
+
+		vk::ImageBlit blit {
+			vk::ImageSubresourceLayers { image.aspect, mip - 1, 0, image.layers },
+			{ vk::Offset3D { 0, 0, 0 }, vk::Offset3D { sw, sh, 1 } },
+			vk::ImageSubresourceLayers { image.aspect, mip, 0, image.layers },
+			{ vk::Offset3D { 0, 0, 0 }, vk::Offset3D { dw, dh, 1 } }
+		};
+
+		cmd.blitImage(image.image, vk::ImageLayout::eTransferSrcOptimal,
+			image.image, vk::ImageLayout::eTransferDstOptimal,
+			blit, vk::Filter::eLinear);
+	}
+
+	transition(cmd, image, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eTransferSrcOptimal, image.mips - 1, 1);
+	transition(cmd, image, vk::ImageLayout::eTransferSrcOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
+}
+
+}
@@ -1,56 +1,576 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
 #include <littlevk/littlevk.hpp>
 
 #include "core/caches.hpp"
+#include "core/profiler.hpp"
 
 namespace ivy {
 
 void DeviceTextureCache::load(const std::filesystem::path &path)
 {
+	IVY_PROFILE_SCOPE("DeviceTextureCache::load");
+
 	std::string tr = path.string();
 	if (host_textures.count(tr))
 		return;
 
-	Texture tex = Texture::load(tr);
-	host_textures[tr] = tex;
+	load_async(path);
+
+	Texture texture = pending[tr].get();
+	pending.erase(tr);
+
+	host_usage += texture.pixels.size();
+	host_last_used[tr] = frame;
+	host_textures[tr] = std::move(texture);
 }
 
-void DeviceTextureCache::upload(const std::filesystem::path &path)
+void DeviceTextureCache::load_async(const std::filesystem::path &path)
 {
 	std::string tr = path.string();
 
-	if (!host_textures.count(tr)) {
-		fprintf(stderr, "DeviceTextureCache::upload: could not find path %s\n", tr.c_str());
+	// Already decoded or in flight
+	if (host_textures.count(tr) || pending.count(tr))
 		return;
+
+	pending[tr] = workers->submit([tr]() {
+		IVY_PROFILE_SCOPE("DeviceTextureCache::decode");
+		return Texture::load(tr);
+	}).share();
+}
+
+void DeviceTextureCache::prefetch(const std::set <std::string> &paths)
+{
+	for (const std::string &path : paths) {
+		if (!path.empty())
+			load_async(path);
 	}
+}
+
+void DeviceTextureCache::poll()
+{
+	for (auto it = pending.begin(); it != pending.end(); ) {
+		auto &[path, future] = *it;
+		if (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+			it++;
+			continue;
+		}
+
+		Texture texture = future.get();
+		host_usage += texture.pixels.size();
+		host_last_used[path] = frame;
+		host_textures[path] = std::move(texture);
+
+		it = pending.erase(it);
+	}
+}
+
+void DeviceTextureCache::upload(const std::filesystem::path &path)
+{
+	upload(std::vector <std::filesystem::path> { path });
+}
+
+// Cooked levels from the given one down to the smallest
+static vk::DeviceSize levels_size(const CookedTexture &cooked, uint32_t first)
+{
+	return cooked.data.size() - cooked.levels[first].offset;
+}
+
+// Grey is replicated into the color channels, as Texture::as_rgba
+static vk::ComponentMapping channel_swizzle(TextureEncoding encoding)
+{
+	using vk::ComponentSwizzle;
+
+	switch (encoding) {
+	case TextureEncoding::eR8:
+		return { ComponentSwizzle::eR, ComponentSwizzle::eR, ComponentSwizzle::eR, ComponentSwizzle::eOne };
+	case TextureEncoding::eRG8:
+		return { ComponentSwizzle::eR, ComponentSwizzle::eR, ComponentSwizzle::eR, ComponentSwizzle::eG };
+	default:
+		break;
+	}
+
+	return {};
+}
+
+static AllocatedImage allocate_levels(DeviceMemoryAllocator *allocator, const CookedTexture &cooked, uint32_t first)
+{
+	const CookedTexture::Level &level = cooked.levels[first];
+
+	vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+	if (cooked.device_mips())
+		usage |= vk::ImageUsageFlagBits::eTransferSrc;
+
+	vk::ImageCreateInfo info {
+		{}, vk::ImageType::e2D, cooked.format(),
+		vk::Extent3D { level.width, level.height, 1 },
+		cooked.mip_count() - first, 1, vk::SampleCountFlagBits::e1,
+		vk::ImageTiling::eOptimal, usage,
+		vk::SharingMode::eExclusive, {},
+		vk::ImageLayout::eUndefined
+	};
+
+	return allocator->image(info, vk::ImageViewType::e2D, vk::ImageAspectFlagBits::eColor,
+		channel_swizzle(cooked.encoding));
+}
+
+// Levels are expected in the staging buffer starting at the offset
+static void record_levels(const vk::CommandBuffer &cmd, const AllocatedImage &image, const AllocatedBuffer &staging,
+		const CookedTexture &cooked, uint32_t first, vk::DeviceSize offset)
+{
+	transition(cmd, image, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal);
+
+	uint32_t stored = cooked.levels.size() - first;
+	for (uint32_t mip = 0; mip < stored; mip++) {
+		vk::DeviceSize relative = cooked.levels[first + mip].offset - cooked.levels[first].offset;
+		copy_buffer_to_image(cmd, image, staging, vk::ImageLayout::eTransferDstOptimal, mip, offset + relative);
+	}
+
+	if (cooked.device_mips())
+		generate_mips(cmd, image);
+	else
+		transition(cmd, image, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
+}
+
+// Offsets of compressed copies must be aligned to the block size
+static vk::DeviceSize align_staging(vk::DeviceSize size)
+{
+	return (size + 15) & ~vk::DeviceSize(15);
+}
 
-	// TODO: callback
-	// ulog_assert(host_textures.count(tr), "load_texture", "could not find path %s\n", tr.c_str());
+void DeviceTextureCache::upload(const std::vector <std::filesystem::path> &paths)
+{
+	IVY_PROFILE_SCOPE("DeviceTextureCache::upload");
+
+	struct Staged {
+		std::string key;
+		CookedTexture cooked;
+		uint32_t first;
+		AllocatedImage image;
+		vk::DeviceSize offset;
+	};
+
+	std::vector <Staged> staged;
+
+	// Cook everything first, to size the staging buffer
+	vk::DeviceSize total = 0;
+	for (const std::filesystem::path &path : paths) {
+		std::string tr = path.string();
+
+		if (!host_textures.count(tr)) {
+			fprintf(stderr, "DeviceTextureCache::upload: could not find path %s\n", tr.c_str());
+			continue;
+		}
 
-	const Texture &tex = host_textures[tr];
+		// TODO: callback
+		// ulog_assert(host_textures.count(tr), "load_texture", "could not find path %s\n", tr.c_str());
 
-	littlevk::Image image;
-	littlevk::Buffer staging;
+		const Texture &tex = host_textures[tr];
+		if (tex.pixels.empty()) {
+			fprintf(stderr, "DeviceTextureCache::upload: texture %s is empty\n", tr.c_str());
+			host_usage -= host_textures[tr].pixels.size();
+			host_textures.erase(tr);
+			host_last_used.erase(tr);
+			continue;
+		}
+
+		Staged s;
+		s.key = tr;
+		TextureRole role = normal_maps.count(tr) ? TextureRole::eNormal : TextureRole::eColor;
+		s.cooked = cooker.cook(tex, role);
+
+		// Streamed textures start with only their tail resident
+		s.first = streamed(tr, s.cooked) ? tail_level(s.cooked) : 0;
+		s.image = allocate_levels(allocator, s.cooked, s.first);
+		s.offset = total;
 
-	 std::tie(image, staging) = bind(device, memory_properties, dal)
-		.image((uint32_t) tex.width, (uint32_t) tex.height,
-			vk::Format::eR8G8B8A8Unorm, // TODO: conditional
-			vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst,
-			vk::ImageAspectFlagBits::eColor)
-		.buffer(tex.pixels, vk::BufferUsageFlagBits::eTransferSrc);
+		total += align_staging(levels_size(s.cooked, s.first));
+
+		staged.push_back(std::move(s));
+	}
+
+	if (staged.empty())
+		return;
+
+	AllocatedBuffer staging = allocator->buffer(total, vk::BufferUsageFlagBits::eTransferSrc);
+	for (const Staged &s : staged) {
+		const uint8_t *data = s.cooked.data.data() + s.cooked.levels[s.first].offset;
+		allocator->upload(staging, data, levels_size(s.cooked, s.first), s.offset);
+	}
 
 	// TODO: some state wise struct to simplify transitioning?
 	littlevk::submit_now(device, command_pool, queue,
 		[&](const vk::CommandBuffer &cmd) {
-			littlevk::transition(cmd, image, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal);
-			littlevk::copy_buffer_to_image(cmd, image, staging, vk::ImageLayout::eTransferDstOptimal);
-			littlevk::transition(cmd, image, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
+			for (const Staged &s : staged)
+				record_levels(cmd, s.image, staging, s.cooked, s.first, s.offset);
 		}
 	);
 
 	// Free interim data
-	littlevk::destroy_buffer(device, staging);
+	allocator->destroy(staging);
+
+	for (Staged &s : staged) {
+		device_textures[s.key] = s.image;
+		device_usage += s.image.allocation.size;
+
+		uint32_t slot;
+		if (indices.count(s.key)) {
+			// Reloaded, so switch to the other array slot
+			slot = indices[s.key];
+			parity[slot] ^= 1;
+			changed_at[slot] = frame;
+		} else {
+			slot = slots.size();
+			indices.emplace(s.key, slot);
+			slots.push_back(s.key);
+			last_used.push_back(frame);
+			parity.push_back(0);
+			changed_at.push_back(frame);
+		}
+
+		// The copy has completed, so the pixels are no longer needed
+		host_usage -= host_textures[s.key].pixels.size();
+		host_textures.erase(s.key);
+		host_last_used.erase(s.key);
+
+		// Finer levels are streamed from the cooked copy
+		if (streamed(s.key, s.cooked)) {
+			if (streams.count(slot))
+				host_usage -= streams[slot].cooked.data.size();
+
+			host_usage += s.cooked.data.size();
+
+			Stream &stream = streams[slot];
+			stream.resident = s.first;
+			stream.tail = s.first;
+			stream.requested = s.first;
+			stream.requested_at = frame;
+			stream.cooked = std::move(s.cooked);
+		}
+	}
+}
+
+// Generated mips exist only on the device, so those are never streamed
+bool DeviceTextureCache::streamed(const std::string &path, const CookedTexture &cooked) const
+{
+	return !pinned.count(path) && !cooked.device_mips();
+}
+
+uint32_t DeviceTextureCache::tail_level(const CookedTexture &cooked)
+{
+	uint32_t level = 0;
+	while (level + 1 < cooked.levels.size()
+			&& std::max(cooked.levels[level].width, cooked.levels[level].height) > tail_size)
+		level++;
+
+	return level;
+}
+
+// Residency
+void DeviceTextureCache::touch(uint32_t slot, float footprint)
+{
+	if (slot >= last_used.size())
+		return;
+
+	last_used[slot] = frame;
+
+	if (streams.count(slot)) {
+		Stream &stream = streams[slot];
+
+		// Roughly one texel per pixel over the footprint
+		const CookedTexture::Level &base = stream.cooked.levels[0];
+		float texels = std::max(base.width, base.height);
+
+		uint32_t level = 0;
+		if (footprint < texels)
+			level = std::min(uint32_t(std::log2(texels/std::max(footprint, 1.0f))), stream.tail);
+
+		stream.requested = std::min(stream.requested, level);
+		if (level <= stream.resident)
+			stream.requested_at = frame;
+
+		// Evicted, but still cooked; streaming brings it back
+		return;
+	}
+
+	// Evicted, so bring it back
+	if (!device_textures.count(slots[slot]))
+		load_async(slots[slot]);
+}
 
-	device_textures[tr] = image;
+bool DeviceTextureCache::resident(const std::string &path) const
+{
+	return device_textures.count(path);
+}
+
+uint32_t DeviceTextureCache::physical(uint32_t slot) const
+{
+	return 2 * slot + parity[slot];
+}
+
+// Replaces images with ones holding the requested levels, within the
+// upload budget; copies are recorded into the frame being recorded
+void DeviceTextureCache::stream(const vk::CommandBuffer &cmd, Residency &residency)
+{
+	struct Change {
+		uint32_t slot;
+		uint32_t level;
+		uint32_t priority;
+	};
+
+	std::vector <Change> changes;
+	for (auto &[slot, stream] : streams) {
+		uint32_t target = stream.requested;
+		stream.requested = stream.tail;
+
+		// Nothing drawn with it lately
+		if (last_used[slot] + min_eviction_age <= frame)
+			target = stream.tail;
+
+		// Frames in flight may still use the other slot
+		if (changed_at[slot] + min_eviction_age > frame)
+			continue;
+
+		bool present = device_textures.count(slots[slot]);
+		if (!present) {
+			// Evicted, and used again
+			if (last_used[slot] + 1 >= frame)
+				changes.push_back({ slot, target, UINT32_MAX });
+		} else if (target < stream.resident) {
+			changes.push_back({ slot, target, stream.resident - target });
+		} else if (target > stream.resident && stream.requested_at + 4 * min_eviction_age <= frame) {
+			// Finer levels have not been needed for a while
+			changes.push_back({ slot, target, 0 });
+		}
+	}
+
+	if (changes.empty())
+		return;
+
+	// Largest deficits first
+	std::sort(changes.begin(), changes.end(),
+		[](const Change &a, const Change &b) { return a.priority > b.priority; });
+
+	vk::DeviceSize total = 0;
+	size_t count = 0;
+	for (const Change &change : changes) {
+		vk::DeviceSize size = align_staging(levels_size(streams[change.slot].cooked, change.level));
+		if (count > 0 && total + size > budget.upload)
+			break;
+
+		total += size;
+		count++;
+	}
+
+	changes.resize(count);
+
+	AllocatedBuffer staging = allocator->buffer(total, vk::BufferUsageFlagBits::eTransferSrc);
+
+	vk::DeviceSize offset = 0;
+	for (const Change &change : changes) {
+		Stream &stream = streams[change.slot];
+		const std::string &path = slots[change.slot];
+
+		vk::DeviceSize size = levels_size(stream.cooked, change.level);
+		const uint8_t *data = stream.cooked.data.data() + stream.cooked.levels[change.level].offset;
+		allocator->upload(staging, data, size, offset);
+
+		AllocatedImage image = allocate_levels(allocator, stream.cooked, change.level);
+		record_levels(cmd, image, staging, stream.cooked, change.level, offset);
+
+		if (device_textures.count(path)) {
+			device_usage -= device_textures[path].allocation.size;
+			release(device_textures[path]);
+		}
+
+		device_textures[path] = image;
+		device_usage += image.allocation.size;
+
+		stream.resident = change.level;
+		stream.requested_at = frame;
+		parity[change.slot] ^= 1;
+		changed_at[change.slot] = frame;
+
+		residency.uploaded.push_back(path);
+		offset += align_staging(size);
+	}
+
+	release_staging(staging);
+}
+
+DeviceTextureCache::Residency DeviceTextureCache::update(const vk::CommandBuffer &cmd)
+{
+	IVY_PROFILE_SCOPE("DeviceTextureCache::update");
+
+	frame++;
+	poll();
+
+	Residency residency;
+
+	// Evicted textures which were used again and have been decoded
+	std::vector <std::filesystem::path> reloads;
+	for (const auto &[path, texture] : host_textures) {
+		if (indices.count(path) && !device_textures.count(path))
+			reloads.push_back(path);
+	}
+
+	if (!reloads.empty()) {
+		upload(reloads);
+
+		for (const std::filesystem::path &path : reloads) {
+			if (device_textures.count(path.string()))
+				residency.uploaded.push_back(path.string());
+		}
+	}
+
+	stream(cmd, residency);
+
+	// Decoded textures which were never uploaded, oldest first
+	while (host_usage > budget.host && !host_last_used.empty()) {
+		auto oldest = std::min_element(host_last_used.begin(), host_last_used.end(),
+			[](const auto &a, const auto &b) { return a.second < b.second; });
+
+		host_usage -= host_textures[oldest->first].pixels.size();
+		host_textures.erase(oldest->first);
+		host_last_used.erase(oldest);
+	}
+
+	// Then the cooked copies of evicted textures, which are decoded again
+	for (auto it = streams.begin(); it != streams.end() && host_usage > budget.host; ) {
+		if (device_textures.count(slots[it->first])) {
+			it++;
+			continue;
+		}
+
+		host_usage -= it->second.cooked.data.size();
+		it = streams.erase(it);
+	}
+
+	// Least recently used textures, which frames in flight cannot be using
+	vk::DeviceSize limit = device_budget();
+	if (device_usage <= limit)
+		return residency;
+
+	std::vector <uint32_t> candidates;
+	for (uint32_t slot = 0; slot < slots.size(); slot++) {
+		const std::string &path = slots[slot];
+		if (device_textures.count(path) && !pinned.count(path)
+				&& last_used[slot] + min_eviction_age <= frame
+				&& changed_at[slot] + min_eviction_age <= frame)
+			candidates.push_back(slot);
+	}
+
+	std::sort(candidates.begin(), candidates.end(),
+		[&](uint32_t a, uint32_t b) { return last_used[a] < last_used[b]; });
+
+	for (uint32_t slot : candidates) {
+		if (device_usage <= limit)
+			break;
+
+		const std::string &path = slots[slot];
+
+		AllocatedImage image = device_textures[path];
+		device_usage -= image.allocation.size;
+		device_textures.erase(path);
+		release(image);
+
+		parity[slot] ^= 1;
+		changed_at[slot] = frame;
+
+		residency.evicted.push_back(path);
+	}
+
+	return residency;
 }
 
-}
\ No newline at end of file
+vk::DeviceSize DeviceTextureCache::device_budget() const
+{
+	vk::DeviceSize limit = 0;
+
+	if (memory_budget) {
+		vk::PhysicalDeviceMemoryBudgetPropertiesEXT budgets;
+
+		vk::PhysicalDeviceMemoryProperties2 properties;
+		properties.pNext = &budgets;
+		phdev.getMemoryProperties2(&properties);
+
+		// Whatever is left by everyone else, keeping a tenth in reserve
+		int64_t available = 0;
+		int64_t reserve = 0;
+		for (uint32_t i = 0; i < memory_properties.memoryHeapCount; i++) {
+			if (!(memory_properties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal))
+				continue;
+
+			available += int64_t(budgets.heapBudget[i]) - int64_t(budgets.heapUsage[i]);
+			reserve += budgets.heapBudget[i]/10;
+		}
+
+		limit = std::max(int64_t(device_usage) + available - reserve, int64_t(0));
+	} else {
+		// Half of device local memory, lacking anything better
+		for (uint32_t i = 0; i < memory_properties.memoryHeapCount; i++) {
+			if (memory_properties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+				limit += memory_properties.memoryHeaps[i].size/2;
+		}
+	}
+
+	if (budget.device > 0)
+		limit = std::min(limit, budget.device);
+
+	return limit;
+}
+
+DeviceTextureCache DeviceTextureCache::from(VulkanResourceBase &drc)
+{
+	DeviceTextureCache dtc {
+		.device = drc.device,
+		.phdev = drc.phdev,
+		.command_pool = drc.command_pool,
+		.queue = drc.graphics_queue,
+		.memory_properties = drc.memory_properties,
+		.allocator = drc.allocator,
+		.workers = drc.workers,
+		.release = [&drc](const AllocatedImage &image) { drc.retire(image); },
+		.release_staging = [&drc](const AllocatedBuffer &buffer) { drc.retire(buffer); }
+	};
+
+	dtc.cooker.block_compression = supports_block_compression(drc.phdev);
+
+	for (const vk::ExtensionProperties &properties : drc.phdev.enumerateDeviceExtensionProperties()) {
+		if (std::strcmp(properties.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0)
+			dtc.memory_budget = true;
+	}
+
+	// Populate with a default blank texture
+	// TODO: should this be a checkboard instead?
+	dtc.host_textures["blank"] = Texture::blank();
+	dtc.host_usage = dtc.host_textures["blank"].pixels.size();
+	dtc.upload("blank");
+	dtc.pinned.insert("blank");
+
+	return dtc;
+}
+
+// Every format the cooker may choose must be sampleable
+bool supports_block_compression(const vk::PhysicalDevice &phdev)
+{
+	if (!phdev.getFeatures().textureCompressionBC)
+		return false;
+
+	static constexpr TextureEncoding encodings[] = {
+		TextureEncoding::eBC1, TextureEncoding::eBC3,
+		TextureEncoding::eBC5, TextureEncoding::eBC7
+	};
+
+	for (TextureEncoding encoding : encodings) {
+		vk::FormatProperties properties = phdev.getFormatProperties(encoding_format(encoding));
+		if (!(properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage))
+			return false;
+	}
+
+	return true;
+}
+
+}
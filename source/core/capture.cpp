@@ -0,0 +1,422 @@
+#include <cstring>
+#include <fstream>
+
+#include <microlog/microlog.h>
+
+#include "core/capture.hpp"
+#include "core/pixel_formats.hpp"
+#include "core/profiler.hpp"
+
+namespace ivy {
+
+std::optional <ImageEncoding> encoding_from(const std::filesystem::path &path)
+{
+	std::string extension = path.extension().string();
+	if (extension == ".png")
+		return ImageEncoding::ePNG;
+	if (extension == ".qoi")
+		return ImageEncoding::eQOI;
+	if (extension == ".exr")
+		return ImageEncoding::eEXR;
+
+	return std::nullopt;
+}
+
+// QOI, see qoiformat.org; four channels, sRGB with linear alpha
+std::vector <uint8_t> encode_qoi(const uint8_t *pixels, uint32_t width, uint32_t height)
+{
+	std::vector <uint8_t> out;
+	out.reserve(14 + size_t(width) * height * 5 + 8);
+
+	auto u32 = [&](uint32_t value) {
+		out.push_back(value >> 24);
+		out.push_back(value >> 16);
+		out.push_back(value >> 8);
+		out.push_back(value);
+	};
+
+	out.insert(out.end(), { 'q', 'o', 'i', 'f' });
+	u32(width);
+	u32(height);
+	out.push_back(4);
+	out.push_back(0);
+
+	uint8_t index[64][4] = {};
+	uint8_t previous[4] = { 0, 0, 0, 255 };
+	uint32_t run = 0;
+
+	size_t count = size_t(width) * height;
+	for (size_t i = 0; i < count; i++) {
+		const uint8_t *px = &pixels[4 * i];
+
+		if (std::memcmp(px, previous, 4) == 0) {
+			run++;
+			if (run == 62 || i + 1 == count) {
+				out.push_back(0xc0 | (run - 1));
+				run = 0;
+			}
+
+			continue;
+		}
+
+		if (run > 0) {
+			out.push_back(0xc0 | (run - 1));
+			run = 0;
+		}
+
+		uint32_t hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+		if (std::memcmp(index[hash], px, 4) == 0) {
+			out.push_back(hash);
+		} else {
+			std::memcpy(index[hash], px, 4);
+
+			if (px[3] == previous[3]) {
+				int8_t dr = px[0] - previous[0];
+				int8_t dg = px[1] - previous[1];
+				int8_t db = px[2] - previous[2];
+				int8_t dr_dg = dr - dg;
+				int8_t db_dg = db - dg;
+
+				if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+					out.push_back(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+				} else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+					out.push_back(0x80 | (dg + 32));
+					out.push_back((dr_dg + 8) << 4 | (db_dg + 8));
+				} else {
+					out.insert(out.end(), { 0xfe, px[0], px[1], px[2] });
+				}
+			} else {
+				out.insert(out.end(), { 0xff, px[0], px[1], px[2], px[3] });
+			}
+		}
+
+		std::memcpy(previous, px, 4);
+	}
+
+	out.insert(out.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+
+	return out;
+}
+
+// OpenEXR, as uncompressed scanlines of half RGBA
+std::vector <uint8_t> encode_exr(const uint16_t *pixels, uint32_t width, uint32_t height)
+{
+	std::vector <uint8_t> out;
+
+	auto bytes = [&](const void *data, size_t size) {
+		const uint8_t *b = (const uint8_t *) data;
+		out.insert(out.end(), b, b + size);
+	};
+
+	auto i32 = [&](int32_t value) { bytes(&value, 4); };
+	auto f32 = [&](float value) { bytes(&value, 4); };
+	auto str = [&](const char *s) { bytes(s, std::strlen(s) + 1); };
+
+	auto attribute = [&](const char *name, const char *type, uint32_t size) {
+		str(name);
+		str(type);
+		i32(size);
+	};
+
+	// Channels are stored in alphabetical order
+	constexpr char channels[] = { 'A', 'B', 'G', 'R' };
+	constexpr uint32_t source[] = { 3, 2, 1, 0 };
+
+	i32(20000630);
+	i32(2);
+
+	attribute("channels", "chlist", 4 * 18 + 1);
+	for (char channel : channels) {
+		const char name[2] = { channel, 0 };
+		bytes(name, 2);
+		i32(1);		// Half
+		i32(0);		// Not linear, and reserved
+		i32(1);
+		i32(1);
+	}
+	out.push_back(0);
+
+	attribute("compression", "compression", 1);
+	out.push_back(0);
+
+	for (const char *window : { "dataWindow", "displayWindow" }) {
+		attribute(window, "box2i", 16);
+		i32(0);
+		i32(0);
+		i32(width - 1);
+		i32(height - 1);
+	}
+
+	attribute("lineOrder", "lineOrder", 1);
+	out.push_back(0);
+
+	attribute("pixelAspectRatio", "float", 4);
+	f32(1.0f);
+
+	attribute("screenWindowCenter", "v2f", 8);
+	f32(0.0f);
+	f32(0.0f);
+
+	attribute("screenWindowWidth", "float", 4);
+	f32(1.0f);
+
+	out.push_back(0);
+
+	// Offsets of each scanline, which follow the table
+	uint32_t line = 4 * width * sizeof(uint16_t);
+	uint64_t offset = out.size() + height * sizeof(uint64_t);
+	for (uint32_t y = 0; y < height; y++) {
+		bytes(&offset, 8);
+		offset += 8 + line;
+	}
+
+	std::vector <uint16_t> planar(4 * width);
+	for (uint32_t y = 0; y < height; y++) {
+		const uint16_t *row = &pixels[4 * size_t(width) * y];
+		for (uint32_t c = 0; c < 4; c++) {
+			for (uint32_t x = 0; x < width; x++)
+				planar[c * width + x] = row[4 * x + source[c]];
+		}
+
+		i32(y);
+		i32(line);
+		bytes(planar.data(), line);
+	}
+
+	return out;
+}
+
+static bool write_file(const std::filesystem::path &path, const std::vector <uint8_t> &data)
+{
+	std::ofstream file(path, std::ios::binary);
+	file.write((const char *) data.data(), data.size());
+	return bool(file);
+}
+
+static bool is_bgra(vk::Format format)
+{
+	return format == vk::Format::eB8G8R8A8Unorm || format == vk::Format::eB8G8R8A8Srgb;
+}
+
+static bool is_srgb(vk::Format format)
+{
+	return format == vk::Format::eR8G8B8A8Srgb || format == vk::Format::eB8G8R8A8Srgb;
+}
+
+// Runs on a worker
+static bool encode(const CaptureService::Slot &slot)
+{
+	IVY_PROFILE_SCOPE("CaptureService::encode");
+
+	uint32_t width = slot.extent.width;
+	uint32_t height = slot.extent.height;
+	size_t count = size_t(width) * height;
+
+	const uint8_t *mapped = (const uint8_t *) slot.buffer.allocation.mapped;
+
+	std::vector <uint8_t> rgba(4 * count);
+	if (is_bgra(slot.format))
+		swizzle_rgba8(mapped, rgba.data(), count, { 2, 1, 0, 3 });
+	else
+		std::memcpy(rgba.data(), mapped, rgba.size());
+
+	switch (slot.encoding) {
+	case ImageEncoding::ePNG:
+	{
+		// Rows start from the bottom for Texture::save
+		Texture texture {
+			.width = int(width),
+			.height = int(height),
+			.channels = 4,
+			.pixels = std::vector <uint8_t> (4 * count)
+		};
+
+		for (uint32_t y = 0; y < height; y++) {
+			std::memcpy(&texture.pixels[4 * size_t(width) * y],
+				&rgba[4 * size_t(width) * (height - 1 - y)], 4 * width);
+		}
+
+		return texture.save(slot.path);
+	}
+
+	case ImageEncoding::eQOI:
+		return write_file(slot.path, encode_qoi(rgba.data(), width, height));
+
+	case ImageEncoding::eEXR:
+	{
+		std::vector <uint16_t> halves(4 * count);
+		if (is_srgb(slot.format)) {
+			std::vector <float> linear(4 * count);
+			srgb_to_linear(rgba.data(), linear.data(), count, 4);
+			f32_to_f16(linear.data(), halves.data(), halves.size());
+		} else {
+			u8_to_f16(rgba.data(), halves.data(), halves.size());
+		}
+
+		return write_file(slot.path, encode_exr(halves.data(), width, height));
+	}
+
+	default:
+		break;
+	}
+
+	return false;
+}
+
+static std::shared_future <bool> resolved(bool value)
+{
+	std::promise <bool> promise;
+	promise.set_value(value);
+	return promise.get_future().share();
+}
+
+std::shared_future <bool> CaptureService::capture(const vk::CommandBuffer &cmd, const AllocatedImage &image,
+		vk::ImageLayout layout, const std::filesystem::path &path)
+{
+	IVY_PROFILE_SCOPE("CaptureService::capture");
+
+	bool rgba = image.format == vk::Format::eR8G8B8A8Unorm || image.format == vk::Format::eR8G8B8A8Srgb;
+	if (!rgba && !is_bgra(image.format)) {
+		ulog_error("capture", "unsupported format %s\n", vk::to_string(image.format).c_str());
+		return resolved(false);
+	}
+
+	std::optional <ImageEncoding> encoding = encoding_from(path);
+	if (!encoding) {
+		ulog_error("capture", "unknown image format for %s\n", path.c_str());
+		return resolved(false);
+	}
+
+	// Oldest captures are finished first if the ring is full
+	Slot *slot = nullptr;
+	while (!slot) {
+		poll();
+
+		for (auto &s : slots) {
+			if (!s->busy) {
+				slot = s.get();
+				break;
+			}
+		}
+
+		if (slot)
+			break;
+
+		Slot *oldest = nullptr;
+		for (auto &s : slots) {
+			if (!oldest || s->timeline < oldest->timeline)
+				oldest = s.get();
+		}
+
+		if (oldest->recorded) {
+			// Every slot was recorded into a frame that is not submitted yet
+			if (oldest->timeline > vrb->timeline_value) {
+				ulog_error("capture", "all %zu slots are taken by the current frame\n", slots.size());
+				return resolved(false);
+			}
+
+			vk::SemaphoreWaitInfo wait_info { {}, 1, &vrb->timeline, &oldest->timeline };
+			if (vrb->device.waitSemaphores(wait_info, UINT64_MAX) != vk::Result::eSuccess) {
+				ulog_error("capture", "failed to wait on the frame timeline\n");
+				return resolved(false);
+			}
+		} else if (oldest->job.valid()) {
+			oldest->job.wait();
+		}
+	}
+
+	vk::DeviceSize size = vk::DeviceSize(image.extent.width) * image.extent.height * 4;
+	if (slot->buffer.size < size) {
+		vrb->allocator->destroy(slot->buffer);
+		slot->buffer = vrb->allocator->buffer(size, vk::BufferUsageFlagBits::eTransferDst);
+	}
+
+	transition(cmd, image, layout, vk::ImageLayout::eTransferSrcOptimal);
+	copy_image_to_buffer(cmd, image, slot->buffer, vk::ImageLayout::eTransferSrcOptimal);
+
+	// Make the copy visible to the host once the frame is done
+	vk::MemoryBarrier readback { vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead };
+	cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+		vk::PipelineStageFlagBits::eHost,
+		{}, readback, {}, {});
+	transition(cmd, image, vk::ImageLayout::eTransferSrcOptimal, layout);
+
+	slot->busy = true;
+	slot->recorded = true;
+	slot->timeline = vrb->timeline_value + 1;
+	slot->extent = image.extent_2d();
+	slot->format = image.format;
+	slot->path = path;
+	slot->encoding = *encoding;
+	slot->done = std::make_shared <std::promise <bool>> ();
+	slot->job = {};
+
+	captured++;
+
+	return slot->done->get_future().share();
+}
+
+void CaptureService::poll()
+{
+	uint64_t value = vrb->device.getSemaphoreCounterValue(vrb->timeline);
+
+	for (auto &s : slots) {
+		if (!s->recorded || s->timeline > value)
+			continue;
+
+		s->recorded = false;
+
+		Slot *slot = s.get();
+		s->job = vrb->workers->submit([slot]() {
+			bool success = encode(*slot);
+			if (!success)
+				ulog_error("capture", "failed to write %s\n", slot->path.c_str());
+
+			auto done = slot->done;
+			slot->busy = false;
+			done->set_value(success);
+		});
+	}
+}
+
+void CaptureService::flush()
+{
+	for (auto &s : slots) {
+		if (s->recorded) {
+			vk::SemaphoreWaitInfo wait_info { {}, 1, &vrb->timeline, &s->timeline };
+			if (vrb->device.waitSemaphores(wait_info, UINT64_MAX) != vk::Result::eSuccess)
+				ulog_error("capture", "failed to wait on the frame timeline\n");
+		}
+	}
+
+	poll();
+
+	for (auto &s : slots) {
+		if (s->job.valid())
+			s->job.wait();
+	}
+}
+
+void CaptureService::destroy()
+{
+	flush();
+
+	for (auto &s : slots)
+		vrb->allocator->destroy(s->buffer);
+
+	slots.clear();
+}
+
+CaptureService *CaptureService::from(VulkanResourceBase &vrb)
+{
+	CaptureService *service = new CaptureService();
+	service->vrb = &vrb;
+
+	// Buffers are allocated on first use, sized for the image
+	for (uint32_t i = 0; i < ring_size; i++)
+		service->slots.push_back(std::make_unique <Slot> ());
+
+	return service;
+}
+
+}
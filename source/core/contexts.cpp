@@ -1,20 +1,32 @@
+#include <algorithm>
+#include <cstring>
+
 #include <imgui/imgui.h>
 #include <imgui/backends/imgui_impl_glfw.h>
 #include <imgui/backends/imgui_impl_vulkan.h>
 
+#include <microlog/microlog.h>
+
 #include "core/contexts.hpp"
+#include "core/profiler.hpp"
 
-VulkanResourceBase VulkanResourceBase::from(const vk::PhysicalDevice &phdev, const std::vector <const char *> &extensions, const vk::PhysicalDeviceFeatures2KHR &features)
-{
-	VulkanResourceBase drc;
+// Per frame scratch memory for uploads and uniforms
+static constexpr vk::DeviceSize TRANSIENT_BUFFER_SIZE = 4 << 20;
 
-	// TODO: option for headless, null swapchain etc
-	drc.skeletonize(phdev, { 1920, 1080 }, "IVY", extensions, features);
+// Offscreen targets in headless mode
+static constexpr vk::Format OFFSCREEN_FORMAT = vk::Format::eR8G8B8A8Unorm;
+static constexpr uint32_t OFFSCREEN_IMAGES = 3;
 
+// Everything after device creation, shared by windowed and headless modes
+static void initialize(VulkanResourceBase &drc, const vk::PhysicalDevice &phdev, uint32_t frames_in_flight)
+{
 	drc.phdev = phdev;
 	drc.memory_properties = phdev.getMemoryProperties();
 	drc.dal = new littlevk::Deallocator(drc.device);
-	drc.sync = littlevk::present_syncronization(drc.device, 2).unwrap(drc.dal);
+	drc.allocator = ivy::DeviceMemoryAllocator::from(drc.device, drc.memory_properties);
+	drc.pipeline_cache = ivy::load_pipeline_cache(drc.device, phdev);
+	drc.workers = ivy::ThreadPool::from();
+	drc.pipeline_service = ivy::PipelineService::from(drc.device, phdev, drc.pipeline_cache, drc.workers);
 
 	// Allocate command buffers
 	drc.command_pool = littlevk::command_pool
@@ -26,66 +38,366 @@ VulkanResourceBase VulkanResourceBase::from(const vk::PhysicalDevice &phdev, con
 		}
 	).unwrap(drc.dal);
 
-	drc.command_buffers = drc.device.allocateCommandBuffers({
-		drc.command_pool,
-		vk::CommandBufferLevel::ePrimary, 2
-	});
+	// Timeline for pacing the frames in flight
+	vk::SemaphoreTypeCreateInfo timeline_info { vk::SemaphoreType::eTimeline, 0 };
+
+	vk::SemaphoreCreateInfo semaphore_info;
+	semaphore_info.pNext = &timeline_info;
+
+	drc.timeline = drc.device.createSemaphore(semaphore_info);
+	drc.deletion_queue = ivy::DeletionQueue::from(drc.device, drc.allocator, frames_in_flight + 1);
+	drc.gpu_profiler = ivy::GpuProfiler::from(drc.device, phdev);
+	drc.configure_frames(frames_in_flight);
 
 	// Allocate descriptor pool
-	vk::DescriptorPoolSize pool_size {
-		vk::DescriptorType::eCombinedImageSampler, 1 << 10
-	};
+	std::array <vk::DescriptorPoolSize, 4> pool_sizes {{
+		{ vk::DescriptorType::eCombinedImageSampler, 1 << 10 },
+		{ vk::DescriptorType::eInputAttachment, 1 << 8 },
+		{ vk::DescriptorType::eStorageImage, 1 << 6 },
+		{ vk::DescriptorType::eStorageBuffer, 1 << 6 }
+	}};
 
+	// Sets can be freed individually through the deletion queue
 	drc.descriptor_pool = littlevk::descriptor_pool(
 		drc.device, vk::DescriptorPoolCreateInfo {
-			{}, 1 << 10, pool_size
+			vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
+			1 << 10, pool_sizes
 		}
 	).unwrap(drc.dal);
+}
+
+VulkanResourceBase VulkanResourceBase::from(const vk::PhysicalDevice &phdev, const std::vector <const char *> &extensions,
+		const vk::PhysicalDeviceFeatures2KHR &features, uint32_t frames_in_flight)
+{
+	VulkanResourceBase drc;
+
+	drc.skeletonize(phdev, { 1920, 1080 }, "IVY", extensions, features);
+	initialize(drc, phdev, frames_in_flight);
 
 	return drc;
 }
 
-std::optional <std::pair <vk::CommandBuffer, littlevk::SurfaceOperation>> VulkanResourceBase::new_frame(size_t frame)
+VulkanResourceBase VulkanResourceBase::headless_from(const vk::Instance &instance, const vk::PhysicalDevice &phdev,
+		const std::vector <const char *> &extensions, const vk::PhysicalDeviceFeatures2KHR &features,
+		const vk::Extent2D &extent, uint32_t frames_in_flight)
 {
-	// Get next image
-	littlevk::SurfaceOperation op;
-	op = littlevk::acquire_image(device, swapchain.swapchain, sync[frame]);
-	if (op.status == littlevk::SurfaceOperation::eResize) {
-		resize();
+	VulkanResourceBase drc;
+	drc.headless = true;
+	drc.instance = instance;
+
+	// Single queue for both graphics and "presentation"
+	uint32_t family = littlevk::find_graphics_queue_family(phdev);
+	float priority = 1.0f;
+
+	vk::DeviceQueueCreateInfo queue_info { {}, family, 1, &priority };
+
+	vk::DeviceCreateInfo device_info { {}, queue_info, {}, extensions };
+	device_info.pNext = &features;
+
+	drc.device = phdev.createDevice(device_info);
+	drc.graphics_queue = drc.device.getQueue(family, 0);
+	drc.present_queue = drc.graphics_queue;
+
+	initialize(drc, phdev, frames_in_flight);
+
+	// Offscreen images stand in for the swapchain
+	drc.offscreen_extent = extent;
+	drc.swapchain.format = OFFSCREEN_FORMAT;
+
+	for (uint32_t i = 0; i < OFFSCREEN_IMAGES; i++) {
+		ivy::AllocatedImage image = drc.allocator->image(extent, OFFSCREEN_FORMAT,
+			vk::ImageUsageFlagBits::eColorAttachment
+			| vk::ImageUsageFlagBits::eSampled
+			| vk::ImageUsageFlagBits::eTransferSrc,
+			vk::ImageAspectFlagBits::eColor);
+
+		drc.offscreen.push_back(image);
+		drc.swapchain.images.push_back(image.image);
+		drc.swapchain.image_views.push_back(image.view);
+	}
+
+	return drc;
+}
+
+// Copies an image back to the host, after all submitted frames
+ivy::Texture VulkanResourceBase::readback(const ivy::AllocatedImage &image, vk::ImageLayout layout)
+{
+	vk::SemaphoreWaitInfo wait_info { {}, 1, &timeline, &timeline_value };
+	if (device.waitSemaphores(wait_info, UINT64_MAX) != vk::Result::eSuccess)
+		ulog_error("readback", "failed to wait on the frame timeline\n");
+
+	bool rgba = image.format == vk::Format::eR8G8B8A8Unorm || image.format == vk::Format::eR8G8B8A8Srgb;
+	bool bgra = image.format == vk::Format::eB8G8R8A8Unorm || image.format == vk::Format::eB8G8R8A8Srgb;
+	if (!rgba && !bgra) {
+		ulog_error("readback", "unsupported format %s\n", vk::to_string(image.format).c_str());
+		return ivy::Texture::blank();
+	}
+
+	uint32_t width = image.extent.width;
+	uint32_t height = image.extent.height;
+
+	ivy::AllocatedBuffer staging = allocator->buffer(width * height * 4, vk::BufferUsageFlagBits::eTransferDst);
+
+	littlevk::submit_now(device, command_pool, graphics_queue,
+		[&](const vk::CommandBuffer &cmd) {
+			ivy::transition(cmd, image, layout, vk::ImageLayout::eTransferSrcOptimal);
+			ivy::copy_image_to_buffer(cmd, image, staging, vk::ImageLayout::eTransferSrcOptimal);
+			ivy::transition(cmd, image, vk::ImageLayout::eTransferSrcOptimal, layout);
+		}
+	);
+
+	ivy::Texture texture {
+		.width = int(width),
+		.height = int(height),
+		.channels = 4,
+		.pixels = std::vector <uint8_t> (width * height * 4)
+	};
+
+	// Rows are flipped to match loaded textures, which start at the bottom
+	const uint8_t *source = (const uint8_t *) staging.allocation.mapped;
+	for (uint32_t y = 0; y < height; y++) {
+		const uint8_t *row = source + (height - 1 - y) * width * 4;
+		uint8_t *destination = texture.pixels.data() + y * width * 4;
+		std::memcpy(destination, row, width * 4);
+
+		if (bgra) {
+			for (uint32_t x = 0; x < width; x++)
+				std::swap(destination[4 * x], destination[4 * x + 2]);
+		}
+	}
+
+	allocator->destroy(staging);
+
+	return texture;
+}
+
+// Replaces the frame contexts; nothing may be in flight
+void VulkanResourceBase::configure_frames(uint32_t count)
+{
+	if (!frames.empty()) {
+		wait_idle();
+		release_frames();
+	}
+
+	// One bucket for each frame in flight, and the one being recorded
+	deletion_queue->resize(count + 1);
+	gpu_profiler->resize(count);
+
+	std::vector <vk::CommandBuffer> cmds = device.allocateCommandBuffers({
+		command_pool,
+		vk::CommandBufferLevel::ePrimary, count
+	});
+
+	for (uint32_t i = 0; i < count; i++) {
+		ivy::FrameContext fc;
+		fc.cmd = cmds[i];
+		fc.image_available = device.createSemaphore({});
+		fc.timeline = timeline_value;
+		fc.transient.buffer = allocator->buffer(TRANSIENT_BUFFER_SIZE,
+			vk::BufferUsageFlagBits::eTransferSrc
+			| vk::BufferUsageFlagBits::eUniformBuffer
+			| vk::BufferUsageFlagBits::eStorageBuffer);
+
+		frames.push_back(fc);
+	}
+
+	frames_in_flight = count;
+	frame = 0;
+}
+
+void VulkanResourceBase::release_frames()
+{
+	for (ivy::FrameContext &fc : frames) {
+		device.freeCommandBuffers(command_pool, fc.cmd);
+		device.destroySemaphore(fc.image_available);
+		allocator->destroy(fc.transient.buffer);
+	}
+
+	for (vk::Semaphore semaphore : render_finished)
+		device.destroySemaphore(semaphore);
+
+	frames.clear();
+	render_finished.clear();
+}
+
+// Waits for the device and releases everything that was retired
+void VulkanResourceBase::wait_idle()
+{
+	device.waitIdle();
+	deletion_queue->flush();
+}
+
+bool VulkanResourceBase::configure_present_mode(ivy::PresentMode mode)
+{
+	if (headless) {
+		ulog_warning("present mode", "nothing is presented in headless mode\n");
+		return false;
+	}
+
+	vk::PresentModeKHR pm = ivy::translate(mode);
+
+	auto modes = phdev.getSurfacePresentModesKHR(surface);
+	if (std::find(modes.begin(), modes.end(), pm) == modes.end()) {
+		ulog_warning("present mode", "%s is not supported by the surface\n", vk::to_string(pm).c_str());
+		return false;
+	}
+
+	wait_idle();
+
+	present_mode = mode;
+	swapchain.info.presentMode = pm;
+	resize();
+
+	return true;
+}
+
+ivy::FrameContext &VulkanResourceBase::current_frame()
+{
+	return frames[frame];
+}
+
+void VulkanResourceBase::defer(std::function <void ()> &&ftn)
+{
+	deletion_queue->push(timeline_value + 1, std::move(ftn));
+}
+
+std::optional <std::pair <vk::CommandBuffer, littlevk::SurfaceOperation>> VulkanResourceBase::new_frame()
+{
+	IVY_PROFILE_SCOPE("VulkanResourceBase::new_frame");
+
+	// Apply any configuration changes between frames
+	if (requested.frames_in_flight || requested.present_mode) {
+		if (requested.frames_in_flight && *requested.frames_in_flight != frames_in_flight)
+			configure_frames(*requested.frames_in_flight);
+
+		if (requested.present_mode && *requested.present_mode != present_mode)
+			configure_present_mode(*requested.present_mode);
+
+		requested.frames_in_flight.reset();
+		requested.present_mode.reset();
 		return std::nullopt;
 	}
 
-	vk::CommandBuffer cmd = command_buffers[frame];
-	cmd.begin(vk::CommandBufferBeginInfo {});
+	ivy::FrameContext &fc = frames[frame];
+
+	// Wait for the last submission of this frame, then release what
+	// has been retired up to that point
+	vk::SemaphoreWaitInfo wait_info { {}, 1, &timeline, &fc.timeline };
+	{
+		IVY_PROFILE_SCOPE("VulkanResourceBase::new_frame: wait");
+		if (device.waitSemaphores(wait_info, UINT64_MAX) != vk::Result::eSuccess)
+			ulog_error("new_frame", "failed to wait on the frame timeline\n");
+	}
+
+	deletion_queue->collect(device.getSemaphoreCounterValue(timeline));
+	fc.transient.reset();
 
-	littlevk::viewport_and_scissor(cmd, littlevk::RenderArea(window));
+	// Get next image
+	uint32_t index = 0;
+
+	if (headless) {
+		index = offscreen_index;
+		offscreen_index = (offscreen_index + 1) % offscreen.size();
+	} else {
+		try {
+			index = device.acquireNextImageKHR(swapchain.swapchain, UINT64_MAX, fc.image_available, nullptr).value;
+		} catch (vk::OutOfDateKHRError &) {
+			resize();
+			return std::nullopt;
+		}
+
+		// Recreating the swapchain may change the number of images
+		while (render_finished.size() < swapchain.images.size())
+			render_finished.push_back(device.createSemaphore({}));
+	}
+
+	image_index = index;
+
+	littlevk::SurfaceOperation op;
+	op.status = littlevk::SurfaceOperation::eOk;
+	op.index = index;
+
+	fc.cmd.begin(vk::CommandBufferBeginInfo {});
+
+	// Queries of this frame have completed by now
+	gpu_profiler->begin_frame(fc.cmd, frame);
+
+	if (headless)
+		littlevk::viewport_and_scissor(fc.cmd, offscreen_extent);
+	else
+		littlevk::viewport_and_scissor(fc.cmd, littlevk::RenderArea(window));
 
 	// Record command buffer
-	return std::make_pair(cmd, op);
+	return std::make_pair(fc.cmd, op);
 }
 
-void VulkanResourceBase::end_frame(const vk::CommandBuffer &cmd, size_t frame) const
+void VulkanResourceBase::end_frame(const vk::CommandBuffer &cmd)
 {
+	IVY_PROFILE_SCOPE("VulkanResourceBase::end_frame");
+
+	ivy::FrameContext &fc = frames[frame];
+
+	gpu_profiler->end_frame(cmd);
 	cmd.end();
 
-	// Submit command buffer while signaling the semaphore
-	// TODO: littlevk shortcut for this...
+	fc.timeline = ++timeline_value;
+
+	// Binary semaphores for the swapchain, and the timeline for pacing;
+	// the values for binary semaphores are ignored, and headless frames
+	// only signal the timeline
+	vk::Semaphore finished = headless ? vk::Semaphore() : render_finished[image_index];
+
+	std::array <vk::Semaphore, 2> signals { finished, timeline };
+	std::array <uint64_t, 2> signal_values { 0, fc.timeline };
+	uint64_t wait_value = 0;
+
+	uint32_t waits = headless ? 0 : 1;
+	uint32_t skip = headless ? 1 : 0;
+
+	vk::TimelineSemaphoreSubmitInfo timeline_info {
+		waits, &wait_value,
+		2 - skip, signal_values.data() + skip
+	};
+
 	vk::PipelineStageFlags wait_stage = vk::PipelineStageFlagBits::eColorAttachmentOutput;
 
 	vk::SubmitInfo submit_info {
-		1, &sync.image_available[frame],
+		waits, &fc.image_available,
 		&wait_stage,
 		1, &cmd,
-		1, &sync.render_finished[frame]
+		2 - skip, signals.data() + skip
 	};
 
-	graphics_queue.submit(submit_info, sync.in_flight[frame]);
+	submit_info.pNext = &timeline_info;
+
+	graphics_queue.submit(submit_info);
 }
 
-littlevk::SurfaceOperation VulkanResourceBase::present_frame(const littlevk::SurfaceOperation &op, size_t frame)
+littlevk::SurfaceOperation VulkanResourceBase::present_frame(const littlevk::SurfaceOperation &op)
 {
+	IVY_PROFILE_SCOPE("VulkanResourceBase::present_frame");
+
+	frame = (frame + 1) % frames_in_flight;
+
+	if (headless)
+		return op;
+
 	// Send image to the screen
-	littlevk::SurfaceOperation pop = littlevk::present_image(present_queue, swapchain.swapchain, sync[frame], op.index);
+	littlevk::SurfaceOperation pop = op;
+
+	vk::PresentInfoKHR present_info {
+		1, &render_finished[op.index],
+		1, &swapchain.swapchain,
+		&op.index
+	};
+
+	try {
+		if (present_queue.presentKHR(present_info) == vk::Result::eSuboptimalKHR)
+			pop.status = littlevk::SurfaceOperation::eResize;
+	} catch (vk::OutOfDateKHRError &) {
+		pop.status = littlevk::SurfaceOperation::eResize;
+	}
+
 	if (pop.status == littlevk::SurfaceOperation::eResize)
 		resize();
 
@@ -94,9 +406,18 @@ littlevk::SurfaceOperation VulkanResourceBase::present_frame(const littlevk::Sur
 
 bool VulkanResourceBase::valid_window() const
 {
+	// Headless runs decide for themselves when to stop
+	if (headless)
+		return true;
+
 	return glfwWindowShouldClose(window->handle) == 0;
 }
 
+void VulkanResourceBase::save_pipeline_cache() const
+{
+	ivy::save_pipeline_cache(device, phdev, pipeline_cache);
+}
+
 // ImGui configureation
 void imgui_context_from(const VulkanResourceBase &drc, const vk::RenderPass &render_pass)
 {
@@ -0,0 +1,121 @@
+#include <algorithm>
+
+#include "core/deletion_queue.hpp"
+
+namespace ivy {
+
+size_t DeletionQueue::Bucket::size() const
+{
+	return buffers.size() + images.size()
+		+ pipelines.size() + framebuffers.size()
+		+ descriptor_sets.size() + callbacks.size();
+}
+
+// Buckets may be shared between values if the ring wraps around before
+// collection; the later value is kept, which only delays the release
+DeletionQueue::Bucket &DeletionQueue::bucket(uint64_t value)
+{
+	Bucket &b = buckets[value % buckets.size()];
+	b.value = std::max(b.value, value);
+	return b;
+}
+
+void DeletionQueue::push(uint64_t value, const AllocatedBuffer &buffer)
+{
+	bucket(value).buffers.push_back(buffer);
+}
+
+void DeletionQueue::push(uint64_t value, const AllocatedImage &image)
+{
+	bucket(value).images.push_back(image);
+}
+
+void DeletionQueue::push(uint64_t value, const vk::Pipeline &pipeline)
+{
+	bucket(value).pipelines.push_back(pipeline);
+}
+
+void DeletionQueue::push(uint64_t value, const vk::Framebuffer &framebuffer)
+{
+	bucket(value).framebuffers.push_back(framebuffer);
+}
+
+void DeletionQueue::push(uint64_t value, const vk::DescriptorPool &pool, const vk::DescriptorSet &dset)
+{
+	bucket(value).descriptor_sets.emplace_back(pool, dset);
+}
+
+void DeletionQueue::push(uint64_t value, std::function <void ()> &&callback)
+{
+	bucket(value).callbacks.emplace_back(std::move(callback));
+}
+
+void DeletionQueue::release(Bucket &b)
+{
+	for (const vk::Framebuffer &framebuffer : b.framebuffers)
+		device.destroyFramebuffer(framebuffer);
+
+	for (const vk::Pipeline &pipeline : b.pipelines)
+		device.destroyPipeline(pipeline);
+
+	for (const auto &[pool, dset] : b.descriptor_sets)
+		device.freeDescriptorSets(pool, dset);
+
+	for (AllocatedImage &image : b.images)
+		allocator->destroy(image);
+
+	for (AllocatedBuffer &buffer : b.buffers)
+		allocator->destroy(buffer);
+
+	// Last, since these may destroy the pools and layouts of the above
+	for (std::function <void ()> &callback : b.callbacks)
+		callback();
+
+	// Keep the capacity for the next time around
+	b.callbacks.clear();
+	b.framebuffers.clear();
+	b.pipelines.clear();
+	b.descriptor_sets.clear();
+	b.images.clear();
+	b.buffers.clear();
+}
+
+void DeletionQueue::collect(uint64_t completed)
+{
+	for (Bucket &b : buckets) {
+		if (b.value <= completed)
+			release(b);
+	}
+}
+
+void DeletionQueue::flush()
+{
+	for (Bucket &b : buckets)
+		release(b);
+}
+
+void DeletionQueue::resize(size_t count)
+{
+	flush();
+	buckets.resize(count);
+}
+
+size_t DeletionQueue::pending() const
+{
+	size_t total = 0;
+	for (const Bucket &b : buckets)
+		total += b.size();
+
+	return total;
+}
+
+DeletionQueue *DeletionQueue::from(const vk::Device &device, DeviceMemoryAllocator *allocator, size_t count)
+{
+	DeletionQueue *queue = new DeletionQueue();
+	queue->device = device;
+	queue->allocator = allocator;
+	queue->buckets.resize(count);
+	return queue;
+}
+
+}
@@ -0,0 +1,68 @@
+#include <fstream>
+#include <thread>
+
+#include <microlog/microlog.h>
+
+#include "core/disk_cache.hpp"
+#include "core/hash.hpp"
+#include "paths.hpp"
+
+namespace ivy {
+
+std::filesystem::path cache_path(const std::string &category, const std::string &key)
+{
+	return std::filesystem::path(IVY_CACHE) / category / key;
+}
+
+std::optional <std::vector <uint8_t>> read_cache(const std::string &category, const std::string &key)
+{
+	std::filesystem::path path = cache_path(category, key);
+
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file)
+		return std::nullopt;
+
+	std::vector <uint8_t> data(file.tellg());
+	file.seekg(0);
+	file.read((char *) data.data(), data.size());
+	if (!file)
+		return std::nullopt;
+
+	return data;
+}
+
+bool write_cache(const std::string &category, const std::string &key, const void *data, size_t size)
+{
+	std::filesystem::path path = cache_path(category, key);
+
+	std::error_code error;
+	std::filesystem::create_directories(path.parent_path(), error);
+	if (error) {
+		ulog_warning("disk cache", "failed to create %s: %s\n", path.parent_path().c_str(), error.message().c_str());
+		return false;
+	}
+
+	// Write to a unique temporary first, then move into place
+	size_t tid = std::hash <std::thread::id> {} (std::this_thread::get_id());
+	std::filesystem::path temporary = path;
+	temporary += "." + hash_hex(tid) + ".tmp";
+
+	{
+		std::ofstream file(temporary, std::ios::binary);
+		file.write((const char *) data, size);
+		if (!file) {
+			ulog_warning("disk cache", "failed to write %s\n", temporary.c_str());
+			return false;
+		}
+	}
+
+	std::filesystem::rename(temporary, path, error);
+	if (error) {
+		std::filesystem::remove(temporary, error);
+		return false;
+	}
+
+	return true;
+}
+
+}
@@ -0,0 +1,306 @@
+#include <cmath>
+#include <cstring>
+
+#include <glm/gtc/constants.hpp>
+
+#include <microlog/microlog.h>
+
+#include "core/disk_cache.hpp"
+#include "core/environment_map.hpp"
+#include "core/hash.hpp"
+#include "core/mapped_file.hpp"
+#include "core/pixel_formats.hpp"
+#include "core/profiler.hpp"
+#include "paths.hpp"
+
+namespace ivy {
+
+// Bump whenever the prefiltering changes
+static constexpr uint32_t ENVIRONMENT_VERSION = 1;
+static constexpr uint32_t ENVIRONMENT_MAGIC = 0x766e6569; // "ienv"
+
+static constexpr vk::Format ENVIRONMENT_FORMAT = vk::Format::eR16G16B16A16Sfloat;
+
+struct EnvironmentHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t face_size;
+	uint32_t levels;
+};
+
+struct PrefilterConstants {
+	uint32_t size;
+	float roughness;
+	uint32_t samples;
+	float source_solid_angle;
+};
+
+static constexpr auto prefilter_dslbs = std::array <vk::DescriptorSetLayoutBinding, 2> {{
+	{ 0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute },
+	{ 1, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute }
+}};
+
+uint64_t hash_file(const std::filesystem::path &path)
+{
+	std::optional <MappedFile> file = MappedFile::from(path);
+	if (!file)
+		return 0;
+
+	return hash_bytes(file->data, file->size);
+}
+
+// All six faces of a level, tightly packed
+static vk::DeviceSize level_size(uint32_t level)
+{
+	vk::DeviceSize size = EnvironmentMap::face_size >> level;
+	return 6 * size * size * 4 * sizeof(uint16_t);
+}
+
+static vk::DeviceSize cubemap_size()
+{
+	vk::DeviceSize total = 0;
+	for (uint32_t level = 0; level < EnvironmentMap::levels; level++)
+		total += level_size(level);
+
+	return total;
+}
+
+static AllocatedImage allocate_cubemap(DeviceMemoryAllocator *allocator, vk::ImageUsageFlags usage)
+{
+	vk::ImageCreateInfo info {
+		vk::ImageCreateFlagBits::eCubeCompatible,
+		vk::ImageType::e2D, ENVIRONMENT_FORMAT,
+		vk::Extent3D { EnvironmentMap::face_size, EnvironmentMap::face_size, 1 },
+		EnvironmentMap::levels, 6, vk::SampleCountFlagBits::e1,
+		vk::ImageTiling::eOptimal, usage,
+		vk::SharingMode::eExclusive, {},
+		vk::ImageLayout::eUndefined
+	};
+
+	return allocator->image(info, vk::ImageViewType::eCube, vk::ImageAspectFlagBits::eColor);
+}
+
+static void upload_cached(VulkanResourceBase &vrb, EnvironmentMap &map, const std::vector <uint8_t> &blob)
+{
+	map.cubemap = allocate_cubemap(vrb.allocator,
+		vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst);
+
+	vk::DeviceSize size = blob.size() - sizeof(EnvironmentHeader);
+
+	AllocatedBuffer staging = vrb.allocator->buffer(size, vk::BufferUsageFlagBits::eTransferSrc);
+	vrb.allocator->upload(staging, blob.data() + sizeof(EnvironmentHeader), size);
+
+	littlevk::submit_now(vrb.device, vrb.command_pool, vrb.graphics_queue,
+		[&](const vk::CommandBuffer &cmd) {
+			transition(cmd, map.cubemap, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal);
+
+			vk::DeviceSize offset = 0;
+			for (uint32_t level = 0; level < EnvironmentMap::levels; level++) {
+				copy_buffer_to_image(cmd, map.cubemap, staging, vk::ImageLayout::eTransferDstOptimal, level, offset);
+				offset += level_size(level);
+			}
+
+			transition(cmd, map.cubemap, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
+		}
+	);
+
+	vrb.allocator->destroy(staging);
+}
+
+// Returns the contents for the disk cache
+static std::vector <uint8_t> prefilter(VulkanResourceBase &vrb, EnvironmentMap &map, const HDRTexture &source)
+{
+	IVY_PROFILE_SCOPE("EnvironmentMap::prefilter");
+
+	// Equirectangular source, converted to half floats
+	std::vector <uint16_t> halves(source.pixels.size());
+	f32_to_f16(source.pixels.data(), halves.data(), halves.size());
+
+	uint32_t mips = std::floor(std::log2(std::max(source.width, source.height))) + 1;
+
+	vk::ImageCreateInfo source_info {
+		{}, vk::ImageType::e2D, ENVIRONMENT_FORMAT,
+		vk::Extent3D { uint32_t(source.width), uint32_t(source.height), 1 },
+		mips, 1, vk::SampleCountFlagBits::e1,
+		vk::ImageTiling::eOptimal,
+		vk::ImageUsageFlagBits::eSampled
+			| vk::ImageUsageFlagBits::eTransferSrc
+			| vk::ImageUsageFlagBits::eTransferDst,
+		vk::SharingMode::eExclusive, {},
+		vk::ImageLayout::eUndefined
+	};
+
+	AllocatedImage equirectangular = vrb.allocator->image(source_info,
+		vk::ImageViewType::e2D, vk::ImageAspectFlagBits::eColor);
+
+	AllocatedBuffer staging = vrb.allocator->buffer(halves, vk::BufferUsageFlagBits::eTransferSrc);
+	AllocatedBuffer readback = vrb.allocator->buffer(cubemap_size(), vk::BufferUsageFlagBits::eTransferDst);
+
+	map.cubemap = allocate_cubemap(vrb.allocator,
+		vk::ImageUsageFlagBits::eSampled
+		| vk::ImageUsageFlagBits::eStorage
+		| vk::ImageUsageFlagBits::eTransferSrc);
+
+	// Wraps around in longitude only
+	vk::SamplerCreateInfo sampler_info;
+	sampler_info.magFilter = vk::Filter::eLinear;
+	sampler_info.minFilter = vk::Filter::eLinear;
+	sampler_info.mipmapMode = vk::SamplerMipmapMode::eLinear;
+	sampler_info.addressModeU = vk::SamplerAddressMode::eRepeat;
+	sampler_info.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+	sampler_info.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+	sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+
+	vk::Sampler sampler = vrb.device.createSampler(sampler_info);
+
+	// Compute pipeline, writing one level at a time
+	vk::DescriptorSetLayout dsl = create_descriptor_set_layout(vrb.device, { prefilter_dslbs.begin(), prefilter_dslbs.end() });
+
+	vk::PushConstantRange push_constants { vk::ShaderStageFlagBits::eCompute, 0, sizeof(PrefilterConstants) };
+	vk::PipelineLayout layout = create_pipeline_layout(vrb.device, { dsl }, { push_constants });
+
+	ShaderSource shader {
+		standalone::readfile(IVY_SHADERS "/prefilter.comp"),
+		vk::ShaderStageFlagBits::eCompute
+	};
+
+	vk::Pipeline pipeline = create_compute_pipeline(vrb.device, shader, layout, vrb.pipeline_cache);
+
+	std::vector <vk::DescriptorSetLayout> dsls(EnvironmentMap::levels, dsl);
+	std::vector <vk::DescriptorSet> dsets = vrb.device.allocateDescriptorSets(
+		vk::DescriptorSetAllocateInfo { vrb.descriptor_pool, dsls });
+
+	std::vector <vk::ImageView> views;
+	for (uint32_t level = 0; level < EnvironmentMap::levels; level++) {
+		views.push_back(vrb.device.createImageView(vk::ImageViewCreateInfo {
+			{}, map.cubemap.image, vk::ImageViewType::e2DArray, ENVIRONMENT_FORMAT, {},
+			vk::ImageSubresourceRange { vk::ImageAspectFlagBits::eColor, level, 1, 0, 6 }
+		}));
+
+		vk::DescriptorImageInfo source_image { sampler, equirectangular.view, vk::ImageLayout::eShaderReadOnlyOptimal };
+		vk::DescriptorImageInfo target_image { {}, views.back(), vk::ImageLayout::eGeneral };
+
+		std::array <vk::WriteDescriptorSet, 2> writes {{
+			{ dsets[level], 0, 0, 1, vk::DescriptorType::eCombinedImageSampler, &source_image },
+			{ dsets[level], 1, 0, 1, vk::DescriptorType::eStorageImage, &target_image }
+		}};
+
+		vrb.device.updateDescriptorSets(writes, {});
+	}
+
+	littlevk::submit_now(vrb.device, vrb.command_pool, vrb.graphics_queue,
+		[&](const vk::CommandBuffer &cmd) {
+			transition(cmd, equirectangular, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal);
+			copy_buffer_to_image(cmd, equirectangular, staging, vk::ImageLayout::eTransferDstOptimal);
+			// Box filtered mips of the source, for filtered importance sampling
+			generate_mips(cmd, equirectangular);
+
+			transition(cmd, map.cubemap, vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral);
+
+			cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+
+			for (uint32_t level = 0; level < EnvironmentMap::levels; level++) {
+				PrefilterConstants constants;
+				constants.size = EnvironmentMap::face_size >> level;
+				constants.roughness = map.roughness(level);
+				constants.samples = (level == 0) ? 1 : EnvironmentMap::samples;
+				constants.source_solid_angle = 2.0f * glm::pi <float> () * glm::pi <float> ()
+					/ float(source.width * source.height);
+
+				cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, layout, 0, dsets[level], {});
+				cmd.pushConstants <PrefilterConstants> (layout, vk::ShaderStageFlagBits::eCompute, 0, constants);
+
+				uint32_t groups = (constants.size + 7)/8;
+				cmd.dispatch(groups, groups, 6);
+			}
+
+			// Read back every level for the disk cache
+			transition(cmd, map.cubemap, vk::ImageLayout::eGeneral, vk::ImageLayout::eTransferSrcOptimal);
+
+			vk::DeviceSize offset = 0;
+			for (uint32_t level = 0; level < EnvironmentMap::levels; level++) {
+				copy_image_to_buffer(cmd, map.cubemap, readback, vk::ImageLayout::eTransferSrcOptimal, level, offset);
+				offset += level_size(level);
+			}
+
+			transition(cmd, map.cubemap, vk::ImageLayout::eTransferSrcOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
+		}
+	);
+
+	EnvironmentHeader header {
+		.magic = ENVIRONMENT_MAGIC,
+		.version = ENVIRONMENT_VERSION,
+		.face_size = EnvironmentMap::face_size,
+		.levels = EnvironmentMap::levels
+	};
+
+	std::vector <uint8_t> blob(sizeof(header) + cubemap_size());
+	std::memcpy(blob.data(), &header, sizeof(header));
+	std::memcpy(blob.data() + sizeof(header), readback.allocation.mapped, cubemap_size());
+
+	// Free interim data
+	for (const vk::ImageView &view : views)
+		vrb.device.destroyImageView(view);
+
+	vrb.device.freeDescriptorSets(vrb.descriptor_pool, dsets);
+	vrb.device.destroyPipeline(pipeline);
+	vrb.device.destroyPipelineLayout(layout);
+	vrb.device.destroyDescriptorSetLayout(dsl);
+	vrb.device.destroySampler(sampler);
+
+	vrb.allocator->destroy(staging);
+	vrb.allocator->destroy(readback);
+	vrb.allocator->destroy(equirectangular);
+
+	return blob;
+}
+
+EnvironmentMap EnvironmentMap::from(VulkanResourceBase &vrb, const std::filesystem::path &path)
+{
+	IVY_PROFILE_SCOPE("EnvironmentMap::from");
+
+	EnvironmentMap map;
+	map.hash = hash_file(path);
+
+	// Missing sources are never cached
+	bool cacheable = (map.hash != 0);
+
+	map.hash = hash_value(ENVIRONMENT_VERSION, map.hash);
+	map.hash = hash_value(face_size, map.hash);
+	map.hash = hash_value(levels, map.hash);
+	map.hash = hash_value(samples, map.hash);
+
+	auto cached = cacheable ? read_cache("environments", hash_hex(map.hash)) : std::nullopt;
+	if (cached && cached->size() == sizeof(EnvironmentHeader) + cubemap_size()) {
+		EnvironmentHeader header;
+		std::memcpy(&header, cached->data(), sizeof(header));
+
+		if (header.magic == ENVIRONMENT_MAGIC && header.version == ENVIRONMENT_VERSION) {
+			upload_cached(vrb, map, *cached);
+			return map;
+		}
+	}
+
+	HDRTexture source = HDRTexture::load(path);
+	if (source.pixels.empty()) {
+		ulog_warning("environment", "using a black environment in place of %s\n", path.c_str());
+		source = HDRTexture { 1, 1, { 0.0f, 0.0f, 0.0f, 1.0f } };
+	}
+
+	std::vector <uint8_t> blob = prefilter(vrb, map, source);
+	if (cacheable)
+		write_cache("environments", hash_hex(map.hash), blob);
+
+	return map;
+}
+
+// Retired, since frames in flight may still sample it
+void EnvironmentMap::destroy(VulkanResourceBase &vrb)
+{
+	if (cubemap.image)
+		vrb.retire(cubemap);
+
+	cubemap = {};
+}
+
+}
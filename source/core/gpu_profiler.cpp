@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <fstream>
+
+#include <fmt/format.h>
+
+#include <microlog/microlog.h>
+
+#include "core/gpu_profiler.hpp"
+
+namespace ivy {
+
+// Statistics
+void GpuProfiler::Statistics::add(float ms)
+{
+	if (samples.size() < history) {
+		samples.push_back(ms);
+		head = samples.size() % history;
+	} else {
+		samples[head] = ms;
+		head = (head + 1) % history;
+	}
+}
+
+float GpuProfiler::Statistics::last() const
+{
+	if (samples.empty())
+		return 0.0f;
+
+	return samples[(head + samples.size() - 1) % samples.size()];
+}
+
+float GpuProfiler::Statistics::average() const
+{
+	if (samples.empty())
+		return 0.0f;
+
+	float sum = 0.0f;
+	for (float ms : samples)
+		sum += ms;
+
+	return sum/samples.size();
+}
+
+float GpuProfiler::Statistics::percentile(float p) const
+{
+	if (samples.empty())
+		return 0.0f;
+
+	std::vector <float> sorted = samples;
+
+	size_t k = std::min(size_t(p * (sorted.size() - 1) + 0.5f), sorted.size() - 1);
+	std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+	return sorted[k];
+}
+
+// Recording
+void GpuProfiler::begin_frame(const vk::CommandBuffer &cmd, size_t frame)
+{
+	if (!enabled || frame >= frames.size())
+		return;
+
+	current = frame;
+	stack.clear();
+
+	FrameQueries &fq = frames[frame];
+
+	// Results of the last time this frame was recorded
+	if (fq.next > 0) {
+		std::vector <uint64_t> timestamps(fq.next);
+
+		vk::Result result = device.getQueryPoolResults(fq.pool, 0, fq.next,
+			timestamps.size() * sizeof(uint64_t), timestamps.data(),
+			sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+
+		if (result == vk::Result::eSuccess) {
+			for (const Scope &scope : fq.scopes) {
+				uint64_t ticks = (timestamps[scope.end] - timestamps[scope.begin]) & valid_mask;
+
+				if (!statistics.count(scope.name))
+					order.push_back(scope.name);
+
+				Statistics &stats = statistics[scope.name];
+				stats.depth = scope.depth;
+				stats.add(1e-6f * period * ticks);
+			}
+		}
+	}
+
+	fq.scopes.clear();
+	fq.next = 0;
+
+	cmd.resetQueryPool(fq.pool, 0, 2 * max_scopes);
+
+	begin(cmd, "Frame");
+}
+
+void GpuProfiler::end_frame(const vk::CommandBuffer &cmd)
+{
+	if (!enabled || frames.empty())
+		return;
+
+	// Close anything left open, down to the frame scope
+	while (!stack.empty())
+		end(cmd, stack.back());
+}
+
+uint32_t GpuProfiler::begin(const vk::CommandBuffer &cmd, const std::string &name)
+{
+	// Without timestamps, there are no pools to index
+	if (!enabled || current >= frames.size())
+		return ~0u;
+
+	FrameQueries &fq = frames[current];
+	if (fq.scopes.size() >= max_scopes)
+		return ~0u;
+
+	Scope scope {
+		.name = name,
+		.depth = uint32_t(stack.size()),
+		.begin = fq.next++,
+		.end = ~0u
+	};
+
+	cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, fq.pool, scope.begin);
+
+	uint32_t index = fq.scopes.size();
+	fq.scopes.push_back(scope);
+	stack.push_back(index);
+
+	return index;
+}
+
+void GpuProfiler::end(const vk::CommandBuffer &cmd, uint32_t index)
+{
+	if (!enabled || index == ~0u || current >= frames.size())
+		return;
+
+	FrameQueries &fq = frames[current];
+	if (index >= fq.scopes.size())
+		return;
+
+	Scope &scope = fq.scopes[index];
+	scope.end = fq.next++;
+
+	cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, fq.pool, scope.end);
+
+	if (!stack.empty() && stack.back() == index)
+		stack.pop_back();
+}
+
+GpuProfiler::ScopeGuard GpuProfiler::scope(const vk::CommandBuffer &cmd, const std::string &name)
+{
+	uint32_t index = begin(cmd, name);
+	return ScopeGuard { (index == ~0u) ? nullptr : this, cmd, index };
+}
+
+// Pools for each frame in flight
+void GpuProfiler::resize(uint32_t count)
+{
+	destroy();
+
+	if (!enabled)
+		return;
+
+	frames.resize(count);
+	for (FrameQueries &fq : frames) {
+		fq.pool = device.createQueryPool(vk::QueryPoolCreateInfo {
+			{}, vk::QueryType::eTimestamp, 2 * max_scopes
+		});
+	}
+
+	current = 0;
+}
+
+void GpuProfiler::destroy()
+{
+	for (FrameQueries &fq : frames)
+		device.destroyQueryPool(fq.pool);
+
+	frames.clear();
+	stack.clear();
+}
+
+// Exporting
+std::string GpuProfiler::export_csv() const
+{
+	std::string csv = "scope,depth,last,average,p50,p95,p99,samples\n";
+	for (const std::string &name : order) {
+		const Statistics &stats = statistics.at(name);
+		csv += fmt::format("{},{},{:.4f},{:.4f},{:.4f},{:.4f},{:.4f},{}\n",
+			name, stats.depth, stats.last(), stats.average(),
+			stats.percentile(0.50f), stats.percentile(0.95f), stats.percentile(0.99f),
+			stats.samples.size());
+	}
+
+	return csv;
+}
+
+std::string GpuProfiler::export_json() const
+{
+	std::string json = "{\n\t\"unit\": \"ms\",\n\t\"scopes\": [";
+	for (size_t i = 0; i < order.size(); i++) {
+		const Statistics &stats = statistics.at(order[i]);
+		json += fmt::format("{}\n\t\t{{ \"name\": \"{}\", \"depth\": {}, \"last\": {:.4f}, \"average\": {:.4f}, "
+			"\"p50\": {:.4f}, \"p95\": {:.4f}, \"p99\": {:.4f}, \"samples\": {} }}",
+			(i > 0) ? "," : "",
+			order[i], stats.depth, stats.last(), stats.average(),
+			stats.percentile(0.50f), stats.percentile(0.95f), stats.percentile(0.99f),
+			stats.samples.size());
+	}
+
+	json += "\n\t]\n}\n";
+	return json;
+}
+
+// Format is chosen by the extension
+void GpuProfiler::save(const std::filesystem::path &path) const
+{
+	std::ofstream file(path);
+	if (!file) {
+		ulog_error("gpu profiler", "failed to open %s\n", path.c_str());
+		return;
+	}
+
+	if (path.extension() == ".csv")
+		file << export_csv();
+	else
+		file << export_json();
+}
+
+GpuProfiler *GpuProfiler::from(const vk::Device &device, const vk::PhysicalDevice &phdev)
+{
+	GpuProfiler *profiler = new GpuProfiler();
+	profiler->device = device;
+
+	vk::PhysicalDeviceProperties properties = phdev.getProperties();
+	profiler->period = properties.limits.timestampPeriod;
+
+	uint32_t family = littlevk::find_graphics_queue_family(phdev);
+	uint32_t bits = phdev.getQueueFamilyProperties()[family].timestampValidBits;
+
+	profiler->enabled = (bits > 0);
+	if (!profiler->enabled)
+		ulog_warning("gpu profiler", "timestamps are not supported on the graphics queue\n");
+	else if (bits < 64)
+		profiler->valid_mask = (1ull << bits) - 1;
+
+	return profiler;
+}
+
+}
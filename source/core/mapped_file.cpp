@@ -0,0 +1,59 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <utility>
+
+#include "core/mapped_file.hpp"
+
+namespace ivy {
+
+MappedFile::MappedFile(MappedFile &&other)
+{
+	*this = std::move(other);
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other)
+{
+	std::swap(data, other.data);
+	std::swap(size, other.size);
+	return *this;
+}
+
+MappedFile::~MappedFile()
+{
+	if (data)
+		munmap((void *) data, size);
+}
+
+std::optional <MappedFile> MappedFile::from(const std::filesystem::path &path)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return std::nullopt;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return std::nullopt;
+	}
+
+	void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	// The mapping stays valid once the descriptor is closed
+	close(fd);
+
+	if (mapping == MAP_FAILED)
+		return std::nullopt;
+
+	// Decoding reads the file front to back
+	madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+
+	MappedFile file;
+	file.data = (const uint8_t *) mapping;
+	file.size = st.st_size;
+	return file;
+}
+
+}
@@ -0,0 +1,68 @@
+#include <microlog/microlog.h>
+
+#include "core/pipeline_service.hpp"
+
+namespace ivy {
+
+// Errors are rethrown from the future, on whichever thread waits for it
+template <typename F>
+vk::Pipeline PipelineService::finish(const F &create)
+{
+	vk::Pipeline pipeline;
+
+	try {
+		pipeline = create();
+	} catch (...) {
+		ulog_error("pipeline service", "failed to create pipeline\n");
+		outstanding--;
+		throw;
+	}
+
+	if (--outstanding == 0)
+		save_pipeline_cache(device, phdev, cache);
+
+	return pipeline;
+}
+
+PendingPipeline PipelineService::graphics(const GraphicsPipelineInfo &info, const std::optional <vk::DescriptorSetLayout> &dsl)
+{
+	outstanding++;
+
+	// Copy of the info is owned by the job
+	auto future = workers->submit([this, info]() {
+		return finish([&]() { return create_graphics_pipeline(device, info, cache); });
+	});
+
+	return PendingPipeline {
+		.handle = future.share(),
+		.layout = info.layout,
+		.dsl = dsl,
+	};
+}
+
+PendingPipeline PipelineService::compute(const ShaderSource &shader, const vk::PipelineLayout &layout, const std::optional <vk::DescriptorSetLayout> &dsl)
+{
+	outstanding++;
+
+	auto future = workers->submit([this, shader, layout]() {
+		return finish([&]() { return create_compute_pipeline(device, shader, layout, cache); });
+	});
+
+	return PendingPipeline {
+		.handle = future.share(),
+		.layout = layout,
+		.dsl = dsl,
+	};
+}
+
+PipelineService *PipelineService::from(const vk::Device &device, const vk::PhysicalDevice &phdev, const vk::PipelineCache &cache, ThreadPool *workers)
+{
+	PipelineService *service = new PipelineService();
+	service->device = device;
+	service->phdev = phdev;
+	service->cache = cache;
+	service->workers = workers;
+	return service;
+}
+
+}
@@ -0,0 +1,299 @@
+#include <cstring>
+#include <mutex>
+
+#include <glslang/build_info.h>
+#include <glslang/Public/ShaderLang.h>
+#include <glslang/Public/ResourceLimits.h>
+#include <glslang/SPIRV/GlslangToSpv.h>
+
+#include <microlog/microlog.h>
+
+#include "core/disk_cache.hpp"
+#include "core/hash.hpp"
+#include "core/pipelines.hpp"
+
+namespace ivy {
+
+static EShLanguage translate_stage(vk::ShaderStageFlagBits stage)
+{
+	switch (stage) {
+	case vk::ShaderStageFlagBits::eVertex:
+		return EShLangVertex;
+	case vk::ShaderStageFlagBits::eFragment:
+		return EShLangFragment;
+	case vk::ShaderStageFlagBits::eCompute:
+		return EShLangCompute;
+	case vk::ShaderStageFlagBits::eGeometry:
+		return EShLangGeometry;
+	default:
+		break;
+	}
+
+	ulog_error("compile_glsl", "unsupported shader stage %s\n", vk::to_string(stage).c_str());
+	return EShLangCount;
+}
+
+// Definitions are either NAME or NAME=VALUE
+static std::string preamble(const std::vector <std::string> &defines)
+{
+	std::string result;
+	for (const std::string &define : defines) {
+		size_t eq = define.find('=');
+		if (eq == std::string::npos)
+			result += "#define " + define + "\n";
+		else
+			result += "#define " + define.substr(0, eq) + " " + define.substr(eq + 1) + "\n";
+	}
+
+	return result;
+}
+
+std::optional <std::vector <uint32_t>> compile_glsl(const ShaderSource &shader_source)
+{
+	static std::once_flag initialized;
+	std::call_once(initialized, []() { glslang::InitializeProcess(); });
+
+	EShLanguage language = translate_stage(shader_source.stage);
+	if (language == EShLangCount)
+		return std::nullopt;
+
+	std::string header = preamble(shader_source.defines);
+	const char *source = shader_source.source.c_str();
+
+	glslang::TShader shader(language);
+	shader.setStrings(&source, 1);
+	shader.setPreamble(header.c_str());
+	shader.setEnvInput(glslang::EShSourceGlsl, language, glslang::EShClientVulkan, 100);
+	shader.setEnvClient(glslang::EShClientVulkan, glslang::EShTargetVulkan_1_2);
+	shader.setEnvTarget(glslang::EShTargetSpv, glslang::EShTargetSpv_1_5);
+
+	EShMessages messages = EShMessages(EShMsgSpvRules | EShMsgVulkanRules);
+	if (!shader.parse(GetDefaultResources(), 450, false, messages)) {
+		ulog_error("compile_glsl", "failed to compile shader:\n%s\n", shader.getInfoLog());
+		return std::nullopt;
+	}
+
+	glslang::TProgram program;
+	program.addShader(&shader);
+	if (!program.link(messages)) {
+		ulog_error("compile_glsl", "failed to link shader:\n%s\n", program.getInfoLog());
+		return std::nullopt;
+	}
+
+	std::vector <uint32_t> spirv;
+	glslang::GlslangToSpv(*program.getIntermediate(language), spirv);
+	return spirv;
+}
+
+std::optional <std::vector <uint32_t>> load_spirv(const ShaderSource &shader_source)
+{
+	static const std::string compiler = std::to_string(GLSLANG_VERSION_MAJOR)
+		+ "." + std::to_string(GLSLANG_VERSION_MINOR)
+		+ "." + std::to_string(GLSLANG_VERSION_PATCH);
+
+	uint64_t h = hash_string(shader_source.source);
+	h = hash_string(preamble(shader_source.defines), h);
+	h = hash_value(shader_source.stage, h);
+	h = hash_string(compiler, h);
+
+	std::string key = hash_hex(h) + ".spv";
+
+	auto cached = read_cache("shaders", key);
+	if (cached && cached->size() % sizeof(uint32_t) == 0 && !cached->empty()) {
+		std::vector <uint32_t> spirv(cached->size()/sizeof(uint32_t));
+		std::memcpy(spirv.data(), cached->data(), cached->size());
+		return spirv;
+	}
+
+	auto spirv = compile_glsl(shader_source);
+	if (spirv)
+		write_cache("shaders", key, *spirv);
+
+	return spirv;
+}
+
+static uint32_t format_size(vk::Format format)
+{
+	switch (format) {
+	case vk::Format::eR32Sfloat:
+		return sizeof(float);
+	case vk::Format::eR32G32Sfloat:
+		return 2 * sizeof(float);
+	case vk::Format::eR32G32B32Sfloat:
+		return 3 * sizeof(float);
+	case vk::Format::eR32G32B32A32Sfloat:
+		return 4 * sizeof(float);
+	default:
+		break;
+	}
+
+	ulog_error("create_graphics_pipeline", "unsupported vertex format %s\n", vk::to_string(format).c_str());
+	return 0;
+}
+
+vk::Pipeline create_graphics_pipeline(const vk::Device &device, const GraphicsPipelineInfo &info, const vk::PipelineCache &cache)
+{
+	// Shader modules, only needed until the pipeline is created
+	std::vector <vk::ShaderModule> modules;
+	std::vector <vk::PipelineShaderStageCreateInfo> stages;
+
+	for (const ShaderSource &shader : info.shaders) {
+		auto spirv = load_spirv(shader);
+		if (!spirv)
+			throw "error";
+
+		vk::ShaderModule module = device.createShaderModule(vk::ShaderModuleCreateInfo { {}, *spirv });
+		modules.push_back(module);
+		stages.push_back(vk::PipelineShaderStageCreateInfo { {}, shader.stage, module, "main" });
+	}
+
+	// Vertex input
+	std::vector <vk::VertexInputAttributeDescription> attributes;
+
+	uint32_t stride = 0;
+	for (uint32_t i = 0; i < info.vertex_attributes.size(); i++) {
+		attributes.push_back({ i, 0, info.vertex_attributes[i], stride });
+		stride += format_size(info.vertex_attributes[i]);
+	}
+
+	vk::VertexInputBindingDescription binding { 0, stride, vk::VertexInputRate::eVertex };
+
+	vk::PipelineVertexInputStateCreateInfo vertex_input { {}, {}, attributes };
+	if (stride > 0)
+		vertex_input.setVertexBindingDescriptions(binding);
+
+	vk::PipelineInputAssemblyStateCreateInfo input_assembly { {}, vk::PrimitiveTopology::eTriangleList };
+
+	// Viewport and scissor are always dynamic
+	vk::PipelineViewportStateCreateInfo viewport { {}, 1, nullptr, 1, nullptr };
+
+	std::array <vk::DynamicState, 2> dynamic_states {
+		vk::DynamicState::eViewport,
+		vk::DynamicState::eScissor
+	};
+
+	vk::PipelineDynamicStateCreateInfo dynamic { {}, dynamic_states };
+
+	vk::PipelineRasterizationStateCreateInfo rasterization {
+		{}, false, false,
+		vk::PolygonMode::eFill,
+		vk::CullModeFlagBits::eNone,
+		vk::FrontFace::eCounterClockwise,
+		false, 0.0f, 0.0f, 0.0f, 1.0f
+	};
+
+	vk::PipelineMultisampleStateCreateInfo multisample { {}, vk::SampleCountFlagBits::e1 };
+
+	vk::PipelineDepthStencilStateCreateInfo depth_stencil {
+		{}, info.depth_test, info.depth_write,
+		info.depth_compare, false, false
+	};
+
+	vk::PipelineColorBlendAttachmentState blend_attachment;
+	blend_attachment.colorWriteMask = vk::ColorComponentFlagBits::eR
+		| vk::ColorComponentFlagBits::eG
+		| vk::ColorComponentFlagBits::eB
+		| vk::ColorComponentFlagBits::eA;
+
+	if (info.alpha_blending) {
+		blend_attachment.blendEnable = true;
+		blend_attachment.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+		blend_attachment.dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+		blend_attachment.colorBlendOp = vk::BlendOp::eAdd;
+		blend_attachment.srcAlphaBlendFactor = vk::BlendFactor::eOne;
+		blend_attachment.dstAlphaBlendFactor = vk::BlendFactor::eZero;
+		blend_attachment.alphaBlendOp = vk::BlendOp::eAdd;
+	}
+
+	vk::PipelineColorBlendStateCreateInfo blending { {}, false, vk::LogicOp::eCopy, blend_attachment };
+
+	vk::GraphicsPipelineCreateInfo pipeline_info {
+		{}, stages,
+		&vertex_input, &input_assembly, nullptr,
+		&viewport, &rasterization, &multisample,
+		&depth_stencil, &blending, &dynamic,
+		info.layout, info.render_pass, info.subpass
+	};
+
+	vk::Pipeline pipeline = device.createGraphicsPipeline(cache, pipeline_info).value;
+
+	for (const vk::ShaderModule &module : modules)
+		device.destroyShaderModule(module);
+
+	return pipeline;
+}
+
+vk::Pipeline create_compute_pipeline(const vk::Device &device, const ShaderSource &shader, const vk::PipelineLayout &layout, const vk::PipelineCache &cache)
+{
+	auto spirv = load_spirv(shader);
+	if (!spirv)
+		throw "error";
+
+	vk::ShaderModule module = device.createShaderModule(vk::ShaderModuleCreateInfo { {}, *spirv });
+
+	vk::ComputePipelineCreateInfo pipeline_info {
+		{}, vk::PipelineShaderStageCreateInfo {
+			{}, vk::ShaderStageFlagBits::eCompute, module, "main"
+		}, layout
+	};
+
+	vk::Pipeline pipeline = device.createComputePipeline(cache, pipeline_info).value;
+	device.destroyShaderModule(module);
+
+	return pipeline;
+}
+
+vk::DescriptorSetLayout create_descriptor_set_layout(const vk::Device &device,
+		const std::vector <vk::DescriptorSetLayoutBinding> &bindings,
+		const std::vector <vk::DescriptorBindingFlags> &flags,
+		vk::DescriptorSetLayoutCreateFlags layout_flags)
+{
+	vk::DescriptorSetLayoutBindingFlagsCreateInfo flags_info { flags };
+
+	vk::DescriptorSetLayoutCreateInfo info { layout_flags, bindings };
+	if (!flags.empty())
+		info.pNext = &flags_info;
+
+	return device.createDescriptorSetLayout(info);
+}
+
+vk::PipelineLayout create_pipeline_layout(const vk::Device &device,
+		const std::vector <vk::DescriptorSetLayout> &dsls,
+		const std::vector <vk::PushConstantRange> &push_constants)
+{
+	return device.createPipelineLayout(vk::PipelineLayoutCreateInfo { {}, dsls, push_constants });
+}
+
+// Pipeline caches are only valid for the same driver and device
+static std::string pipeline_cache_key(const vk::PhysicalDevice &phdev)
+{
+	vk::PhysicalDeviceProperties properties = phdev.getProperties();
+
+	uint64_t h = hash_bytes(properties.pipelineCacheUUID.data(), VK_UUID_SIZE);
+	h = hash_value(properties.vendorID, h);
+	h = hash_value(properties.deviceID, h);
+	h = hash_value(properties.driverVersion, h);
+
+	return hash_hex(h) + ".bin";
+}
+
+vk::PipelineCache load_pipeline_cache(const vk::Device &device, const vk::PhysicalDevice &phdev)
+{
+	vk::PipelineCacheCreateInfo info;
+
+	auto data = read_cache("pipelines", pipeline_cache_key(phdev));
+	if (data) {
+		info.initialDataSize = data->size();
+		info.pInitialData = data->data();
+	}
+
+	return device.createPipelineCache(info);
+}
+
+void save_pipeline_cache(const vk::Device &device, const vk::PhysicalDevice &phdev, const vk::PipelineCache &cache)
+{
+	std::vector <uint8_t> data = device.getPipelineCacheData(cache);
+	write_cache("pipelines", pipeline_cache_key(phdev), data);
+}
+
+}
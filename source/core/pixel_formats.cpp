@@ -0,0 +1,536 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IVY_X86
+#endif
+
+#include "core/pixel_formats.hpp"
+
+namespace ivy {
+
+// Components per chunk handed to a worker; smaller conversions stay
+// on the calling thread
+static constexpr size_t CHUNK = 1 << 18;
+
+template <typename F>
+static void parallel_chunks(size_t count, size_t granularity, const F &ftn)
+{
+	size_t chunk = (CHUNK/granularity) * granularity;
+	ptrdiff_t chunks = (count + chunk - 1)/chunk;
+
+	#pragma omp parallel for if (chunks > 1)
+	for (ptrdiff_t i = 0; i < chunks; i++) {
+		size_t begin = i * chunk;
+		size_t end = std::min(begin + chunk, count);
+		ftn(begin, end);
+	}
+}
+
+SIMDLevel simd_level()
+{
+#ifdef IVY_X86
+	static const SIMDLevel level = []() {
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c"))
+			return SIMDLevel::eAVX2;
+		if (__builtin_cpu_supports("sse4.1"))
+			return SIMDLevel::eSSE4;
+		return SIMDLevel::eScalar;
+	}();
+
+	return level;
+#else
+	return SIMDLevel::eScalar;
+#endif
+}
+
+static constexpr float INV_255 = 1.0f/255.0f;
+
+// Rounds to the nearest even, like F16C
+static uint16_t float_to_half(float f)
+{
+	uint32_t x;
+	std::memcpy(&x, &f, sizeof(x));
+
+	uint32_t sign = (x >> 16) & 0x8000;
+	uint32_t exponent = (x >> 23) & 0xff;
+	uint32_t mantissa = x & 0x7fffff;
+
+	// Infinities and NaNs
+	if (exponent == 0xff)
+		return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+
+	int32_t e = int32_t(exponent) - 127 + 15;
+	if (e >= 0x1f)
+		return sign | 0x7c00;
+
+	// Subnormals
+	if (e <= 0) {
+		if (e < -10)
+			return sign;
+
+		mantissa |= 0x800000;
+
+		uint32_t shift = 14 - e;
+		uint32_t half = mantissa >> shift;
+		uint32_t remainder = mantissa & ((1u << shift) - 1);
+		uint32_t midpoint = 1u << (shift - 1);
+		if (remainder > midpoint || (remainder == midpoint && (half & 1)))
+			half++;
+
+		return sign | half;
+	}
+
+	// A carry out of the mantissa correctly bumps the exponent
+	uint32_t half = (e << 10) | (mantissa >> 13);
+	uint32_t remainder = mantissa & 0x1fff;
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+		half++;
+
+	return sign | half;
+}
+
+static uint8_t float_to_u8(float f)
+{
+	// Also maps NaNs to zero
+	f = (f > 0.0f) ? f : 0.0f;
+	f = (f < 1.0f) ? f : 1.0f;
+	return uint8_t(std::nearbyint(255.0f * f));
+}
+
+// Decoded sRGB values, followed by linear ones for alpha
+static const float *srgb_table()
+{
+	static const auto table = []() {
+		std::array <float, 512> table;
+		for (uint32_t i = 0; i < 256; i++) {
+			float c = i * INV_255;
+			table[i] = (c <= 0.04045f) ? c/12.92f : std::pow((c + 0.055f)/1.055f, 2.4f);
+			table[i + 256] = c;
+		}
+
+		return table;
+	}();
+
+	return table.data();
+}
+
+// Scalar kernels, also used for the tails of the vector ones
+static void u8_to_f32_scalar(const uint8_t *src, float *dst, size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i++)
+		dst[i] = src[i] * INV_255;
+}
+
+static void u8_to_f16_scalar(const uint8_t *src, uint16_t *dst, size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i++)
+		dst[i] = float_to_half(src[i] * INV_255);
+}
+
+static void f32_to_u8_scalar(const float *src, uint8_t *dst, size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i++)
+		dst[i] = float_to_u8(src[i]);
+}
+
+static void f32_to_f16_scalar(const float *src, uint16_t *dst, size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i++)
+		dst[i] = float_to_half(src[i]);
+}
+
+static void srgb_to_linear_scalar(const uint8_t *src, float *dst, size_t begin, size_t end, uint32_t channels)
+{
+	const float *table = srgb_table();
+	for (size_t i = begin; i < end; i++) {
+		uint32_t alpha = (channels == 4 && (i & 3) == 3) ? 256 : 0;
+		dst[i] = table[src[i] + alpha];
+	}
+}
+
+// In pixels from here on
+static void swizzle_rgba8_scalar(const uint8_t *src, uint8_t *dst, size_t begin, size_t end, const std::array <uint8_t, 4> &order)
+{
+	for (size_t i = begin; i < end; i++) {
+		uint8_t pixel[4];
+		for (uint32_t c = 0; c < 4; c++)
+			pixel[c] = src[4 * i + order[c]];
+
+		std::memcpy(&dst[4 * i], pixel, 4);
+	}
+}
+
+static void expand_u8_scalar(const uint8_t *src, uint32_t channels, uint8_t *dst, size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i++) {
+		uint8_t pixel[4] = { 0, 0, 0, 0xff };
+		for (uint32_t c = 0; c < channels; c++)
+			pixel[c] = src[channels * i + c];
+
+		std::memcpy(&dst[4 * i], pixel, 4);
+	}
+}
+
+static void pack_u8_scalar(const uint8_t *src, uint8_t *dst, uint32_t channels, size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i++) {
+		for (uint32_t c = 0; c < channels; c++)
+			dst[channels * i + c] = src[4 * i + c];
+	}
+}
+
+#ifdef IVY_X86
+
+// SSE4.1 kernels; each processes as much as it can and returns where
+// the scalar kernel should pick up
+__attribute__((target("sse4.1")))
+static size_t u8_to_f32_sse4(const uint8_t *src, float *dst, size_t begin, size_t end)
+{
+	const __m128 scale = _mm_set1_ps(INV_255);
+
+	size_t i = begin;
+	for (; i + 4 <= end; i += 4) {
+		int32_t bytes;
+		std::memcpy(&bytes, &src[i], 4);
+
+		__m128i x = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+		_mm_storeu_ps(&dst[i], _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+	}
+
+	return i;
+}
+
+__attribute__((target("sse4.1")))
+static size_t f32_to_u8_sse4(const float *src, uint8_t *dst, size_t begin, size_t end)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(255.0f);
+
+	size_t i = begin;
+	for (; i + 4 <= end; i += 4) {
+		__m128 x = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(&src[i]), zero), one);
+		__m128i n = _mm_cvtps_epi32(_mm_mul_ps(x, scale));
+		n = _mm_packus_epi32(n, n);
+		n = _mm_packus_epi16(n, n);
+
+		int32_t bytes = _mm_cvtsi128_si32(n);
+		std::memcpy(&dst[i], &bytes, 4);
+	}
+
+	return i;
+}
+
+__attribute__((target("sse4.1")))
+static size_t swizzle_rgba8_sse4(const uint8_t *src, uint8_t *dst, size_t begin, size_t end, const std::array <uint8_t, 4> &order)
+{
+	alignas(16) uint8_t mask[16];
+	for (uint32_t p = 0; p < 4; p++) {
+		for (uint32_t c = 0; c < 4; c++)
+			mask[4 * p + c] = 4 * p + order[c];
+	}
+
+	const __m128i shuffle = _mm_load_si128((const __m128i *) mask);
+
+	size_t i = begin;
+	for (; i + 4 <= end; i += 4) {
+		__m128i x = _mm_loadu_si128((const __m128i *) &src[4 * i]);
+		_mm_storeu_si128((__m128i *) &dst[4 * i], _mm_shuffle_epi8(x, shuffle));
+	}
+
+	return i;
+}
+
+__attribute__((target("sse4.1")))
+static size_t expand_u8_sse4(const uint8_t *src, uint32_t channels, uint8_t *dst, size_t begin, size_t end)
+{
+	const __m128i alpha = _mm_set1_epi32(0xff000000);
+
+	size_t i = begin;
+	if (channels == 1) {
+		for (; i + 4 <= end; i += 4) {
+			int32_t bytes;
+			std::memcpy(&bytes, &src[i], 4);
+
+			__m128i x = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+			_mm_storeu_si128((__m128i *) &dst[4 * i], _mm_or_si128(x, alpha));
+		}
+	} else if (channels == 2) {
+		for (; i + 4 <= end; i += 4) {
+			__m128i x = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *) &src[2 * i]));
+			_mm_storeu_si128((__m128i *) &dst[4 * i], _mm_or_si128(x, alpha));
+		}
+	} else if (channels == 3) {
+		const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+
+		// Reads 16 bytes for every 12 consumed
+		for (; i + 6 <= end; i += 4) {
+			__m128i x = _mm_loadu_si128((const __m128i *) &src[3 * i]);
+			_mm_storeu_si128((__m128i *) &dst[4 * i], _mm_or_si128(_mm_shuffle_epi8(x, shuffle), alpha));
+		}
+	}
+
+	return i;
+}
+
+__attribute__((target("sse4.1")))
+static size_t pack_u8_sse4(const uint8_t *src, uint8_t *dst, uint32_t channels, size_t begin, size_t end)
+{
+	__m128i shuffle;
+	if (channels == 1)
+		shuffle = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	else if (channels == 2)
+		shuffle = _mm_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+	else if (channels == 3)
+		shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	else
+		return begin;
+
+	size_t i = begin;
+	for (; i + 4 <= end; i += 4) {
+		__m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) &src[4 * i]), shuffle);
+
+		// Exactly the packed bytes, to stay within the output
+		uint8_t packed[16];
+		_mm_storeu_si128((__m128i *) packed, x);
+		std::memcpy(&dst[channels * i], packed, 4 * channels);
+	}
+
+	return i;
+}
+
+// AVX2 kernels, with F16C for half floats
+__attribute__((target("avx2,f16c")))
+static size_t u8_to_f32_avx2(const uint8_t *src, float *dst, size_t begin, size_t end)
+{
+	const __m256 scale = _mm256_set1_ps(INV_255);
+
+	size_t i = begin;
+	for (; i + 8 <= end; i += 8) {
+		__m256i x = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) &src[i]));
+		_mm256_storeu_ps(&dst[i], _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2,f16c")))
+static size_t u8_to_f16_avx2(const uint8_t *src, uint16_t *dst, size_t begin, size_t end)
+{
+	const __m256 scale = _mm256_set1_ps(INV_255);
+
+	size_t i = begin;
+	for (; i + 8 <= end; i += 8) {
+		__m256i x = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) &src[i]));
+		__m256 f = _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale);
+		_mm_storeu_si128((__m128i *) &dst[i], _mm256_cvtps_ph(f, _MM_FROUND_TO_NEAREST_INT));
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2,f16c")))
+static size_t f32_to_u8_avx2(const float *src, uint8_t *dst, size_t begin, size_t end)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 scale = _mm256_set1_ps(255.0f);
+
+	size_t i = begin;
+	for (; i + 8 <= end; i += 8) {
+		__m256 x = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(&src[i]), zero), one);
+		__m256i n = _mm256_cvtps_epi32(_mm256_mul_ps(x, scale));
+
+		__m128i words = _mm_packus_epi32(_mm256_castsi256_si128(n), _mm256_extracti128_si256(n, 1));
+		_mm_storel_epi64((__m128i *) &dst[i], _mm_packus_epi16(words, words));
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2,f16c")))
+static size_t f32_to_f16_avx2(const float *src, uint16_t *dst, size_t begin, size_t end)
+{
+	size_t i = begin;
+	for (; i + 8 <= end; i += 8) {
+		__m256 f = _mm256_loadu_ps(&src[i]);
+		_mm_storeu_si128((__m128i *) &dst[i], _mm256_cvtps_ph(f, _MM_FROUND_TO_NEAREST_INT));
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2,f16c")))
+static size_t srgb_to_linear_avx2(const uint8_t *src, float *dst, size_t begin, size_t end, uint32_t channels)
+{
+	const float *table = srgb_table();
+
+	// Chunks start on pixel boundaries, so lanes line up with channels
+	const __m256i alpha = (channels == 4)
+		? _mm256_setr_epi32(0, 0, 0, 256, 0, 0, 0, 256)
+		: _mm256_setzero_si256();
+
+	size_t i = begin;
+	for (; i + 8 <= end; i += 8) {
+		__m256i x = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) &src[i]));
+		x = _mm256_add_epi32(x, alpha);
+		_mm256_storeu_ps(&dst[i], _mm256_i32gather_ps(table, x, 4));
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2,f16c")))
+static size_t swizzle_rgba8_avx2(const uint8_t *src, uint8_t *dst, size_t begin, size_t end, const std::array <uint8_t, 4> &order)
+{
+	alignas(32) uint8_t mask[32];
+	for (uint32_t p = 0; p < 8; p++) {
+		for (uint32_t c = 0; c < 4; c++)
+			mask[4 * p + c] = 4 * (p & 3) + order[c];
+	}
+
+	const __m256i shuffle = _mm256_load_si256((const __m256i *) mask);
+
+	size_t i = begin;
+	for (; i + 8 <= end; i += 8) {
+		__m256i x = _mm256_loadu_si256((const __m256i *) &src[4 * i]);
+		_mm256_storeu_si256((__m256i *) &dst[4 * i], _mm256_shuffle_epi8(x, shuffle));
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2,f16c")))
+static size_t expand_u8_avx2(const uint8_t *src, uint32_t channels, uint8_t *dst, size_t begin, size_t end)
+{
+	const __m256i alpha = _mm256_set1_epi32(0xff000000);
+
+	size_t i = begin;
+	if (channels == 1) {
+		for (; i + 8 <= end; i += 8) {
+			__m256i x = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) &src[i]));
+			_mm256_storeu_si256((__m256i *) &dst[4 * i], _mm256_or_si256(x, alpha));
+		}
+	} else if (channels == 2) {
+		for (; i + 8 <= end; i += 8) {
+			__m256i x = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) &src[2 * i]));
+			_mm256_storeu_si256((__m256i *) &dst[4 * i], _mm256_or_si256(x, alpha));
+		}
+	}
+
+	// Three channels cross the lanes, see the SSE4 kernel
+	return expand_u8_sse4(src, channels, dst, i, end);
+}
+
+#endif
+
+// Dispatch
+void u8_to_f32(const uint8_t *src, float *dst, size_t count)
+{
+	SIMDLevel level = simd_level();
+	parallel_chunks(count, 8, [&](size_t begin, size_t end) {
+#ifdef IVY_X86
+		if (level == SIMDLevel::eAVX2)
+			begin = u8_to_f32_avx2(src, dst, begin, end);
+		else if (level == SIMDLevel::eSSE4)
+			begin = u8_to_f32_sse4(src, dst, begin, end);
+#endif
+		u8_to_f32_scalar(src, dst, begin, end);
+	});
+}
+
+void u8_to_f16(const uint8_t *src, uint16_t *dst, size_t count)
+{
+	SIMDLevel level = simd_level();
+	parallel_chunks(count, 8, [&](size_t begin, size_t end) {
+#ifdef IVY_X86
+		if (level == SIMDLevel::eAVX2)
+			begin = u8_to_f16_avx2(src, dst, begin, end);
+#endif
+		u8_to_f16_scalar(src, dst, begin, end);
+	});
+}
+
+void f32_to_u8(const float *src, uint8_t *dst, size_t count)
+{
+	SIMDLevel level = simd_level();
+	parallel_chunks(count, 8, [&](size_t begin, size_t end) {
+#ifdef IVY_X86
+		if (level == SIMDLevel::eAVX2)
+			begin = f32_to_u8_avx2(src, dst, begin, end);
+		else if (level == SIMDLevel::eSSE4)
+			begin = f32_to_u8_sse4(src, dst, begin, end);
+#endif
+		f32_to_u8_scalar(src, dst, begin, end);
+	});
+}
+
+void f32_to_f16(const float *src, uint16_t *dst, size_t count)
+{
+	SIMDLevel level = simd_level();
+	parallel_chunks(count, 8, [&](size_t begin, size_t end) {
+#ifdef IVY_X86
+		if (level == SIMDLevel::eAVX2)
+			begin = f32_to_f16_avx2(src, dst, begin, end);
+#endif
+		f32_to_f16_scalar(src, dst, begin, end);
+	});
+}
+
+void srgb_to_linear(const uint8_t *src, float *dst, size_t pixels, uint32_t channels)
+{
+	SIMDLevel level = simd_level();
+	parallel_chunks(pixels * channels, 8 * channels, [&](size_t begin, size_t end) {
+#ifdef IVY_X86
+		if (level == SIMDLevel::eAVX2)
+			begin = srgb_to_linear_avx2(src, dst, begin, end, channels);
+#endif
+		srgb_to_linear_scalar(src, dst, begin, end, channels);
+	});
+}
+
+void swizzle_rgba8(const uint8_t *src, uint8_t *dst, size_t pixels, const std::array <uint8_t, 4> &order)
+{
+	SIMDLevel level = simd_level();
+	parallel_chunks(pixels, 8, [&](size_t begin, size_t end) {
+#ifdef IVY_X86
+		if (level == SIMDLevel::eAVX2)
+			begin = swizzle_rgba8_avx2(src, dst, begin, end, order);
+		else if (level == SIMDLevel::eSSE4)
+			begin = swizzle_rgba8_sse4(src, dst, begin, end, order);
+#endif
+		swizzle_rgba8_scalar(src, dst, begin, end, order);
+	});
+}
+
+void expand_u8(const uint8_t *src, uint32_t channels, uint8_t *dst, size_t pixels)
+{
+	SIMDLevel level = simd_level();
+	parallel_chunks(pixels, 8, [&](size_t begin, size_t end) {
+#ifdef IVY_X86
+		if (level == SIMDLevel::eAVX2)
+			begin = expand_u8_avx2(src, channels, dst, begin, end);
+		else if (level == SIMDLevel::eSSE4)
+			begin = expand_u8_sse4(src, channels, dst, begin, end);
+#endif
+		expand_u8_scalar(src, channels, dst, begin, end);
+	});
+}
+
+void pack_u8(const uint8_t *src, uint8_t *dst, uint32_t channels, size_t pixels)
+{
+	SIMDLevel level = simd_level();
+	parallel_chunks(pixels, 8, [&](size_t begin, size_t end) {
+#ifdef IVY_X86
+		if (level != SIMDLevel::eScalar)
+			begin = pack_u8_sse4(src, dst, channels, begin, end);
+#endif
+		pack_u8_scalar(src, dst, channels, begin, end);
+	});
+}
+
+}
@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+#include <fmt/format.h>
+
+#include <microlog/microlog.h>
+
+#include "core/profiler.hpp"
+
+namespace ivy::profiling {
+
+static const auto startup = std::chrono::steady_clock::now();
+
+// Every buffer ever created, for exporting
+static std::mutex registry_lock;
+static std::vector <std::shared_ptr <ThreadBuffer>> registry;
+
+static ThreadBuffer &local_buffer()
+{
+	thread_local std::shared_ptr <ThreadBuffer> buffer = []() {
+		auto buffer = std::make_shared <ThreadBuffer> ();
+		buffer->slots = std::make_unique <ThreadBuffer::Slot []> (ThreadBuffer::capacity);
+
+		std::lock_guard guard(registry_lock);
+		buffer->tid = registry.size();
+		buffer->name = fmt::format("Thread {}", buffer->tid);
+		registry.push_back(buffer);
+
+		return buffer;
+	}();
+
+	return *buffer;
+}
+
+uint64_t now()
+{
+	auto elapsed = std::chrono::steady_clock::now() - startup;
+	return std::chrono::duration_cast <std::chrono::nanoseconds> (elapsed).count();
+}
+
+void record(const char *name, uint64_t begin, uint64_t end)
+{
+	ThreadBuffer &buffer = local_buffer();
+
+	uint64_t head = buffer.head.load(std::memory_order_relaxed);
+	ThreadBuffer::Slot &slot = buffer.slots[head % ThreadBuffer::capacity];
+
+	slot.sequence.store(2 * head + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	slot.name.store(name, std::memory_order_relaxed);
+	slot.begin.store(begin, std::memory_order_relaxed);
+	slot.end.store(end, std::memory_order_relaxed);
+
+	slot.sequence.store(2 * head + 2, std::memory_order_release);
+	buffer.head.store(head + 1, std::memory_order_release);
+}
+
+void set_thread_name(const std::string &name)
+{
+	ThreadBuffer &buffer = local_buffer();
+
+	std::lock_guard guard(registry_lock);
+	buffer.name = name;
+}
+
+static std::string escape(const char *str)
+{
+	std::string result;
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			result += '\\';
+		result += *str;
+	}
+
+	return result;
+}
+
+// Copies the events still in the ring; slots which were being written
+// or already held a later event while copying are dropped
+static std::vector <Event> snapshot(const ThreadBuffer &buffer)
+{
+	uint64_t head = buffer.head.load(std::memory_order_acquire);
+	uint64_t first = (head > ThreadBuffer::capacity) ? head - ThreadBuffer::capacity : 0;
+
+	std::vector <Event> events;
+	for (uint64_t i = first; i < head; i++) {
+		const ThreadBuffer::Slot &slot = buffer.slots[i % ThreadBuffer::capacity];
+
+		uint64_t before = slot.sequence.load(std::memory_order_acquire);
+
+		Event event {
+			slot.name.load(std::memory_order_relaxed),
+			slot.begin.load(std::memory_order_relaxed),
+			slot.end.load(std::memory_order_relaxed)
+		};
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t after = slot.sequence.load(std::memory_order_relaxed);
+
+		if (before == 2 * i + 2 && after == before)
+			events.push_back(event);
+	}
+
+	return events;
+}
+
+bool save_trace(const std::filesystem::path &path)
+{
+	std::ofstream file(path);
+	if (!file) {
+		ulog_error("profiler", "failed to open %s\n", path.c_str());
+		return false;
+	}
+
+	std::vector <std::shared_ptr <ThreadBuffer>> buffers;
+	{
+		std::lock_guard guard(registry_lock);
+		buffers = registry;
+	}
+
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+	bool first = true;
+	auto separate = [&]() {
+		if (!first)
+			file << ",";
+		file << "\n";
+		first = false;
+	};
+
+	for (const auto &buffer : buffers) {
+		std::string name;
+		{
+			std::lock_guard guard(registry_lock);
+			name = buffer->name;
+		}
+
+		separate();
+		file << fmt::format("{{\"ph\":\"M\",\"pid\":0,\"tid\":{},\"name\":\"thread_name\",\"args\":{{\"name\":\"{}\"}}}}",
+			buffer->tid, escape(name.c_str()));
+
+		// Microseconds, as expected by the trace format
+		for (const Event &event : snapshot(*buffer)) {
+			separate();
+			file << fmt::format("{{\"ph\":\"X\",\"pid\":0,\"tid\":{},\"name\":\"{}\",\"ts\":{:.3f},\"dur\":{:.3f}}}",
+				buffer->tid, escape(event.name),
+				1e-3 * event.begin, 1e-3 * (event.end - event.begin));
+		}
+	}
+
+	file << "\n]}\n";
+
+	ulog_info("profiler", "saved trace to %s\n", path.c_str());
+
+	return true;
+}
+
+}
@@ -4,14 +4,58 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb/stb_image_write.h>
 
+#include "core/mapped_file.hpp"
+#include "core/pixel_formats.hpp"
 #include "core/texture.hpp"
 
 namespace ivy {
 
-void Texture::save(const std::filesystem::path &path) const
+Texture Texture::as_rgba() const
+{
+	if (channels == 4)
+		return *this;
+
+	size_t count = size_t(width) * size_t(height);
+
+	Texture result {
+		.width = width,
+		.height = height,
+		.channels = 4,
+		.pixels = std::vector <uint8_t> (4 * count)
+	};
+
+	for (size_t i = 0; i < count; i++) {
+		uint8_t grey = pixels[channels * i];
+		uint8_t alpha = (channels == 2) ? pixels[2 * i + 1] : 0xff;
+
+		uint8_t *dst = &result.pixels[4 * i];
+		dst[0] = dst[1] = dst[2] = grey;
+		dst[3] = alpha;
+	}
+
+	return result;
+}
+
+std::vector <glm::vec3> Texture::as_rgb() const
+{
+	if (channels != 4)
+		return as_rgba().as_rgb();
+
+	size_t count = size_t(width) * size_t(height);
+
+	std::vector <uint8_t> packed(3 * count);
+	pack_u8(pixels.data(), packed.data(), 3, count);
+
+	std::vector <glm::vec3> rgb(count);
+	u8_to_f32(packed.data(), (float *) rgb.data(), 3 * count);
+
+	return rgb;
+}
+
+bool Texture::save(const std::filesystem::path &path) const
 {
 	stbi_flip_vertically_on_write(true);
-	stbi_write_png(path.c_str(), width, height, 4, (uint8_t *) pixels.data(), width * sizeof(uint32_t));
+	return stbi_write_png(path.c_str(), width, height, channels, (uint8_t *) pixels.data(), width * channels);
 }
 
 Texture Texture::load(const std::filesystem::path &path)
@@ -22,25 +66,87 @@ Texture Texture::load(const std::filesystem::path &path)
 		return {};
 	}
 
+	// Decoded straight from the page cache
+	std::optional <MappedFile> file = MappedFile::from(path);
+	if (!file) {
+		fprintf(stderr, "Texture::load: could not map %s\n", tr.c_str());
+		return {};
+	}
+
+	Texture texture = decode(file->data, file->size);
+	if (texture.pixels.empty())
+		fprintf(stderr, "Texture::load: failed to decode %s: %s\n", tr.c_str(), stbi_failure_reason());
+
+	return texture;
+}
+
+Texture Texture::decode(const uint8_t *data, size_t size)
+{
 	int width;
 	int height;
 	int channels;
 
+	if (!stbi_info_from_memory(data, size, &width, &height, &channels))
+		return {};
+
+	// Grey and grey with alpha are kept as is; there is no widely
+	// sampleable three channel format, so color is expanded to four
+	int stored = (channels <= 2) ? channels : 4;
+
 	stbi_set_flip_vertically_on_load(true);
 
-	uint8_t *pixels = stbi_load(tr.c_str(), &width, &height, &channels, 4);
+	uint8_t *pixels = stbi_load_from_memory(data, size, &width, &height, &channels, stored);
+	if (!pixels)
+		return {};
 
-	// TODO: use the right number of channels...
-	std::vector <uint8_t> vector;
-	vector.resize(width * height * 4);
-	memcpy(vector.data(), pixels, vector.size() * sizeof(uint8_t));
+	std::vector <uint8_t> vector(pixels, pixels + size_t(width) * height * stored);
 	free(pixels);
 
 	return Texture {
 		.width = width,
 		.height = height,
-		.channels = channels,
-		.pixels = vector
+		.channels = stored,
+		.pixels = std::move(vector)
+	};
+}
+
+HDRTexture HDRTexture::load(const std::filesystem::path &path)
+{
+	std::string tr = path.string();
+
+	std::optional <MappedFile> file = MappedFile::from(path);
+	if (!file) {
+		fprintf(stderr, "HDRTexture::load: could not map %s\n", tr.c_str());
+		return {};
+	}
+
+	HDRTexture texture = decode(file->data, file->size);
+	if (texture.pixels.empty())
+		fprintf(stderr, "HDRTexture::load: failed to decode %s: %s\n", tr.c_str(), stbi_failure_reason());
+
+	return texture;
+}
+
+// Same orientation as Texture::decode
+HDRTexture HDRTexture::decode(const uint8_t *data, size_t size)
+{
+	int width;
+	int height;
+	int channels;
+
+	stbi_set_flip_vertically_on_load(true);
+
+	float *pixels = stbi_loadf_from_memory(data, size, &width, &height, &channels, 4);
+	if (!pixels)
+		return {};
+
+	std::vector <float> vector(pixels, pixels + width * height * 4);
+	free(pixels);
+
+	return HDRTexture {
+		.width = width,
+		.height = height,
+		.pixels = std::move(vector)
 	};
 }
 
@@ -0,0 +1,647 @@
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include <microlog/microlog.h>
+
+#include "core/disk_cache.hpp"
+#include "core/hash.hpp"
+#include "core/profiler.hpp"
+#include "core/texture_cooker.hpp"
+
+namespace ivy {
+
+// Bumped whenever the encoders change, to invalidate the cache
+static constexpr uint32_t COOKER_VERSION = 2;
+
+vk::Format encoding_format(TextureEncoding encoding, bool srgb)
+{
+	switch (encoding) {
+	case TextureEncoding::eBC1:
+		return srgb ? vk::Format::eBc1RgbaSrgbBlock : vk::Format::eBc1RgbaUnormBlock;
+	case TextureEncoding::eBC3:
+		return srgb ? vk::Format::eBc3SrgbBlock : vk::Format::eBc3UnormBlock;
+	case TextureEncoding::eBC5:
+		return vk::Format::eBc5UnormBlock;
+	case TextureEncoding::eBC7:
+		return srgb ? vk::Format::eBc7SrgbBlock : vk::Format::eBc7UnormBlock;
+	case TextureEncoding::eR8:
+		return vk::Format::eR8Unorm;
+	case TextureEncoding::eRG8:
+		return vk::Format::eR8G8Unorm;
+	default:
+		break;
+	}
+
+	return srgb ? vk::Format::eR8G8B8A8Srgb : vk::Format::eR8G8B8A8Unorm;
+}
+
+bool encoding_compressed(TextureEncoding encoding)
+{
+	switch (encoding) {
+	case TextureEncoding::eBC1:
+	case TextureEncoding::eBC3:
+	case TextureEncoding::eBC5:
+	case TextureEncoding::eBC7:
+		return true;
+	default:
+		break;
+	}
+
+	return false;
+}
+
+size_t encoding_block_size(TextureEncoding encoding)
+{
+	switch (encoding) {
+	case TextureEncoding::eBC1:
+		return 8;
+	case TextureEncoding::eBC3:
+	case TextureEncoding::eBC5:
+	case TextureEncoding::eBC7:
+		return 16;
+	case TextureEncoding::eR8:
+		return 1;
+	case TextureEncoding::eRG8:
+		return 2;
+	default:
+		break;
+	}
+
+	return 4;
+}
+
+static size_t level_size(TextureEncoding encoding, uint32_t width, uint32_t height)
+{
+	if (!encoding_compressed(encoding))
+		return size_t(width) * height * encoding_block_size(encoding);
+
+	size_t blocks = size_t((width + 3)/4) * ((height + 3)/4);
+	return blocks * encoding_block_size(encoding);
+}
+
+// Block encoding helpers
+static uint16_t pack_565(const int *c)
+{
+	int r = (c[0] * 31 + 127)/255;
+	int g = (c[1] * 63 + 127)/255;
+	int b = (c[2] * 31 + 127)/255;
+	return (r << 11) | (g << 5) | b;
+}
+
+static void unpack_565(uint16_t v, int *c)
+{
+	int r = (v >> 11) & 31;
+	int g = (v >> 5) & 63;
+	int b = v & 31;
+
+	c[0] = (r << 3) | (r >> 2);
+	c[1] = (g << 2) | (g >> 4);
+	c[2] = (b << 3) | (b >> 2);
+}
+
+// Bounding box of the block, with its diagonal oriented along the
+// correlation with the channel of largest extent
+static void bounding_box(const uint8_t *rgba, int channels, int *lo, int *hi)
+{
+	int mean[4] = { 0, 0, 0, 0 };
+	for (int c = 0; c < channels; c++) {
+		lo[c] = 255;
+		hi[c] = 0;
+		for (int i = 0; i < 16; i++) {
+			int v = rgba[4 * i + c];
+			lo[c] = std::min(lo[c], v);
+			hi[c] = std::max(hi[c], v);
+			mean[c] += v;
+		}
+
+		mean[c] = (mean[c] + 8)/16;
+	}
+
+	int major = 0;
+	for (int c = 1; c < channels; c++) {
+		if (hi[c] - lo[c] > hi[major] - lo[major])
+			major = c;
+	}
+
+	for (int c = 0; c < channels; c++) {
+		if (c == major)
+			continue;
+
+		int covariance = 0;
+		for (int i = 0; i < 16; i++)
+			covariance += (rgba[4 * i + major] - mean[major]) * (rgba[4 * i + c] - mean[c]);
+
+		if (covariance < 0)
+			std::swap(lo[c], hi[c]);
+	}
+
+	// Inset slightly, since the extremes are rarely hit exactly
+	for (int c = 0; c < channels; c++) {
+		int inset = (hi[c] - lo[c])/16;
+		lo[c] += inset;
+		hi[c] -= inset;
+	}
+}
+
+static void encode_color(const uint8_t *rgba, uint8_t *out)
+{
+	int lo[4];
+	int hi[4];
+	bounding_box(rgba, 3, lo, hi);
+
+	uint16_t c0 = pack_565(hi);
+	uint16_t c1 = pack_565(lo);
+
+	// Four color mode requires the first endpoint to be larger
+	if (c0 < c1)
+		std::swap(c0, c1);
+
+	int palette[4][3];
+	unpack_565(c0, palette[0]);
+	unpack_565(c1, palette[1]);
+	for (int c = 0; c < 3; c++) {
+		palette[2][c] = (2 * palette[0][c] + palette[1][c])/3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c])/3;
+	}
+
+	uint32_t indices = 0;
+	if (c0 != c1) {
+		for (int i = 0; i < 16; i++) {
+			int best = 0;
+			int best_error = INT32_MAX;
+			for (int p = 0; p < 4; p++) {
+				int error = 0;
+				for (int c = 0; c < 3; c++) {
+					int d = rgba[4 * i + c] - palette[p][c];
+					error += d * d;
+				}
+
+				if (error < best_error) {
+					best = p;
+					best_error = error;
+				}
+			}
+
+			indices |= uint32_t(best) << (2 * i);
+		}
+	}
+
+	out[0] = c0 & 0xff;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 0xff;
+	out[3] = c1 >> 8;
+	std::memcpy(out + 4, &indices, 4);
+}
+
+// Single channel block, with eight interpolated values
+static void encode_channel(const uint8_t *rgba, int channel, uint8_t *out)
+{
+	int a0 = 0;
+	int a1 = 255;
+	for (int i = 0; i < 16; i++) {
+		a0 = std::max(a0, int(rgba[4 * i + channel]));
+		a1 = std::min(a1, int(rgba[4 * i + channel]));
+	}
+
+	out[0] = a0;
+	out[1] = a1;
+
+	int palette[8] = { a0, a1 };
+	for (int i = 2; i < 8; i++)
+		palette[i] = ((8 - i) * a0 + (i - 1) * a1)/7;
+
+	uint64_t indices = 0;
+	if (a0 != a1) {
+		for (int i = 0; i < 16; i++) {
+			int best = 0;
+			int best_error = INT32_MAX;
+			for (int p = 0; p < 8; p++) {
+				int error = std::abs(rgba[4 * i + channel] - palette[p]);
+				if (error < best_error) {
+					best = p;
+					best_error = error;
+				}
+			}
+
+			indices |= uint64_t(best) << (3 * i);
+		}
+	}
+
+	for (int i = 0; i < 6; i++)
+		out[2 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+void encode_bc1(const uint8_t *rgba, uint8_t *out)
+{
+	encode_color(rgba, out);
+}
+
+void encode_bc3(const uint8_t *rgba, uint8_t *out)
+{
+	encode_channel(rgba, 3, out);
+	encode_color(rgba, out + 8);
+}
+
+void encode_bc5(const uint8_t *rgba, uint8_t *out)
+{
+	encode_channel(rgba, 0, out);
+	encode_channel(rgba, 1, out + 8);
+}
+
+// BC7, restricted to mode 6: a single subset with RGBA endpoints
+// of seven bits plus a shared bit each, and four bit indices
+struct BitWriter {
+	uint8_t *out;
+	uint32_t position = 0;
+
+	void put(uint32_t value, uint32_t bits) {
+		for (uint32_t i = 0; i < bits; i++, position++) {
+			if ((value >> i) & 1)
+				out[position >> 3] |= 1 << (position & 7);
+		}
+	}
+};
+
+static constexpr int BC7_WEIGHTS[16] = {
+	0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64
+};
+
+// Seven bit endpoint and its shared bit, closest to the target
+static void quantize_bc7(const int *target, int *quantized, int &pbit)
+{
+	int best_error = INT32_MAX;
+	for (int p = 0; p < 2; p++) {
+		int error = 0;
+		int candidate[4];
+		for (int c = 0; c < 4; c++) {
+			candidate[c] = std::clamp((target[c] - p + 1)/2, 0, 127);
+			int d = target[c] - ((candidate[c] << 1) | p);
+			error += d * d;
+		}
+
+		if (error < best_error) {
+			best_error = error;
+			pbit = p;
+			std::copy(candidate, candidate + 4, quantized);
+		}
+	}
+}
+
+void encode_bc7(const uint8_t *rgba, uint8_t *out)
+{
+	int lo[4];
+	int hi[4];
+	bounding_box(rgba, 4, lo, hi);
+
+	int e[2][4];
+	int p[2];
+	quantize_bc7(lo, e[0], p[0]);
+	quantize_bc7(hi, e[1], p[1]);
+
+	int palette[16][4];
+	for (int c = 0; c < 4; c++) {
+		int v0 = (e[0][c] << 1) | p[0];
+		int v1 = (e[1][c] << 1) | p[1];
+		for (int i = 0; i < 16; i++)
+			palette[i][c] = ((64 - BC7_WEIGHTS[i]) * v0 + BC7_WEIGHTS[i] * v1 + 32) >> 6;
+	}
+
+	int indices[16];
+	for (int i = 0; i < 16; i++) {
+		int best_error = INT32_MAX;
+		for (int k = 0; k < 16; k++) {
+			int error = 0;
+			for (int c = 0; c < 4; c++) {
+				int d = rgba[4 * i + c] - palette[k][c];
+				error += d * d;
+			}
+
+			if (error < best_error) {
+				best_error = error;
+				indices[i] = k;
+			}
+		}
+	}
+
+	// The top bit of the first index is implicitly zero
+	if (indices[0] >= 8) {
+		std::swap(e[0], e[1]);
+		std::swap(p[0], p[1]);
+		for (int i = 0; i < 16; i++)
+			indices[i] = 15 - indices[i];
+	}
+
+	std::memset(out, 0, 16);
+
+	BitWriter writer { out };
+	writer.put(1 << 6, 7);
+	for (int c = 0; c < 4; c++) {
+		writer.put(e[0][c], 7);
+		writer.put(e[1][c], 7);
+	}
+
+	writer.put(p[0], 1);
+	writer.put(p[1], 1);
+
+	writer.put(indices[0], 3);
+	for (int i = 1; i < 16; i++)
+		writer.put(indices[i], 4);
+}
+
+// Encoding whole levels, rows of blocks in parallel
+static void encode_level(const Texture &level, TextureEncoding encoding, uint8_t *out)
+{
+	if (!encoding_compressed(encoding)) {
+		std::memcpy(out, level.pixels.data(), level.pixels.size());
+		return;
+	}
+
+	int bw = (level.width + 3)/4;
+	int bh = (level.height + 3)/4;
+	size_t block_size = encoding_block_size(encoding);
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int by = 0; by < bh; by++) {
+		uint8_t block[64];
+		for (int bx = 0; bx < bw; bx++) {
+			// Edges are padded by clamping
+			for (int y = 0; y < 4; y++) {
+				for (int x = 0; x < 4; x++) {
+					int sx = std::min(4 * bx + x, level.width - 1);
+					int sy = std::min(4 * by + y, level.height - 1);
+					std::memcpy(&block[4 * (4 * y + x)], &level.pixels[4 * (sy * level.width + sx)], 4);
+				}
+			}
+
+			uint8_t *dst = out + (by * bw + bx) * block_size;
+			switch (encoding) {
+			case TextureEncoding::eBC1:
+				encode_bc1(block, dst);
+				break;
+			case TextureEncoding::eBC3:
+				encode_bc3(block, dst);
+				break;
+			case TextureEncoding::eBC5:
+				encode_bc5(block, dst);
+				break;
+			case TextureEncoding::eBC7:
+				encode_bc7(block, dst);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+// Cooking
+std::vector <Texture> TextureCooker::mip_chain(const Texture &texture)
+{
+	std::vector <Texture> chain { texture };
+
+	while (chain.back().width > 1 || chain.back().height > 1) {
+		const Texture &src = chain.back();
+
+		Texture dst;
+		dst.width = std::max(src.width/2, 1);
+		dst.height = std::max(src.height/2, 1);
+		dst.channels = src.channels;
+		dst.pixels.resize(size_t(dst.channels) * dst.width * dst.height);
+
+		int n = src.channels;
+
+		for (int y = 0; y < dst.height; y++) {
+			int y0 = std::min(2 * y, src.height - 1);
+			int y1 = std::min(2 * y + 1, src.height - 1);
+
+			for (int x = 0; x < dst.width; x++) {
+				int x0 = std::min(2 * x, src.width - 1);
+				int x1 = std::min(2 * x + 1, src.width - 1);
+
+				for (int c = 0; c < n; c++) {
+					int sum = src.pixels[n * (y0 * src.width + x0) + c]
+						+ src.pixels[n * (y0 * src.width + x1) + c]
+						+ src.pixels[n * (y1 * src.width + x0) + c]
+						+ src.pixels[n * (y1 * src.width + x1) + c];
+
+					dst.pixels[n * (y * dst.width + x) + c] = (sum + 2)/4;
+				}
+			}
+		}
+
+		chain.push_back(std::move(dst));
+	}
+
+	return chain;
+}
+
+TextureFormat TextureCooker::choose(const Texture &texture, TextureRole role) const
+{
+	if (texture.channels == 1)
+		return { TextureEncoding::eR8, false };
+
+	if (texture.channels == 2)
+		return { TextureEncoding::eRG8, false };
+
+	// Normals are data, and their third channel is rebuilt when sampled
+	if (role == TextureRole::eNormal)
+		return { block_compression ? TextureEncoding::eBC5 : TextureEncoding::eRGBA8, false };
+
+	size_t count = size_t(texture.width) * texture.height;
+
+	bool opaque = true;
+	for (size_t i = 0; i < count; i++)
+		opaque &= (texture.pixels[4 * i + 3] == 255);
+
+	if (!block_compression)
+		return { TextureEncoding::eRGBA8, true };
+
+	if (high_quality)
+		return { TextureEncoding::eBC7, true };
+
+	return { opaque ? TextureEncoding::eBC1 : TextureEncoding::eBC3, true };
+}
+
+CookedTexture TextureCooker::cook(const Texture &texture, TextureRole role) const
+{
+	IVY_PROFILE_SCOPE("TextureCooker::cook");
+
+	auto [encoding, srgb] = choose(texture, role);
+
+	uint64_t h = hash_bytes(texture.pixels.data(), texture.pixels.size());
+	h = hash_value(texture.width, h);
+	h = hash_value(texture.height, h);
+	h = hash_value(texture.channels, h);
+	h = hash_value(encoding, h);
+	h = hash_value(srgb, h);
+	h = hash_value(COOKER_VERSION, h);
+
+	std::string key = hash_hex(h) + ".ktx2";
+
+	if (cache) {
+		if (auto data = read_cache("textures", key)) {
+			if (auto cooked = CookedTexture::deserialize(*data))
+				return *cooked;
+
+			ulog_warning("texture cooker", "discarding invalid cache entry %s\n", key.c_str());
+		}
+	}
+
+	// Uncompressed mips are cheaper to blit at upload than to store
+	std::vector <Texture> chain;
+	if (encoding_compressed(encoding))
+		chain = mip_chain(texture.as_rgba());
+	else
+		chain = { texture };
+
+	CookedTexture cooked;
+	cooked.encoding = encoding;
+	cooked.srgb = srgb;
+	cooked.width = texture.width;
+	cooked.height = texture.height;
+
+	size_t offset = 0;
+	for (const Texture &level : chain) {
+		size_t size = level_size(encoding, level.width, level.height);
+		cooked.levels.push_back({ uint32_t(level.width), uint32_t(level.height), offset, size });
+		offset += size;
+	}
+
+	cooked.data.resize(offset);
+	for (size_t i = 0; i < chain.size(); i++)
+		encode_level(chain[i], encoding, &cooked.data[cooked.levels[i].offset]);
+
+	if (cache)
+		write_cache("textures", key, cooked.serialize());
+
+	return cooked;
+}
+
+uint32_t CookedTexture::mip_count() const
+{
+	if (!device_mips())
+		return levels.size();
+
+	return std::bit_width(std::max(width, height));
+}
+
+// KTX2 container; levels are stored smallest first, as the format expects
+static constexpr uint8_t KTX2_IDENTIFIER[12] = {
+	0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A
+};
+
+struct KTX2Header {
+	uint8_t identifier[12];
+	uint32_t format;
+	uint32_t type_size;
+	uint32_t width;
+	uint32_t height;
+	uint32_t depth;
+	uint32_t layers;
+	uint32_t faces;
+	uint32_t levels;
+	uint32_t supercompression;
+	uint32_t dfd_offset;
+	uint32_t dfd_length;
+	uint32_t kvd_offset;
+	uint32_t kvd_length;
+	uint64_t sgd_offset;
+	uint64_t sgd_length;
+};
+
+struct KTX2Level {
+	uint64_t offset;
+	uint64_t length;
+	uint64_t uncompressed_length;
+};
+
+static_assert(sizeof(KTX2Header) == 80);
+
+std::vector <uint8_t> CookedTexture::serialize() const
+{
+	KTX2Header header {};
+	std::memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+	header.format = uint32_t(format());
+	header.type_size = 1;
+	header.width = width;
+	header.height = height;
+	header.faces = 1;
+	header.levels = levels.size();
+
+	size_t index_size = levels.size() * sizeof(KTX2Level);
+	size_t start = (sizeof(KTX2Header) + index_size + 15) & ~size_t(15);
+
+	std::vector <uint8_t> result(start + data.size());
+	std::memcpy(result.data(), &header, sizeof(header));
+
+	size_t offset = start;
+	for (size_t i = levels.size(); i-- > 0; ) {
+		const Level &level = levels[i];
+
+		KTX2Level entry { offset, level.size, level.size };
+		std::memcpy(&result[sizeof(KTX2Header) + i * sizeof(KTX2Level)], &entry, sizeof(entry));
+		std::memcpy(&result[offset], &data[level.offset], level.size);
+		offset += level.size;
+	}
+
+	return result;
+}
+
+std::optional <CookedTexture> CookedTexture::deserialize(const std::vector <uint8_t> &bytes)
+{
+	if (bytes.size() < sizeof(KTX2Header))
+		return std::nullopt;
+
+	KTX2Header header;
+	std::memcpy(&header, bytes.data(), sizeof(header));
+	if (std::memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+		return std::nullopt;
+
+	CookedTexture cooked;
+	cooked.width = header.width;
+	cooked.height = header.height;
+
+	static constexpr TextureEncoding encodings[] = {
+		TextureEncoding::eRGBA8, TextureEncoding::eBC1, TextureEncoding::eBC3,
+		TextureEncoding::eBC5, TextureEncoding::eBC7, TextureEncoding::eR8,
+		TextureEncoding::eRG8
+	};
+
+	bool known = false;
+	for (TextureEncoding encoding : encodings) {
+		for (bool srgb : { false, true }) {
+			if (!known && uint32_t(encoding_format(encoding, srgb)) == header.format) {
+				cooked.encoding = encoding;
+				cooked.srgb = srgb;
+				known = true;
+			}
+		}
+	}
+
+	if (!known || header.levels == 0)
+		return std::nullopt;
+
+	if (bytes.size() < sizeof(KTX2Header) + header.levels * sizeof(KTX2Level))
+		return std::nullopt;
+
+	size_t offset = 0;
+	for (uint32_t i = 0; i < header.levels; i++) {
+		KTX2Level entry;
+		std::memcpy(&entry, &bytes[sizeof(KTX2Header) + i * sizeof(KTX2Level)], sizeof(entry));
+
+		uint32_t width = std::max(header.width >> i, 1u);
+		uint32_t height = std::max(header.height >> i, 1u);
+		if (entry.length != level_size(cooked.encoding, width, height)
+				|| entry.offset + entry.length > bytes.size())
+			return std::nullopt;
+
+		cooked.levels.push_back({ width, height, offset, size_t(entry.length) });
+		cooked.data.insert(cooked.data.end(), &bytes[entry.offset], &bytes[entry.offset] + entry.length);
+		offset += entry.length;
+	}
+
+	return cooked;
+}
+
+}
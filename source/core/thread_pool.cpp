@@ -0,0 +1,54 @@
+#include <algorithm>
+
+#include <fmt/format.h>
+
+#include "core/profiler.hpp"
+#include "core/thread_pool.hpp"
+
+namespace ivy {
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard guard(lock);
+		stopping = true;
+	}
+
+	signal.notify_all();
+	for (std::thread &worker : workers)
+		worker.join();
+}
+
+ThreadPool *ThreadPool::from(size_t count)
+{
+	if (count == 0)
+		count = std::max(1u, std::thread::hardware_concurrency());
+
+	ThreadPool *pool = new ThreadPool();
+	for (size_t i = 0; i < count; i++) {
+		pool->workers.emplace_back([pool, i]() {
+			IVY_PROFILE_THREAD(fmt::format("Worker {}", i));
+
+			while (true) {
+				std::function <void ()> job;
+
+				{
+					std::unique_lock guard(pool->lock);
+					pool->signal.wait(guard, [pool]() { return pool->stopping || !pool->jobs.empty(); });
+					if (pool->stopping && pool->jobs.empty())
+						return;
+
+					job = std::move(pool->jobs.front());
+					pool->jobs.pop_front();
+				}
+
+				IVY_PROFILE_SCOPE("Job");
+				job();
+			}
+		});
+	}
+
+	return pool;
+}
+
+}
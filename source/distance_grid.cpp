@@ -0,0 +1,456 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <limits>
+
+#include "core/profiler.hpp"
+#include "distance_grid.hpp"
+
+namespace ivy::sdf {
+
+// Empty samples around the mesh, so that the outside is resolved
+static constexpr uint32_t PADDING = 3;
+
+// Samples within this many cells of a triangle's plane, and of its
+// bounds, are seeded with their exact distance to it
+static constexpr float SEED_BAND = 2.0f;
+
+static constexpr uint32_t NO_TRIANGLE = UINT32_MAX;
+
+float DistanceGrid::distance(const glm::vec3 &p) const
+{
+	glm::vec3 g = (p - origin)/cell;
+	glm::vec3 clamped = glm::clamp(g, glm::vec3(0.0f), glm::vec3(dims - 1u));
+
+	glm::uvec3 lo = glm::min(glm::uvec3(clamped), dims - 2u);
+	glm::vec3 t = clamped - glm::vec3(lo);
+
+	float c00 = glm::mix((*this)(lo.x, lo.y, lo.z), (*this)(lo.x + 1, lo.y, lo.z), t.x);
+	float c10 = glm::mix((*this)(lo.x, lo.y + 1, lo.z), (*this)(lo.x + 1, lo.y + 1, lo.z), t.x);
+	float c01 = glm::mix((*this)(lo.x, lo.y, lo.z + 1), (*this)(lo.x + 1, lo.y, lo.z + 1), t.x);
+	float c11 = glm::mix((*this)(lo.x, lo.y + 1, lo.z + 1), (*this)(lo.x + 1, lo.y + 1, lo.z + 1), t.x);
+
+	float d = glm::mix(glm::mix(c00, c10, t.y), glm::mix(c01, c11, t.y), t.z);
+
+	// Outside the grid, the offset to its boundary and the distance
+	// sampled there are taken as the legs of a right triangle
+	float o = glm::length(g - clamped) * cell;
+	if (d >= 0.0f)
+		return std::sqrt(d * d + o * o);
+
+	return d + o;
+}
+
+void DistanceGrid::distance(const glm::vec3 *points, float *distances, size_t count) const
+{
+	#pragma omp parallel for if (count > 4096)
+	for (ptrdiff_t i = 0; i < ptrdiff_t(count); i++)
+		distances[i] = distance(points[i]);
+}
+
+// Closest point on a triangle, by the region of the point
+static glm::vec3 closest_point(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c)
+{
+	glm::vec3 ab = b - a;
+	glm::vec3 ac = c - a;
+	glm::vec3 ap = p - a;
+
+	float d1 = glm::dot(ab, ap);
+	float d2 = glm::dot(ac, ap);
+	if (d1 <= 0.0f && d2 <= 0.0f)
+		return a;
+
+	glm::vec3 bp = p - b;
+	float d3 = glm::dot(ab, bp);
+	float d4 = glm::dot(ac, bp);
+	if (d3 >= 0.0f && d4 <= d3)
+		return b;
+
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+		return a + ab * (d1/(d1 - d3));
+
+	glm::vec3 cp = p - c;
+	float d5 = glm::dot(ab, cp);
+	float d6 = glm::dot(ac, cp);
+	if (d6 >= 0.0f && d5 <= d6)
+		return c;
+
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+		return a + ac * (d2/(d2 - d6));
+
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+		return b + (c - b) * ((d4 - d3)/((d4 - d3) + (d5 - d6)));
+
+	// Degenerate triangles are caught by the edges above
+	float sum = va + vb + vc;
+	if (sum <= 0.0f)
+		return a;
+
+	return a + ab * (vb/sum) + ac * (vc/sum);
+}
+
+// Vertices copied out of the mesh, so that testing a triangle touches one
+// cache line rather than three scattered ones
+struct Triangle {
+	glm::vec3 a;
+	glm::vec3 b;
+	glm::vec3 c;
+};
+
+struct MeshSweeper {
+	std::vector <Triangle> triangles;
+	DistanceGrid &grid;
+
+	// Nearest triangle found so far for each sample
+	std::vector <uint32_t> nearest;
+
+	size_t index(uint32_t x, uint32_t y, uint32_t z) const {
+		return (size_t(z) * grid.dims.y + y) * grid.dims.x + x;
+	}
+
+	glm::vec3 position(uint32_t x, uint32_t y, uint32_t z) const {
+		return grid.origin + glm::vec3(x, y, z) * grid.cell;
+	}
+
+	float distance(uint32_t triangle, const glm::vec3 &p) const {
+		const Triangle &tri = triangles[triangle];
+		return glm::distance(p, closest_point(p, tri.a, tri.b, tri.c));
+	}
+
+	// Every sample near a triangle takes the nearest of them; the distance
+	// and the triangle are packed so that one atomic minimum keeps both
+	void seed() {
+		IVY_PROFILE_SCOPE("DistanceGrid::seed");
+
+		size_t samples = grid.values.size();
+
+		std::vector <uint64_t> packed(samples, UINT64_MAX);
+
+		#pragma omp parallel for schedule(dynamic, 256)
+		for (ptrdiff_t t = 0; t < ptrdiff_t(triangles.size()); t++) {
+			const Triangle &tri = triangles[t];
+			glm::vec3 lo = glm::min(tri.a, glm::min(tri.b, tri.c));
+			glm::vec3 hi = glm::max(tri.a, glm::max(tri.b, tri.c));
+
+			glm::vec3 first = glm::ceil((lo - grid.origin)/grid.cell - SEED_BAND);
+			glm::vec3 last = glm::floor((hi - grid.origin)/grid.cell + SEED_BAND);
+			glm::uvec3 begin(glm::max(first, glm::vec3(0.0f)));
+			glm::uvec3 end(glm::min(last, glm::vec3(grid.dims - 1u)));
+
+			// Plane in grid coordinates; degenerate triangles keep their
+			// whole bounds
+			glm::vec3 normal = glm::cross(tri.b - tri.a, tri.c - tri.a);
+			float length = glm::length(normal);
+			normal = (length > 0.0f) ? normal/length : glm::vec3(0.0f);
+
+			glm::vec3 a = (tri.a - grid.origin)/grid.cell;
+			float offset = glm::dot(normal, a);
+
+			for (uint32_t z = begin.z; z <= end.z; z++) {
+				for (uint32_t y = begin.y; y <= end.y; y++) {
+					// Span of the row within the band of the plane
+					float rest = normal.y * y + normal.z * z - offset;
+
+					uint32_t row_begin = begin.x;
+					uint32_t row_end = end.x;
+					if (std::abs(normal.x) > 1e-6f) {
+						float x0 = (-SEED_BAND - rest)/normal.x;
+						float x1 = (SEED_BAND - rest)/normal.x;
+						float from = std::max(std::ceil(std::min(x0, x1)), float(begin.x));
+						float to = std::min(std::floor(std::max(x0, x1)), float(end.x));
+						if (from > to)
+							continue;
+
+						row_begin = uint32_t(from);
+						row_end = uint32_t(to);
+					} else if (std::abs(rest) > SEED_BAND) {
+						continue;
+					}
+
+					for (uint32_t x = row_begin; x <= row_end; x++) {
+						float d = distance(t, position(x, y, z));
+
+						// Non-negative floats order the same as their bits
+						uint64_t key = (uint64_t(std::bit_cast <uint32_t> (d)) << 32) | uint64_t(t);
+
+						std::atomic_ref <uint64_t> slot(packed[index(x, y, z)]);
+						uint64_t current = slot.load(std::memory_order_relaxed);
+						while (key < current && !slot.compare_exchange_weak(current, key, std::memory_order_relaxed));
+					}
+				}
+			}
+		}
+
+		#pragma omp parallel for
+		for (ptrdiff_t i = 0; i < ptrdiff_t(samples); i++) {
+			if (packed[i] == UINT64_MAX)
+				continue;
+
+			grid.values[i] = std::bit_cast <float> (uint32_t(packed[i] >> 32));
+			nearest[i] = uint32_t(packed[i]);
+		}
+	}
+
+	// Rows along x are swept in order; rows on the same diagonal of the
+	// yz plane only depend on earlier diagonals, so those run in parallel
+	void sweep(int dx, int dy, int dz) {
+		int nx = grid.dims.x;
+		int ny = grid.dims.y;
+		int nz = grid.dims.z;
+
+		for (int level = 0; level < ny + nz - 1; level++) {
+			int first = std::max(0, level - (nz - 1));
+			int last = std::min(ny - 1, level);
+
+			#pragma omp parallel for schedule(dynamic, 4)
+			for (int jj = first; jj <= last; jj++) {
+				int kk = level - jj;
+				int y = dy > 0 ? jj : ny - 1 - jj;
+				int z = dz > 0 ? kk : nz - 1 - kk;
+				int py = y - dy;
+				int pz = z - dz;
+
+				bool has_y = (py >= 0 && py < ny);
+				bool has_z = (pz >= 0 && pz < nz);
+
+				for (int ii = 0; ii < nx; ii++) {
+					int x = dx > 0 ? ii : nx - 1 - ii;
+					int px = x - dx;
+					bool has_x = (px >= 0 && px < nx);
+
+					// Nearest triangles of the neighbors already swept over,
+					// each tested once
+					uint32_t candidates[7];
+					uint32_t count = 0;
+
+					auto gather = [&](bool valid, int cx, int cy, int cz) {
+						if (!valid)
+							return;
+
+						uint32_t t = nearest[index(cx, cy, cz)];
+						if (t == NO_TRIANGLE || std::find(candidates, candidates + count, t) != candidates + count)
+							return;
+
+						candidates[count++] = t;
+					};
+
+					gather(has_x, px, y, z);
+					gather(has_y, x, py, z);
+					gather(has_z, x, y, pz);
+					gather(has_x && has_y, px, py, z);
+					gather(has_x && has_z, px, y, pz);
+					gather(has_y && has_z, x, py, pz);
+					gather(has_x && has_y && has_z, px, py, pz);
+
+					size_t sample = index(x, y, z);
+					glm::vec3 p = position(x, y, z);
+
+					for (uint32_t i = 0; i < count; i++) {
+						if (candidates[i] == nearest[sample])
+							continue;
+
+						float d = distance(candidates[i], p);
+						if (d < grid.values[sample]) {
+							grid.values[sample] = d;
+							nearest[sample] = candidates[i];
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// One round in each of the eight directions; exact distances are
+	// carried by the triangles, so a second round barely changes them
+	void sweep() {
+		IVY_PROFILE_SCOPE("DistanceGrid::sweep");
+
+		for (uint32_t i = 0; i < 8; i++)
+			sweep((i & 1) ? -1 : 1, (i & 2) ? -1 : 1, (i & 4) ? -1 : 1);
+	}
+
+	// Casts a ray along the axis through every row of samples, counting
+	// the triangles crossed before each sample; odd counts are a vote for
+	// the inside
+	void vote(const BVH &bvh, int axis, std::vector <uint8_t> &votes) const {
+		int u = (axis + 1) % 3;
+		int v = (axis + 2) % 3;
+
+		int nu = grid.dims[u];
+		int nv = grid.dims[v];
+		int na = grid.dims[axis];
+
+		// Off the lattice, so that rays rarely graze shared edges
+		float offset_u = 0.0137f * grid.cell;
+		float offset_v = 0.0291f * grid.cell;
+
+		#pragma omp parallel for schedule(dynamic, 16)
+		for (int row = 0; row < nu * nv; row++) {
+			int i = row % nu;
+			int j = row/nu;
+
+			float ru = grid.origin[u] + i * grid.cell + offset_u;
+			float rv = grid.origin[v] + j * grid.cell + offset_v;
+
+			std::vector <float> crossings;
+
+			uint32_t stack[64];
+			uint32_t top = 0;
+			stack[top++] = 0;
+
+			while (top > 0) {
+				const BVH::Node &node = bvh.nodes[stack[--top]];
+				if (ru < node.min[u] || ru > node.max[u] || rv < node.min[v] || rv > node.max[v])
+					continue;
+
+				if (node.count == 0) {
+					stack[top++] = node.first;
+					stack[top++] = node.first + 1;
+					continue;
+				}
+
+				for (uint32_t k = node.first; k < node.first + node.count; k++) {
+					const glm::vec3 &a = triangles[bvh.indices[k]].a;
+					const glm::vec3 &b = triangles[bvh.indices[k]].b;
+					const glm::vec3 &c = triangles[bvh.indices[k]].c;
+
+					// Edge functions in the plane across the axis
+					float wa = (b[u] - ru) * (c[v] - rv) - (b[v] - rv) * (c[u] - ru);
+					float wb = (c[u] - ru) * (a[v] - rv) - (c[v] - rv) * (a[u] - ru);
+					float wc = (a[u] - ru) * (b[v] - rv) - (a[v] - rv) * (b[u] - ru);
+
+					bool positive = (wa >= 0.0f && wb >= 0.0f && wc >= 0.0f);
+					bool negative = (wa <= 0.0f && wb <= 0.0f && wc <= 0.0f);
+					float sum = wa + wb + wc;
+					if ((!positive && !negative) || sum == 0.0f)
+						continue;
+
+					crossings.push_back((wa * a[axis] + wb * b[axis] + wc * c[axis])/sum);
+				}
+			}
+
+			if (crossings.empty())
+				continue;
+
+			std::sort(crossings.begin(), crossings.end());
+
+			size_t crossed = 0;
+			for (int k = 0; k < na; k++) {
+				float position = grid.origin[axis] + k * grid.cell;
+				while (crossed < crossings.size() && crossings[crossed] < position)
+					crossed++;
+
+				if (crossed & 1) {
+					glm::uvec3 c;
+					c[axis] = k;
+					c[u] = i;
+					c[v] = j;
+					votes[index(c.x, c.y, c.z)]++;
+				}
+			}
+		}
+	}
+
+	void sign() {
+		IVY_PROFILE_SCOPE("DistanceGrid::sign");
+
+		std::vector <AABB> boxes;
+		for (const Triangle &tri : triangles)
+			boxes.push_back({ glm::min(tri.a, glm::min(tri.b, tri.c)), glm::max(tri.a, glm::max(tri.b, tri.c)) });
+
+		BVH bvh = BVH::from(boxes);
+
+		// Each axis visits every sample once, so votes never race
+		std::vector <uint8_t> votes(grid.values.size(), 0);
+		for (int axis = 0; axis < 3; axis++)
+			vote(bvh, axis, votes);
+
+		#pragma omp parallel for
+		for (ptrdiff_t i = 0; i < ptrdiff_t(votes.size()); i++) {
+			if (votes[i] >= 2)
+				grid.values[i] = -grid.values[i];
+		}
+	}
+};
+
+DistanceGrid DistanceGrid::from(const Mesh &mesh, float cell)
+{
+	IVY_PROFILE_SCOPE("DistanceGrid::from");
+
+	glm::vec3 lo(0.0f);
+	glm::vec3 hi(0.0f);
+	if (!mesh.positions.empty()) {
+		lo = hi = mesh.positions[0];
+		for (const glm::vec3 &p : mesh.positions) {
+			lo = glm::min(lo, p);
+			hi = glm::max(hi, p);
+		}
+	}
+
+	DistanceGrid grid;
+	grid.cell = cell;
+	grid.origin = lo - float(PADDING) * cell;
+	grid.dims = glm::uvec3(glm::ceil((hi - lo)/cell)) + 2u * PADDING + 1u;
+	grid.values.assign(size_t(grid.dims.x) * grid.dims.y * grid.dims.z, std::numeric_limits <float> ::max());
+
+	if (mesh.triangles.empty())
+		return grid;
+
+	MeshSweeper sweeper { {}, grid, std::vector <uint32_t> (grid.values.size(), NO_TRIANGLE) };
+	for (const glm::uvec3 &tri : mesh.triangles)
+		sweeper.triangles.push_back({ mesh.positions[tri.x], mesh.positions[tri.y], mesh.positions[tri.z] });
+
+	sweeper.seed();
+	sweeper.sweep();
+	sweeper.sign();
+
+	return grid;
+}
+
+GridInstance GridInstance::from(const std::shared_ptr <const DistanceGrid> &grid, const Transform &transform)
+{
+	glm::mat4 model = transform.matrix();
+	glm::vec3 scale = glm::abs(transform.scale);
+
+	AABB local = grid->bounds();
+
+	AABB box { glm::vec3(std::numeric_limits <float> ::max()), glm::vec3(-std::numeric_limits <float> ::max()) };
+	for (uint32_t i = 0; i < 8; i++) {
+		glm::vec3 corner {
+			(i & 1) ? local.max.x : local.min.x,
+			(i & 2) ? local.max.y : local.min.y,
+			(i & 4) ? local.max.z : local.min.z
+		};
+
+		corner = glm::vec3(model * glm::vec4(corner, 1.0f));
+		box.min = glm::min(box.min, corner);
+		box.max = glm::max(box.max, corner);
+	}
+
+	return { grid, glm::inverse(model), std::min({ scale.x, scale.y, scale.z }), box };
+}
+
+float GridInstance::distance(const glm::vec3 &p) const
+{
+	return scale * grid->distance(glm::vec3(inverse * glm::vec4(p, 1.0f)));
+}
+
+glm::vec3 GridInstance::gradient(const glm::vec3 &p) const
+{
+	float h = 0.5f * grid->cell * scale;
+
+	glm::vec3 g {
+		distance(p + glm::vec3(h, 0, 0)) - distance(p - glm::vec3(h, 0, 0)),
+		distance(p + glm::vec3(0, h, 0)) - distance(p - glm::vec3(0, h, 0)),
+		distance(p + glm::vec3(0, 0, h)) - distance(p - glm::vec3(0, 0, h)),
+	};
+
+	float length = glm::length(g);
+	return (length > 0.0f) ? g/length : glm::vec3(0.0f);
+}
+
+}
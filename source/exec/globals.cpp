@@ -1,38 +1,167 @@
+#include <cstring>
+
+#include <microlog/microlog.h>
+
 #include "exec/globals.hpp"
 
 namespace ivy::exec {
 
-VulkanResourceBase prepare_vulkan_resource_base()
+// Device extensions needed by the engine, besides presentation
+static const std::vector <const char *> EXTENSIONS {
+	VK_KHR_FRAGMENT_SHADER_BARYCENTRIC_EXTENSION_NAME,
+	VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
+	VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME
+};
+
+// Feature structures, chained in place
+struct DeviceFeatures {
+	vk::PhysicalDeviceFeatures2KHR features {};
+	vk::PhysicalDeviceFragmentShaderBarycentricFeaturesKHR barycentrics {};
+	vk::PhysicalDeviceSeparateDepthStencilLayoutsFeaturesKHR separation {};
+	vk::PhysicalDeviceDescriptorIndexingFeaturesEXT indexing {};
+	vk::PhysicalDeviceTimelineSemaphoreFeaturesKHR timeline {};
+};
+
+static void query_features(const vk::PhysicalDevice &phdev, DeviceFeatures &df)
 {
-	// Device extensions
-	static const std::vector <const char *> EXTENSIONS {
-		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
-		VK_KHR_FRAGMENT_SHADER_BARYCENTRIC_EXTENSION_NAME
-	};
+	df.barycentrics.fragmentShaderBarycentric = vk::True;
+	df.separation.separateDepthStencilLayouts = vk::True;
+
+	// Bindless textures and materials
+	df.indexing.runtimeDescriptorArray = vk::True;
+	df.indexing.descriptorBindingPartiallyBound = vk::True;
+	df.indexing.descriptorBindingVariableDescriptorCount = vk::True;
+	df.indexing.descriptorBindingSampledImageUpdateAfterBind = vk::True;
+	df.indexing.descriptorBindingUpdateUnusedWhilePending = vk::True;
+
+	// Frame pacing
+	df.timeline.timelineSemaphore = vk::True;
+
+	// Core features, including block compressed textures and anisotropic
+	// filtering, are enabled exactly where getFeatures2 reports them
+
+	df.features.pNext = &df.barycentrics;
+	df.barycentrics.pNext = &df.separation;
+	df.separation.pNext = &df.indexing;
+	df.indexing.pNext = &df.timeline;
+
+	phdev.getFeatures2(&df.features);
+}
+
+// Enabled whenever the device has them
+static const std::vector <const char *> OPTIONAL_EXTENSIONS {
+	VK_EXT_MEMORY_BUDGET_EXTENSION_NAME
+};
+
+static bool supports_extension(const std::vector <vk::ExtensionProperties> &available, const char *name)
+{
+	for (const vk::ExtensionProperties &properties : available) {
+		if (std::strcmp(properties.extensionName, name) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+static void add_optional_extensions(const vk::PhysicalDevice &phdev, std::vector <const char *> &extensions)
+{
+	auto available = phdev.enumerateDeviceExtensionProperties();
+	for (const char *name : OPTIONAL_EXTENSIONS) {
+		if (supports_extension(available, name))
+			extensions.push_back(name);
+	}
+}
+
+VulkanResourceBase prepare_vulkan_resource_base(uint32_t frames_in_flight)
+{
+	std::vector <const char *> extensions = EXTENSIONS;
+	extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 
 	// Load physical device
-	auto predicate = [](vk::PhysicalDevice phdev) {
-		return littlevk::physical_device_able(phdev, EXTENSIONS);
+	auto predicate = [&](vk::PhysicalDevice phdev) {
+		return littlevk::physical_device_able(phdev, extensions);
 	};
 
 	vk::PhysicalDevice phdev = littlevk::pick_physical_device(predicate);
+	add_optional_extensions(phdev, extensions);
 
 	// Enable features
-	vk::PhysicalDeviceFeatures2KHR features {};
+	DeviceFeatures df;
+	query_features(phdev, df);
 
-	vk::PhysicalDeviceFragmentShaderBarycentricFeaturesKHR barycentrics {};
-	barycentrics.fragmentShaderBarycentric = vk::True;
+	// Create the resource base
+	return VulkanResourceBase::from(phdev, extensions, df.features, frames_in_flight);
+}
 
-	vk::PhysicalDeviceSeparateDepthStencilLayoutsFeaturesKHR separation {};
-	separation.separateDepthStencilLayouts = vk::True;
+// Prefer dedicated hardware, but accept software implementations (e.g.
+// lavapipe) so that batch runs work on machines without a GPU
+static int device_rank(vk::PhysicalDeviceType type)
+{
+	switch (type) {
+	case vk::PhysicalDeviceType::eDiscreteGpu:
+		return 4;
+	case vk::PhysicalDeviceType::eIntegratedGpu:
+		return 3;
+	case vk::PhysicalDeviceType::eVirtualGpu:
+		return 2;
+	case vk::PhysicalDeviceType::eCpu:
+		return 1;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+VulkanResourceBase prepare_headless_resource_base(const vk::Extent2D &extent, uint32_t frames_in_flight)
+{
+	// No window system extensions are needed
+	vk::ApplicationInfo application {
+		"IVY", VK_MAKE_VERSION(1, 0, 0),
+		"IVY", VK_MAKE_VERSION(1, 0, 0),
+		VK_API_VERSION_1_2
+	};
 
-	features.pNext = &barycentrics;
-	barycentrics.pNext = &separation;
+	vk::Instance instance = vk::createInstance(vk::InstanceCreateInfo { {}, &application });
 
-	phdev.getFeatures2(&features);
+	// Pick the best device with the necessary extensions
+	vk::PhysicalDevice phdev;
+	int best = -1;
 
-	// Create the resource base
-	return VulkanResourceBase::from(phdev, EXTENSIONS, features);
+	for (const vk::PhysicalDevice &candidate : instance.enumeratePhysicalDevices()) {
+		auto available = candidate.enumerateDeviceExtensionProperties();
+
+		bool able = true;
+		for (const char *name : EXTENSIONS)
+			able &= supports_extension(available, name);
+
+		int rank = device_rank(candidate.getProperties().deviceType);
+		if (able && rank > best) {
+			phdev = candidate;
+			best = rank;
+		}
+	}
+
+	if (best < 0) {
+		ulog_error("headless", "no device supports the required extensions\n");
+		instance.destroy();
+		throw "error";
+	}
+
+	ulog_info("headless", "using device %s\n", phdev.getProperties().deviceName.data());
+
+	// Render passes end in the present layout, which needs the swapchain
+	// extension even without a surface
+	std::vector <const char *> extensions = EXTENSIONS;
+	if (supports_extension(phdev.enumerateDeviceExtensionProperties(), VK_KHR_SWAPCHAIN_EXTENSION_NAME))
+		extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+
+	add_optional_extensions(phdev, extensions);
+
+	DeviceFeatures df;
+	query_features(phdev, df);
+
+	return VulkanResourceBase::headless_from(instance, phdev, extensions, df.features, extent, frames_in_flight);
 }
 
 Biome &Globals::active_biome()
@@ -40,9 +169,9 @@ Biome &Globals::active_biome()
 	return *biome;
 }
 
-Globals Globals::from()
+Globals Globals::from(uint32_t frames_in_flight)
 {
-	return { prepare_vulkan_resource_base(), std::nullopt };
+	return { prepare_vulkan_resource_base(frames_in_flight), std::nullopt };
 }
 
 }
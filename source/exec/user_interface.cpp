@@ -2,6 +2,7 @@
 
 #include <imgui/imgui.h>
 
+#include "core/profiler.hpp"
 #include "exec/user_interface.hpp"
 
 namespace ivy::exec {
@@ -56,22 +57,29 @@ std::optional <uint32_t> biome_tree(Biome &biome)
 
 void UserInterface::resize(const vk::Extent2D &extent)
 {
-	if (vk.extent == extent)
-		return;
+	// Always regenerated, since the swapchain images change on recreation
+	// even if the extent does not
 
 	// Transfer the extent
 	vk.extent = extent;
 
-	// Generate the framebuffers
-	littlevk::FramebufferGenerator generator(engine.vrb.device, vk.render_pass, extent, engine.vrb.dal);
-	for (const vk::ImageView &view : engine.vrb.swapchain.image_views)
-		generator.add(view);
+	// Generate the framebuffers, releasing the old ones after the frames in flight
+	for (const vk::Framebuffer &framebuffer : vk.framebuffers)
+		engine.vrb.retire(framebuffer);
 
-	vk.framebuffers = generator.unpack();
+	vk.framebuffers.clear();
+	for (const vk::ImageView &view : engine.vrb.swapchain.image_views) {
+		vk.framebuffers.push_back(engine.vrb.device.createFramebuffer(vk::FramebufferCreateInfo {
+			{}, vk.render_pass, view,
+			extent.width, extent.height, 1
+		}));
+	}
 }
 
 void UserInterface::draw(const vk::CommandBuffer &cmd, const littlevk::SurfaceOperation &op)
 {
+	IVY_PROFILE_SCOPE("UserInterface::draw");
+
 	// TODO: manage own index?
 
 	// Begin the render pass
@@ -79,6 +87,8 @@ void UserInterface::draw(const vk::CommandBuffer &cmd, const littlevk::SurfaceOp
 		(vk.render_pass, vk.framebuffers[op.index], vk.extent)
 		.clear_color(0, std::array <float, 4> { 1.0f, 1.0f, 1.0f, 1.0f });
 
+	uint32_t ui_scope = engine.vrb.gpu_profiler->begin(cmd, "User Interface");
+
 	cmd.beginRenderPass(rpbi, vk::SubpassContents::eInline);
 
 	// Render the user interface
@@ -197,6 +207,103 @@ void UserInterface::draw(const vk::CommandBuffer &cmd, const littlevk::SurfaceOp
 		ImGui::End();
 	}
 
+	// Device memory statistics
+	if (ImGui::Begin("Statistics")) {
+		MemoryStatistics stats = engine.vrb.allocator->statistics();
+
+		constexpr float MiB = 1024.0f * 1024.0f;
+		ImGui::Text("Live: %.2f MiB in %u allocations", stats.live/MiB, stats.allocations);
+		ImGui::Text("Blocks: %u (%.2f MiB reserved, %.2f MiB committed)",
+			stats.blocks, stats.reserved/MiB, stats.committed/MiB);
+		ImGui::Text("Dedicated: %.2f MiB in %u allocations", stats.dedicated/MiB, stats.dedicated_allocations);
+		ImGui::Text("Fragmentation: %.1f%%", 100.0f * stats.fragmentation);
+		ImGui::Text("Pending releases: %lu", engine.vrb.deletion_queue->pending());
+
+		if (viewport_ref) {
+			const DeviceTextureCache &dtc = viewport_ref->dtc;
+			ImGui::Text("Textures: %.2f of %.2f MiB on device, %.2f MiB on host",
+				dtc.device_usage/MiB, dtc.device_budget()/MiB, dtc.host_usage/MiB);
+
+			// Textures with levels finer than their tail resident
+			uint32_t streamed = 0;
+			for (const auto &[slot, stream] : dtc.streams)
+				streamed += (stream.resident < stream.tail);
+
+			ImGui::Text("Streamed: %u of %lu textures above their tail", streamed, dtc.streams.size());
+		}
+
+#ifdef IVY_PROFILING
+		if (ImGui::Button("Save CPU trace"))
+			profiling::save_trace("cpu-trace.json");
+#endif
+
+		ImGui::End();
+	}
+
+	// Frame pacing, applied before the next frame
+	if (ImGui::Begin("Frame Pacing")) {
+		static constexpr const char *modes[] = { "FIFO", "Mailbox", "Immediate" };
+
+		int mode = int(engine.vrb.present_mode);
+		if (ImGui::Combo("Present mode", &mode, modes, IM_ARRAYSIZE(modes)))
+			engine.vrb.requested.present_mode = PresentMode(mode);
+
+		int frames = engine.vrb.frames_in_flight;
+		if (ImGui::SliderInt("Frames in flight", &frames, 1, 4))
+			engine.vrb.requested.frames_in_flight = frames;
+
+		ImGui::End();
+	}
+
+	// GPU timings, averaged over the recent frames
+	if (ImGui::Begin("GPU Profiler")) {
+		GpuProfiler *profiler = engine.vrb.gpu_profiler;
+
+		if (!profiler->enabled) {
+			ImGui::Text("Timestamps are not supported on this device");
+		} else {
+			if (ImGui::Button("Export CSV"))
+				profiler->save("gpu-profile.csv");
+
+			ImGui::SameLine();
+			if (ImGui::Button("Export JSON"))
+				profiler->save("gpu-profile.json");
+
+			ImGuiTableFlags flags = ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg;
+			if (ImGui::BeginTable("Timings", 5, flags)) {
+				ImGui::TableSetupColumn("Scope");
+				ImGui::TableSetupColumn("Last (ms)");
+				ImGui::TableSetupColumn("Average");
+				ImGui::TableSetupColumn("p95");
+				ImGui::TableSetupColumn("p99");
+				ImGui::TableHeadersRow();
+
+				for (const std::string &name : profiler->order) {
+					const auto &stats = profiler->statistics.at(name);
+
+					ImGui::TableNextRow();
+					ImGui::TableNextColumn();
+					ImGui::Indent(stats.depth * 10.0f);
+					ImGui::Text("%s", name.c_str());
+					ImGui::Unindent(stats.depth * 10.0f);
+
+					ImGui::TableNextColumn();
+					ImGui::Text("%.3f", stats.last());
+					ImGui::TableNextColumn();
+					ImGui::Text("%.3f", stats.average());
+					ImGui::TableNextColumn();
+					ImGui::Text("%.3f", stats.percentile(0.95f));
+					ImGui::TableNextColumn();
+					ImGui::Text("%.3f", stats.percentile(0.99f));
+				}
+
+				ImGui::EndTable();
+			}
+		}
+
+		ImGui::End();
+	}
+
 	// ImGui::PopFont();
 
 	imgui_end(cmd);
@@ -204,6 +311,8 @@ void UserInterface::draw(const vk::CommandBuffer &cmd, const littlevk::SurfaceOp
 	// End the current render pass
 	cmd.endRenderPass();
 
+	engine.vrb.gpu_profiler->end(cmd, ui_scope);
+
 	// Generate the viewport rendering
 	if (viewport_ref && viewport_size.width > 0 && viewport_size.height > 0) {
 		viewport_ref->resize(viewport_size);
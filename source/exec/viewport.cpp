@@ -6,6 +6,9 @@
 
 #include <microlog/microlog.h>
 
+#include "core/hash.hpp"
+#include "core/pipelines.hpp"
+#include "core/profiler.hpp"
 #include "core/polygon.hpp"
 #include "exec/viewport.hpp"
 #include "paths.hpp"
@@ -24,6 +27,8 @@ struct MVPConstants {
 	glm::mat4 view;
 	glm::mat4 proj;
 	alignas(16) glm::vec3 camera;
+	uint32_t material;
+	uint32_t texture;
 };
 
 struct RayFrameExtra : RayFrame {
@@ -32,14 +37,45 @@ struct RayFrameExtra : RayFrame {
 };
 
 // Pipeline configurations
-static constexpr auto rendering_dslbs = std::array <vk::DescriptorSetLayoutBinding, 3> {{
-	{ 0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment },
-	{ 1, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eFragment },
-	{ 2, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eFragment }
-}};
+static constexpr uint32_t MAX_BINDLESS_TEXTURES = 1 << 16;
+static constexpr uint32_t INITIAL_MATERIAL_CAPACITY = 1 << 12;
+
+// Colliders are baked into a brick map past this many shapes, or once
+// any is a mesh, with this many samples along the longest side of the
+// scene
+static constexpr size_t BRICKMAP_THRESHOLD = 64;
+static constexpr float BRICKMAP_RESOLUTION = 512.0f;
+
+// TODO: load a blue skybox
+static constexpr const char *ENVIRONMENT = IVY_ROOT "/data/environments/crossroads.hdr";
+
+// Variable sized texture array must be the last binding
+static std::vector <vk::DescriptorSetLayoutBinding> bindless_dslbs(uint32_t textures)
+{
+	return {
+		{ 0, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eFragment },
+		{ 1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eFragment },
+		{ 2, vk::DescriptorType::eCombinedImageSampler, textures, vk::ShaderStageFlagBits::eFragment }
+	};
+}
+
+static const std::vector <vk::DescriptorBindingFlags> bindless_flags {
+	{}, {},
+	vk::DescriptorBindingFlagBits::ePartiallyBound
+		| vk::DescriptorBindingFlagBits::eVariableDescriptorCount
+		| vk::DescriptorBindingFlagBits::eUpdateAfterBind
+		| vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending
+};
+
+// Shared by the cone pass, which uses everything but the depth
+static constexpr vk::ShaderStageFlags sdf_stages = vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute;
 
-static constexpr auto sdf_dslbs = std::array <vk::DescriptorSetLayoutBinding, 1> {{
+static constexpr auto sdf_dslbs = std::array <vk::DescriptorSetLayoutBinding, 5> {{
 	{ 0, vk::DescriptorType::eInputAttachment, 1, vk::ShaderStageFlagBits::eFragment },
+	{ 1, vk::DescriptorType::eStorageBuffer, 1, sdf_stages },
+	{ 2, vk::DescriptorType::eCombinedImageSampler, 1, sdf_stages },
+	{ 3, vk::DescriptorType::eStorageBuffer, 1, sdf_stages },
+	{ 4, vk::DescriptorType::eStorageImage, 1, sdf_stages }
 }};
 
 static constexpr auto environment_dslbs = std::array <vk::DescriptorSetLayoutBinding, 2> {{
@@ -97,11 +133,11 @@ void Viewport::cursor_handler(const CursorDispatcher::MouseInfo &mouse)
 void Viewport::export_framebuffers_to_imgui()
 {
 	// Generate the descriptor sets
-	for (size_t i = 0; i < imgui_descriptors.size(); i++)
-		await_free_queue.push_back({ .left = 1, .frame = i, .resource = imgui_descriptors[i] });
+	for (vk::DescriptorSet dset : imgui_descriptors)
+		vrb.defer([dset]() { ImGui_ImplVulkan_RemoveTexture(dset); });
 
 	imgui_descriptors.clear();
-	for (const littlevk::Image &image : vk.images) {
+	for (const AllocatedImage &image : vk.images) {
 		vk::DescriptorSet dset = ImGui_ImplVulkan_AddTexture
 			(static_cast <VkSampler> (sampler),
 			static_cast <VkImageView> (image.view),
@@ -114,64 +150,88 @@ void Viewport::export_framebuffers_to_imgui()
 // Resize the framebuffers (including from a null state)
 void Viewport::resize(const vk::Extent2D &extent)
 {
-	// Skip if the extent is the same
-	if (extent == vk.extent)
+	// Skip if the extent is the same, unless the swapchain was recreated
+	if (extent == vk.extent && vk.images.size() == vrb.swapchain.images.size())
 		return;
 
 	// Translate the extent
 	vk.extent = extent;
 
-	// Free old resources
-	for (size_t i = 0; i < vk.images.size(); i++)
-		await_free_queue.push_back({ .left = 1, .frame = i, .resource = vk.images[i] });
+	// Free old resources once the frames in flight are done with them
+	for (const AllocatedImage &image : vk.images)
+		vrb.retire(image);
+
+	for (const vk::Framebuffer &framebuffer : vk.framebuffers)
+		vrb.retire(framebuffer);
+
+	if (vk.depth.image)
+		vrb.retire(vk.depth);
 
-	if (vk.depth.device_size())
-		await_free_queue.push_back({ .left = 2, .frame = 0, .resource = vk.depth });
+	if (vk.cone_seeds.image)
+		vrb.retire(vk.cone_seeds);
 
 	// Allocate the images
 	vk.images.clear();
 	for (size_t i = 0; i < vrb.swapchain.images.size(); i++) {
-		vk.images.push_back(littlevk::bind(vrb.device, vrb.memory_properties, vrb.dal)
-			.image(extent.width, extent.height,
-				vrb.swapchain.format,
-				vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eColorAttachment,
-				vk::ImageAspectFlagBits::eColor));
+		vk.images.push_back(vrb.allocator->image(extent,
+			vrb.swapchain.format,
+			vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eColorAttachment,
+			vk::ImageAspectFlagBits::eColor));
 	}
 
+	// One seed for every 2x2 tile of pixels
+	vk.cone_seeds = vrb.allocator->image(vk::Extent2D { (extent.width + 1)/2, (extent.height + 1)/2 },
+		vk::Format::eR32Sfloat,
+		vk::ImageUsageFlagBits::eStorage,
+		vk::ImageAspectFlagBits::eColor);
+
 	// Transition right away
 	// TODO: bind
 	littlevk::submit_now(vrb.device, vrb.command_pool, vrb.graphics_queue,
 		[&](const vk::CommandBuffer &cmd) {
-			for (const littlevk::Image &image : vk.images) {
-				littlevk::transition(cmd, image,
+			for (const AllocatedImage &image : vk.images) {
+				transition(cmd, image,
 					vk::ImageLayout::eUndefined,
 					vk::ImageLayout::eShaderReadOnlyOptimal);
 			}
+
+			transition(cmd, vk.cone_seeds,
+				vk::ImageLayout::eUndefined,
+				vk::ImageLayout::eGeneral);
 		}
 	);
 
 	// Create the depth buffer
-	vk.depth = bind(vrb.device, vrb.memory_properties, vrb.dal)
-		.image(extent,
-			vk::Format::eD32Sfloat,
-			vk::ImageUsageFlagBits::eDepthStencilAttachment
-				| vk::ImageUsageFlagBits::eInputAttachment,
-			vk::ImageAspectFlagBits::eDepth);
+	vk.depth = vrb.allocator->image(extent,
+		vk::Format::eD32Sfloat,
+		vk::ImageUsageFlagBits::eDepthStencilAttachment
+			| vk::ImageUsageFlagBits::eInputAttachment,
+		vk::ImageAspectFlagBits::eDepth);
 
 	// Create the framebuffers
-	littlevk::FramebufferGenerator generator(vrb.device, vk.render_pass, extent, vrb.dal);
-	for (const littlevk::Image &image : vk.images)
-		generator.add(image.view, vk.depth.view);
+	vk.framebuffers.clear();
+	for (const AllocatedImage &image : vk.images) {
+		std::array <vk::ImageView, 2> attachments { image.view, vk.depth.view };
+
+		vk.framebuffers.push_back(vrb.device.createFramebuffer(vk::FramebufferCreateInfo {
+			{}, vk.render_pass, attachments,
+			extent.width, extent.height, 1
+		}));
+	}
 
-	vk.framebuffers = generator.unpack();
+	// Fresh descriptor sets, since the old ones may still be in use
+	if (scrap.environment_descriptor)
+		vrb.retire(vrb.descriptor_pool, scrap.environment_descriptor);
+
+	scrap.environment_descriptor = littlevk::bind(vrb.device, vrb.descriptor_pool)
+		.allocate_descriptor_sets(*pipelines.environment.dsl).front();
 
 	// Bind the depth buffer wherever necessary
-	littlevk::bind(vrb.device, scrap.sdf_descriptor, sdf_dslbs)
-		.update(0, 0, sampler, vk.depth.view, vk::ImageLayout::eGeneral)
-		.finalize();
+	write_sdf_descriptor();
 
 	littlevk::bind(vrb.device, scrap.environment_descriptor, environment_dslbs)
 		.update(0, 0, sampler, vk.depth.view, vk::ImageLayout::eDepthReadOnlyOptimal)
+		.update(1, 0, sampler, scrap.environment.cubemap.view, vk::ImageLayout::eShaderReadOnlyOptimal)
 		.finalize();
 
 	// Export to ImGui
@@ -181,112 +241,495 @@ void Viewport::resize(const vk::Extent2D &extent)
 // Prepare internal resources
 void Viewport::prepare()
 {
-	sampler = littlevk::SamplerAssembler(vrb.device, vrb.dal);
+	// Trilinear, and anisotropic where supported, for the cooked mip chains
+	vk::PhysicalDeviceFeatures features = vrb.phdev.getFeatures();
+	vk::PhysicalDeviceProperties properties = vrb.phdev.getProperties();
+
+	vk::SamplerCreateInfo sampler_info;
+	sampler_info.magFilter = vk::Filter::eLinear;
+	sampler_info.minFilter = vk::Filter::eLinear;
+	sampler_info.mipmapMode = vk::SamplerMipmapMode::eLinear;
+	sampler_info.addressModeU = vk::SamplerAddressMode::eRepeat;
+	sampler_info.addressModeV = vk::SamplerAddressMode::eRepeat;
+	sampler_info.addressModeW = vk::SamplerAddressMode::eRepeat;
+	sampler_info.anisotropyEnable = features.samplerAnisotropy;
+	sampler_info.maxAnisotropy = std::min(8.0f, properties.limits.maxSamplerAnisotropy);
+	sampler_info.minLod = 0.0f;
+	sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+
+	sampler = vrb.device.createSampler(sampler_info);
 
 	prepare_render_pass();
+	prepare_bindless();
 	prepare_raster_pipeline();
 	prepare_sdf_pipeline();
 	prepare_environment_pipeline();
 
-	// Load the environment map
-	// TODO: load a blue skybox
-	const std::string environment = IVY_ROOT "/data/environments/crossroads.hdr";
+	// Load the environment map, as a prefiltered cubemap in floating
+	// point; bound to the environment subpass on resize
+	scrap.environment = EnvironmentMap::from(vrb, ENVIRONMENT);
+}
 
-	// Environment subpass resources
-	// TODO: put into that function...
-	vk::DescriptorSet environment_dset = littlevk::bind(vrb.device, vrb.descriptor_pool)
-		.allocate_descriptor_sets(*pipelines.environment.dsl).front();
+// Depth written by one subpass, at the late fragment tests, and read by
+// the next through its input attachment
+static vk::SubpassDependency depth_dependency(uint32_t src, uint32_t dst, vk::PipelineStageFlags stages, vk::AccessFlags access)
+{
+	return vk::SubpassDependency {
+		src, dst,
+		vk::PipelineStageFlagBits::eLateFragmentTests,
+		vk::PipelineStageFlagBits::eFragmentShader | stages,
+		vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+		vk::AccessFlagBits::eInputAttachmentRead | access,
+		vk::DependencyFlagBits::eByRegion
+	};
+}
 
-	dtc.load(environment);
-	dtc.upload(environment);
-	const littlevk::Image &environment_map = dtc.device_textures[environment];
+// Prepare the render pass; assembled by hand, since the subpass
+// dependencies need access masks
+void Viewport::prepare_render_pass()
+{
+	std::array <vk::AttachmentDescription, 2> attachments {
+		littlevk::default_color_attachment(vrb.swapchain.format),
+		littlevk::default_depth_attachment(),
+	};
 
-	littlevk::bind(vrb.device, environment_dset, environment_dslbs)
-		.update(1, 0, sampler, environment_map.view, vk::ImageLayout::eShaderReadOnlyOptimal)
-		.finalize();
+	vk::AttachmentReference color { 0, vk::ImageLayout::eColorAttachmentOptimal };
+	vk::AttachmentReference raster_depth { 1, vk::ImageLayout::eDepthStencilAttachmentOptimal };
+	vk::AttachmentReference sdf_depth { 1, vk::ImageLayout::eGeneral };
+	vk::AttachmentReference environment_depth { 1, vk::ImageLayout::eDepthReadOnlyOptimal };
 
-	scrap.environment_descriptor = environment_dset;
+	std::array <vk::SubpassDescription, 3> subpasses {
+		// (A) Primary rasterization
+		vk::SubpassDescription {
+			{}, vk::PipelineBindPoint::eGraphics,
+			0, nullptr, 1, &color, nullptr, &raster_depth
+		},
+		// (B) Raymarching signed distance fields, reading the raster
+		// depth and writing its own
+		vk::SubpassDescription {
+			{}, vk::PipelineBindPoint::eGraphics,
+			1, &sdf_depth, 1, &color, nullptr, &sdf_depth
+		},
+		// (C) Environment mapping, wherever nothing was drawn
+		vk::SubpassDescription {
+			{}, vk::PipelineBindPoint::eGraphics,
+			1, &environment_depth, 1, &color, nullptr, nullptr
+		},
+	};
+
+	// (B) also tests and writes depth, after (A) has written it
+	std::array <vk::SubpassDependency, 2> dependencies {
+		depth_dependency(0, 1,
+			vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests,
+			vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite),
+		depth_dependency(1, 2, {}, {}),
+	};
+
+	vk.render_pass = vrb.device.createRenderPass(vk::RenderPassCreateInfo {
+		{}, attachments, subpasses, dependencies
+	});
 }
 
-// Prepare the render pass
-void Viewport::prepare_render_pass()
+// Global descriptor set for bindless rendering
+void Viewport::prepare_bindless()
 {
-	vk.render_pass = littlevk::RenderPassAssembler(vrb.device, vrb.dal)
-		.add_attachment(littlevk::default_color_attachment(vrb.swapchain.format))
-		.add_attachment(littlevk::default_depth_attachment())
-		// (A) Primary rasterization
-		.add_subpass(vk::PipelineBindPoint::eGraphics)
-			.color_attachment(0, vk::ImageLayout::eColorAttachmentOptimal)
-			.depth_attachment(1, vk::ImageLayout::eDepthStencilAttachmentOptimal)
-			.done()
-		// (B) Raymarching signed distance fields
-		.add_subpass(vk::PipelineBindPoint::eGraphics)
-			.input_attachment(1, vk::ImageLayout::eGeneral) // TODO:: read and write
-			.color_attachment(0, vk::ImageLayout::eColorAttachmentOptimal)
-			.depth_attachment(1, vk::ImageLayout::eGeneral)
-			.done()
-		// (C) Environment mapping
-		.add_subpass(vk::PipelineBindPoint::eGraphics)
-			.input_attachment(1, vk::ImageLayout::eDepthReadOnlyOptimal)
-			.color_attachment(0, vk::ImageLayout::eColorAttachmentOptimal)
-			.done()
-		// (C) -> (B) -> (A)
-		.add_dependency(0, 1,
-			vk::PipelineStageFlagBits::eFragmentShader,
-			vk::PipelineStageFlagBits::eFragmentShader)
-		.add_dependency(1, 2,
-			vk::PipelineStageFlagBits::eFragmentShader,
-			vk::PipelineStageFlagBits::eFragmentShader);
+	// Clamp the texture array to what the device supports
+	vk::PhysicalDeviceDescriptorIndexingPropertiesEXT indexing;
+
+	vk::PhysicalDeviceProperties2 properties;
+	properties.pNext = &indexing;
+	vrb.phdev.getProperties2(&properties);
+
+	bindless.max_textures = std::min({
+		MAX_BINDLESS_TEXTURES,
+		indexing.maxDescriptorSetUpdateAfterBindSampledImages,
+		indexing.maxPerStageDescriptorUpdateAfterBindSampledImages
+	});
+
+	bindless.dsl = create_descriptor_set_layout(vrb.device,
+		bindless_dslbs(bindless.max_textures), bindless_flags,
+		vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool);
+
+	// The current set, and the one it replaced while frames are in flight
+	constexpr uint32_t SETS = 2;
+
+	std::array <vk::DescriptorPoolSize, 3> sizes {{
+		{ vk::DescriptorType::eUniformBuffer, SETS },
+		{ vk::DescriptorType::eStorageBuffer, SETS },
+		{ vk::DescriptorType::eCombinedImageSampler, SETS * bindless.max_textures }
+	}};
+
+	bindless.pool = vrb.device.createDescriptorPool(vk::DescriptorPoolCreateInfo {
+		vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind
+			| vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
+		SETS, sizes
+	});
+
+	// Upload the lighting information to the device, projected
+	// from the environment map once and cached after that
+	SHLighting shl = SHLighting::from(std::filesystem::path(ENVIRONMENT));
+
+	scrap.shl = bind(vrb.device, vrb.memory_properties, vrb.dal)
+		.buffer(&shl, sizeof(shl), vk::BufferUsageFlagBits::eUniformBuffer);
+
+	allocate_bindless_set(INITIAL_MATERIAL_CAPACITY);
+}
+
+// (Re)allocate the global set with a material table of the given capacity
+void Viewport::allocate_bindless_set(uint32_t capacity)
+{
+	AllocatedBuffer materials = vrb.allocator->buffer(capacity * sizeof(VulkanMaterial),
+		vk::BufferUsageFlagBits::eStorageBuffer);
+
+	if (bindless.material_count > 0) {
+		vrb.allocator->upload(materials, bindless.materials.allocation.mapped,
+			bindless.material_count * sizeof(VulkanMaterial));
+	}
+
+	uint32_t count = bindless.max_textures;
+	vk::DescriptorSetVariableDescriptorCountAllocateInfo variable { 1, &count };
+
+	vk::DescriptorSetAllocateInfo info { bindless.pool, bindless.dsl };
+	info.pNext = &variable;
+
+	// The old set may still be in use by frames in flight
+	if (bindless.dset)
+		vrb.retire(bindless.pool, bindless.dset);
+
+	try {
+		bindless.dset = vrb.device.allocateDescriptorSets(info).front();
+	} catch (vk::OutOfPoolMemoryError &) {
+		// Grown more than once before the frames in flight retired a set
+		vrb.wait_idle();
+		bindless.dset = vrb.device.allocateDescriptorSets(info).front();
+	}
+
+	vk::DescriptorBufferInfo shl_info { *scrap.shl, 0, sizeof(SHLighting) };
+	vk::DescriptorBufferInfo materials_info { materials.buffer, 0, VK_WHOLE_SIZE };
+
+	std::array <vk::WriteDescriptorSet, 2> writes {{
+		{ bindless.dset, 0, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &shl_info },
+		{ bindless.dset, 1, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &materials_info }
+	}};
+
+	vrb.device.updateDescriptorSets(writes, {});
+
+	// Carry over the textures uploaded so far
+	for (const auto &[path, index] : dtc.indices)
+		write_bindless_texture(path);
+
+	// The old table may still be in use by frames in flight
+	if (bindless.materials.buffer) {
+		AllocatedBuffer old = bindless.materials;
+		DeviceMemoryAllocator *allocator = vrb.allocator;
+		vrb.defer([allocator, old]() mutable { allocator->destroy(old); });
+	}
+
+	bindless.materials = materials;
+	bindless.material_capacity = capacity;
 }
 
 // Preparing the pipelines
 void Viewport::prepare_raster_pipeline()
 {
-	// Upload the lighting information to the device
-	SHLighting shl {
-		.red = glm::mat4(0.9f),
-		.green = glm::mat4(0.9f),
-		.blue = glm::mat4(1.0f),
+	vk::PushConstantRange push_constants {
+		vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+		0, sizeof(MVPConstants)
 	};
 
-	scrap.shl = bind(vrb.device, vrb.memory_properties, vrb.dal)
-		.buffer(&shl, sizeof(shl), vk::BufferUsageFlagBits::eUniformBuffer);
+	vk::PipelineLayout layout = create_pipeline_layout(vrb.device, { bindless.dsl }, { push_constants });
+
+	GraphicsPipelineInfo info {
+		.render_pass = vk.render_pass,
+		.subpass = 0,
+		.vertex_attributes = {
+			vk::Format::eR32G32B32Sfloat,
+			vk::Format::eR32G32B32Sfloat,
+			vk::Format::eR32G32Sfloat
+		},
+		.shaders = {
+			{ readfile(IVY_SHADERS "/mesh.vert"), vk::ShaderStageFlagBits::eVertex },
+			{ readfile(IVY_SHADERS "/environment.frag"), vk::ShaderStageFlagBits::eFragment }
+		},
+		.layout = layout
+	};
+
+	pipelines.raster = vrb.pipeline_service->graphics(info, bindless.dsl);
+}
 
-	// Pipeline
-	constexpr auto raster_layout = littlevk::VertexLayout <littlevk::rgb32f, littlevk::rgb32f, littlevk::rg32f> ();
+void Viewport::prepare_sdf_pipeline()
+{
+	vk::DescriptorSetLayout dsl = create_descriptor_set_layout(vrb.device, { sdf_dslbs.begin(), sdf_dslbs.end() });
+
+	vk::PushConstantRange push_constants { vk::ShaderStageFlagBits::eFragment, 0, sizeof(RayFrameExtra) };
+	vk::PipelineLayout layout = create_pipeline_layout(vrb.device, { dsl }, { push_constants });
+
+	pipelines.sdf_info = GraphicsPipelineInfo {
+		.render_pass = vk.render_pass,
+		.subpass = 1,
+		.vertex_attributes = { vk::Format::eR32G32Sfloat, vk::Format::eR32G32Sfloat },
+		.shaders = {
+			{ readfile(IVY_SHADERS "/screen.vert"), vk::ShaderStageFlagBits::eVertex },
+			{ readfile(IVY_SHADERS "/sdf.frag"), vk::ShaderStageFlagBits::eFragment }
+		},
+		.layout = layout,
+		.alpha_blending = true,
+		.depth_compare = vk::CompareOp::eLessOrEqual
+	};
 
-	auto raster_bundle = littlevk::ShaderStageBundle(vrb.device, vrb.dal)
-		.attach(readfile(IVY_SHADERS "/mesh.vert"), vk::ShaderStageFlagBits::eVertex)
-		.attach(readfile(IVY_SHADERS "/environment.frag"), vk::ShaderStageFlagBits::eFragment);
+	// Same source and descriptor set, with the camera for the compute stage
+	vk::PushConstantRange cone_push_constants { vk::ShaderStageFlagBits::eCompute, 0, sizeof(RayFrameExtra) };
 
-	pipelines.raster = littlevk::PipelineAssembler <littlevk::eGraphics> (vrb.device, vrb.window, vrb.dal)
-		.with_render_pass(vk.render_pass, 0)
-		.with_vertex_layout(raster_layout)
-		.with_shader_bundle(raster_bundle)
-		.with_dsl_bindings(rendering_dslbs)
-		.with_push_constant <MVPConstants> (vk::ShaderStageFlagBits::eVertex);
+	pipelines.sdf_cone_shader = ShaderSource {
+		readfile(IVY_SHADERS "/sdf.frag"),
+		vk::ShaderStageFlagBits::eCompute,
+		{ "CONE_PASS" }
+	};
+
+	// Layouts are needed right away for the descriptor set
+	pipelines.sdf.layout = layout;
+	pipelines.sdf.dsl = dsl;
+	pipelines.sdf_cone.layout = create_pipeline_layout(vrb.device, { dsl }, { cone_push_constants });
+	pipelines.sdf_cone.dsl = dsl;
+
+	// Empty until the colliders are first gathered
+	scrap.sdf_scene = vrb.allocator->buffer(sdf::Compound().serialize(), vk::BufferUsageFlagBits::eStorageBuffer);
+	scrap.device_brickmap = sdf::DeviceBrickMap::from(vrb);
+
+	// Bricks are sampled at their sample centers, without mips
+	vk::SamplerCreateInfo sampler_info;
+	sampler_info.magFilter = vk::Filter::eLinear;
+	sampler_info.minFilter = vk::Filter::eLinear;
+	sampler_info.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+	sampler_info.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+	sampler_info.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+
+	scrap.brick_sampler = vrb.device.createSampler(sampler_info);
 }
 
-void Viewport::prepare_sdf_pipeline()
+static uint64_t hash_shape(const sdf::Shape &shape, uint64_t seed = FNV_OFFSET)
+{
+	uint64_t hash = hash_value(shape.index(), seed);
+	std::visit([&](const auto &primitive) { hash = hash_value(primitive, hash); }, shape);
+	return hash;
+}
+
+// By identity, since grids are shared and never modified in place
+static uint64_t hash_grid(const sdf::GridInstance &instance, uint64_t seed = FNV_OFFSET)
 {
-	// Pipeline
-	constexpr auto vlayout = littlevk::VertexLayout <littlevk::rg32f, littlevk::rg32f> ();
-
-	auto bundle = littlevk::ShaderStageBundle(vrb.device, vrb.dal)
-		.attach(readfile(IVY_SHADERS "/screen.vert"), vk::ShaderStageFlagBits::eVertex)
-		.attach(readfile(IVY_SHADERS "/sdf.frag"), vk::ShaderStageFlagBits::eFragment);
-
-	pipelines.sdf = littlevk::PipelineAssembler <littlevk::eGraphics> (vrb.device, vrb.window, vrb.dal)
-		.with_render_pass(vk.render_pass, 1)
-		.with_vertex_layout(vlayout)
-		.with_shader_bundle(bundle)
-		.alpha_blending(true)
-		.with_dsl_bindings(sdf_dslbs)
-		.with_push_constant <RayFrameExtra> (vk::ShaderStageFlagBits::eFragment);
-
-	// Allocate the corresponding descriptor set
+	uint64_t hash = hash_value(instance.grid.get(), seed);
+	return hash_value(instance.inverse, hash);
+}
+
+// Rebuilt from the colliders whenever anything about them changes; the
+// buffers and set in use by frames in flight are retired
+void Viewport::update_sdf_scene(const vk::CommandBuffer &cmd)
+{
+	IVY_PROFILE_SCOPE("Viewport::update_sdf_scene");
+
+	sdf::Compound compound;
+	for (const Collider &collider : biome.colliders) {
+		if (!collider.enabled)
+			continue;
+
+		const Transform &transform = collider.transform.get();
+		if (auto sphere = std::get_if <sdf::Sphere> (&collider.shape))
+			compound.shapes.push_back(sdf::transformed(*sphere, transform));
+		else if (auto box = std::get_if <sdf::Box> (&collider.shape))
+			compound.shapes.push_back(sdf::transformed(*box, transform));
+		else
+			compound.grids.push_back(sdf::GridInstance::from(std::get <2> (collider.shape), transform));
+	}
+
+	uint64_t hash = hash_value(compound.shapes.size());
+	for (const sdf::Shape &shape : compound.shapes)
+		hash = hash_shape(shape, hash);
+
+	hash = hash_value(compound.grids.size(), hash);
+	for (const sdf::GridInstance &instance : compound.grids)
+		hash = hash_grid(instance, hash);
+
+	if (hash == scrap.sdf_hash)
+		return;
+
+	vrb.retire(scrap.sdf_scene);
+
+	scrap.sdf_scene = vrb.allocator->buffer(compound.serialize(), vk::BufferUsageFlagBits::eStorageBuffer);
+	scrap.sdf_hash = hash;
+
+	if (compound.shapes.size() >= BRICKMAP_THRESHOLD || !compound.grids.empty() || scrap.brickmap)
+		update_brickmap(cmd, compound);
+
+	scrap.sdf_compound = std::move(compound);
+
+	write_sdf_descriptor();
+}
+
+// Re-bakes around the shapes and grids which changed, unless they moved
+// outside of the baked region or the scene became small enough to march
+// directly; grids are only ever drawn through the brick map
+void Viewport::update_brickmap(const vk::CommandBuffer &cmd, const sdf::Compound &compound)
+{
+	if (compound.shapes.size() < BRICKMAP_THRESHOLD && compound.grids.empty()) {
+		scrap.brickmap.reset();
+		vrb.retire(scrap.device_brickmap.atlas);
+		vrb.retire(scrap.device_brickmap.grid);
+		scrap.device_brickmap = sdf::DeviceBrickMap::from(vrb);
+		return;
+	}
+
+	sdf::AABB scene = compound.bounds();
+
+	std::optional <sdf::AABB> changed;
+	auto include = [&](const sdf::AABB &box) {
+		if (!changed)
+			changed = box;
+
+		changed->min = glm::min(changed->min, box.min);
+		changed->max = glm::max(changed->max, box.max);
+	};
+
+	const std::vector <sdf::Shape> &previous = scrap.sdf_compound.shapes;
+	for (size_t i = 0; i < std::max(previous.size(), compound.shapes.size()); i++) {
+		bool old = i < previous.size();
+		bool now = i < compound.shapes.size();
+		if (old && now && hash_shape(previous[i]) == hash_shape(compound.shapes[i]))
+			continue;
+
+		if (old)
+			include(sdf::bounds(previous[i]));
+		if (now)
+			include(sdf::bounds(compound.shapes[i]));
+	}
+
+	const std::vector <sdf::GridInstance> &previous_grids = scrap.sdf_compound.grids;
+	for (size_t i = 0; i < std::max(previous_grids.size(), compound.grids.size()); i++) {
+		bool old = i < previous_grids.size();
+		bool now = i < compound.grids.size();
+		if (old && now && hash_grid(previous_grids[i]) == hash_grid(compound.grids[i]))
+			continue;
+
+		if (old)
+			include(previous_grids[i].box);
+		if (now)
+			include(compound.grids[i].box);
+	}
+
+	bool inside = false;
+	if (scrap.brickmap) {
+		const sdf::BrickMap &map = *scrap.brickmap;
+		glm::vec3 lo = map.origin + map.band;
+		glm::vec3 hi = map.origin + glm::vec3(map.dims) * map.extent() - map.band;
+		inside = glm::all(glm::lessThanEqual(lo, scene.min)) && glm::all(glm::lessThanEqual(scene.max, hi));
+	}
+
+	if (inside && changed) {
+		scrap.brickmap->rebake(sdf::BrickMap::function(compound), *changed);
+	} else {
+		glm::vec3 size = scene.max - scene.min;
+		float cell = std::max({ size.x, size.y, size.z, 1e-3f })/BRICKMAP_RESOLUTION;
+		scrap.brickmap = sdf::BrickMap::bake(compound, cell);
+	}
+
+	scrap.device_brickmap.upload(vrb, cmd, *scrap.brickmap);
+}
+
+void Viewport::write_sdf_descriptor()
+{
+	if (scrap.sdf_descriptor)
+		vrb.retire(vrb.descriptor_pool, scrap.sdf_descriptor);
+
 	scrap.sdf_descriptor = littlevk::bind(vrb.device, vrb.descriptor_pool)
 		.allocate_descriptor_sets(*pipelines.sdf.dsl).front();
+
+	littlevk::bind(vrb.device, scrap.sdf_descriptor, sdf_dslbs)
+		.update(0, 0, sampler, vk.depth.view, vk::ImageLayout::eGeneral)
+		.finalize();
+
+	vk::DescriptorBufferInfo scene_info { scrap.sdf_scene.buffer, 0, VK_WHOLE_SIZE };
+	vk::DescriptorBufferInfo grid_info { scrap.device_brickmap.grid.buffer, 0, VK_WHOLE_SIZE };
+
+	vk::DescriptorImageInfo atlas_info {
+		scrap.brick_sampler, scrap.device_brickmap.atlas.view,
+		vk::ImageLayout::eShaderReadOnlyOptimal
+	};
+
+	vk::DescriptorImageInfo seeds_info { {}, vk.cone_seeds.view, vk::ImageLayout::eGeneral };
+
+	std::array <vk::WriteDescriptorSet, 4> writes {{
+		{ scrap.sdf_descriptor, 1, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &scene_info },
+		{ scrap.sdf_descriptor, 2, 0, 1, vk::DescriptorType::eCombinedImageSampler, &atlas_info },
+		{ scrap.sdf_descriptor, 3, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &grid_info },
+		{ scrap.sdf_descriptor, 4, 0, 1, vk::DescriptorType::eStorageImage, &seeds_info }
+	}};
+
+	vrb.device.updateDescriptorSets(writes, {});
+}
+
+void Viewport::request_sdf_pipeline()
+{
+	pipelines.sdf = vrb.pipeline_service->graphics(pipelines.sdf_info, pipelines.sdf.dsl);
+	pipelines.sdf_cone = vrb.pipeline_service->compute(pipelines.sdf_cone_shader, pipelines.sdf_cone.layout, pipelines.sdf_cone.dsl);
+}
+
+// The generated function goes right after the version directive; the
+// SPIR-V cache keys on the source, so trees seen before skip glslang
+void Viewport::request_sdf_tree_pipeline(uint64_t hash)
+{
+	std::string generated = sdf::glsl(sdf_tree);
+
+	GraphicsPipelineInfo info = pipelines.sdf_info;
+	ShaderSource cone = pipelines.sdf_cone_shader;
+
+	for (ShaderSource *shader : { &info.shaders[1], &cone }) {
+		shader->source.insert(shader->source.find('\n') + 1, generated);
+		shader->defines.push_back("SDF_TREE");
+	}
+
+	pipelines.sdf_trees[hash] = vrb.pipeline_service->graphics(info, pipelines.sdf.dsl);
+	pipelines.sdf_tree_cones[hash] = vrb.pipeline_service->compute(cone, pipelines.sdf_cone.layout, pipelines.sdf_cone.dsl);
+}
+
+// Every tree's pipelines other than those of the given hash; ones still
+// compiling are waited on when released, frames later
+void Viewport::retire_sdf_tree_pipelines(const std::optional <uint64_t> &keep)
+{
+	vk::Device device = vrb.device;
+	for (auto map : { &pipelines.sdf_trees, &pipelines.sdf_tree_cones }) {
+		std::erase_if(*map, [&](const auto &entry) {
+			if (entry.first == keep)
+				return false;
+
+			vrb.defer([device, handle = entry.second.handle]() {
+				device.destroyPipeline(handle.get());
+			});
+
+			return true;
+		});
+	}
+}
+
+// Blocks until every pipeline the biome needs is ready
+void Viewport::wait_for_pipelines()
+{
+	if (!pipelines.sdf.requested() && !biome.colliders.empty())
+		request_sdf_pipeline();
+
+	uint64_t tree = sdf_tree.hash();
+	if (!sdf_tree.empty() && !pipelines.sdf_trees.count(tree)) {
+		retire_sdf_tree_pipelines(tree);
+		request_sdf_tree_pipeline(tree);
+	}
+
+	for (const PendingPipeline *pending : { &pipelines.raster, &pipelines.sdf, &pipelines.sdf_cone, &pipelines.environment }) {
+		if (pending->requested())
+			pending->handle.wait();
+	}
+
+	for (const auto &map : { &pipelines.sdf_trees, &pipelines.sdf_tree_cones }) {
+		for (const auto &[hash, pending] : *map)
+			pending.handle.wait();
+	}
 }
 
 void Viewport::prepare_environment_pipeline()
@@ -296,19 +739,74 @@ void Viewport::prepare_environment_pipeline()
 	auto screen = Polygon::screen();
 	scrap.screen = VulkanGeometry::from(vrb, screen);
 
-	// Pipeline
-	constexpr auto vlayout = littlevk::VertexLayout <littlevk::rg32f, littlevk::rg32f> ();
+	vk::DescriptorSetLayout dsl = create_descriptor_set_layout(vrb.device, { environment_dslbs.begin(), environment_dslbs.end() });
+
+	vk::PushConstantRange push_constants { vk::ShaderStageFlagBits::eFragment, 0, sizeof(RayFrameExtra) };
+	vk::PipelineLayout layout = create_pipeline_layout(vrb.device, { dsl }, { push_constants });
+
+	// No depth attachment in this subpass
+	GraphicsPipelineInfo info {
+		.render_pass = vk.render_pass,
+		.subpass = 2,
+		.vertex_attributes = { vk::Format::eR32G32Sfloat, vk::Format::eR32G32Sfloat },
+		.shaders = {
+			{ readfile(IVY_SHADERS "/screen.vert"), vk::ShaderStageFlagBits::eVertex },
+			{ readfile(IVY_SHADERS "/post.frag"), vk::ShaderStageFlagBits::eFragment }
+		},
+		.layout = layout,
+		.depth_test = false,
+		.depth_write = false
+	};
 
-	auto bundle = littlevk::ShaderStageBundle(vrb.device, vrb.dal)
-		.attach(readfile(IVY_SHADERS "/screen.vert"), vk::ShaderStageFlagBits::eVertex)
-		.attach(readfile(IVY_SHADERS "/post.frag"), vk::ShaderStageFlagBits::eFragment);
+	pipelines.environment = vrb.pipeline_service->graphics(info, dsl);
+}
 
-	pipelines.environment = littlevk::PipelineAssembler <littlevk::eGraphics> (vrb.device, vrb.window, vrb.dal)
-		.with_render_pass(vk.render_pass, 2)
-		.with_vertex_layout(vlayout)
-		.with_shader_bundle(bundle)
-		.with_dsl_bindings(environment_dslbs)
-		.with_push_constant <RayFrameExtra> (vk::ShaderStageFlagBits::eFragment);
+uint32_t Viewport::cache_texture(const std::string &path)
+{
+	if (path.empty())
+		return dtc.indices["blank"];
+
+	if (dtc.indices.count(path))
+		return dtc.indices[path];
+
+	dtc.load(path);
+	dtc.upload(path);
+	if (!dtc.indices.count(path))
+		return dtc.indices["blank"];
+
+	write_bindless_texture(path);
+
+	return dtc.indices[path];
+}
+
+// Write into the texture array slot owned by the texture, which
+// shows the blank texture while evicted
+void Viewport::write_bindless_texture(const std::string &path)
+{
+	const std::string &source = dtc.resident(path) ? path : "blank";
+
+	vk::DescriptorImageInfo image_info {
+		sampler, dtc.device_textures[source].view,
+		vk::ImageLayout::eShaderReadOnlyOptimal
+	};
+
+	vk::WriteDescriptorSet write {
+		bindless.dset, 2, dtc.physical(dtc.indices[path]), 1,
+		vk::DescriptorType::eCombinedImageSampler,
+		&image_info
+	};
+
+	vrb.device.updateDescriptorSets(write, {});
+}
+
+uint32_t Viewport::cache_material(const VulkanMaterial &vmat)
+{
+	if (bindless.material_count == bindless.material_capacity)
+		allocate_bindless_set(2 * bindless.material_capacity);
+
+	uint32_t index = bindless.material_count++;
+	vrb.allocator->upload(bindless.materials, &vmat, sizeof(vmat), index * sizeof(VulkanMaterial));
+	return index;
 }
 
 void Viewport::cache_geometry_properties(ComponentRef <Geometry> &g)
@@ -320,80 +818,203 @@ void Viewport::cache_geometry_properties(ComponentRef <Geometry> &g)
 	g->mesh.normals = smooth_normals(g->mesh);
 	caches.geometry[i] = VulkanGeometry::from(vrb, g->mesh);
 
-	vk::DescriptorSet dset = littlevk::bind(vrb.device, vrb.descriptor_pool)
-		.allocate_descriptor_sets(*pipelines.raster.dsl).front();
-
 	// TODO: stream/batchify
-	const littlevk::Image &image = [&](const std::string &diffuse) {
-		if (!diffuse.empty()) {
-			dtc.load(diffuse);
-			dtc.upload(diffuse);
-			return dtc.device_textures[diffuse];
-		}
-
-		return dtc.device_textures["blank"];
-	} (g->material.textures.diffuse);
+	uint32_t texture = cache_texture(g->material.textures.diffuse);
+
+	// Bounding sphere and UV span, for picking mips to stream
+	glm::vec3 min = glm::vec3(std::numeric_limits <float> ::max());
+	glm::vec3 max = -min;
+	for (const glm::vec3 &p : g->mesh.positions) {
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
 
-	// Export the material as well
-	auto vmat = VulkanMaterial::from(g->material);
+	glm::vec2 uv_min = glm::vec2(std::numeric_limits <float> ::max());
+	glm::vec2 uv_max = -uv_min;
+	for (const glm::vec2 &uv : g->mesh.uvs) {
+		uv_min = glm::min(uv_min, uv);
+		uv_max = glm::max(uv_max, uv);
+	}
 
-	littlevk::Buffer material_buffer = littlevk::bind(vrb.device, vrb.memory_properties, vrb.dal)
-		.buffer(&vmat, sizeof(vmat), vk::BufferUsageFlagBits::eUniformBuffer);
+	glm::vec2 span = g->mesh.uvs.empty() ? glm::vec2(1.0f) : uv_max - uv_min;
 
-	littlevk::bind(vrb.device, dset, rendering_dslbs)
-		.update(0, 0, sampler, image.view, vk::ImageLayout::eShaderReadOnlyOptimal)
-		.update(1, 0, *scrap.shl, 0, sizeof(SHLighting))
-		.update(2, 0, *material_buffer, 0, sizeof(VulkanMaterial))
-		.finalize();
+	caches.textures[i] = TextureUsage {
+		.slot = texture,
+		.center = 0.5f * (min + max),
+		.radius = 0.5f * glm::length(max - min),
+		.tiling = std::max({ span.x, span.y, 1.0f })
+	};
 
-	caches.descriptors[i] = dset;
+	// Export the material to the global table
+	caches.materials[i] = cache_material(VulkanMaterial::from(g->material));
 }
 
 // TODO: keep an internal frame state?
 void Viewport::render(const vk::CommandBuffer &cmd, const littlevk::SurfaceOperation &op)
 {
+	IVY_PROFILE_SCOPE("Viewport::render");
+
 	camera.aspect = float(vk.extent.width)/float(vk.extent.height);
 
 	littlevk::viewport_and_scissor(cmd, vk.extent);
 
-	// Key input
-	handle_key_input(vrb.window->handle, camera_transform);
+	// Key input, if there is a window
+	if (!vrb.headless) {
+		IVY_PROFILE_SCOPE("Viewport::render: input");
+		handle_key_input(vrb.window->handle, camera_transform);
+	}
 
 	// Begin the render pass
 	const auto &rpbi = littlevk::default_rp_begin_info <2>
 		(vk.render_pass, vk.framebuffers[op.index], vk.extent)
 		.clear_color(0, std::array <float, 4> { 1.0f, 1.0f, 1.0f, 1.0f });
 
+	auto viewport_scope = vrb.gpu_profiler->scope(cmd, "Viewport");
+
+	// Streamed mips are copied outside of the render pass; slots of
+	// textures that changed or were evicted are rewritten
+	{
+		IVY_PROFILE_SCOPE("Viewport::render: stream textures");
+
+		auto residency = dtc.update(cmd);
+		for (const std::string &path : residency.uploaded)
+			write_bindless_texture(path);
+		for (const std::string &path : residency.evicted)
+			write_bindless_texture(path);
+	}
+
+	// Before the render pass, since it may replace the descriptor set
+	if (!biome.colliders.empty())
+		update_sdf_scene(cmd);
+
+	if (!pipelines.sdf.requested() && !biome.colliders.empty())
+		request_sdf_pipeline();
+
+	// Shared by the screen space passes
+	RayFrame rayframe = camera.rayframe(camera_transform);
+	RayFrameExtra rayframe_extra;
+
+	rayframe_extra.origin = rayframe.origin;
+	rayframe_extra.lower_left = rayframe.lower_left;
+	rayframe_extra.horizontal = rayframe.horizontal;
+	rayframe_extra.vertical = rayframe.vertical;
+	rayframe_extra.near = camera.near;
+	rayframe_extra.far = camera.far;
+
+	// Cones are marched at half resolution before the render pass, and
+	// seed where the rays of the SDF subpass start
+	const PendingPipeline *sdf = &pipelines.sdf;
+	const PendingPipeline *sdf_cone = &pipelines.sdf_cone;
+
+	// Until the tree's own pipelines are compiled, only the colliders
+	if (sdf_tree.empty()) {
+		retire_sdf_tree_pipelines(std::nullopt);
+	} else {
+		uint64_t hash = sdf_tree.hash();
+		if (!pipelines.sdf_trees.count(hash)) {
+			retire_sdf_tree_pipelines(hash);
+			request_sdf_tree_pipeline(hash);
+		}
+
+		if (pipelines.sdf_trees[hash].ready() && pipelines.sdf_tree_cones[hash].ready()) {
+			sdf = &pipelines.sdf_trees[hash];
+			sdf_cone = &pipelines.sdf_tree_cones[hash];
+		}
+	}
+
+	bool sdf_ready = sdf->ready() && sdf_cone->ready();
+	if (sdf_ready) {
+		auto scope = vrb.gpu_profiler->scope(cmd, "SDF cones");
+		auto ppl = sdf_cone->get();
+
+		// The previous frame may still be reading the seeds
+		cmd.pipelineBarrier(vk::PipelineStageFlagBits::eFragmentShader,
+			vk::PipelineStageFlagBits::eComputeShader,
+			{}, {}, {}, {});
+
+		cmd.bindPipeline(vk::PipelineBindPoint::eCompute, ppl.handle);
+		cmd.pushConstants <RayFrameExtra> (ppl.layout, vk::ShaderStageFlagBits::eCompute, 0, rayframe_extra);
+		cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, ppl.layout,
+			0, scrap.sdf_descriptor, {});
+
+		vk::Extent3D seeds = vk.cone_seeds.extent;
+		cmd.dispatch((seeds.width + 7)/8, (seeds.height + 7)/8, 1);
+
+		vk::MemoryBarrier barrier {
+			vk::AccessFlagBits::eShaderWrite,
+			vk::AccessFlagBits::eShaderRead
+		};
+
+		cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+			vk::PipelineStageFlagBits::eFragmentShader,
+			{}, barrier, {}, {});
+	}
+
 	cmd.beginRenderPass(rpbi, vk::SubpassContents::eInline);
 
 	// Render all active geometry
 	// TODO: methods
-	{
-		auto ppl = pipelines.raster;
+	if (pipelines.raster.ready()) {
+		auto scope = vrb.gpu_profiler->scope(cmd, "Raster");
+		auto ppl = pipelines.raster.get();
+
+		decltype(biome.grab_all <Transform, Geometry> ()) geometries;
+		{
+			IVY_PROFILE_SCOPE("Viewport::render: grab_all");
+			geometries = biome.grab_all <Transform, Geometry> ();
+		}
+
+		// Cache new geometry first, since it may reallocate the global set
+		{
+			IVY_PROFILE_SCOPE("Viewport::render: cache geometry");
+
+			for (auto &[transform, g] : geometries) {
+				if (caches.geometry.count(g.hash()) == 0)
+					cache_geometry_properties(g);
+			}
+		}
+
+		IVY_PROFILE_SCOPE("Viewport::render: raster");
 
 		cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, ppl.handle);
+		cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, ppl.layout, 0, bindless.dset, {});
 
 		MVPConstants mvp {};
 		mvp.proj = camera.perspective_matrix();
 		mvp.view = Camera::view_matrix(camera_transform);
 		mvp.camera = camera_transform.position;
 
-		for (auto [transform, g] : biome.grab_all <Transform, Geometry> ()) {
-			if (caches.geometry.count(g.hash()) == 0)
-				cache_geometry_properties(g);
+		// Pixels per unit of distance at a depth of one
+		float focal = vk.extent.height / (2.0f * std::tan(glm::radians(camera.fov)/2.0f));
 
+		for (auto [transform, g] : geometries) {
 			// TODO: check dirty flag
 			uint32_t index = g.hash();
 			const auto &vg = caches.geometry[index];
-			const auto &dset = caches.descriptors[index];
 
 			// TODO: if not in cache, skip for now and spawn a thread for it (requries a thread pool)
 
 			mvp.model = transform->matrix();
-//				mvp.model = glm::mat4(1.0f);
+			mvp.material = caches.materials[index];
+
+			// Approximate texels needed across the object on screen
+			const TextureUsage &usage = caches.textures[index];
+
+			glm::vec3 center = glm::vec3(mvp.model * glm::vec4(usage.center, 1.0f));
+			float scale = glm::max(glm::length(glm::vec3(mvp.model[0])),
+				glm::max(glm::length(glm::vec3(mvp.model[1])), glm::length(glm::vec3(mvp.model[2]))));
+
+			float radius = usage.radius * scale;
+			float distance = std::max(glm::length(center - camera_transform.position) - radius, camera.near);
+			float footprint = 2.0f * radius * focal / distance / usage.tiling;
+
+			mvp.texture = dtc.physical(usage.slot);
+			dtc.touch(usage.slot, footprint);
+
+			cmd.pushConstants <MVPConstants> (ppl.layout,
+				vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+				0, mvp);
 
-			cmd.pushConstants <MVPConstants> (ppl.layout, vk::ShaderStageFlagBits::eVertex, 0, mvp);
-			cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, ppl.layout, 0, dset, {});
 			cmd.bindVertexBuffers(0, { vg.vertices.buffer }, { 0 });
 			cmd.bindIndexBuffer(vg.triangles.buffer, 0, vk::IndexType::eUint32);
 			cmd.drawIndexed(vg.count, 1, 0, 0, 0);
@@ -404,21 +1025,12 @@ void Viewport::render(const vk::CommandBuffer &cmd, const littlevk::SurfaceOpera
 	// TODO: separate rendering stages
 	cmd.nextSubpass(vk::SubpassContents::eInline);
 
-	{
-		auto ppl = pipelines.sdf;
+	if (sdf_ready) {
+		auto scope = vrb.gpu_profiler->scope(cmd, "SDF");
+		auto ppl = sdf->get();
 
 		cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, ppl.handle);
 
-		RayFrame rayframe = camera.rayframe(camera_transform);
-		RayFrameExtra rayframe_extra;
-
-		rayframe_extra.origin = rayframe.origin;
-		rayframe_extra.lower_left = rayframe.lower_left;
-		rayframe_extra.horizontal = rayframe.horizontal;
-		rayframe_extra.vertical = rayframe.vertical;
-		rayframe_extra.near = camera.near;
-		rayframe_extra.far = camera.far;
-
 		cmd.pushConstants <RayFrameExtra> (ppl.layout, vk::ShaderStageFlagBits::eFragment, 0, rayframe_extra);
 
 		cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, ppl.layout,
@@ -432,25 +1044,12 @@ void Viewport::render(const vk::CommandBuffer &cmd, const littlevk::SurfaceOpera
 	// Render the environment
 	cmd.nextSubpass(vk::SubpassContents::eInline);
 
-	{
-		auto ppl = pipelines.environment;
+	if (pipelines.environment.ready()) {
+		auto scope = vrb.gpu_profiler->scope(cmd, "Environment");
+		auto ppl = pipelines.environment.get();
 
 		cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, ppl.handle);
 
-		// RayFrame rayframe = camera.rayframe(camera_transform);
-		//
-		// cmd.pushConstants <RayFrame> (ppl.layout, eFragment, 0, rayframe);
-
-		RayFrame rayframe = camera.rayframe(camera_transform);
-		RayFrameExtra rayframe_extra;
-
-		rayframe_extra.origin = rayframe.origin;
-		rayframe_extra.lower_left = rayframe.lower_left;
-		rayframe_extra.horizontal = rayframe.horizontal;
-		rayframe_extra.vertical = rayframe.vertical;
-		rayframe_extra.near = camera.near;
-		rayframe_extra.far = camera.far;
-
 		cmd.pushConstants <RayFrameExtra> (ppl.layout, vk::ShaderStageFlagBits::eFragment, 0, rayframe_extra);
 
 		cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, ppl.layout,
@@ -465,61 +1064,100 @@ void Viewport::render(const vk::CommandBuffer &cmd, const littlevk::SurfaceOpera
 	cmd.endRenderPass();
 
 	// Transition to a reasonable layout
-	littlevk::transition(cmd, vk.images[op.index],
+	transition(cmd, vk.images[op.index],
 		vk::ImageLayout::ePresentSrcKHR,
 		vk::ImageLayout::eShaderReadOnlyOptimal);
-
-	// Handling the free queue
-	await_free_queue.remove_if(
-		[&](AwaitResourceFree &arf) -> bool {
-			if (arf.frame == op.index) {
-				arf.left--;
-				if (arf.left < 0) {
-					// TODO: visitor
-					if (std::holds_alternative <littlevk::Image> (arf.resource)) {
-						littlevk::destroy_image(vrb.device, std::get <littlevk::Image> (arf.resource));
-						ulog_info("Viewport", "Destroyed leftover image\n");
-					}
-
-					if (std::holds_alternative <vk::DescriptorSet> (arf.resource)) {
-						ImGui_ImplVulkan_RemoveTexture(std::get <vk::DescriptorSet> (arf.resource));
-						ulog_info("Viewport", "Destroyed leftover descriptor set\n");
-					}
-				}
-			}
-
-			return arf.left < 0;
-		}
-	);
 }
 
 std::unique_ptr <Viewport> Viewport::from
 (
 	Biome &biome,
-	const VulkanResourceBase &vrb,
+	VulkanResourceBase &vrb,
 	std::unique_ptr <CursorDispatcher> &cursor_dispatcher,
 	const vk::Extent2D &extent
 )
 {
-	// Allocate the viewport
-	auto viewport = std::make_unique <Viewport> (Viewport {
+	// Allocate the viewport, in place since it is not movable
+	std::unique_ptr <Viewport> viewport(new Viewport {
 		.biome = biome,
 		.vrb = vrb,
 		.dtc = DeviceTextureCache::from(vrb)
 	});
 
+	// Start decoding every texture of the biome in the background
+	viewport->dtc.normal_maps = biome.normal_maps();
+	viewport->dtc.prefetch(biome.textures());
+
 	// Set it off to prepare itself
 	viewport->prepare();
 	viewport->resize(extent);
 
-	// Register the viewport for cursor control
-	Viewport *raw = viewport.get();
-	cursor_dispatcher->handlers[&viewport->region] = [raw](const CursorDispatcher::MouseInfo &info) {
-		return raw->cursor_handler(info);
-	};
+	// Register the viewport for cursor control, if there is a window
+	if (cursor_dispatcher) {
+		Viewport *raw = viewport.get();
+		cursor_dispatcher->handlers[&viewport->region] = [raw](const CursorDispatcher::MouseInfo &info) {
+			return raw->cursor_handler(info);
+		};
+	}
 
 	// Return once completed
 	return viewport;
 }
 
+// Released once the frames in flight are done with them, or when
+// the resource base is destroyed
+Viewport::~Viewport()
+{
+	scrap.environment.destroy(vrb);
+	retire_sdf_tree_pipelines(std::nullopt);
+
+	vrb.retire(scrap.sdf_scene);
+	vrb.retire(scrap.device_brickmap.atlas);
+	vrb.retire(scrap.device_brickmap.grid);
+
+	vk::Device device = vrb.device;
+
+	// Pipelines still compiling are waited on when released
+	for (const PendingPipeline *pending : { &pipelines.raster, &pipelines.sdf, &pipelines.sdf_cone, &pipelines.environment }) {
+		if (!pending->requested())
+			continue;
+
+		vrb.defer([device, handle = pending->handle]() {
+			device.destroyPipeline(handle.get());
+		});
+	}
+
+	// The cone pass shares the descriptor set layout of the SDF pass
+	std::vector <vk::PipelineLayout> layouts {
+		pipelines.raster.layout,
+		pipelines.sdf.layout,
+		pipelines.sdf_cone.layout,
+		pipelines.environment.layout,
+	};
+
+	std::vector <vk::DescriptorSetLayout> dsls { bindless.dsl };
+	for (const PendingPipeline *pending : { &pipelines.sdf, &pipelines.environment }) {
+		if (pending->dsl)
+			dsls.push_back(*pending->dsl);
+	}
+
+	vrb.defer([device, layouts, dsls, pool = bindless.pool, sampler = sampler, brick_sampler = scrap.brick_sampler, render_pass = vk.render_pass]() {
+		for (auto layout : layouts) {
+			if (layout)
+				device.destroyPipelineLayout(layout);
+		}
+
+		for (auto dsl : dsls) {
+			if (dsl)
+				device.destroyDescriptorSetLayout(dsl);
+		}
+
+		// Frees the bindless set along with it
+		device.destroyDescriptorPool(pool);
+		device.destroySampler(sampler);
+		device.destroySampler(brick_sampler);
+		device.destroyRenderPass(render_pass);
+	});
+}
+
 }
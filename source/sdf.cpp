@@ -1,7 +1,199 @@
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
 #include "sdf.hpp"
 
 namespace ivy::sdf {
 
+AABB bounds(const Shape &shape)
+{
+	if (auto sphere = std::get_if <Sphere> (&shape))
+		return { sphere->center - sphere->radius, sphere->center + sphere->radius };
+
+	const Box &box = std::get <Box> (shape);
+	return { box.min, box.max };
+}
+
+float distance(const Shape &shape, const glm::vec3 &p)
+{
+	if (auto sphere = std::get_if <Sphere> (&shape))
+		return glm::distance(p, sphere->center) - sphere->radius;
+
+	const Box &box = std::get <Box> (shape);
+
+	glm::vec3 q = glm::abs(p - 0.5f * (box.min + box.max)) - 0.5f * (box.max - box.min);
+	return glm::length(glm::max(q, 0.0f)) + std::min(std::max(q.x, std::max(q.y, q.z)), 0.0f);
+}
+
+// Lower bound on the distance to anything inside
+static float distance(const AABB &box, const glm::vec3 &p)
+{
+	return glm::length(glm::max(glm::max(box.min - p, p - box.max), 0.0f));
+}
+
+Shape transformed(const Shape &shape, const Transform &transform)
+{
+	glm::mat4 model = transform.matrix();
+
+	if (auto sphere = std::get_if <Sphere> (&shape)) {
+		glm::vec3 scale = glm::abs(transform.scale);
+		float factor = std::max({ scale.x, scale.y, scale.z });
+		return Sphere { glm::vec3(model * glm::vec4(sphere->center, 1.0f)), factor * sphere->radius };
+	}
+
+	const Box &box = std::get <Box> (shape);
+
+	Box result { glm::vec3(std::numeric_limits <float> ::max()), glm::vec3(-std::numeric_limits <float> ::max()) };
+	for (uint32_t i = 0; i < 8; i++) {
+		glm::vec3 corner {
+			(i & 1) ? box.max.x : box.min.x,
+			(i & 2) ? box.max.y : box.min.y,
+			(i & 4) ? box.max.z : box.min.z
+		};
+
+		corner = glm::vec3(model * glm::vec4(corner, 1.0f));
+		result.min = glm::min(result.min, corner);
+		result.max = glm::max(result.max, corner);
+	}
+
+	return result;
+}
+
+// Building the hierarchy
+struct BVHBuilder {
+	BVH &bvh;
+	const std::vector <AABB> &boxes;
+	const std::vector <glm::vec3> &centroids;
+
+	void split(uint32_t node, uint32_t begin, uint32_t end) {
+		AABB box = boxes[bvh.indices[begin]];
+		glm::vec3 lo = centroids[bvh.indices[begin]];
+		glm::vec3 hi = lo;
+		for (uint32_t i = begin + 1; i < end; i++) {
+			box.min = glm::min(box.min, boxes[bvh.indices[i]].min);
+			box.max = glm::max(box.max, boxes[bvh.indices[i]].max);
+			lo = glm::min(lo, centroids[bvh.indices[i]]);
+			hi = glm::max(hi, centroids[bvh.indices[i]]);
+		}
+
+		bvh.nodes[node].min = box.min;
+		bvh.nodes[node].max = box.max;
+
+		glm::vec3 extent = hi - lo;
+		if (end - begin <= BVH::leaf_size || std::max({ extent.x, extent.y, extent.z }) <= 0.0f) {
+			bvh.nodes[node].first = begin;
+			bvh.nodes[node].count = end - begin;
+			return;
+		}
+
+		int axis = 0;
+		if (extent.y > extent[axis])
+			axis = 1;
+		if (extent.z > extent[axis])
+			axis = 2;
+
+		uint32_t middle = (begin + end)/2;
+		std::nth_element(bvh.indices.begin() + begin, bvh.indices.begin() + middle, bvh.indices.begin() + end,
+			[&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+
+		uint32_t left = bvh.nodes.size();
+		bvh.nodes[node].first = left;
+		bvh.nodes[node].count = 0;
+		bvh.nodes.resize(left + 2);
+
+		split(left, begin, middle);
+		split(left + 1, middle, end);
+	}
+};
+
+BVH BVH::from(const std::vector <AABB> &boxes)
+{
+	BVH bvh;
+	if (boxes.empty())
+		return bvh;
+
+	std::vector <glm::vec3> centroids;
+	for (const AABB &box : boxes)
+		centroids.push_back(0.5f * (box.min + box.max));
+
+	bvh.indices.resize(boxes.size());
+	std::iota(bvh.indices.begin(), bvh.indices.end(), 0);
+
+	bvh.nodes.resize(1);
+	BVHBuilder { bvh, boxes, centroids }.split(0, 0, boxes.size());
+
+	return bvh;
+}
+
+BVH BVH::from(const std::vector <Shape> &shapes)
+{
+	std::vector <AABB> boxes;
+	for (const Shape &shape : shapes)
+		boxes.push_back(bounds(shape));
+
+	return from(boxes);
+}
+
+float BVH::distance(const std::vector <Shape> &shapes, const glm::vec3 &p) const
+{
+	float closest = std::numeric_limits <float> ::max();
+	if (nodes.empty())
+		return closest;
+
+	uint32_t stack[64];
+	uint32_t top = 0;
+	stack[top++] = 0;
+
+	while (top > 0) {
+		const Node &node = nodes[stack[--top]];
+		if (sdf::distance(AABB { node.min, node.max }, p) >= closest)
+			continue;
+
+		if (node.count > 0) {
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+				closest = std::min(closest, sdf::distance(shapes[indices[i]], p));
+
+			continue;
+		}
+
+		const Node &left = nodes[node.first];
+		const Node &right = nodes[node.first + 1];
+
+		// Nearer child last, so that it is visited first
+		if (sdf::distance(AABB { left.min, left.max }, p) < sdf::distance(AABB { right.min, right.max }, p)) {
+			stack[top++] = node.first + 1;
+			stack[top++] = node.first;
+		} else {
+			stack[top++] = node.first;
+			stack[top++] = node.first + 1;
+		}
+	}
+
+	return closest;
+}
+
+AABB Compound::bounds() const
+{
+	AABB region { glm::vec3(std::numeric_limits <float> ::max()), glm::vec3(-std::numeric_limits <float> ::max()) };
+	for (const Shape &shape : shapes) {
+		AABB box = sdf::bounds(shape);
+		region.min = glm::min(region.min, box.min);
+		region.max = glm::max(region.max, box.max);
+	}
+
+	for (const GridInstance &instance : grids) {
+		region.min = glm::min(region.min, instance.box.min);
+		region.max = glm::max(region.max, instance.box.max);
+	}
+
+	// Empty compounds are a point at the origin
+	if (shapes.empty() && grids.empty())
+		return { glm::vec3(0.0f), glm::vec3(0.0f) };
+
+	return region;
+}
+
 std::vector <glm::vec4> Compound::serialize() const
 {
 	std::vector <glm::vec4> result;
@@ -15,14 +207,22 @@ std::vector <glm::vec4> Compound::serialize() const
 		}
 
 		void operator()(const Box &box) {
-			buffer.emplace_back(box.min, 0.0f);
+			buffer.emplace_back(box.min, 1.0f);
 			buffer.emplace_back(box.max, 0.0f);
 		}
 	};
 
-	result.emplace_back(shapes.size());
-	for (const Shape &s : shapes)
-		std::visit(visitor { result }, s);
+	BVH bvh = BVH::from(shapes);
+
+	// Leaves refer to ranges of shapes, so those are stored in order
+	result.emplace_back(shapes.size(), bvh.nodes.size(), 0.0f, 0.0f);
+	for (uint32_t index : bvh.indices)
+		std::visit(visitor { result }, shapes[index]);
+
+	for (const BVH::Node &node : bvh.nodes) {
+		result.emplace_back(node.min, node.first);
+		result.emplace_back(node.max, node.count);
+	}
 
 	return result;
 }
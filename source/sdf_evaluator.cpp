@@ -0,0 +1,359 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IVY_X86
+#endif
+
+#include "core/pixel_formats.hpp"
+#include "core/profiler.hpp"
+#include "sdf_evaluator.hpp"
+
+namespace ivy::sdf {
+
+// Roughly this many point and shape tests per worker; small batches
+// stay on the calling thread
+static constexpr size_t WORK_PER_CHUNK = 1 << 18;
+
+template <typename F>
+static void parallel_chunks(size_t count, size_t shapes, const F &ftn)
+{
+	size_t chunk = std::max(WORK_PER_CHUNK/std::max(shapes, size_t(1)), size_t(64)) & ~size_t(7);
+	ptrdiff_t chunks = (count + chunk - 1)/chunk;
+
+	#pragma omp parallel for if (chunks > 1)
+	for (ptrdiff_t i = 0; i < chunks; i++) {
+		size_t begin = i * chunk;
+		size_t end = std::min(begin + chunk, count);
+		ftn(begin, end);
+	}
+}
+
+// Outputs are skipped where null
+struct Outputs {
+	float *distances;
+	float *gradients;
+	uint32_t *ids;
+};
+
+static void evaluate_scalar(const Evaluator &ev, const float *points, const Outputs &out, size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i++) {
+		float px = points[3 * i + 0];
+		float py = points[3 * i + 1];
+		float pz = points[3 * i + 2];
+
+		float best = std::numeric_limits <float> ::max();
+		float gx = 0.0f;
+		float gy = 0.0f;
+		float gz = 0.0f;
+		uint32_t id = Evaluator::none;
+
+		for (size_t j = 0; j < ev.spheres.ids.size(); j++) {
+			float dx = px - ev.spheres.x[j];
+			float dy = py - ev.spheres.y[j];
+			float dz = pz - ev.spheres.z[j];
+			float length = std::sqrt(dx * dx + dy * dy + dz * dz);
+			float d = length - ev.spheres.radius[j];
+			if (d < best) {
+				float inverse = 1.0f/std::max(length, 1e-20f);
+				best = d;
+				gx = dx * inverse;
+				gy = dy * inverse;
+				gz = dz * inverse;
+				id = ev.spheres.ids[j];
+			}
+		}
+
+		for (size_t j = 0; j < ev.boxes.ids.size(); j++) {
+			float dx = px - ev.boxes.x[j];
+			float dy = py - ev.boxes.y[j];
+			float dz = pz - ev.boxes.z[j];
+			float qx = std::abs(dx) - ev.boxes.hx[j];
+			float qy = std::abs(dy) - ev.boxes.hy[j];
+			float qz = std::abs(dz) - ev.boxes.hz[j];
+			float ox = std::max(qx, 0.0f);
+			float oy = std::max(qy, 0.0f);
+			float oz = std::max(qz, 0.0f);
+			float outside = std::sqrt(ox * ox + oy * oy + oz * oz);
+			float inside = std::min(std::max(qx, std::max(qy, qz)), 0.0f);
+			float d = outside + inside;
+			if (d < best) {
+				best = d;
+				id = ev.boxes.ids[j];
+
+				float sx = std::copysign(1.0f, dx);
+				float sy = std::copysign(1.0f, dy);
+				float sz = std::copysign(1.0f, dz);
+				if (outside > 0.0f) {
+					float inverse = 1.0f/outside;
+					gx = ox * inverse * sx;
+					gy = oy * inverse * sy;
+					gz = oz * inverse * sz;
+				} else {
+					// Towards the nearest face
+					bool x = (qx >= qy && qx >= qz);
+					bool y = !x && (qy >= qz);
+					gx = x ? sx : 0.0f;
+					gy = y ? sy : 0.0f;
+					gz = (!x && !y) ? sz : 0.0f;
+				}
+			}
+		}
+
+		if (out.distances)
+			out.distances[i] = best;
+
+		if (out.gradients) {
+			out.gradients[3 * i + 0] = gx;
+			out.gradients[3 * i + 1] = gy;
+			out.gradients[3 * i + 2] = gz;
+		}
+
+		if (out.ids)
+			out.ids[i] = id;
+	}
+}
+
+#ifdef IVY_X86
+
+// One with the sign of each lane
+__attribute__((target("avx2")))
+static inline __m256 sign_of(__m256 v)
+{
+	return _mm256_or_ps(_mm256_and_ps(v, _mm256_set1_ps(-0.0f)), _mm256_set1_ps(1.0f));
+}
+
+// Eight points per iteration against one shape at a time; the results
+// match the scalar path, including which shape wins ties
+__attribute__((target("avx2")))
+static size_t evaluate_avx2(const Evaluator &ev, const float *points, const Outputs &out, size_t begin, size_t end)
+{
+	const __m256i stride = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	const __m256 tiny = _mm256_set1_ps(1e-20f);
+
+	for (; begin + 8 <= end; begin += 8) {
+		const float *base = points + 3 * begin;
+		__m256 px = _mm256_i32gather_ps(base + 0, stride, 4);
+		__m256 py = _mm256_i32gather_ps(base + 1, stride, 4);
+		__m256 pz = _mm256_i32gather_ps(base + 2, stride, 4);
+
+		__m256 best = _mm256_set1_ps(std::numeric_limits <float> ::max());
+		__m256 gx = zero;
+		__m256 gy = zero;
+		__m256 gz = zero;
+		__m256 id = _mm256_castsi256_ps(_mm256_set1_epi32(Evaluator::none));
+
+		for (size_t j = 0; j < ev.spheres.ids.size(); j++) {
+			__m256 dx = _mm256_sub_ps(px, _mm256_set1_ps(ev.spheres.x[j]));
+			__m256 dy = _mm256_sub_ps(py, _mm256_set1_ps(ev.spheres.y[j]));
+			__m256 dz = _mm256_sub_ps(pz, _mm256_set1_ps(ev.spheres.z[j]));
+
+			__m256 squared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+			__m256 length = _mm256_sqrt_ps(squared);
+			__m256 d = _mm256_sub_ps(length, _mm256_set1_ps(ev.spheres.radius[j]));
+
+			__m256 mask = _mm256_cmp_ps(d, best, _CMP_LT_OQ);
+			if (_mm256_testz_ps(mask, mask))
+				continue;
+
+			best = _mm256_blendv_ps(best, d, mask);
+			id = _mm256_blendv_ps(id, _mm256_castsi256_ps(_mm256_set1_epi32(ev.spheres.ids[j])), mask);
+
+			__m256 inverse = _mm256_div_ps(one, _mm256_max_ps(length, tiny));
+			gx = _mm256_blendv_ps(gx, _mm256_mul_ps(dx, inverse), mask);
+			gy = _mm256_blendv_ps(gy, _mm256_mul_ps(dy, inverse), mask);
+			gz = _mm256_blendv_ps(gz, _mm256_mul_ps(dz, inverse), mask);
+		}
+
+		for (size_t j = 0; j < ev.boxes.ids.size(); j++) {
+			__m256 dx = _mm256_sub_ps(px, _mm256_set1_ps(ev.boxes.x[j]));
+			__m256 dy = _mm256_sub_ps(py, _mm256_set1_ps(ev.boxes.y[j]));
+			__m256 dz = _mm256_sub_ps(pz, _mm256_set1_ps(ev.boxes.z[j]));
+
+			__m256 qx = _mm256_sub_ps(_mm256_andnot_ps(sign, dx), _mm256_set1_ps(ev.boxes.hx[j]));
+			__m256 qy = _mm256_sub_ps(_mm256_andnot_ps(sign, dy), _mm256_set1_ps(ev.boxes.hy[j]));
+			__m256 qz = _mm256_sub_ps(_mm256_andnot_ps(sign, dz), _mm256_set1_ps(ev.boxes.hz[j]));
+
+			__m256 ox = _mm256_max_ps(qx, zero);
+			__m256 oy = _mm256_max_ps(qy, zero);
+			__m256 oz = _mm256_max_ps(qz, zero);
+
+			__m256 squared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ox, ox), _mm256_mul_ps(oy, oy)), _mm256_mul_ps(oz, oz));
+			__m256 outside = _mm256_sqrt_ps(squared);
+			__m256 inside = _mm256_min_ps(_mm256_max_ps(qx, _mm256_max_ps(qy, qz)), zero);
+			__m256 d = _mm256_add_ps(outside, inside);
+
+			__m256 mask = _mm256_cmp_ps(d, best, _CMP_LT_OQ);
+			if (_mm256_testz_ps(mask, mask))
+				continue;
+
+			best = _mm256_blendv_ps(best, d, mask);
+			id = _mm256_blendv_ps(id, _mm256_castsi256_ps(_mm256_set1_epi32(ev.boxes.ids[j])), mask);
+
+			__m256 sx = sign_of(dx);
+			__m256 sy = sign_of(dy);
+			__m256 sz = sign_of(dz);
+
+			// Outside, along the offset from the box
+			__m256 inverse = _mm256_div_ps(one, _mm256_max_ps(outside, tiny));
+			__m256 outer_x = _mm256_mul_ps(_mm256_mul_ps(ox, inverse), sx);
+			__m256 outer_y = _mm256_mul_ps(_mm256_mul_ps(oy, inverse), sy);
+			__m256 outer_z = _mm256_mul_ps(_mm256_mul_ps(oz, inverse), sz);
+
+			// Inside, towards the nearest face
+			__m256 x = _mm256_and_ps(_mm256_cmp_ps(qx, qy, _CMP_GE_OQ), _mm256_cmp_ps(qx, qz, _CMP_GE_OQ));
+			__m256 y = _mm256_andnot_ps(x, _mm256_cmp_ps(qy, qz, _CMP_GE_OQ));
+			__m256 z = _mm256_andnot_ps(_mm256_or_ps(x, y), _mm256_castsi256_ps(_mm256_set1_epi32(-1)));
+
+			__m256 outer = _mm256_cmp_ps(outside, zero, _CMP_GT_OQ);
+			__m256 grad_x = _mm256_blendv_ps(_mm256_and_ps(x, sx), outer_x, outer);
+			__m256 grad_y = _mm256_blendv_ps(_mm256_and_ps(y, sy), outer_y, outer);
+			__m256 grad_z = _mm256_blendv_ps(_mm256_and_ps(z, sz), outer_z, outer);
+
+			gx = _mm256_blendv_ps(gx, grad_x, mask);
+			gy = _mm256_blendv_ps(gy, grad_y, mask);
+			gz = _mm256_blendv_ps(gz, grad_z, mask);
+		}
+
+		if (out.distances)
+			_mm256_storeu_ps(out.distances + begin, best);
+
+		if (out.gradients) {
+			alignas(32) float x[8];
+			alignas(32) float y[8];
+			alignas(32) float z[8];
+			_mm256_store_ps(x, gx);
+			_mm256_store_ps(y, gy);
+			_mm256_store_ps(z, gz);
+
+			float *dst = out.gradients + 3 * begin;
+			for (int k = 0; k < 8; k++) {
+				dst[3 * k + 0] = x[k];
+				dst[3 * k + 1] = y[k];
+				dst[3 * k + 2] = z[k];
+			}
+		}
+
+		if (out.ids)
+			_mm256_storeu_si256((__m256i *) (out.ids + begin), _mm256_castps_si256(id));
+	}
+
+	return begin;
+}
+
+#endif
+
+// Over the results of the shapes, which must include the distances
+static void evaluate_grids(const Evaluator &ev, const float *points, const Outputs &out, size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i++) {
+		glm::vec3 p { points[3 * i + 0], points[3 * i + 1], points[3 * i + 2] };
+
+		for (size_t j = 0; j < ev.grids.ids.size(); j++) {
+			const GridInstance &instance = ev.grids.instances[j];
+
+			float d = instance.distance(p);
+			if (d >= out.distances[i])
+				continue;
+
+			out.distances[i] = d;
+
+			if (out.gradients) {
+				glm::vec3 g = instance.gradient(p);
+				out.gradients[3 * i + 0] = g.x;
+				out.gradients[3 * i + 1] = g.y;
+				out.gradients[3 * i + 2] = g.z;
+			}
+
+			if (out.ids)
+				out.ids[i] = ev.grids.ids[j];
+		}
+	}
+}
+
+static void evaluate(const Evaluator &ev, const glm::vec3 *points, Outputs out, size_t count)
+{
+	IVY_PROFILE_SCOPE("sdf::Evaluator::evaluate");
+
+	const float *xyz = (const float *) points;
+
+	// Grids compare against the distances to the shapes
+	std::vector <float> scratch;
+	if (!ev.grids.ids.empty() && !out.distances) {
+		scratch.resize(count);
+		out.distances = scratch.data();
+	}
+
+	SIMDLevel level = simd_level();
+	parallel_chunks(count, ev.size(), [&](size_t begin, size_t end) {
+		size_t first = begin;
+#ifdef IVY_X86
+		if (level == SIMDLevel::eAVX2)
+			begin = evaluate_avx2(ev, xyz, out, begin, end);
+#endif
+		evaluate_scalar(ev, xyz, out, begin, end);
+
+		if (!ev.grids.ids.empty())
+			evaluate_grids(ev, xyz, out, first, end);
+	});
+}
+
+void Evaluator::distance(const glm::vec3 *points, float *distances, size_t count) const
+{
+	evaluate(*this, points, { distances, nullptr, nullptr }, count);
+}
+
+void Evaluator::gradient(const glm::vec3 *points, float *distances, glm::vec3 *gradients, size_t count) const
+{
+	evaluate(*this, points, { distances, (float *) gradients, nullptr }, count);
+}
+
+void Evaluator::closest(const glm::vec3 *points, float *distances, uint32_t *ids, size_t count) const
+{
+	evaluate(*this, points, { distances, nullptr, ids }, count);
+}
+
+Evaluator Evaluator::from(const Compound &compound)
+{
+	Evaluator ev;
+
+	for (uint32_t i = 0; i < compound.shapes.size(); i++) {
+		const Shape &shape = compound.shapes[i];
+
+		if (auto sphere = std::get_if <Sphere> (&shape)) {
+			ev.spheres.x.push_back(sphere->center.x);
+			ev.spheres.y.push_back(sphere->center.y);
+			ev.spheres.z.push_back(sphere->center.z);
+			ev.spheres.radius.push_back(sphere->radius);
+			ev.spheres.ids.push_back(i);
+		} else {
+			const Box &box = std::get <Box> (shape);
+
+			glm::vec3 center = 0.5f * (box.min + box.max);
+			glm::vec3 half = 0.5f * (box.max - box.min);
+
+			ev.boxes.x.push_back(center.x);
+			ev.boxes.y.push_back(center.y);
+			ev.boxes.z.push_back(center.z);
+			ev.boxes.hx.push_back(half.x);
+			ev.boxes.hy.push_back(half.y);
+			ev.boxes.hz.push_back(half.z);
+			ev.boxes.ids.push_back(i);
+		}
+	}
+
+	for (uint32_t i = 0; i < compound.grids.size(); i++) {
+		ev.grids.instances.push_back(compound.grids[i]);
+		ev.grids.ids.push_back(compound.shapes.size() + i);
+	}
+
+	return ev;
+}
+
+}
@@ -0,0 +1,352 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include <microlog/microlog.h>
+
+#include "core/profiler.hpp"
+#include "sdf_evaluator.hpp"
+#include "sdf_mesh.hpp"
+
+namespace ivy::sdf {
+
+// Cells are addressed by 21 bits per axis, packed into one key
+static constexpr uint32_t KEY_BITS = 21;
+static constexpr uint64_t KEY_MASK = (uint64_t(1) << KEY_BITS) - 1;
+
+// Pulls cell vertices towards the mean of the crossings, where the
+// normals alone do not pin them down (e.g. on flat faces)
+static constexpr float REGULARIZATION = 0.05f;
+
+static constexpr uint32_t NONE = UINT32_MAX;
+
+static uint64_t pack(const glm::uvec3 &c)
+{
+	return uint64_t(c.x) | (uint64_t(c.y) << KEY_BITS) | (uint64_t(c.z) << (2 * KEY_BITS));
+}
+
+static glm::uvec3 unpack(uint64_t key)
+{
+	return glm::uvec3(key & KEY_MASK, (key >> KEY_BITS) & KEY_MASK, key >> (2 * KEY_BITS));
+}
+
+static uint32_t find(const std::vector <uint64_t> &keys, uint64_t key)
+{
+	auto it = std::lower_bound(keys.begin(), keys.end(), key);
+	if (it == keys.end() || *it != key)
+		return NONE;
+
+	return uint32_t(it - keys.begin());
+}
+
+// Lattice of cells over the compound, with a cell of padding on each side
+struct Lattice {
+	glm::vec3 origin;
+	float cell;
+	glm::uvec3 dims;
+
+	glm::vec3 position(const glm::uvec3 &c) const {
+		return origin + glm::vec3(c) * cell;
+	}
+
+	// Coarsens the cell if the keys cannot address the whole compound
+	static Lattice from(const Compound &compound, float cell) {
+		AABB box = compound.bounds();
+
+		glm::vec3 extent = box.max - box.min;
+		float longest = std::max(extent.x, std::max(extent.y, extent.z));
+
+		// Padding, and a cell for rounding up
+		float limit = float(KEY_MASK - 3);
+		if (longest/cell > limit) {
+			float coarse = longest/limit;
+			ulog_warning("sdf polygonize", "cell size %g is too fine for the compound, using %g\n", cell, coarse);
+			cell = coarse;
+		}
+
+		glm::uvec3 dims = glm::uvec3(glm::ceil(extent/cell)) + 2u;
+		return { box.min - cell, cell, glm::min(dims, glm::uvec3(uint32_t(KEY_MASK))) };
+	}
+};
+
+// Cells of the finest level that the surface may pass through; nodes
+// farther from the surface than their half diagonal are dropped, along
+// with everything below them
+static std::vector <uint64_t> refine(const Evaluator &ev, const Lattice &lattice)
+{
+	IVY_PROFILE_SCOPE("sdf::polygonize::refine");
+
+	uint32_t size = std::bit_ceil(std::max(lattice.dims.x, std::max(lattice.dims.y, lattice.dims.z)));
+
+	std::vector <glm::uvec3> nodes { glm::uvec3(0) };
+	std::vector <glm::uvec3> children;
+	std::vector <glm::vec3> centers;
+	std::vector <float> distances;
+
+	while (size > 1) {
+		size /= 2;
+
+		children.clear();
+		for (const glm::uvec3 &node : nodes) {
+			for (uint32_t i = 0; i < 8; i++) {
+				glm::uvec3 child = node + size * glm::uvec3(i & 1, (i >> 1) & 1, i >> 2);
+				if (glm::any(glm::greaterThanEqual(child, lattice.dims)))
+					continue;
+
+				children.push_back(child);
+			}
+		}
+
+		centers.resize(children.size());
+		distances.resize(children.size());
+
+		float half = 0.5f * size * lattice.cell;
+		for (size_t i = 0; i < children.size(); i++)
+			centers[i] = lattice.position(children[i]) + half;
+
+		ev.distance(centers.data(), distances.data(), centers.size());
+
+		// Slightly loose, since the distances are rounded
+		float reach = 1.001f * std::sqrt(3.0f) * half;
+
+		nodes.clear();
+		for (size_t i = 0; i < children.size(); i++) {
+			if (std::abs(distances[i]) <= reach)
+				nodes.push_back(children[i]);
+		}
+	}
+
+	std::vector <uint64_t> leaves(nodes.size());
+	for (size_t i = 0; i < nodes.size(); i++)
+		leaves[i] = pack(nodes[i]);
+
+	std::sort(leaves.begin(), leaves.end());
+	return leaves;
+}
+
+static glm::uvec3 corner(uint32_t i)
+{
+	return glm::uvec3(i & 1, (i >> 1) & 1, i >> 2);
+}
+
+static glm::uvec3 axis(uint32_t a)
+{
+	return glm::uvec3(a == 0, a == 1, a == 2);
+}
+
+// Minimizes the distance to the planes of the crossings, relative to
+// their mean so that the regularization pulls towards it
+static glm::vec3 solve(const glm::vec3 *points, const glm::vec3 *normals, uint32_t count, const glm::vec3 &lo, const glm::vec3 &hi)
+{
+	glm::vec3 mean(0.0f);
+	for (uint32_t i = 0; i < count; i++)
+		mean += points[i];
+
+	mean /= float(count);
+
+	glm::mat3 A(REGULARIZATION);
+	glm::vec3 b(0.0f);
+	for (uint32_t i = 0; i < count; i++) {
+		const glm::vec3 &n = normals[i];
+		A += glm::outerProduct(n, n);
+		b += n * glm::dot(n, points[i] - mean);
+	}
+
+	glm::vec3 x = mean + glm::inverse(A) * b;
+	return glm::clamp(x, lo, hi);
+}
+
+Mesh polygonize(const Compound &compound, float cell)
+{
+	IVY_PROFILE_SCOPE("sdf::polygonize");
+
+	Mesh mesh;
+	if (compound.shapes.empty() && compound.grids.empty())
+		return mesh;
+
+	Evaluator ev = Evaluator::from(compound);
+	Lattice lattice = Lattice::from(compound, cell);
+	cell = lattice.cell;
+
+	std::vector <uint64_t> leaves = refine(ev, lattice);
+
+	// Corners shared by the leaves, evaluated once each
+	std::vector <uint64_t> corners(8 * leaves.size());
+
+	#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < ptrdiff_t(leaves.size()); i++) {
+		glm::uvec3 c = unpack(leaves[i]);
+		for (uint32_t k = 0; k < 8; k++)
+			corners[8 * i + k] = pack(c + corner(k));
+	}
+
+	std::sort(corners.begin(), corners.end());
+	corners.erase(std::unique(corners.begin(), corners.end()), corners.end());
+
+	std::vector <glm::vec3> points(corners.size());
+	std::vector <float> values(corners.size());
+
+	#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < ptrdiff_t(corners.size()); i++)
+		points[i] = lattice.position(unpack(corners[i]));
+
+	ev.distance(points.data(), values.data(), points.size());
+
+	auto inside = [&](const glm::uvec3 &c) {
+		return values[find(corners, pack(c))] < 0.0f;
+	};
+
+	// Only leaves with corners on both sides hold a vertex
+	std::vector <uint8_t> crossed(leaves.size());
+
+	#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < ptrdiff_t(leaves.size()); i++) {
+		glm::uvec3 c = unpack(leaves[i]);
+
+		uint32_t count = 0;
+		for (uint32_t k = 0; k < 8; k++)
+			count += inside(c + corner(k));
+
+		crossed[i] = (count > 0 && count < 8);
+	}
+
+	std::vector <uint64_t> cells;
+	for (size_t i = 0; i < leaves.size(); i++) {
+		if (crossed[i])
+			cells.push_back(leaves[i]);
+	}
+
+	if (cells.empty())
+		return mesh;
+
+	// Each cell owns the three edges leaving its lowest corner; crossings
+	// are interpolated from the corner distances
+	std::vector <glm::vec3> crossings(3 * cells.size());
+	std::vector <uint8_t> owned(3 * cells.size());
+
+	#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < ptrdiff_t(cells.size()); i++) {
+		glm::uvec3 c = unpack(cells[i]);
+		float d0 = values[find(corners, pack(c))];
+
+		for (uint32_t a = 0; a < 3; a++) {
+			float d1 = values[find(corners, pack(c + axis(a)))];
+
+			owned[3 * i + a] = ((d0 < 0.0f) != (d1 < 0.0f));
+			if (owned[3 * i + a]) {
+				float t = d0/(d0 - d1);
+				crossings[3 * i + a] = lattice.position(c) + t * cell * glm::vec3(axis(a));
+			}
+		}
+	}
+
+	std::vector <uint32_t> slots;
+	for (uint32_t i = 0; i < owned.size(); i++) {
+		if (owned[i])
+			slots.push_back(i);
+	}
+
+	std::vector <glm::vec3> samples(slots.size());
+	std::vector <glm::vec3> gradients(slots.size());
+	std::vector <float> unused(slots.size());
+
+	for (size_t i = 0; i < slots.size(); i++)
+		samples[i] = crossings[slots[i]];
+
+	ev.gradient(samples.data(), unused.data(), gradients.data(), samples.size());
+
+	std::vector <glm::vec3> planes(crossings.size());
+	for (size_t i = 0; i < slots.size(); i++)
+		planes[slots[i]] = gradients[i];
+
+	// One vertex per cell, from the crossings on its twelve edges
+	std::vector <glm::vec3> &positions = mesh.positions;
+	positions.resize(cells.size());
+
+	#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < ptrdiff_t(cells.size()); i++) {
+		glm::uvec3 c = unpack(cells[i]);
+
+		glm::vec3 p[12];
+		glm::vec3 n[12];
+		uint32_t count = 0;
+
+		for (uint32_t a = 0; a < 3; a++) {
+			glm::uvec3 u = axis((a + 1) % 3);
+			glm::uvec3 v = axis((a + 2) % 3);
+
+			for (const glm::uvec3 &offset : { glm::uvec3(0), u, v, u + v }) {
+				uint32_t owner = find(cells, pack(c + offset));
+				if (owner == NONE || !owned[3 * owner + a])
+					continue;
+
+				p[count] = crossings[3 * owner + a];
+				n[count] = planes[3 * owner + a];
+				count++;
+			}
+		}
+
+		glm::vec3 lo = lattice.position(c);
+		positions[i] = solve(p, n, count, lo, lo + cell);
+	}
+
+	mesh.normals.resize(positions.size());
+	unused.resize(positions.size());
+	ev.gradient(positions.data(), unused.data(), mesh.normals.data(), positions.size());
+
+	mesh.uvs.resize(positions.size(), glm::vec2(0.0f));
+
+	// A quad around each crossed edge, joining the four cells sharing it;
+	// wound counter clockwise when seen from outside
+	std::vector <glm::uvec4> quads(3 * cells.size(), glm::uvec4(NONE));
+
+	#pragma omp parallel for
+	for (ptrdiff_t i = 0; i < ptrdiff_t(cells.size()); i++) {
+		glm::uvec3 c = unpack(cells[i]);
+
+		for (uint32_t a = 0; a < 3; a++) {
+			if (!owned[3 * i + a])
+				continue;
+
+			glm::uvec3 u = axis((a + 1) % 3);
+			glm::uvec3 v = axis((a + 2) % 3);
+			if (glm::any(glm::lessThan(c, u + v)))
+				continue;
+
+			glm::uvec4 quad {
+				uint32_t(i),
+				find(cells, pack(c - u)),
+				find(cells, pack(c - u - v)),
+				find(cells, pack(c - v)),
+			};
+
+			if (glm::any(glm::equal(quad, glm::uvec4(NONE))))
+				continue;
+
+			if (!inside(c))
+				quad = glm::uvec4(quad.w, quad.z, quad.y, quad.x);
+
+			quads[3 * i + a] = quad;
+		}
+	}
+
+	for (const glm::uvec4 &q : quads) {
+		if (q.x == NONE)
+			continue;
+
+		// Split along the shorter diagonal
+		float d02 = glm::distance(positions[q.x], positions[q.z]);
+		float d13 = glm::distance(positions[q.y], positions[q.w]);
+		if (d02 <= d13) {
+			mesh.triangles.emplace_back(q.x, q.y, q.z);
+			mesh.triangles.emplace_back(q.x, q.z, q.w);
+		} else {
+			mesh.triangles.emplace_back(q.x, q.y, q.w);
+			mesh.triangles.emplace_back(q.y, q.z, q.w);
+		}
+	}
+
+	return mesh;
+}
+
+}
@@ -0,0 +1,397 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <fmt/format.h>
+
+#include "core/hash.hpp"
+#include "sdf_tree.hpp"
+
+namespace ivy::sdf {
+
+uint32_t Tree::shape(const Shape &s)
+{
+	shapes.push_back(s);
+	nodes.push_back(Node { Operation::eShape, uint32_t(shapes.size() - 1) });
+	return root = nodes.size() - 1;
+}
+
+uint32_t Tree::unite(uint32_t a, uint32_t b, float radius)
+{
+	Operation op = (radius > 0.0f) ? Operation::eSmoothUnion : Operation::eUnion;
+	nodes.push_back(Node { op, a, b, std::max(radius, 0.0f) });
+	return root = nodes.size() - 1;
+}
+
+uint32_t Tree::intersect(uint32_t a, uint32_t b, float radius)
+{
+	Operation op = (radius > 0.0f) ? Operation::eSmoothIntersection : Operation::eIntersection;
+	nodes.push_back(Node { op, a, b, std::max(radius, 0.0f) });
+	return root = nodes.size() - 1;
+}
+
+uint32_t Tree::subtract(uint32_t a, uint32_t b, float radius)
+{
+	Operation op = (radius > 0.0f) ? Operation::eSmoothSubtraction : Operation::eSubtraction;
+	nodes.push_back(Node { op, a, b, std::max(radius, 0.0f) });
+	return root = nodes.size() - 1;
+}
+
+uint32_t Tree::transform(uint32_t a, const Transform &t)
+{
+	transforms.push_back(t);
+	nodes.push_back(Node { Operation::eTransform, a, uint32_t(transforms.size() - 1) });
+	return root = nodes.size() - 1;
+}
+
+// Distances shrink by at most the smallest factor of the scale
+static float distance_scale(const Transform &t)
+{
+	glm::vec3 scale = glm::abs(t.scale);
+	return std::min({ scale.x, scale.y, scale.z });
+}
+
+static AABB bounds(const Tree &tree, uint32_t index)
+{
+	const Tree::Node &node = tree.nodes[index];
+
+	if (node.op == Operation::eShape)
+		return sdf::bounds(tree.shapes[node.left]);
+
+	if (node.op == Operation::eTransform) {
+		AABB child = bounds(tree, node.left);
+		Shape box = Box { child.min, child.max };
+		return sdf::bounds(transformed(box, tree.transforms[node.right]));
+	}
+
+	AABB a = bounds(tree, node.left);
+	AABB b = bounds(tree, node.right);
+
+	// Blends reach out by less than their radius
+	glm::vec3 grow(node.radius);
+
+	switch (node.op) {
+	case Operation::eUnion:
+	case Operation::eSmoothUnion:
+		return { glm::min(a.min, b.min) - grow, glm::max(a.max, b.max) + grow };
+	case Operation::eIntersection:
+	case Operation::eSmoothIntersection:
+		return { glm::max(a.min, b.min) - grow, glm::min(a.max, b.max) + grow };
+	default:
+		break;
+	}
+
+	return { a.min - grow, a.max + grow };
+}
+
+AABB Tree::bounds() const
+{
+	if (nodes.empty())
+		return { glm::vec3(0.0f), glm::vec3(0.0f) };
+
+	return sdf::bounds(*this, root);
+}
+
+// Polynomial smooth minimum, lower than either by up to a quarter of
+// the radius where they are close
+static float smooth_min(float a, float b, float k)
+{
+	float h = std::clamp(0.5f + 0.5f * (b - a)/k, 0.0f, 1.0f);
+	return glm::mix(b, a, h) - k * h * (1.0f - h);
+}
+
+static float distance(const Tree &tree, uint32_t index, const glm::vec3 &p)
+{
+	const Tree::Node &node = tree.nodes[index];
+
+	if (node.op == Operation::eShape)
+		return sdf::distance(tree.shapes[node.left], p);
+
+	if (node.op == Operation::eTransform) {
+		const Transform &t = tree.transforms[node.right];
+		glm::vec3 local = glm::vec3(glm::inverse(t.matrix()) * glm::vec4(p, 1.0f));
+		return distance_scale(t) * distance(tree, node.left, local);
+	}
+
+	float a = distance(tree, node.left, p);
+	float b = distance(tree, node.right, p);
+	float k = node.radius;
+
+	switch (node.op) {
+	case Operation::eUnion:
+		return std::min(a, b);
+	case Operation::eIntersection:
+		return std::max(a, b);
+	case Operation::eSubtraction:
+		return std::max(a, -b);
+	case Operation::eSmoothUnion:
+		return smooth_min(a, b, k);
+	case Operation::eSmoothIntersection:
+		return -smooth_min(-a, -b, k);
+	case Operation::eSmoothSubtraction:
+		return -smooth_min(-a, b, k);
+	default:
+		break;
+	}
+
+	return std::numeric_limits <float> ::max();
+}
+
+float Tree::distance(const glm::vec3 &p) const
+{
+	if (nodes.empty())
+		return std::numeric_limits <float> ::max();
+
+	return sdf::distance(*this, root, p);
+}
+
+static uint64_t hash(const Tree &tree, uint32_t index, uint64_t seed)
+{
+	const Tree::Node &node = tree.nodes[index];
+
+	uint64_t h = hash_value(node.op, seed);
+
+	if (node.op == Operation::eShape) {
+		const Shape &shape = tree.shapes[node.left];
+		h = hash_value(shape.index(), h);
+		return std::visit([&](const auto &s) { return hash_value(s, h); }, shape);
+	}
+
+	if (node.op == Operation::eTransform) {
+		const Transform &t = tree.transforms[node.right];
+		h = hash_value(t.position, h);
+		h = hash_value(t.rotation, h);
+		h = hash_value(t.scale, h);
+		return hash(tree, node.left, h);
+	}
+
+	h = hash_value(node.radius, h);
+	h = hash(tree, node.left, h);
+	return hash(tree, node.right, h);
+}
+
+uint64_t Tree::hash() const
+{
+	if (nodes.empty())
+		return FNV_OFFSET;
+
+	return sdf::hash(*this, root, FNV_OFFSET);
+}
+
+// Balanced, to keep the generated code shallow
+Tree Tree::from(const Compound &compound)
+{
+	Tree tree;
+
+	std::vector <uint32_t> level;
+	for (const Shape &shape : compound.shapes)
+		level.push_back(tree.shape(shape));
+
+	while (level.size() > 1) {
+		std::vector <uint32_t> next;
+		for (size_t i = 0; i + 1 < level.size(); i += 2)
+			next.push_back(tree.unite(level[i], level[i + 1]));
+
+		if (level.size() % 2)
+			next.push_back(level.back());
+
+		level = std::move(next);
+	}
+
+	if (!level.empty())
+		tree.root = level.front();
+
+	return tree;
+}
+
+// Code generation
+static std::string literal(float x)
+{
+	// GLSL has no literal for infinity, as in the bounds of empty trees
+	x = std::clamp(x, -std::numeric_limits <float> ::max(), std::numeric_limits <float> ::max());
+
+	std::string s = fmt::format("{}", x);
+	if (s.find_first_of(".e") == std::string::npos)
+		s += ".0";
+
+	return s;
+}
+
+static std::string literal(const glm::vec3 &v)
+{
+	if (v.x == v.y && v.y == v.z)
+		return "vec3(" + literal(v.x) + ")";
+
+	return "vec3(" + literal(v.x) + ", " + literal(v.y) + ", " + literal(v.z) + ")";
+}
+
+// Scale of an affine map that only scales uniformly and translates
+static bool uniform_scale(const glm::mat4 &m, float &scale)
+{
+	scale = m[0][0];
+	if (scale <= 0.0f)
+		return false;
+
+	float tolerance = 1e-6f * scale;
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			float expected = (i == j) ? scale : 0.0f;
+			if (std::abs(m[i][j] - expected) > tolerance)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static constexpr const char *HELPERS = R"(
+float sdf_tree_box(vec3 p, vec3 half_size)
+{
+	vec3 q = abs(p) - half_size;
+	return length(max(q, 0.0)) + min(max(q.x, max(q.y, q.z)), 0.0);
+}
+
+float sdf_tree_smin(float a, float b, float k, float rate)
+{
+	float h = clamp(0.5 + rate * (b - a), 0.0, 1.0);
+	return mix(b, a, h) - k * h * (1.0 - h);
+}
+)";
+
+// Point variable of a subtree, and the map from it into the local space
+// of the subtree which has not been emitted yet; world distances are
+// the local ones times the factor
+struct Frame {
+	std::string point;
+	glm::mat4 pending;
+	float factor;
+};
+
+struct Generator {
+	const Tree &tree;
+	std::string body;
+	uint32_t values = 0;
+	uint32_t points = 0;
+
+	std::string value(const std::string &expression) {
+		std::string name = "d" + std::to_string(values++);
+		body += "\tfloat " + name + " = " + expression + ";\n";
+		return name;
+	}
+
+	std::string shape(const Shape &shape, const Frame &frame) {
+		// Pending maps only scale and translate here, so they fold into
+		// the parameters of the shape
+		float scale;
+		uniform_scale(frame.pending, scale);
+
+		glm::vec3 offset = glm::vec3(frame.pending[3]);
+		float factor = frame.factor * scale;
+
+		std::string expression;
+		if (auto sphere = std::get_if <Sphere> (&shape)) {
+			glm::vec3 center = (sphere->center - offset)/scale;
+			std::string p = (center == glm::vec3(0.0f)) ? frame.point : frame.point + " - " + literal(center);
+			expression = "length(" + p + ") - " + literal(sphere->radius/scale);
+		} else {
+			const Box &box = std::get <Box> (shape);
+			glm::vec3 center = (0.5f * (box.min + box.max) - offset)/scale;
+			glm::vec3 half = 0.5f * (box.max - box.min)/scale;
+			std::string p = (center == glm::vec3(0.0f)) ? frame.point : frame.point + " - " + literal(center);
+			expression = "sdf_tree_box(" + p + ", " + literal(half) + ")";
+		}
+
+		if (factor != 1.0f)
+			expression = "(" + expression + ") * " + literal(factor);
+
+		return value(expression);
+	}
+
+	// Rotations are applied once for the whole subtree
+	Frame place(const Transform &t, const Frame &frame) {
+		glm::mat4 pending = glm::inverse(t.matrix()) * frame.pending;
+		float factor = frame.factor * distance_scale(t);
+
+		float scale;
+		if (uniform_scale(pending, scale))
+			return { frame.point, pending, factor };
+
+		std::string name = "p" + std::to_string(points++);
+
+		glm::mat3 linear(pending);
+		std::string matrix = "mat3(";
+		for (int i = 0; i < 3; i++) {
+			for (int j = 0; j < 3; j++)
+				matrix += literal(std::abs(linear[i][j]) < 1e-7f ? 0.0f : linear[i][j]) + ((i == 2 && j == 2) ? ")" : ", ");
+		}
+
+		glm::vec3 offset = glm::vec3(pending[3]);
+		std::string expression = matrix + " * " + frame.point;
+		if (offset != glm::vec3(0.0f))
+			expression += " + " + literal(offset);
+
+		body += "\tvec3 " + name + " = " + expression + ";\n";
+		return { name, glm::mat4(1.0f), factor };
+	}
+
+	std::string emit(uint32_t index, const Frame &frame) {
+		const Tree::Node &node = tree.nodes[index];
+
+		if (node.op == Operation::eShape)
+			return shape(tree.shapes[node.left], frame);
+
+		if (node.op == Operation::eTransform)
+			return emit(node.left, place(tree.transforms[node.right], frame));
+
+		std::string a = emit(node.left, frame);
+		std::string b = emit(node.right, frame);
+
+		// Blending the distances after they are scaled to the world
+		float radius = node.radius * frame.factor;
+		std::string k = literal(radius);
+		std::string rate = (radius > 0.0f) ? literal(0.5f/radius) : "";
+
+		switch (node.op) {
+		case Operation::eUnion:
+			return value("min(" + a + ", " + b + ")");
+		case Operation::eIntersection:
+			return value("max(" + a + ", " + b + ")");
+		case Operation::eSubtraction:
+			return value("max(" + a + ", -" + b + ")");
+		case Operation::eSmoothUnion:
+			return value("sdf_tree_smin(" + a + ", " + b + ", " + k + ", " + rate + ")");
+		case Operation::eSmoothIntersection:
+			return value("-sdf_tree_smin(-" + a + ", -" + b + ", " + k + ", " + rate + ")");
+		case Operation::eSmoothSubtraction:
+			return value("-sdf_tree_smin(-" + a + ", " + b + ", " + k + ", " + rate + ")");
+		default:
+			break;
+		}
+
+		return value("1e30");
+	}
+};
+
+std::string glsl(const Tree &tree)
+{
+	AABB box = tree.bounds();
+
+	std::string source;
+	source += "const vec3 SDF_TREE_MIN = " + literal(box.min) + ";\n";
+	source += "const vec3 SDF_TREE_MAX = " + literal(box.max) + ";\n";
+	source += HELPERS;
+
+	if (tree.empty())
+		return source + "\nfloat sdf_tree(vec3 p)\n{\n\treturn 1e30;\n}\n";
+
+	Generator generator { tree };
+	std::string result = generator.emit(tree.root, Frame { "p", glm::mat4(1.0f), 1.0f });
+
+	source += "\nfloat sdf_tree(vec3 p)\n{\n";
+	source += generator.body;
+	source += "\treturn " + result + ";\n}\n";
+
+	return source;
+}
+
+}
@@ -1,84 +1,98 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
 #include <glm/gtc/constants.hpp>
 
 #include <microlog/microlog.h>
 
+#include "core/disk_cache.hpp"
+#include "core/environment_map.hpp"
+#include "core/hash.hpp"
+#include "core/profiler.hpp"
 #include "shlighting.hpp"
 
 namespace ivy {
 
-SHLighting SHLighting::from(const Texture &tex)
-{
-	std::vector <glm::vec3> rgb = tex.as_rgb();
-
-	float dt_dp = glm::pi <float> ();
-	dt_dp = (2 * dt_dp * dt_dp)/rgb.size();
-
-	glm::vec3 vY0;
-	glm::vec3 vY1[3];
-	glm::vec3 vY2[5];
-
-	vY0 = glm::vec3(0.0f);
-	vY1[0] = vY1[1] = vY1[2] = glm::vec3(0.0f);
-	vY2[0] = vY2[1] = vY2[2] = vY2[3] = vY2[4] = glm::vec3(0.0f);
-
-	for (int i = 0; i < tex.width; i++) {
-		for (int j = 0; j < tex.height; j++) {
-			uint32_t index = i * tex.height + j;
+// Bump whenever the projection changes
+static constexpr uint32_t SH_VERSION = 2;
 
-			// Convert to unit direction
-			float u = i/float(tex.width);
-			float v = j/float(tex.height);
+// Nine coefficients per channel, in the order L00, L1 (x, z, y)
+// and L2 (x^2 - y^2, xz, 3z^2 - 1, yz, xy)
+using SHCoefficients = std::array <float, 27>;
 
-			float theta = u * glm::pi <float> ();
-			float phi = v * glm::two_pi <float> ();
-
-			float sin_theta = sin(theta);
-
-			glm::vec3 n {
-				sin_theta * cos(phi),
-				sin_theta * sin(phi),
-				cos(theta)
-			};
-
-			// Convolve with the spherical harmonics
-			float Y0 = 0.282095f;
-
-			constexpr float cc0 = 0.488603f;
-			float Y1[] = {
-				cc0 * n.x,
-				cc0 * n.z,
-				cc0 * n.y
-			};
+// Fetches the linear RGB radiance of a texel into the output
+template <typename F>
+static SHCoefficients project(int width, int height, const F &fetch)
+{
+	IVY_PROFILE_SCOPE("SHLighting::project");
+
+	// Longitude is shared by every row
+	std::vector <float> cos_phi(width);
+	std::vector <float> sin_phi(width);
+	for (int c = 0; c < width; c++) {
+		float phi = glm::two_pi <float> () * (c + 0.5f)/width;
+		cos_phi[c] = std::cos(phi);
+		sin_phi[c] = std::sin(phi);
+	}
 
-			constexpr float cc1 = 1.092548f;
-			constexpr float cc2 = 0.315392f;
-			constexpr float cc3 = 0.546274f;
-			float Y2[] = {
-				cc3 * (n.x * n.x - n.y * n.y),
-				cc1 * n.x * n.z,
-				cc2 * (3 * n.z * n.z - 1),
-				cc1 * n.y * n.z,
-				cc1 * n.x * n.y
+	float dphi_dtheta = glm::two_pi <float> () * glm::pi <float> ()/(width * height);
+
+	// Plain arrays, for the reductions
+	float total[27] = {};
+
+	#pragma omp parallel for schedule(dynamic, 16) reduction(+: total[:27])
+	for (int r = 0; r < height; r++) {
+		// Rows start from the bottom, see Texture::decode
+		float theta = glm::pi <float> () * (r + 0.5f)/height;
+		float sin_theta = std::sin(theta);
+		float cos_theta = std::cos(theta);
+		float weight = sin_theta * dphi_dtheta;
+
+		float row[27] = {};
+
+		#pragma omp simd reduction(+: row[:27])
+		for (int c = 0; c < width; c++) {
+			float rgb[3];
+			fetch(r * width + c, rgb);
+
+			float x = -sin_theta * cos_phi[c];
+			float y = -cos_theta;
+			float z = -sin_theta * sin_phi[c];
+
+			const float Y[9] = {
+				0.282095f,
+				0.488603f * x,
+				0.488603f * z,
+				0.488603f * y,
+				0.546274f * (x * x - y * y),
+				1.092548f * x * z,
+				0.315392f * (3 * z * z - 1),
+				1.092548f * y * z,
+				1.092548f * x * y
 			};
 
-			const glm::vec3 &radiance = rgb[index];
-
-			vY0 += radiance * Y0 * sin_theta * dt_dp;
-
-			vY1[0] += radiance * Y1[0] * sin_theta * dt_dp;
-			vY1[1] += radiance * Y1[1] * sin_theta * dt_dp;
-			vY1[2] += radiance * Y1[2] * sin_theta * dt_dp;
-
-			vY2[0] += radiance * Y2[0] * sin_theta * dt_dp;
-			vY2[1] += radiance * Y2[1] * sin_theta * dt_dp;
-			vY2[2] += radiance * Y2[2] * sin_theta * dt_dp;
-			vY2[3] += radiance * Y2[3] * sin_theta * dt_dp;
-			vY2[4] += radiance * Y2[4] * sin_theta * dt_dp;
+			for (int k = 0; k < 9; k++) {
+				row[3 * k + 0] += rgb[0] * Y[k];
+				row[3 * k + 1] += rgb[1] * Y[k];
+				row[3 * k + 2] += rgb[2] * Y[k];
+			}
 		}
+
+		for (int k = 0; k < 27; k++)
+			total[k] += row[k] * weight;
 	}
 
-	ulog_info("sh lighting", "vY0: %f, %f, %f\n", vY0.x, vY0.y, vY0.z);
+	SHCoefficients coefficients;
+	std::copy(total, total + 27, coefficients.begin());
 
+	return coefficients;
+}
+
+// Irradiance matrices, from Ramamoorthi and Hanrahan
+static SHLighting irradiance(const SHCoefficients &L)
+{
 	constexpr float c1 = 0.429043f;
 	constexpr float c2 = 0.511664f;
 	constexpr float c3 = 0.743125f;
@@ -88,17 +102,17 @@ SHLighting SHLighting::from(const Texture &tex)
 	glm::mat4 Ms[3];
 
 	for (uint32_t i = 0; i < 3; i++) {
-		float L00 = vY0[i];
+		float L00 = L[0 + i];
 
-		float L1p1 = vY1[0][i];
-		float L1e0 = vY1[1][i];
-		float L1m1 = vY1[2][i];
+		float L1p1 = L[3 + i];
+		float L1e0 = L[6 + i];
+		float L1m1 = L[9 + i];
 
-		float L2p2 = vY2[0][i];
-		float L2p1 = vY2[1][i];
-		float L2e0 = vY2[2][i];
-		float L2m1 = vY2[3][i];
-		float L2m2 = vY2[4][i];
+		float L2p2 = L[12 + i];
+		float L2p1 = L[15 + i];
+		float L2e0 = L[18 + i];
+		float L2m1 = L[21 + i];
+		float L2m2 = L[24 + i];
 
 		Ms[i] = glm::mat4 {
 			c1 * L2p2, c1 * L2m2, c1 * L2p1, c2 * L1p1,
@@ -108,7 +122,83 @@ SHLighting SHLighting::from(const Texture &tex)
 		};
 	}
 
+	ulog_info("sh lighting", "L00: %f, %f, %f\n", L[0], L[1], L[2]);
+
 	return { Ms[0], Ms[1], Ms[2] };
 }
 
-}
\ No newline at end of file
+SHLighting SHLighting::from(const Texture &tex)
+{
+	if (tex.channels != 4)
+		return from(tex.as_rgba());
+
+	const uint8_t *pixels = tex.pixels.data();
+
+	auto coefficients = project(tex.width, tex.height,
+		[pixels](int index, float *rgb) {
+			const uint8_t *texel = pixels + 4 * index;
+			rgb[0] = texel[0]/255.0f;
+			rgb[1] = texel[1]/255.0f;
+			rgb[2] = texel[2]/255.0f;
+		}
+	);
+
+	return irradiance(coefficients);
+}
+
+SHLighting SHLighting::from(const HDRTexture &tex)
+{
+	const float *pixels = tex.pixels.data();
+
+	auto coefficients = project(tex.width, tex.height,
+		[pixels](int index, float *rgb) {
+			const float *texel = pixels + 4 * index;
+			rgb[0] = texel[0];
+			rgb[1] = texel[1];
+			rgb[2] = texel[2];
+		}
+	);
+
+	return irradiance(coefficients);
+}
+
+SHLighting SHLighting::from(const std::filesystem::path &path)
+{
+	IVY_PROFILE_SCOPE("SHLighting::from");
+
+	uint64_t hash = hash_file(path);
+	if (hash == 0) {
+		ulog_warning("sh lighting", "could not read %s, using no lighting\n", path.c_str());
+		return {};
+	}
+
+	std::string key = hash_hex(hash_value(SH_VERSION, hash));
+
+	auto cached = read_cache("lighting", key);
+	if (cached && cached->size() == sizeof(SHLighting)) {
+		SHLighting shl;
+		std::memcpy(&shl, cached->data(), sizeof(shl));
+		return shl;
+	}
+
+	SHLighting shl;
+	if (path.extension() == ".hdr") {
+		HDRTexture tex = HDRTexture::load(path);
+		if (tex.pixels.empty())
+			return {};
+
+		shl = from(tex);
+	} else {
+		Texture tex = Texture::load(path);
+		if (tex.pixels.empty())
+			return {};
+
+		shl = from(tex);
+	}
+
+	write_cache("lighting", key, &shl, sizeof(shl));
+
+	return shl;
+}
+
+}
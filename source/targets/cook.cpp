@@ -0,0 +1,59 @@
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <set>
+
+#include <fmt/printf.h>
+
+#include <microlog/microlog.h>
+
+#include "biome.hpp"
+#include "core/texture_cooker.hpp"
+
+// Cooks every texture referenced by a biome into the on-disk cache ahead
+// of time, so that loading the scene only reads the cooked results
+//
+// usage: cook <scene> [--bc7]
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		ulog_error("cook", "usage: %s <scene> [--bc7]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	ivy::TextureCooker cooker;
+	cooker.high_quality = (argc > 2 && std::strcmp(argv[2], "--bc7") == 0);
+
+	ivy::Biome &biome = ivy::Biome::load(argv[1]);
+
+	std::set <std::string> paths = biome.textures();
+	std::set <std::string> normal_maps = biome.normal_maps();
+
+	static constexpr const char *encodings[] = { "RGBA8", "BC1", "BC3", "BC5", "BC7", "R8", "RG8" };
+
+	size_t raw = 0;
+	size_t cooked = 0;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (const std::string &path : paths) {
+		ivy::Texture texture = ivy::Texture::load(path);
+		if (texture.pixels.empty())
+			continue;
+
+		ivy::TextureRole role = normal_maps.count(path) ? ivy::TextureRole::eNormal : ivy::TextureRole::eColor;
+		ivy::CookedTexture result = cooker.cook(texture, role);
+		raw += texture.pixels.size();
+		cooked += result.data.size();
+
+		fmt::println("{}: {}x{}, {} mips{}, {}{}", path, result.width, result.height,
+			result.mip_count(), result.device_mips() ? " (device)" : "",
+			encodings[uint32_t(result.encoding)], result.srgb ? " sRGB" : "");
+	}
+
+	auto end = std::chrono::steady_clock::now();
+
+	double seconds = std::chrono::duration <double> (end - start).count();
+	fmt::println("{} textures in {:.2f} s, {:.1f} MiB decoded to {:.1f} MiB cooked",
+		paths.size(), seconds, raw/1048576.0, cooked/1048576.0);
+}
@@ -7,6 +7,8 @@
 
 #include <littlevk/littlevk.hpp>
 
+#include "core/pixel_formats.hpp"
+#include "core/profiler.hpp"
 #include "core/texture.hpp"
 #include "exec/globals.hpp"
 #include "paths.hpp"
@@ -76,24 +78,12 @@ Texture <T> transform(const Texture <U> &texture, const F &ftn)
 	return result;
 }
 
+// Clamped to [0, 1], with missing channels as in ivy::expand_u8
 template <>
 ivy::Texture Texture <glm::vec4> ::as_texture() const
 {
 	std::vector <uint8_t> uint_pixels(width * height * sizeof(uint32_t));
-
-	for (int i = 0; i < width; i++) {
-		for (int j = 0; j < height; j++) {
-			uint32_t index = (i * height + j);
-
-			const glm::vec4 &c = pixels[index];
-
-			uint8_t *dst = &uint_pixels[index << 2];
-			dst[0] = 255.0f * c.r;
-			dst[1] = 255.0f * c.g;
-			dst[2] = 255.0f * c.b;
-			dst[3] = 255.0f * c.a;
-		}
-	}
+	ivy::f32_to_u8((const float *) pixels.data(), uint_pixels.data(), 4 * width * height);
 
 	return { (int) width, (int) height, 4, uint_pixels };
 }
@@ -101,21 +91,11 @@ ivy::Texture Texture <glm::vec4> ::as_texture() const
 template <>
 ivy::Texture Texture <glm::vec3> ::as_texture() const
 {
-	std::vector <uint8_t> uint_pixels(width * height * sizeof(uint32_t));
-
-	for (int i = 0; i < width; i++) {
-		for (int j = 0; j < height; j++) {
-			uint32_t index = (i * height + j);
+	std::vector <uint8_t> packed(3 * width * height);
+	ivy::f32_to_u8((const float *) pixels.data(), packed.data(), packed.size());
 
-			const glm::vec3 &c = pixels[index];
-
-			uint8_t *dst = &uint_pixels[index << 2];
-			dst[0] = 255.0f * c.r;
-			dst[1] = 255.0f * c.g;
-			dst[2] = 255.0f * c.b;
-			dst[3] = 0xff;
-		}
-	}
+	std::vector <uint8_t> uint_pixels(width * height * sizeof(uint32_t));
+	ivy::expand_u8(packed.data(), 3, uint_pixels.data(), width * height);
 
 	return { (int) width, (int) height, 4, uint_pixels };
 }
@@ -123,21 +103,11 @@ ivy::Texture Texture <glm::vec3> ::as_texture() const
 template <>
 ivy::Texture Texture <glm::vec2> ::as_texture() const
 {
-	std::vector <uint8_t> uint_pixels(width * height * sizeof(uint32_t));
-
-	for (int i = 0; i < width; i++) {
-		for (int j = 0; j < height; j++) {
-			uint32_t index = (i * height + j);
-
-			const glm::vec2 &c = pixels[index];
+	std::vector <uint8_t> packed(2 * width * height);
+	ivy::f32_to_u8((const float *) pixels.data(), packed.data(), packed.size());
 
-			uint8_t *dst = &uint_pixels[index << 2];
-			dst[0] = 255.0f * c.r;
-			dst[1] = 255.0f * c.g;
-			dst[2] = 0;
-			dst[3] = 0xff;
-		}
-	}
+	std::vector <uint8_t> uint_pixels(width * height * sizeof(uint32_t));
+	ivy::expand_u8(packed.data(), 2, uint_pixels.data(), width * height);
 
 	return { (int) width, (int) height, 4, uint_pixels };
 }
@@ -147,6 +117,8 @@ struct DIn {
 	Texture <glm::vec3> colors;
 
 	Texture <glm::vec3> render(size_t w, size_t h) const {
+		IVY_PROFILE_SCOPE("DIn::render");
+
 		auto tex = Texture <glm::vec3> ::from(w, h);
 
 		for (size_t i = 0; i < h; i++) {
@@ -187,6 +159,8 @@ struct DIn {
 
 void optimize(DIn &din, const Texture <glm::vec3> &reference)
 {
+	IVY_PROFILE_FUNCTION();
+
 	auto loss = [&](const Texture <glm::vec3> &image) {
 		size_t pixels = image.width * image.height;
 
@@ -211,6 +185,8 @@ void optimize(DIn &din, const Texture <glm::vec3> &reference)
 	auto dcolors_Sh = Texture <glm::vec3> ::from(din.colors.width, din.colors.height);
 
 	for (size_t i = 0; i < 100; i++) {
+		IVY_PROFILE_SCOPE("optimize: iteration");
+
 		auto proxy = din.render(reference.width, reference.height);
 		fmt::println("{:>3}: {}", i + 1, loss(proxy));
 
@@ -317,6 +293,8 @@ void main()
 
 int main()
 {
+	IVY_PROFILE_THREAD("Main");
+
 	auto source = ivy::Texture::load(IVY_ROOT "/data/textures/cornell_box.png");
 	fmt::println("source: {} x {}", source.width, source.height);
 
@@ -360,25 +338,63 @@ int main()
 
 	auto framebuffers = generator.unpack();
 
-	auto bundle = littlevk::ShaderStageBundle(vrb.device, vrb.dal)
-		.attach(standalone::readfile(IVY_ROOT "/shaders/splat.vert"), vk::ShaderStageFlagBits::eVertex)
-		.attach(renderer, vk::ShaderStageFlagBits::eFragment);
-
 	// TODO: infer from argument to a render_once function
 	static constexpr auto rendering_dslbs = std::array <vk::DescriptorSetLayoutBinding, 2> {{
 		{ 0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment },
 		{ 1, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment },
 	}};
 
-	littlevk::Pipeline ppl = littlevk::PipelineAssembler <littlevk::eGraphics> (vrb.device, vrb.window, vrb.dal)
-		.with_render_pass(render_pass, 0)
-		.with_shader_bundle(bundle)
-		.with_dsl_bindings(rendering_dslbs);
+	struct backward_push_constants {
+		glm::vec2 ref_extent;
+		glm::vec2 uvs_extent;
+		glm::vec2 colors_extent;
+	};
+
+	static constexpr auto render_backwards_dslbs = std::array <vk::DescriptorSetLayoutBinding, 3> {{
+		{ 0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute },
+		{ 1, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute },
+		{ 2, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute },
+	}};
+
+	// Both pipelines are compiled in parallel, in the background
+	vk::DescriptorSetLayout rendering_dsl = ivy::create_descriptor_set_layout(vrb.device,
+		{ rendering_dslbs.begin(), rendering_dslbs.end() });
+
+	vk::PipelineLayout rendering_layout = ivy::create_pipeline_layout(vrb.device, { rendering_dsl });
+
+	ivy::PendingPipeline pending = vrb.pipeline_service->graphics(ivy::GraphicsPipelineInfo {
+		.render_pass = render_pass,
+		.subpass = 0,
+		.shaders = {
+			{ standalone::readfile(IVY_ROOT "/shaders/splat.vert"), vk::ShaderStageFlagBits::eVertex },
+			{ renderer, vk::ShaderStageFlagBits::eFragment }
+		},
+		.layout = rendering_layout,
+		.depth_test = false,
+		.depth_write = false
+	}, rendering_dsl);
+
+	vk::DescriptorSetLayout backward_dsl = ivy::create_descriptor_set_layout(vrb.device,
+		{ render_backwards_dslbs.begin(), render_backwards_dslbs.end() });
+
+	vk::PushConstantRange backward_push_range {
+		vk::ShaderStageFlagBits::eCompute,
+		0, sizeof(backward_push_constants)
+	};
+
+	vk::PipelineLayout backward_layout = ivy::create_pipeline_layout(vrb.device, { backward_dsl }, { backward_push_range });
+
+	ivy::PendingPipeline pending_backward = vrb.pipeline_service->compute(
+		{ renderer_backwards, vk::ShaderStageFlagBits::eCompute },
+		backward_layout, backward_dsl);
 
 	vk::DescriptorSet dset = littlevk::bind(vrb.device, vrb.descriptor_pool)
-		.allocate_descriptor_sets(*ppl.dsl).front();
+		.allocate_descriptor_sets(rendering_dsl).front();
 
 	auto render_function = [&](const vk::CommandBuffer &cmd) {
+		// Blocks on first use
+		littlevk::Pipeline ppl = pending.get();
+
 		littlevk::viewport_and_scissor(cmd, render_target.extent);
 
 		// Begin the render pass
@@ -480,28 +496,7 @@ int main()
 	// 	frame = 1 - frame;
 	// }
 
-	struct backward_push_constants {
-		glm::vec2 ref_extent;
-		glm::vec2 uvs_extent;
-		glm::vec2 colors_extent;
-	};
-
-	static constexpr auto render_backwards_dslbs = std::array <vk::DescriptorSetLayoutBinding, 3> {{
-		{ 0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute },
-		{ 1, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute },
-		{ 2, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute },
-	}};
-
-	littlevk::Pipeline backward_ppl = [vrb]()
-	{
-		auto bundle = littlevk::ShaderStageBundle(vrb.device, vrb.dal)
-			.attach(renderer_backwards, vk::ShaderStageFlagBits::eCompute);
-
-		return littlevk::PipelineAssembler <littlevk::eCompute> (vrb.device, vrb.dal)
-			.with_push_constant <backward_push_constants> (vk::ShaderStageFlagBits::eCompute)
-			.with_dsl_bindings(render_backwards_dslbs)
-			.with_shader_bundle(bundle);
-	} ();
+	littlevk::Pipeline backward_ppl = pending_backward.get();
 
 	// TODO: replace with textureSize and imageSize
 	backward_push_constants bpc;
@@ -531,4 +526,8 @@ int main()
 
 	vrb.device.waitIdle();
 	vrb.destroy();
+
+#ifdef IVY_PROFILING
+	ivy::profiling::save_trace("din-trace.json");
+#endif
 }
@@ -7,6 +7,7 @@
 
 #include <littlevk/littlevk.hpp>
 
+#include "core/pixel_formats.hpp"
 #include "core/texture.hpp"
 #include "exec/globals.hpp"
 #include "paths.hpp"
@@ -76,24 +77,12 @@ Texture <T> transform(const Texture <U> &texture, const F &ftn)
 	return result;
 }
 
+// Clamped to [0, 1], with missing channels as in ivy::expand_u8
 template <>
 ivy::Texture Texture <glm::vec4> ::as_texture() const
 {
 	std::vector <uint8_t> uint_pixels(width * height * sizeof(uint32_t));
-
-	for (int i = 0; i < width; i++) {
-		for (int j = 0; j < height; j++) {
-			uint32_t index = (i * height + j);
-
-			const glm::vec4 &c = pixels[index];
-
-			uint8_t *dst = &uint_pixels[index << 2];
-			dst[0] = 255.0f * c.r;
-			dst[1] = 255.0f * c.g;
-			dst[2] = 255.0f * c.b;
-			dst[3] = 255.0f * c.a;
-		}
-	}
+	ivy::f32_to_u8((const float *) pixels.data(), uint_pixels.data(), 4 * width * height);
 
 	return { (int) width, (int) height, 4, uint_pixels };
 }
@@ -101,21 +90,11 @@ ivy::Texture Texture <glm::vec4> ::as_texture() const
 template <>
 ivy::Texture Texture <glm::vec3> ::as_texture() const
 {
-	std::vector <uint8_t> uint_pixels(width * height * sizeof(uint32_t));
-
-	for (int i = 0; i < width; i++) {
-		for (int j = 0; j < height; j++) {
-			uint32_t index = (i * height + j);
+	std::vector <uint8_t> packed(3 * width * height);
+	ivy::f32_to_u8((const float *) pixels.data(), packed.data(), packed.size());
 
-			const glm::vec3 &c = pixels[index];
-
-			uint8_t *dst = &uint_pixels[index << 2];
-			dst[0] = 255.0f * c.r;
-			dst[1] = 255.0f * c.g;
-			dst[2] = 255.0f * c.b;
-			dst[3] = 0xff;
-		}
-	}
+	std::vector <uint8_t> uint_pixels(width * height * sizeof(uint32_t));
+	ivy::expand_u8(packed.data(), 3, uint_pixels.data(), width * height);
 
 	return { (int) width, (int) height, 4, uint_pixels };
 }
@@ -123,21 +102,11 @@ ivy::Texture Texture <glm::vec3> ::as_texture() const
 template <>
 ivy::Texture Texture <glm::vec2> ::as_texture() const
 {
-	std::vector <uint8_t> uint_pixels(width * height * sizeof(uint32_t));
-
-	for (int i = 0; i < width; i++) {
-		for (int j = 0; j < height; j++) {
-			uint32_t index = (i * height + j);
+	std::vector <uint8_t> packed(2 * width * height);
+	ivy::f32_to_u8((const float *) pixels.data(), packed.data(), packed.size());
 
-			const glm::vec2 &c = pixels[index];
-
-			uint8_t *dst = &uint_pixels[index << 2];
-			dst[0] = 255.0f * c.r;
-			dst[1] = 255.0f * c.g;
-			dst[2] = 0;
-			dst[3] = 0xff;
-		}
-	}
+	std::vector <uint8_t> uint_pixels(width * height * sizeof(uint32_t));
+	ivy::expand_u8(packed.data(), 2, uint_pixels.data(), width * height);
 
 	return { (int) width, (int) height, 4, uint_pixels };
 }
@@ -3,6 +3,7 @@
 
 #include "biome.hpp"
 #include "components.hpp"
+#include "core/profiler.hpp"
 #include "core/transform.hpp"
 #include "exec/globals.hpp"
 #include "exec/user_interface.hpp"
@@ -10,6 +11,8 @@
 
 int main()
 {
+	IVY_PROFILE_THREAD("Main");
+
 	auto engine = ivy::exec::Globals::from();
 	auto user_interface = ivy::exec::UserInterface::from(engine);
 
@@ -29,30 +32,46 @@ int main()
 	auto [transform] = *inh->grab <ivy::Transform> ();
 	inh->add_component <ivy::Collider> (*transform, sphere, true, true);
 
+	// Static asset next to the box, drawn by shaders generated for it
+	ivy::sdf::Tree tree;
+	uint32_t pillar = tree.shape(ivy::sdf::Box({ 30, 0, -5 }, { 40, 30, 5 }));
+	uint32_t cap = tree.shape(ivy::sdf::Sphere({ 35, 30, 0 }, 8));
+	tree.unite(pillar, cap, 3.0f);
+
 	// Rendering
-	size_t frame = 0;
 	while (engine.vrb.valid_window()) {
+		IVY_PROFILE_SCOPE("Frame");
+
 		// Get events
-		glfwPollEvents();
+		{
+			IVY_PROFILE_SCOPE("Frame: events");
+			glfwPollEvents();
+		}
 
-		// Begin the new frame
-		auto [cmd, op] = engine.vrb.new_frame(frame).value();
-		if (op.status == littlevk::SurfaceOperation::eResize)
+		// Begin the new frame, unless the swapchain was recreated
+		auto next = engine.vrb.new_frame();
+		if (!next) {
 			user_interface.resize(engine.vrb.window->extent);
+			continue;
+		}
+
+		auto [cmd, op] = *next;
 
 		// float t = 10.0f * glfwGetTime();
 		// glm::vec3 position = { 50 * sin(t), 20 * cos(t), 100 * cos(t/2) };
 		// inh->transform->position = position;
 
+		// The viewport only exists after the first draw
+		if (user_interface.viewport_ref && user_interface.viewport_ref->sdf_tree.empty())
+			user_interface.viewport_ref->sdf_tree = tree;
+
 		// Draw the user interface
 		user_interface.draw(cmd, op);
 
 		// Complete and present the frame
-		engine.vrb.end_frame(cmd, frame);
-		auto pop = engine.vrb.present_frame(op, frame);
+		engine.vrb.end_frame(cmd);
+		auto pop = engine.vrb.present_frame(op);
 		if (pop.status == littlevk::SurfaceOperation::eResize)
 			user_interface.resize(engine.vrb.window->extent);
-
-		frame = 1 - frame;
 	}
 }
@@ -0,0 +1,100 @@
+#include <chrono>
+#include <filesystem>
+
+#include <fmt/printf.h>
+
+#include <littlevk/littlevk.hpp>
+#include <microlog/microlog.h>
+
+#include "biome.hpp"
+#include "core/capture.hpp"
+#include "core/profiler.hpp"
+#include "exec/globals.hpp"
+#include "exec/viewport.hpp"
+
+// Renders a biome offscreen, without a window system, for throughput
+// benchmarks and image regression on build servers
+//
+// usage: headless <scene> [frames] [output directory] [png|qoi|exr]
+int main(int argc, char *argv[])
+{
+	IVY_PROFILE_THREAD("Main");
+
+	if (argc < 2) {
+		ulog_error("headless", "usage: %s <scene> [frames] [output directory] [png|qoi|exr]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::filesystem::path scene = argv[1];
+	uint32_t count = (argc > 2) ? std::stoul(argv[2]) : 100;
+
+	std::optional <std::filesystem::path> output;
+	if (argc > 3) {
+		output = argv[3];
+		std::filesystem::create_directories(*output);
+	}
+
+	std::string extension = (argc > 4) ? argv[4] : "png";
+
+	constexpr vk::Extent2D extent { 1920, 1080 };
+
+	auto vrb = ivy::exec::prepare_headless_resource_base(extent);
+
+	ivy::Biome &biome = ivy::Biome::load(scene);
+
+	std::unique_ptr <ivy::CursorDispatcher> cursor_dispatcher;
+	auto viewport = ivy::exec::Viewport::from(biome, vrb, cursor_dispatcher, extent);
+
+	// Every frame should be complete, for regression purposes
+	viewport->wait_for_pipelines();
+
+	// Frames are copied out and encoded without stalling the loop
+	ivy::CaptureService *capture = ivy::CaptureService::from(vrb);
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (uint32_t i = 0; i < count; i++) {
+		IVY_PROFILE_SCOPE("Frame");
+
+		auto next = vrb.new_frame();
+		if (!next)
+			continue;
+
+		auto [cmd, op] = *next;
+
+		viewport->render(cmd, op);
+
+		if (output) {
+			capture->capture(cmd, viewport->vk.images[op.index], vk::ImageLayout::eShaderReadOnlyOptimal,
+				*output / fmt::format("frame-{:05d}.{}", i, extension));
+		}
+
+		vrb.end_frame(cmd);
+		vrb.present_frame(op);
+
+		capture->poll();
+	}
+
+	vrb.wait_idle();
+	capture->flush();
+
+	auto end = std::chrono::steady_clock::now();
+
+	double seconds = std::chrono::duration <double> (end - start).count();
+	fmt::println("{} frames in {:.3f} s ({:.3f} ms/frame, {:.1f} fps)",
+		count, seconds, 1000.0 * seconds/count, count/seconds);
+
+	// GPU timings alongside the frames, for comparing runs
+	if (output) {
+		vrb.gpu_profiler->save(*output / "gpu-profile.json");
+#ifdef IVY_PROFILING
+		ivy::profiling::save_trace(*output / "cpu-trace.json");
+#endif
+	}
+
+	capture->destroy();
+	delete capture;
+
+	viewport.reset();
+	vrb.destroy();
+}
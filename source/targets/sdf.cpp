@@ -42,6 +42,8 @@ struct Viewport : UserInterfaceModule {
 	using resizer = std::function <void (const vk::Extent2D &)>;
 	using viewer = std::function <vk::ImageView ()>;
 
+	VulkanResourceBase &vrb;
+
 	vk::DescriptorSet fb_descriptor;
 	vk::ImageView fb_view_cached;
 	vk::Sampler fb_sampler;
@@ -49,8 +51,9 @@ struct Viewport : UserInterfaceModule {
 	viewer ftn_view;
 	resizer ftn_resize;
 
-	Viewport(const VulkanResourceBase &vrb, const viewer &viewer_, const resizer &resizer_)
-			: fb_descriptor(nullptr),
+	Viewport(VulkanResourceBase &vrb_, const viewer &viewer_, const resizer &resizer_)
+			: vrb(vrb_),
+			fb_descriptor(nullptr),
 			fb_view_cached(nullptr),
 			ftn_view(viewer_),
 			ftn_resize(resizer_) {
@@ -60,13 +63,17 @@ struct Viewport : UserInterfaceModule {
 	void draw(const vk::CommandBuffer &cmd) override {
 		auto view = ftn_view();
 		if (view != fb_view_cached && view) {
+			if (fb_descriptor) {
+				vk::DescriptorSet old = fb_descriptor;
+				vrb.defer([old]() { ImGui_ImplVulkan_RemoveTexture(old); });
+			}
+
 			fb_view_cached = view;
 			fb_descriptor = ImGui_ImplVulkan_AddTexture
 				(static_cast <VkSampler> (fb_sampler),
 				static_cast <VkImageView> (view),
 				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
-			// TODO: delete the old
 		}
 
 		if (ImGui::Begin("Viewport", nullptr, ImGuiWindowFlags_NoScrollbar)) {
@@ -181,92 +188,88 @@ int main()
 	// Allocate the images and framebuffer
 	auto extent = vk::Extent2D { 1024, 1024 };
 
-	littlevk::Image image = littlevk::bind(vrb.device, vrb.memory_properties, vrb.dal)
-			.image(extent.width, extent.height,
-				vrb.swapchain.format,
-				vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eColorAttachment,
-				vk::ImageAspectFlagBits::eColor);
+	ivy::AllocatedImage image;
+	vk::Framebuffer framebuffer;
 
-	littlevk::FramebufferGenerator generator(vrb.device, render_pass, extent, vrb.dal);
-	generator.add(image.view);
+	auto allocate = [&](const vk::Extent2D &extent) {
+		image = vrb.allocator->image(extent,
+			vrb.swapchain.format,
+			vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eColorAttachment,
+			vk::ImageAspectFlagBits::eColor);
 
-	auto framebuffers = generator.unpack();
-
-	// Pipeline
-	auto bundle = littlevk::ShaderStageBundle(vrb.device, vrb.dal)
-		.attach(readfile(IVY_SHADERS "/splat.vert"), vk::ShaderStageFlagBits::eVertex)
-		.attach(readfile(IVY_SHADERS "/sdf.frag"), vk::ShaderStageFlagBits::eFragment);
+		framebuffer = vrb.device.createFramebuffer(vk::FramebufferCreateInfo {
+			{}, render_pass, image.view,
+			extent.width, extent.height, 1
+		});
+	};
 
-	littlevk::Pipeline ppl = littlevk::PipelineAssembler <littlevk::eGraphics> (vrb.device, vrb.window, vrb.dal)
-		.with_render_pass(render_pass, 0)
-		.with_shader_bundle(bundle)
-		.alpha_blending(true)
-		.with_push_constant <RayFrame> (vk::ShaderStageFlagBits::eFragment);
+	allocate(extent);
+
+	// Pipeline, compiled in the background while the window comes up
+	vk::PushConstantRange push_constants { vk::ShaderStageFlagBits::eFragment, 0, sizeof(RayFrame) };
+	vk::PipelineLayout layout = ivy::create_pipeline_layout(vrb.device, {}, { push_constants });
+
+	ivy::PendingPipeline pending = vrb.pipeline_service->graphics(ivy::GraphicsPipelineInfo {
+		.render_pass = render_pass,
+		.subpass = 0,
+		.shaders = {
+			{ readfile(IVY_SHADERS "/splat.vert"), vk::ShaderStageFlagBits::eVertex },
+			{ readfile(IVY_SHADERS "/sdf.frag"), vk::ShaderStageFlagBits::eFragment }
+		},
+		.layout = layout,
+		.alpha_blending = true,
+		.depth_test = false,
+		.depth_write = false
+	});
 
 	// Load data into the pipeline
 
 	Camera camera;
 	Transform camera_transform;
 
-	std::list <std::pair <littlevk::Image, int>> freeq;
-
 	auto ftn = [&](const vk::CommandBuffer &cmd) {
-		extent = image.extent;
+		extent = image.extent_2d();
 
 		camera.aspect = float(extent.width)/float(extent.height);
 		littlevk::viewport_and_scissor(cmd, extent);
 
 		// Begin the render pass
 		const auto &rpbi = littlevk::default_rp_begin_info <2>
-			(render_pass, framebuffers[0], extent)
+			(render_pass, framebuffer, extent)
 			.clear_color(0, std::array <float, 4> { 1.0f, 1.0f, 1.0f, 1.0f });
 
 		cmd.beginRenderPass(rpbi, vk::SubpassContents::eInline);
 
-		cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, ppl.handle);
+		if (pending.ready()) {
+			auto ppl = pending.get();
 
-		RayFrame rayframe = camera.rayframe(camera_transform);
+			cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, ppl.handle);
 
-		cmd.pushConstants <RayFrame> (ppl.layout, vk::ShaderStageFlagBits::eFragment, 0, rayframe);
-		cmd.draw(6, 1, 0, 0);
+			RayFrame rayframe = camera.rayframe(camera_transform);
+
+			cmd.pushConstants <RayFrame> (ppl.layout, vk::ShaderStageFlagBits::eFragment, 0, rayframe);
+			cmd.draw(6, 1, 0, 0);
+		}
 
 		// End the current render pass
 		cmd.endRenderPass();
 
 		// Transition to a reasonable layout
-		littlevk::transition(cmd, image,
+		ivy::transition(cmd, image,
 			vk::ImageLayout::ePresentSrcKHR,
 			vk::ImageLayout::eShaderReadOnlyOptimal);
-
-		freeq.remove_if([&](auto &pr) -> bool {
-			auto &[image, countdown] = pr;
-			if (--countdown <= 0) {
-				littlevk::destroy_image(vrb.device, image);
-				return true;
-			}
-
-			return false;
-		});
 	};
 
 	auto resize = [&](const vk::Extent2D &extent) {
-		if (image.extent == extent)
+		if (image.extent_2d() == extent)
 			return;
 
-		// Free old
-		freeq.push_back({ image, 2 });
+		// Free old once the frames in flight are done with it
+		vrb.retire(image);
+		vrb.retire(framebuffer);
 
 		// Allocate new
-		image = littlevk::bind(vrb.device, vrb.memory_properties, vrb.dal)
-			.image(extent.width, extent.height,
-				vrb.swapchain.format,
-				vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eColorAttachment,
-				vk::ImageAspectFlagBits::eColor);
-
-		littlevk::FramebufferGenerator generator(vrb.device, render_pass, extent, vrb.dal);
-		generator.add(image.view);
-
-		framebuffers = generator.unpack();
+		allocate(extent);
 	};
 
 	auto view = [&]() -> vk::ImageView {
@@ -276,13 +279,16 @@ int main()
 	ui.modules.emplace_back(std::make_unique <Viewport> (vrb, view, resize));
 
 	// Rendering
-	size_t frame = 0;
 	while (vrb.valid_window()) {
 		// Get events
 		glfwPollEvents();
 
-		// Begin the new frame
-		auto [cmd, op] = vrb.new_frame(frame).value();
+		// Begin the new frame, unless the swapchain was recreated
+		auto next = vrb.new_frame();
+		if (!next)
+			continue;
+
+		auto [cmd, op] = *next;
 
 		// TODO: multithreaded queues?
 		handle_key_input(vrb.window->handle, camera_transform);
@@ -292,9 +298,7 @@ int main()
 		ui.draw(cmd, op);
 
 		// Complete and present the frame
-		vrb.end_frame(cmd, frame);
-		vrb.present_frame(op, frame);
-
-		frame = 1 - frame;
+		vrb.end_frame(cmd);
+		vrb.present_frame(op);
 	}
 }